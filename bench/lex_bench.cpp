@@ -0,0 +1,205 @@
+#include "../src/parsing.h"
+
+#include <ch_stl/time.h>
+#include <ch_stl/filesystem.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Compares the lexer kernels against the table DFA. Fails if any of them gives different lexemes.
+// Usage: lex_bench [path]. Without a path 256 MB of generated source code is lexed, followed by random snippets
+// that start and end runs at every offset. A file is lexed as the language its extension says, like the editor does.
+
+const usize generated_size = 256ull * 1024 * 1024;
+const usize fuzz_size = 16ull * 1024 * 1024;
+
+static u8* generate_text(usize size) {
+	static const char* lines[] = {
+		"#include \"buffer.h\"\r\n",
+		"\r\n",
+		"/* Block comments\r\n * can go over many lines and only the star matters.\r\n */\r\n",
+		"static void foo(int a, int b) {\r\n",
+		"\tif (a < b) return; // comparing things\r\n",
+		"\t\tconst char* s = \"h\xC3\xA9llo w\xC3\xB6rld \\\"escaped\\\"\";\r\n",
+		"\t\tchar c = '\\n';\r\n",
+		"}\r\n",
+		"        for (usize i = 0; i < count; i += 1) sum += values[i] * 0x3F'FFu;\n",
+	};
+	const usize num_lines = sizeof(lines) / sizeof(lines[0]);
+
+	u8* const result = (u8*)malloc(size);
+	if (!result) return nullptr;
+
+	usize written = 0;
+	for (usize i = 0; written < size; i += 1) {
+		const char* line = lines[i % num_lines];
+		for (const char* c = line; *c && written < size; c += 1) {
+			result[written] = (u8)*c;
+			written += 1;
+		}
+	}
+
+	return result;
+}
+
+// Random runs of the bytes that matter to some state of some language so that every state gets entered and left at every alignment.
+static u8* generate_fuzz(usize size) {
+	static const char* pieces[] = {
+		"/*", "*/", "*", "//", "\"", "'", "\\", "\n", "\r\n", " ", "\t", "\x7F", "\x01",
+		"--[[", "]]", "--", "[[", "]", "#", "\"\"\"", "'''", "`", "```", ">", ".", "+", "-",
+		"abc", "_x$", "@Z", "`", "{", "~", "0", "123", "0x1F'2", "\xC3\xA9", "\xFF", "/",
+	};
+	const usize num_pieces = sizeof(pieces) / sizeof(pieces[0]);
+
+	u8* const result = (u8*)malloc(size);
+	if (!result) return nullptr;
+
+	u32 seed = 12345;
+	usize written = 0;
+	while (written < size) {
+		seed = seed * 1103515245 + 12345;
+		const char* piece = pieces[(seed >> 16) % num_pieces];
+		const usize repeat = 1 + ((seed >> 8) % 3 == 0 ? (seed >> 4) % 40 : 0);
+		for (usize r = 0; r < repeat; r += 1) {
+			for (const char* c = piece; *c && written < size; c += 1) {
+				result[written] = (u8)*c;
+				written += 1;
+			}
+		}
+	}
+
+	return result;
+}
+
+struct Bench_Result {
+	f64 seconds;
+	usize num_lexemes;
+	u8 end_dfa;
+};
+
+static Bench_Result run(const parsing::Lex_Tables& tables, const u8* data, usize count, parsing::Lex_Kernel kernel, parsing::Lexemes& lexemes) {
+	lexemes.count = 0;
+
+	const f64 start = ch::get_time_in_seconds();
+	const u8 end_dfa = parsing::lex(tables, tables.start_state, data, data + count, 0, lexemes, kernel);
+	const f64 end = ch::get_time_in_seconds();
+
+	Bench_Result result;
+	result.seconds = end - start;
+	result.num_lexemes = lexemes.count;
+	result.end_dfa = end_dfa;
+	return result;
+}
+
+static bool same_lexemes(const parsing::Lexemes& a, const parsing::Lexemes& b, usize count) {
+	for (usize i = 0; i < count; i += 1) {
+		if (a.offsets[i] != b.offsets[i] || a.dfa[i] != b.dfa[i] || a.first[i] != b.first[i] || a.lex_dfa[i] != b.lex_dfa[i]) return false;
+	}
+	return true;
+}
+
+struct Pass {
+	const char* name;
+	parsing::Lex_Kernel kernel;
+};
+
+static bool is_supported(parsing::Lex_Kernel kernel) {
+	return kernel <= parsing::get_best_lex_kernel();
+}
+
+static void prefault(parsing::Lexemes& lexemes, usize count) {
+	lexemes.reserve(count);
+	memset(lexemes.offsets, 0, count * sizeof(u32));
+	memset(lexemes.dfa, 0, count);
+	memset(lexemes.lex_dfa, 0, count);
+	memset(lexemes.first, 0, count);
+	memset(lexemes.highlight, 0, count);
+}
+
+static bool check_kernels(const char* what, const parsing::Lex_Tables& tables, const u8* data, usize count, const Pass* passes, usize num_passes, bool print_times) {
+	parsing::Lexemes expected;
+	parsing::Lexemes lexemes;
+	defer(expected.free());
+	defer(lexemes.free());
+
+	// Neither growing nor page faults should count against whichever kernel runs first
+	prefault(expected, count);
+	prefault(lexemes, count);
+
+	if (print_times) printf("%s:\n", what);
+	Bench_Result baseline = {};
+	for (usize i = 0; i < num_passes; i += 1) {
+		const Pass& it = passes[i];
+		if (!is_supported(it.kernel)) {
+			if (print_times) printf("  %-8s not supported\n", it.name);
+			continue;
+		}
+
+		const bool is_baseline = it.kernel == parsing::LK_Scalar;
+		const Bench_Result result = run(tables, data, count, it.kernel, is_baseline ? expected : lexemes);
+		const f64 mb_per_second = (f64)count / (1024.0 * 1024.0) / result.seconds;
+		if (print_times) printf("  %-8s %8.3fs %10.1f MB/s %llu lexemes\n", it.name, result.seconds, mb_per_second, (unsigned long long)result.num_lexemes);
+
+		if (is_baseline) {
+			baseline = result;
+		} else if (result.num_lexemes != baseline.num_lexemes || result.end_dfa != baseline.end_dfa || !same_lexemes(expected, lexemes, result.num_lexemes)) {
+			printf("  %-8s doesn't match scalar on %s\n", it.name, what);
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char** argv) {
+	const Pass passes[] = {
+		{ "scalar", parsing::LK_Scalar },
+		{ "ssse3",  parsing::LK_SSSE3 },
+		{ "avx2",   parsing::LK_AVX2 },
+	};
+	const usize num_passes = sizeof(passes) / sizeof(passes[0]);
+
+	u8* data = nullptr;
+	usize count = 0;
+	parsing::Language language = parsing::LANG_CPP;
+	if (argc > 1) {
+		ch::File f;
+		const ch::Path path = argv[1];
+		const ch::String extension = path.get_extension();
+		language = parsing::get_language_for_extension(extension.data, extension.count);
+		if (!f.open(path, ch::FO_Read | ch::FO_Binary)) {
+			printf("failed to open %s\n", argv[1]);
+			return 1;
+		}
+		count = f.size();
+		data = (u8*)malloc(count);
+		if (data) f.read(data, count);
+		f.close();
+	} else {
+		count = generated_size;
+		data = generate_text(count);
+	}
+	if (!data) {
+		printf("out of memory\n");
+		return 1;
+	}
+	defer(free(data));
+
+	if (!check_kernels(argc > 1 ? argv[1] : "generated source", parsing::get_lex_tables(language), data, count, passes, num_passes, true)) return 1;
+
+	u8* const fuzz = generate_fuzz(fuzz_size);
+	if (!fuzz) {
+		printf("out of memory\n");
+		return 1;
+	}
+	defer(free(fuzz));
+
+	// Every start offset so the vector loads and their tails fall everywhere, in every language
+	for (u8 fuzz_language = 0; fuzz_language < parsing::NUM_LANGUAGES; fuzz_language += 1) {
+		const parsing::Lex_Tables& tables = parsing::get_lex_tables((parsing::Language)fuzz_language);
+		for (usize offset = 0; offset < 64; offset += 1) {
+			if (!check_kernels("fuzz", tables, fuzz + offset, fuzz_size - offset * 3, passes, num_passes, fuzz_language == parsing::LANG_CPP && offset == 0)) return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,161 @@
+#include "../src/line_scan.h"
+
+#include <ch_stl/time.h>
+#include <ch_stl/filesystem.h>
+#include <ch_stl/string.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Compares the line scanning kernels against decoding every codepoint, which is what file loading used to do.
+// Usage: line_scan_bench [path]. Without a path 1 GB of generated source code is scanned.
+
+const usize generated_size = 1024ull * 1024 * 1024;
+const u32 bench_tab_width = 4;
+
+static void scan_lines_decoding(const u8* data, usize count, ch::Array<u32>* sizes, ch::Array<u32>* columns) {
+	u32 codepoint = 0;
+	u32 decoder_state = ch::utf8_accept;
+
+	usize last_eol = 0;
+	u32 col_count = 0;
+	for (usize i = 0; i < count; i += 1) {
+		ch::utf8_decode(&decoder_state, &codepoint, data[i]);
+		if (decoder_state != ch::utf8_accept) continue;
+
+		if (codepoint == '\t') col_count += bench_tab_width;
+		else if (codepoint != ch::utf8_bom) col_count += 1;
+
+		if (codepoint == '\r' || codepoint == '\n') {
+			if (codepoint == '\r' && i + 1 < count && data[i + 1] == '\n') {
+				i += 1;
+				col_count += 1;
+			}
+
+			sizes->push((u32)(i - last_eol + 1));
+			columns->push(col_count);
+			last_eol = i + 1;
+			col_count = 0;
+		}
+	}
+
+	sizes->push((u32)(count - last_eol));
+	columns->push(col_count);
+}
+
+static u8* generate_text(usize size) {
+	static const char* lines[] = {
+		"#include \"buffer.h\"\r\n",
+		"\r\n",
+		"static void foo(int a, int b) {\r\n",
+		"\tif (a < b) return; // comparing things\r\n",
+		"\t\tconst char* s = \"h\xC3\xA9llo w\xC3\xB6rld\";\r\n",
+		"}\r\n",
+		"        for (usize i = 0; i < count; i += 1) sum += values[i] * 3;\n",
+	};
+	const usize num_lines = sizeof(lines) / sizeof(lines[0]);
+
+	u8* const result = (u8*)malloc(size);
+	if (!result) return nullptr;
+
+	usize written = 0;
+	for (usize i = 0; written < size; i += 1) {
+		const char* line = lines[i % num_lines];
+		for (const char* c = line; *c && written < size; c += 1) {
+			result[written] = (u8)*c;
+			written += 1;
+		}
+	}
+
+	return result;
+}
+
+struct Bench_Result {
+	f64 seconds;
+	usize num_lines;
+	u64 column_sum;
+};
+
+static Bench_Result run(const u8* data, usize count, int kernel) {
+	ch::Array<u32> sizes;
+	ch::Array<u32> columns;
+	sizes.allocator = ch::get_heap_allocator();
+	columns.allocator = ch::get_heap_allocator();
+	defer(sizes.free());
+	defer(columns.free());
+
+	const f64 start = ch::get_time_in_seconds();
+	if (kernel < 0) {
+		scan_lines_decoding(data, count, &sizes, &columns);
+	} else {
+		Line_Scanner scanner(bench_tab_width, &sizes, &columns);
+		scanner.kernel = (Line_Scan_Kernel)kernel;
+		scanner.scan(data, count);
+		scanner.finish(true);
+	}
+	const f64 end = ch::get_time_in_seconds();
+
+	Bench_Result result;
+	result.seconds = end - start;
+	result.num_lines = sizes.count;
+	result.column_sum = 0;
+	for (const u32 it : columns) result.column_sum += it;
+	return result;
+}
+
+int main(int argc, char** argv) {
+	u8* data = nullptr;
+	usize count = 0;
+
+	if (argc > 1) {
+		ch::File f;
+		const ch::Path path = argv[1];
+		if (!f.open(path, ch::FO_Read | ch::FO_Binary)) {
+			printf("failed to open %s\n", argv[1]);
+			return 1;
+		}
+		count = f.size();
+		data = (u8*)malloc(count);
+		if (data) f.read(data, count);
+		f.close();
+	} else {
+		count = generated_size;
+		data = generate_text(count);
+	}
+	if (!data) {
+		printf("out of memory\n");
+		return 1;
+	}
+
+	struct {
+		const char* name;
+		int kernel;
+	} const passes[] = {
+		{ "utf8 decode", -1 },
+		{ "scalar",      LSK_Scalar },
+		{ "sse2",        LSK_SSE2 },
+		{ "avx2",        LSK_AVX2 },
+	};
+
+	Bench_Result baseline = {};
+	for (const auto& it : passes) {
+		if (it.kernel == LSK_AVX2 && get_best_line_scan_kernel() != LSK_AVX2) {
+			printf("%-12s not supported\n", it.name);
+			continue;
+		}
+
+		const Bench_Result result = run(data, count, it.kernel);
+		const f64 mb_per_second = (f64)count / (1024.0 * 1024.0) / result.seconds;
+		printf("%-12s %8.3fs %10.1f MB/s %llu lines\n", it.name, result.seconds, mb_per_second, (unsigned long long)result.num_lines);
+
+		if (it.kernel < 0) {
+			baseline = result;
+		} else if (result.num_lines != baseline.num_lines || result.column_sum != baseline.column_sum) {
+			printf("%-12s doesn't match utf8 decode\n", it.name);
+			return 1;
+		}
+	}
+
+	free(data);
+	return 0;
+}
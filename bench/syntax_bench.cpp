@@ -0,0 +1,316 @@
+#include "../src/buffer.h"
+#include "../src/config.h"
+
+#include <ch_stl/time.h>
+#include <ch_stl/filesystem.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Times lexing and parsing whole buffers the way the editor does it, without a window.
+// Usage: syntax_bench [options] [paths]. Without paths ../test_files/10mb_file.h is used if it's there,
+// followed by generated C++ source of a few sizes.
+//   -runs N            Times every corpus N times after a warm-up. 20 by default.
+//   -save PATH         Writes the medians to PATH as a baseline.
+//   -baseline PATH     Fails if a median is slower than the one in PATH by more than the threshold.
+//   -threshold PERCENT How much slower counts as a regression. 10 by default.
+
+const usize generated_sizes[] = { 1024 * 1024, 8 * 1024 * 1024, 32 * 1024 * 1024 };
+const char* const default_corpus_path = "../test_files/10mb_file.h";
+
+// buffer.cpp reads the tab width from the config. config.cpp loads the real one, which needs the editor.
+Config default_config;
+
+const Config& get_config() {
+	return default_config;
+}
+
+static u32 seed = 12345;
+
+static u32 next_random(u32 n) {
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) % n;
+}
+
+struct Text {
+	u8* data;
+	usize count;
+	usize allocated;
+};
+
+static void append(Text* text, const char* s) {
+	for (; *s && text->count < text->allocated; s += 1) {
+		text->data[text->count] = (u8)*s;
+		text->count += 1;
+	}
+}
+
+// Declarations of every kind the parser knows, with names that don't repeat so that identifiers aren't all alike.
+static u8* generate_source(usize size) {
+	static const char* types[] = { "int", "u32", "float", "const char*", "Buffer*", "ch::Array<u32>", "usize" };
+	static const char* names[] = { "count", "index", "buffer", "text", "lexeme", "offset", "result", "value" };
+	const usize num_types = sizeof(types) / sizeof(types[0]);
+	const usize num_names = sizeof(names) / sizeof(names[0]);
+
+	Text text;
+	text.data = (u8*)malloc(size);
+	text.count = 0;
+	text.allocated = size;
+	if (!text.data) return nullptr;
+
+	char line[512];
+	for (u32 i = 0; text.count < size; i += 1) {
+		const char* type = types[next_random(num_types)];
+		const char* name = names[next_random(num_names)];
+		switch (next_random(8)) {
+		case 0:
+			snprintf(line, sizeof(line), "#include \"file_%u.h\"\n#define MACRO_%u(x) ((x) * %u)\n\n", i, i, i);
+			break;
+		case 1:
+			snprintf(line, sizeof(line), "/* Block comment %u\n * over a few lines.\n */\nstruct Thing_%u {\n\t%s %s_%u;\n\t%s* next = nullptr;\n};\n\n", i, i, type, name, i, type);
+			break;
+		case 2:
+			snprintf(line, sizeof(line), "enum Kind_%u : u8 {\n\tKIND_A_%u,\n\tKIND_B_%u = %u,\n};\n\n", i, i, i, i);
+			break;
+		case 3:
+			snprintf(line, sizeof(line), "template <typename T>\nstatic T get_%s_%u(const T& a, %s b) {\n\treturn a + (T)b; // %u\n}\n\n", name, i, type, i);
+			break;
+		default:
+			snprintf(line, sizeof(line),
+				"static %s %s_%u(%s a, %s b) {\n"
+				"\tconst char* s = \"string %u with \\\"escapes\\\"\";\n"
+				"\tfor (usize j = 0; j < %u; j += 1) {\n"
+				"\t\tif (a < b) a = a * 0x%XULL + 'c';\n"
+				"\t}\n"
+				"\treturn (%s)MACRO_%u(a);\n"
+				"}\n\n",
+				type, name, i, type, type, i, i % 100, i, type, i);
+			break;
+		}
+		append(&text, line);
+	}
+	return text.data;
+}
+
+struct Corpus {
+	char name[64];
+	u8* data;
+	usize count;
+};
+
+static bool load_corpus(const char* path, Corpus* out) {
+	ch::File f;
+	const ch::Path file_path = path;
+	if (!f.open(file_path, ch::FO_Read | ch::FO_Binary)) return false;
+	defer(f.close());
+
+	const ch::String filename = file_path.get_filename(true);
+	snprintf(out->name, sizeof(out->name), "%.*s", (int)filename.count, filename.data);
+	out->count = f.size();
+	out->data = (u8*)malloc(out->count);
+	if (!out->data) return false;
+	f.read(out->data, out->count);
+	return true;
+}
+
+static void sort(f64* values, usize count) {
+	for (usize i = 1; i < count; i += 1) {
+		const f64 value = values[i];
+		usize j = i;
+		for (; j > 0 && values[j - 1] > value; j -= 1) values[j] = values[j - 1];
+		values[j] = value;
+	}
+}
+
+// Nearest rank of sorted values.
+static f64 percentile(const f64* sorted, usize count, u32 percent) {
+	usize rank = (count * percent + 99) / 100;
+	if (rank < 1) rank = 1;
+	return sorted[rank - 1];
+}
+
+enum Metric {
+	M_Lex,
+	M_Parse,
+	M_Total,
+
+	NUM_METRICS,
+};
+
+static const char* metric_names[NUM_METRICS] = { "lex_gb_per_s", "parse_mlexemes_per_s", "total_mloc_per_s" };
+static const char* metric_units[NUM_METRICS] = { "GB/s", "million lexemes/s", "mloc/s" };
+
+struct Corpus_Result {
+	f64 median[NUM_METRICS];
+};
+
+static Corpus_Result bench_corpus(const Corpus& corpus, u32 runs) {
+	const Buffer_ID id = create_buffer();
+	Buffer* const buffer = find_buffer(id);
+	buffer->insert_text(0, corpus.data, corpus.count);
+
+	f64* const samples = (f64*)malloc(sizeof(f64) * runs * NUM_METRICS);
+	assert(samples);
+	defer(free(samples));
+
+	// The first run grows the lexemes and faults in their pages
+	for (u32 run = 0; run <= runs; run += 1) {
+		const f64 lex_before = buffer->lex_time;
+		const f64 parse_before = buffer->parse_time;
+		buffer->syntax_dirty = true;
+		buffer->syntax_edit.is_set = false;
+		parsing::parse_cpp(buffer);
+		if (!run) continue;
+
+		const f64 lex_time = buffer->lex_time - lex_before;
+		const f64 parse_time = buffer->parse_time - parse_before;
+		f64* const it = samples + (run - 1) * NUM_METRICS;
+		it[M_Lex] = (f64)corpus.count / lex_time / (1024.0 * 1024.0 * 1024.0);
+		it[M_Parse] = (f64)buffer->lexemes.count / parse_time / 1000000.0;
+		it[M_Total] = (f64)buffer->line_table.count() / (lex_time + parse_time) / 1000000.0;
+	}
+
+	printf("%s: %.1f MB, %llu lines, %llu lexemes, %u runs\n", corpus.name, (f64)corpus.count / (1024.0 * 1024.0),
+		(unsigned long long)buffer->line_table.count(), (unsigned long long)buffer->lexemes.count, runs);
+	printf("  %-22s %10s %10s %10s %10s\n", "", "min", "p10", "p50", "p90");
+
+	Corpus_Result result;
+	f64* const sorted = (f64*)malloc(sizeof(f64) * runs);
+	assert(sorted);
+	defer(free(sorted));
+	for (u32 m = 0; m < NUM_METRICS; m += 1) {
+		for (u32 run = 0; run < runs; run += 1) sorted[run] = samples[run * NUM_METRICS + m];
+		sort(sorted, runs);
+		result.median[m] = percentile(sorted, runs, 50);
+		printf("  %-22s %10.3f %10.3f %10.3f %10.3f %s\n", metric_names[m], sorted[0], percentile(sorted, runs, 10), result.median[m], percentile(sorted, runs, 90), metric_units[m]);
+	}
+
+	remove_buffer(id);
+	return result;
+}
+
+// A baseline has a line per corpus and metric: the corpus name, the metric name and its median.
+struct Baseline_Entry {
+	char corpus[64];
+	char metric[32];
+	f64 value;
+};
+
+const usize max_baseline_entries = 256;
+
+static usize load_baseline(const char* path, Baseline_Entry* entries) {
+	FILE* const f = fopen(path, "r");
+	if (!f) return 0;
+	usize count = 0;
+	while (count < max_baseline_entries) {
+		Baseline_Entry& it = entries[count];
+		if (fscanf(f, "%63s %31s %lf", it.corpus, it.metric, &it.value) != 3) break;
+		count += 1;
+	}
+	fclose(f);
+	return count;
+}
+
+int main(int argc, char** argv) {
+	u32 runs = 20;
+	f64 threshold = 10.0;
+	const char* save_path = nullptr;
+	const char* baseline_path = nullptr;
+
+	const usize max_corpora = 64;
+	Corpus corpora[max_corpora];
+	usize num_corpora = 0;
+
+	for (int i = 1; i < argc; i += 1) {
+		const bool has_value = i + 1 < argc;
+		if (!strcmp(argv[i], "-runs") && has_value) {
+			runs = (u32)atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-save") && has_value) {
+			save_path = argv[++i];
+		} else if (!strcmp(argv[i], "-baseline") && has_value) {
+			baseline_path = argv[++i];
+		} else if (!strcmp(argv[i], "-threshold") && has_value) {
+			threshold = atof(argv[++i]);
+		} else if (argv[i][0] == '-') {
+			printf("unknown option %s\n", argv[i]);
+			return 1;
+		} else if (num_corpora < max_corpora) {
+			if (!load_corpus(argv[i], &corpora[num_corpora])) {
+				printf("failed to open %s\n", argv[i]);
+				return 1;
+			}
+			num_corpora += 1;
+		}
+	}
+	if (runs < 1) runs = 1;
+
+	if (!num_corpora) {
+		if (load_corpus(default_corpus_path, &corpora[num_corpora])) {
+			num_corpora += 1;
+		} else {
+			printf("%s is missing, only generated source is timed\n", default_corpus_path);
+		}
+		for (const usize size : generated_sizes) {
+			Corpus& it = corpora[num_corpora];
+			snprintf(it.name, sizeof(it.name), "generated_%llumb", (unsigned long long)(size / (1024 * 1024)));
+			it.data = generate_source(size);
+			it.count = size;
+			if (!it.data) {
+				printf("out of memory\n");
+				return 1;
+			}
+			num_corpora += 1;
+		}
+	}
+
+	Corpus_Result results[max_corpora];
+	for (usize i = 0; i < num_corpora; i += 1) results[i] = bench_corpus(corpora[i], runs);
+
+	bool has_regressed = false;
+	if (baseline_path) {
+		Baseline_Entry* const entries = (Baseline_Entry*)malloc(sizeof(Baseline_Entry) * max_baseline_entries);
+		assert(entries);
+		defer(free(entries));
+		const usize num_entries = load_baseline(baseline_path, entries);
+		if (!num_entries) {
+			printf("no baseline in %s\n", baseline_path);
+			return 1;
+		}
+
+		printf("against %s, failing below -%.1f%%:\n", baseline_path, threshold);
+		for (usize i = 0; i < num_corpora; i += 1) {
+			for (u32 m = 0; m < NUM_METRICS; m += 1) {
+				const Baseline_Entry* entry = nullptr;
+				for (usize e = 0; e < num_entries; e += 1) {
+					if (!strcmp(entries[e].corpus, corpora[i].name) && !strcmp(entries[e].metric, metric_names[m])) entry = &entries[e];
+				}
+				if (!entry) {
+					printf("  %-16s %-22s not in the baseline\n", corpora[i].name, metric_names[m]);
+					continue;
+				}
+
+				const f64 change = (results[i].median[m] / entry->value - 1.0) * 100.0;
+				const bool is_regression = change < -threshold;
+				if (is_regression) has_regressed = true;
+				printf("  %-16s %-22s %10.3f -> %10.3f %+6.1f%%%s\n", corpora[i].name, metric_names[m], entry->value, results[i].median[m], change, is_regression ? "  REGRESSED" : "");
+			}
+		}
+	}
+
+	if (save_path) {
+		FILE* const f = fopen(save_path, "w");
+		if (!f) {
+			printf("failed to write %s\n", save_path);
+			return 1;
+		}
+		for (usize i = 0; i < num_corpora; i += 1) {
+			for (u32 m = 0; m < NUM_METRICS; m += 1) fprintf(f, "%s %s %.6f\n", corpora[i].name, metric_names[m], results[i].median[m]);
+		}
+		fclose(f);
+		printf("saved the baseline to %s\n", save_path);
+	}
+
+	for (usize i = 0; i < num_corpora; i += 1) free(corpora[i].data);
+	return has_regressed ? 1 : 0;
+}
@@ -72,6 +72,8 @@ project "eden"
         cppdialect "C++17"
 		systemversion "latest"
 		architecture "x64"
+		-- lexer.cpp builds every language's lexer tables at compile time
+		buildoptions { "/constexpr:steps10000000" }
 
 		defines
 		{
@@ -83,4 +85,169 @@ project "eden"
 			"src/win32/**.h",
 			"src/win32/**.cpp",
 			"src/win32/**.rc"
-		}
\ No newline at end of file
+		}
+
+-- The defines, include paths and per configuration settings every bench and tool project shares.
+-- with_lexer is for the ones that build lexer.cpp, which makes every language's lexer tables at compile time.
+local function tool_project_config(with_lexer)
+	defines
+	{
+		"_CRT_SECURE_NO_WARNINGS"
+	}
+
+    includedirs
+    {
+        "src/**",
+        "libs/",
+    }
+
+    filter "configurations:Debug"
+		defines 
+		{
+			"BUILD_DEBUG#1",
+			"BUILD_RELEASE#0",
+			"CH_BUILD_DEBUG#1"
+		}
+		runtime "Debug"
+		symbols "On"
+
+	filter "configurations:Release"
+		defines 
+		{
+			"BUILD_RELEASE#1",
+			"BUILD_DEBUG#0",
+			"NDEBUG"
+		}
+		runtime "Release"
+        optimize "On"
+
+    filter "system:windows"
+        cppdialect "C++17"
+		systemversion "latest"
+		architecture "x64"
+		if with_lexer then
+			buildoptions { "/constexpr:steps10000000" }
+		end
+
+	-- What the project sets after this is for every configuration again
+	filter {}
+end
+
+project "bench"
+    language "C++"
+	dependson { "ch_stl" }
+	kind "ConsoleApp"
+	tool_project_config(false)
+
+    files
+    {
+        "bench/line_scan_bench.cpp",
+        "src/line_scan.h",
+        "src/line_scan.cpp",
+        "src/file_map.h",
+        "src/threads.h",
+        "src/win32/file_map_win32.cpp",
+        "src/win32/threads_win32.cpp",
+    }
+
+    links
+    {
+        "kernel32",
+		"bin/ch_stl"
+    }
+
+project "lex_bench"
+    language "C++"
+	dependson { "ch_stl" }
+	kind "ConsoleApp"
+	tool_project_config(true)
+
+    files
+    {
+        "bench/lex_bench.cpp",
+        "src/parsing.h",
+        "src/lexer.cpp",
+    }
+
+    links
+    {
+        "kernel32",
+		"bin/ch_stl"
+    }
+
+project "syntax_bench"
+    language "C++"
+	dependson { "ch_stl" }
+	kind "ConsoleApp"
+	tool_project_config(true)
+
+	-- The editor's buffers, lexer and parser without any of the window or GL code
+    files
+    {
+        "bench/syntax_bench.cpp",
+        "src/buffer.h",
+        "src/buffer.cpp",
+        "src/undo.h",
+        "src/undo.cpp",
+        "src/line_table.h",
+        "src/line_table.cpp",
+        "src/fold_table.h",
+        "src/fold_table.cpp",
+        "src/line_scan.h",
+        "src/line_scan.cpp",
+        "src/piece_tree.h",
+        "src/piece_tree.cpp",
+        "src/save_job.h",
+        "src/save_job.cpp",
+        "src/parse_job.h",
+        "src/parse_job.cpp",
+        "src/parsing.h",
+        "src/parsing_lex_order.h",
+        "src/parsing.cpp",
+        "src/symbol_index.h",
+        "src/symbol_index.cpp",
+        "src/lexer.cpp",
+        "src/file_map.h",
+        "src/threads.h",
+        "src/win32/file_map_win32.cpp",
+        "src/win32/threads_win32.cpp",
+    }
+
+    links
+    {
+        "kernel32",
+		"shlwapi",
+		"bin/ch_stl"
+    }
+
+project "keyword_hash"
+    language "C++"
+	kind "ConsoleApp"
+	tool_project_config(false)
+
+    files
+    {
+        "tools/keyword_hash.cpp",
+        "src/keyword_hash.h",
+        "src/parsing_cpp_keywords.h",
+    }
+
+project "lex_tune"
+    language "C++"
+	dependson { "ch_stl" }
+	kind "ConsoleApp"
+	tool_project_config(true)
+
+    files
+    {
+        "tools/lex_tune.cpp",
+        "src/parsing.h",
+        "src/parsing_lex_order.h",
+        "src/lexer.cpp",
+    }
+
+    links
+    {
+        "kernel32",
+		"bin/ch_stl"
+    }
@@ -2,6 +2,8 @@
 
 #include "buffer_view.h"
 #include "buffer.h"
+#include "symbol_index.h"
+#include "project_index.h"
 
 #include <ch_stl/string.h>
 
@@ -10,6 +12,7 @@ void newline() {
 	Buffer* const buffer = find_buffer(view->the_buffer);
 	assert(buffer);
 
+	buffer->begin_edit(view->cursor, view->selection);
 	view->remove_selection();
 
 	if (buffer->line_ending == LE_CRLF) {
@@ -18,14 +21,11 @@ void newline() {
 	}
 	buffer->add_char('\n', view->cursor);
 	view->cursor += 1;
+	buffer->end_edit();
 
 	view->selection = view->cursor;
 	view->update_column_info();
-	buffer->syntax_dirty = true;
-
 	view->reset_cursor_timer();
-
-	buffer->mark_file_dirty();
 }
 
 void backspace() {
@@ -34,12 +34,17 @@ void backspace() {
 	assert(buffer);
 
 	if (view->has_selection()) {
+		buffer->begin_edit(view->cursor, view->selection);
 		view->remove_selection();
+		buffer->end_edit();
+
+		view->update_column_info(true);
 		return;
 	}
 
 	if (view->cursor <= 0) return;
 
+	buffer->begin_edit(view->cursor, view->selection);
 	view->cursor = buffer->find_prev_char(view->cursor);
 	const u32 c = buffer->get_char(view->cursor);
 	buffer->remove_char(view->cursor);
@@ -52,13 +57,11 @@ void backspace() {
 			buffer->remove_char(view->cursor);
 		}
 	}
+	buffer->end_edit();
 
 	view->selection = view->cursor;
-	buffer->syntax_dirty = true;
 	view->update_column_info();
 	view->reset_cursor_timer();
-
-	buffer->mark_file_dirty();
 }
 
 void move_cursor_right(bool move_selection) {
@@ -66,9 +69,9 @@ void move_cursor_right(bool move_selection) {
 	Buffer* const buffer = find_buffer(view->the_buffer);
 	assert(buffer);
 
-	if (view->cursor >= buffer->gap_buffer.count()) return;
+	if (view->cursor >= buffer->count()) return;
 
-	if (view->cursor < buffer->gap_buffer.count() - 1) {
+	if (view->cursor < buffer->count() - 1) {
 		const u32 c = buffer->get_char(view->cursor);
 		const usize next_index = buffer->find_next_char(view->cursor);
 		const u32 next_c = buffer->get_char(next_index);
@@ -78,11 +81,27 @@ void move_cursor_right(bool move_selection) {
 	}
 
 	view->cursor = buffer->find_next_char(view->cursor);
+
+	// Steps over folded lines to the start of the line after them
+	if (!buffer->folds.is_empty() && view->cursor < buffer->count()) {
+		const Hidden_Lines* const folded = buffer->folds.find_hidden(buffer->line_table, buffer->get_line_from_index(view->cursor));
+		if (folded) view->cursor = buffer->get_index_from_line(folded->end);
+	}
+
 	if (move_selection) view->selection = view->cursor;
 	view->update_column_info(true);
 	view->reset_cursor_timer();
 }
 
+/** @returns the index of the line ending of line, or the end of the text if it has none. */
+static usize get_line_end_index(Buffer& buffer, usize line) {
+	const usize begin = buffer.get_index_from_line(line);
+	usize end = begin + buffer.line_table.get_line_size(line);
+	if (end > begin && buffer.get_char(end - 1) == '\n') end -= 1;
+	if (end > begin && buffer.get_char(end - 1) == '\r') end -= 1;
+	return end;
+}
+
 void move_cursor_left(bool move_selection) {
 	Buffer_View* const view = get_focused_view();
 	Buffer* const buffer = find_buffer(view->the_buffer);
@@ -92,6 +111,12 @@ void move_cursor_left(bool move_selection) {
 
 	view->cursor = buffer->find_prev_char(view->cursor);
 
+	// Steps over folded lines to the eol of the line before them
+	if (!buffer->folds.is_empty()) {
+		const Hidden_Lines* const folded = buffer->folds.find_hidden(buffer->line_table, buffer->get_line_from_index(view->cursor));
+		if (folded) view->cursor = get_line_end_index(*buffer, folded->first - 1);
+	}
+
 	const u32 c = buffer->get_char(view->cursor);
 	if (view->cursor > 0) {
 		const usize prev_index = buffer->find_prev_char(view->cursor);
@@ -114,8 +139,9 @@ void move_cursor_up(bool move_selection) {
 	const u64 current_line = view->current_line;
 	if (current_line <= 0) return;
 
-	const usize line_index = buffer->get_index_from_line(current_line);
-	const usize prev_line_index = buffer->get_index_from_line(current_line - 1);
+	const usize prev_line = buffer->folds.get_prev_visible_line(buffer->line_table, (usize)current_line);
+	const usize line_index = buffer->get_index_from_line(prev_line + 1);
+	const usize prev_line_index = buffer->get_index_from_line(prev_line);
 
 	u32 col_count = 0;
 	usize i = prev_line_index;
@@ -139,12 +165,13 @@ void move_cursor_down(bool move_selection) {
 	assert(buffer);
 
 	const u64 current_line = view->current_line;
-	const usize num_lines = buffer->eol_table.count;
+	const usize num_lines = buffer->line_table.count();
 
-	if (current_line + 1 >= num_lines) return;
+	const usize next_line = buffer->folds.get_next_visible_line(buffer->line_table, (usize)current_line);
+	if (next_line >= num_lines) return;
 
-	const usize next_line_index = buffer->get_index_from_line(current_line + 1);
-	const usize next_line_size = buffer->eol_table[current_line + 1];
+	const usize next_line_index = buffer->get_index_from_line(next_line);
+	const usize next_line_size = buffer->line_table.get_line_size(next_line);
 
 	u32 col_count = 0;
 	usize i = next_line_index;
@@ -191,7 +218,7 @@ void seek_cursor_right(bool move_selection) {
 	Buffer* const buffer = find_buffer(view->the_buffer);
 	assert(buffer);
 
-	if (view->cursor >= buffer->gap_buffer.count()) return;
+	if (view->cursor >= buffer->count()) return;
 
 	bool found_char = false;
 	for (usize i = buffer->find_next_char(view->cursor); i >= 0; i = buffer->find_next_char(i)) {
@@ -209,6 +236,269 @@ void seek_cursor_right(bool move_selection) {
 	view->reset_cursor_timer();
 }
 
+/** Text that was copied or cut last. Only lives inside the editor. */
+static ch::Array<u8> clipboard;
+
+void copy_selection() {
+	Buffer_View* const view = get_focused_view();
+	Buffer* const buffer = find_buffer(view->the_buffer);
+	assert(buffer);
+
+	if (!view->has_selection()) return;
+
+	const usize begin = view->cursor > view->selection ? view->selection : view->cursor;
+	usize end = view->cursor > view->selection ? view->cursor : view->selection;
+	if (end > buffer->count()) end = buffer->count();
+
+	clipboard.allocator = ch::get_heap_allocator();
+	clipboard.count = 0;
+	if (end - begin > clipboard.allocated) clipboard.reserve(end - begin - clipboard.allocated);
+	buffer->copy_bytes(begin, end - begin, clipboard.data);
+	clipboard.count = end - begin;
+}
+
+void cut_selection() {
+	Buffer_View* const view = get_focused_view();
+	Buffer* const buffer = find_buffer(view->the_buffer);
+	assert(buffer);
+
+	if (!view->has_selection()) return;
+
+	copy_selection();
+
+	buffer->begin_edit(view->cursor, view->selection);
+	view->remove_selection();
+	buffer->end_edit();
+
+	view->update_column_info(true);
+	view->reset_cursor_timer();
+}
+
+void paste() {
+	Buffer_View* const view = get_focused_view();
+	Buffer* const buffer = find_buffer(view->the_buffer);
+	assert(buffer);
+
+	if (!clipboard.count) return;
+
+	buffer->begin_edit(view->cursor, view->selection);
+	view->remove_selection();
+	buffer->insert_text(view->cursor, clipboard.data, clipboard.count);
+	view->cursor += clipboard.count;
+	buffer->end_edit();
+
+	view->selection = view->cursor;
+	view->update_column_info(true);
+	view->reset_cursor_timer();
+}
+
+void undo() {
+	Buffer_View* const view = get_focused_view();
+	Buffer* const buffer = find_buffer(view->the_buffer);
+	assert(buffer);
+
+	if (!buffer->undo(&view->cursor, &view->selection)) return;
+
+	view->update_column_info(true);
+	view->reset_cursor_timer();
+}
+
+void redo() {
+	Buffer_View* const view = get_focused_view();
+	Buffer* const buffer = find_buffer(view->the_buffer);
+	assert(buffer);
+
+	if (!buffer->redo(&view->cursor, &view->selection)) return;
+
+	view->update_column_info(true);
+	view->reset_cursor_timer();
+}
+
+void toggle_fold() {
+	Buffer_View* const view = get_focused_view();
+	Buffer* const buffer = find_buffer(view->the_buffer);
+	assert(buffer);
+
+	const usize current_line = (usize)view->current_line;
+	if (buffer->folds.remove_on_line(buffer->line_table, current_line)) return;
+
+	// The regions come from the lexemes, so they have to be up to date with the text
+	if (buffer->syntax_edit.is_set || buffer->syntax_dirty) return;
+
+	ch::Array<parsing::Fold_Region> regions;
+	regions.allocator = ch::get_heap_allocator();
+	defer(regions.free());
+	parsing::find_fold_regions(buffer->lexemes, *buffer, regions);
+
+	// The innermost region around the cursor that hides any lines. Regions are sorted by begin, so that's the last one.
+	Fold fold = {};
+	bool found_fold = false;
+	for (const parsing::Fold_Region& it : regions) {
+		if (it.begin > view->cursor) break;
+		if (it.end < view->cursor) continue;
+		if (buffer->get_line_from_index(it.end) <= buffer->get_line_from_index(it.begin) + 1) continue;
+		fold.begin = it.begin;
+		fold.end = it.end;
+		found_fold = true;
+	}
+	if (!found_fold) return;
+
+	buffer->folds.add(&fold, 1);
+
+	// The cursor can't stay on a hidden line
+	if (buffer->folds.is_line_hidden(buffer->line_table, current_line)) {
+		view->cursor = fold.begin;
+		view->selection = view->cursor;
+		view->update_column_info(true);
+	}
+}
+
+void fold_all_function_bodies() {
+	Buffer_View* const view = get_focused_view();
+	Buffer* const buffer = find_buffer(view->the_buffer);
+	assert(buffer);
+
+	if (buffer->syntax_edit.is_set || buffer->syntax_dirty) return;
+
+	ch::Array<parsing::Fold_Region> regions;
+	regions.allocator = ch::get_heap_allocator();
+	defer(regions.free());
+	parsing::find_fold_regions(buffer->lexemes, *buffer, regions);
+
+	ch::Array<Fold> folds;
+	folds.allocator = ch::get_heap_allocator();
+	defer(folds.free());
+	for (const parsing::Fold_Region& it : regions) {
+		if (it.kind != parsing::FOLD_Function_Body) continue;
+		const Fold fold = { it.begin, it.end };
+		folds.push(fold);
+	}
+	buffer->folds.add(folds.data, folds.count);
+
+	// Puts the cursor on the line of the function it was in
+	if (buffer->folds.is_line_hidden(buffer->line_table, (usize)view->current_line)) {
+		const Hidden_Lines* const folded = buffer->folds.find_hidden(buffer->line_table, (usize)view->current_line);
+		view->cursor = buffer->get_index_from_line(folded->first - 1);
+		view->selection = view->cursor;
+		view->update_column_info(true);
+	}
+}
+
+void unfold_all() {
+	Buffer_View* const view = get_focused_view();
+	Buffer* const buffer = find_buffer(view->the_buffer);
+	assert(buffer);
+
+	buffer->folds.clear();
+}
+
+/** Goes to the first definition the project index has of the name at the cursor, opening its file if no buffer has it open. */
+static void go_to_indexed_definition(Buffer_View* view, const Buffer& buffer) {
+	const Project_Index& index = get_project_index();
+	usize count;
+	const u8* const text = find_identifier_at(buffer, view->cursor, &count);
+	if (!text || !index) return;
+
+	const u32 name = index.find_name(text, count);
+	if (!name) return;
+	usize num_symbols;
+	const Index_Symbol* const symbols = index.get_symbols(name, &num_symbols);
+	if (!num_symbols) return;
+
+	usize path_count;
+	const u8* const path_text = index.get_name(index.files[symbols[0].file].path, &path_count);
+	ch::Array<char> path_chars;
+	path_chars.allocator = ch::get_heap_allocator();
+	defer(path_chars.free());
+	path_chars.reserve(path_count + 1);
+	for (usize i = 0; i < path_count; i += 1) path_chars.push((char)path_text[i]);
+	path_chars.push(0);
+
+	// The file can be open already, even if its definitions aren't in the symbol table yet
+	Buffer_ID id = find_buffer_by_path(path_chars.data);
+	if (id == invalid_buffer_id) {
+		id = create_buffer();
+		if (!find_buffer(id)->load_file_into_buffer(ch::Path(path_chars.data))) {
+			remove_buffer(id);
+			return;
+		}
+	}
+	Buffer* const target = find_buffer(id);
+	assert(target);
+
+	// The file can have changed since it was indexed
+	const usize offset = symbols[0].offset;
+	view->the_buffer = id;
+	view->cursor = offset < target->count() ? offset : target->count();
+	view->selection = view->cursor;
+	view->update_column_info(true);
+	view->reset_cursor_timer();
+}
+
+void go_to_definition() {
+	Buffer_View* const view = get_focused_view();
+	Buffer* const buffer = find_buffer(view->the_buffer);
+	assert(buffer);
+
+	const u32 name = find_symbol_name_at(*buffer, view->cursor);
+	const Symbol_Table& symbols = get_symbol_table();
+	const Symbol_Site* const first = symbols.find_first(name);
+	if (!first) {
+		// Nothing open defines it
+		go_to_indexed_definition(view, *buffer);
+		return;
+	}
+
+	// From a definition it goes to the next one, so that going again cycles through all of them
+	const Symbol_Site* target = first;
+	for (const Symbol_Site* it = first; it; it = symbols.find_next(*it)) {
+		if (it->buffer != buffer->id) continue;
+		const usize begin = get_symbol_site_index(*it);
+		if (view->cursor < begin || view->cursor > begin + buffer->lexemes.offsets[it->lexeme + 1] - buffer->lexemes.offsets[it->lexeme]) continue;
+		target = symbols.find_next(*it);
+		if (!target) target = first;
+		break;
+	}
+
+	view->the_buffer = target->buffer;
+	view->cursor = get_symbol_site_index(*target);
+	view->selection = view->cursor;
+	view->update_column_info(true);
+	view->reset_cursor_timer();
+}
+
+void go_to_next_use() {
+	Buffer_View* const view = get_focused_view();
+	Buffer* const buffer = find_buffer(view->the_buffer);
+	assert(buffer);
+
+	const u32 name = find_symbol_name_at(*buffer, view->cursor);
+	if (!name) return;
+
+	// Only the uses of the name are looked at, not the rest of the lexemes
+	const usize cursor_lexeme = parsing::find_lexeme(buffer->lexemes, buffer->syntax_edit.to_old(view->cursor));
+	const Symbol_Table& symbols = get_symbol_table();
+	const Symbol_Site* first = nullptr;
+	const Symbol_Site* next = nullptr;
+	for (const Symbol_Site* it = symbols.find_first_use(name); it; it = symbols.find_next(*it)) {
+		if (it->buffer != buffer->id) continue;
+		if (!first || it->lexeme < first->lexeme) first = it;
+		if (it->lexeme > cursor_lexeme && (!next || it->lexeme < next->lexeme)) next = it;
+	}
+	if (!next) next = first;
+	if (!next) return;
+
+	view->cursor = get_symbol_site_index(*next);
+	view->selection = view->cursor;
+	view->update_column_info(true);
+	view->reset_cursor_timer();
+}
+
+void toggle_outline() {
+	Buffer_View* const view = get_focused_view();
+	view->show_outline = !view->show_outline;
+}
+
 void save_buffer() {
 	Buffer_View* const view = get_focused_view();
 	Buffer* const buffer = find_buffer(view->the_buffer);
@@ -217,6 +507,14 @@ void save_buffer() {
 	buffer->save_file_to_path();
 }
 
+void toggle_buffer_storage() {
+	Buffer_View* const view = get_focused_view();
+	Buffer* const buffer = find_buffer(view->the_buffer);
+	assert(buffer);
+
+	buffer->set_storage(buffer->storage == BS_Piece_Tree ? BS_Gap_Buffer : BS_Piece_Tree);
+}
+
 #if CH_PLATFORM_WINDOWS
 typedef UINT_PTR (__stdcall *LPOFNHOOKPROC) (HWND, UINT, WPARAM, LPARAM);
 struct OPENFILENAMEA {
@@ -18,6 +18,44 @@ void seek_cursor_left(bool move_selection);
 
 void seek_cursor_right(bool move_selection);
 
+/** Copies the selected text of the current buffer to the clipboard. */
+void copy_selection();
+
+/** Copies the selected text of the current buffer to the clipboard and removes it. */
+void cut_selection();
+
+/** Replaces the selection in the current buffer with the clipboard text. */
+void paste();
+
+/** Reverts the last edit in the current buffer and puts the cursor back where it was. */
+void undo();
+
+/** Applies the last undone edit in the current buffer again. */
+void redo();
+
+/** Unfolds the folds that start on the cursor line or else folds the innermost block, comment or #if around the cursor. */
+void toggle_fold();
+
+/** Folds the body of every function in the current buffer. */
+void fold_all_function_bodies();
+
+void unfold_all();
+
+/**
+ * Moves the cursor to where the name at it is defined. Goes on to the next definition if it's on one already.
+ * A name no open buffer defines is looked up in the project index and its file is opened.
+ */
+void go_to_definition();
+
+/** Moves the cursor to the next use of the name at it in the current buffer, or back to the first one after the last. */
+void go_to_next_use();
+
+/** Shows or hides the list of the current buffer's functions, types and macros next to it. */
+void toggle_outline();
+
 void save_buffer();
 
+/** Moves the current buffer's text from a gap buffer into a piece tree or back. Big files start out in a piece tree. */
+void toggle_buffer_storage();
+
 void open_dialog();
\ No newline at end of file
@@ -1,6 +1,9 @@
 #include "buffer.h"
 
 #include "config.h"
+#include "file_map.h"
+#include "parse_job.h"
+#include "symbol_index.h"
 
 #include <ch_stl/hash_table.h>
 #include <vadefs.h>
@@ -13,69 +16,316 @@ u32 get_char_column_size(u32 c) {
 	return 1;
 }
 
-Buffer::Buffer(Buffer_ID _id) : id(_id) {
-    line_column_table.allocator = ch::get_heap_allocator();
-	eol_table.allocator = ch::get_heap_allocator();
-	gap_buffer.allocator = ch::get_heap_allocator();
+usize encode_utf8(u32 c, u8* out) {
+	if (c < 0x80) {
+		out[0] = (u8)c;
+		return 1;
+	}
+	if (c < 0x800) {
+		out[0] = (u8)(0xC0 | (c >> 6));
+		out[1] = (u8)(0x80 | (c & 0x3F));
+		return 2;
+	}
+	if (c < 0x10000) {
+		out[0] = (u8)(0xE0 | (c >> 12));
+		out[1] = (u8)(0x80 | ((c >> 6) & 0x3F));
+		out[2] = (u8)(0x80 | (c & 0x3F));
+		return 3;
+	}
 
-	eol_table.push(0);
-	line_column_table.push(0);
+	// Anything past the last codepoint becomes the replacement character
+	if (c > 0x10FFFF) return encode_utf8(0xFFFD, out);
 
-	name = ch::make_stack_string("*scratch*");
+	out[0] = (u8)(0xF0 | (c >> 18));
+	out[1] = (u8)(0x80 | ((c >> 12) & 0x3F));
+	out[2] = (u8)(0x80 | ((c >> 6) & 0x3F));
+	out[3] = (u8)(0x80 | (c & 0x3F));
+	return 4;
 }
 
-bool Buffer::load_file_into_buffer(const ch::Path& path) {
-	if (gap_buffer) return false;
+// Runs the full rebuild after every incremental line table update and checks that both agree.
+#define VERIFY_LINE_TABLES BUILD_DEBUG
 
-	ch::File f;
-	if (!f.open(path, ch::FO_Read | ch::FO_Binary)) return false;
-	defer(f.close());
+/**
+ * Scans [begin, end) and pushes the byte and column size of every line found.
+ * begin must be the start of a line. The trailing line without eol characters is only pushed if is_last_line is set.
+ *
+ * @param out_scanner receives the finished scanner so its line ending counts can be used. Optional.
+ */
+static void scan_lines(const Buffer& buffer, usize begin, usize end, bool is_last_line, ch::Array<u32>* eols, ch::Array<u32>* columns, Line_Scanner* out_scanner = nullptr) {
+	assert(begin <= end && end <= buffer.count());
 
-	const usize f_size = f.size();
-	gap_buffer.resize(f_size + ch::default_gap_size);
+	Line_Scanner scanner(get_config().tab_width, eols, columns);
+
+	for (usize i = begin; i < end;) {
+		usize span_count;
+		const u8* const span = buffer.get_span(i, &span_count);
+		if (span_count > end - i) span_count = end - i;
+
+		scanner.scan(span, span_count);
+		i += span_count;
+	}
+
+	scanner.finish(is_last_line);
+
+	if (out_scanner) *out_scanner = scanner;
+}
+
+/** Parts of a whole text scan are at least this big so that starting a thread for one is worth it. */
+const usize parallel_line_scan_part_size = 4 * 1024 * 1024;
 
-	f.read(gap_buffer.data, f_size);
-	gap_buffer.gap = gap_buffer.data + f_size;
-	gap_buffer.gap_size = ch::default_gap_size;
+/** A part of the text that's scanned on its own thread. It starts right after a '\n', which always ends a line, so it starts a line of its own. */
+struct Line_Scan_Part {
+	ch::Array<File_Span> spans;
+	u32 tab_width = 4;
+	bool is_last_line = false;
 
-	eol_table.count = 0;
-	line_column_table.count = 0;
+	ch::Array<u32> eols;
+	ch::Array<u32> columns;
+	Line_Scanner scanner;
 
-	u32 num_nix = 0;
-	u32 num_clrf = 0;
-	u32 last_eol = 0;
+	Thread thread;
+};
+
+static void line_scan_part_main(void* param) {
+	Line_Scan_Part* const part = (Line_Scan_Part*)param;
+	part->scanner = Line_Scanner(part->tab_width, &part->eols, &part->columns);
+	for (const File_Span& it : part->spans) {
+		part->scanner.scan(it.data, it.size);
+	}
+	part->scanner.finish(part->is_last_line);
+}
+
+static void free_line_scan_parts(ch::Array<Line_Scan_Part>& parts) {
+	for (Line_Scan_Part& it : parts) {
+		it.spans.free();
+		it.eols.free();
+		it.columns.free();
+	}
+	parts.free();
+}
+
+/**
+ * Scans the whole text like scan_lines(buffer, 0, buffer.count(), true, ...).
+ * A piece tree knows how many line feeds every subtree has, so it's split into parts at the line feeds it finds in O(log n)
+ * without reading the text, and the parts are scanned on every cpu thread.
+ */
+static void scan_all_lines(const Buffer& buffer, ch::Array<u32>* eols, ch::Array<u32>* columns, Line_Scanner* out_scanner = nullptr) {
+	const usize size = buffer.count();
+	const Piece_Tree& piece_tree = buffer.piece_tree;
+
+	usize num_parts = get_num_cpu_threads();
+	if (num_parts > size / parallel_line_scan_part_size) num_parts = size / parallel_line_scan_part_size;
+	if (buffer.storage != BS_Piece_Tree || !piece_tree.has_lf_counts || num_parts < 2) {
+		scan_lines(buffer, 0, size, true, eols, columns, out_scanner);
+		return;
+	}
+
+	ch::Array<Line_Scan_Part> parts;
+	parts.allocator = ch::get_heap_allocator();
+	parts.reserve(num_parts);
+	defer(free_line_scan_parts(parts));
+
+	const u64 num_lf = piece_tree.get_num_lf();
+	usize begin = 0;
+	for (usize i = 1; i <= num_parts && begin < size; i += 1) {
+		const usize end = i == num_parts ? size : piece_tree.get_index_after_lf(num_lf * i / num_parts);
+		if (end <= begin) continue;
+
+		Line_Scan_Part part;
+		part.spans.allocator = ch::get_heap_allocator();
+		part.eols.allocator = ch::get_heap_allocator();
+		part.columns.allocator = ch::get_heap_allocator();
+		part.tab_width = get_config().tab_width;
+		part.is_last_line = end == size;
+		for (usize j = begin; j < end;) {
+			usize span_count;
+			const u8* const span = piece_tree.get_span(j, &span_count);
+			if (span_count > end - j) span_count = end - j;
+			part.spans.push({ span, span_count });
+			j += span_count;
+		}
+		parts.push(part);
+		begin = end;
+	}
+
+	// The first part is scanned on this thread, like any whose thread can't be started
+	for (usize i = 1; i < parts.count; i += 1) {
+		if (!parts[i].thread.start(line_scan_part_main, &parts[i])) line_scan_part_main(&parts[i]);
+	}
+	line_scan_part_main(&parts[0]);
+	for (usize i = 1; i < parts.count; i += 1) parts[i].thread.join();
+
+	Line_Scanner scanner;
+	for (const Line_Scan_Part& it : parts) {
+		for (usize i = 0; i < it.eols.count; i += 1) {
+			eols->push(it.eols[i]);
+			columns->push(it.columns[i]);
+		}
+		scanner.num_lf += it.scanner.num_lf;
+		scanner.num_crlf += it.scanner.num_crlf;
+		scanner.num_cr += it.scanner.num_cr;
+	}
+	if (out_scanner) *out_scanner = scanner;
+}
+
+// A lone '\r' has always counted towards crlf
+static Line_Ending get_line_ending(const Line_Scanner& scanner, Line_Ending fallback) {
+	if (!scanner.num_lf && (scanner.num_crlf || scanner.num_cr)) return LE_CRLF;
+	if (scanner.num_lf) return LE_NIX;
+	return fallback;
+}
+
+/** Placeholder lines only keep line_table covering the whole text while it's being scanned so they just have to fit in a u32. */
+const usize max_placeholder_line_size = 1024 * 1024 * 1024;
+
+/** Buffers that have is_scanning_lines set. */
+static ch::Array<Buffer_ID> scanning_buffers;
+
+/** Buffers that have a save_job. */
+static ch::Array<Buffer_ID> saving_buffers;
+
+/** Stops a buffer's line scan worker without touching line_table. Picks the line ending from what was scanned so far. */
+static void stop_line_scan_job(Buffer* buffer) {
+	if (!buffer->is_scanning_lines) return;
+
+	buffer->line_scan_job->stop();
+	buffer->line_ending = get_line_ending(buffer->line_scan_job->scanner, buffer->line_ending);
+
+	ch_delete buffer->line_scan_job;
+	buffer->line_scan_job = nullptr;
+	buffer->is_scanning_lines = false;
+}
+
+/** Cancels a buffer's parse and waits for the worker. The job is kept for the next parse, which starts over from the same lexemes. */
+static void stop_parse_job(Buffer* buffer) {
+	if (!buffer->is_parsing) return;
+
+	atomic_store(&buffer->parse_job->stop_requested, 1);
+	buffer->parse_job->finish();
+	buffer->is_parsing = false;
+	buffer->syntax_dirty = true;
+}
+
+#if VERIFY_LINE_TABLES
+/** Decodes every codepoint of the buffer to check the results of scan_lines against. */
+static void scan_lines_slow(const Buffer& buffer, ch::Array<u32>* eols, ch::Array<u32>* columns) {
+	const usize end = buffer.count();
+
+	usize last_eol = 0;
 	u32 col_count = 0;
-	for (ch::UTF8_Iterator<ch::Gap_Buffer<u8>> it(gap_buffer, gap_buffer.count()); it.can_advance(); it.advance()) {
+	for (ch::UTF8_Iterator<const Buffer> it(buffer, end); it.can_advance(); it.advance()) {
 		const u32 c = it.get();
 
 		col_count += get_char_column_size(c);
 
 		if (c == '\r' || c == '\n') {
-			if (c == '\r' && it.can_advance()) {
-				const u32 peek_c = it.peek();
-				if (peek_c == '\n') {
-					it.advance();
-					col_count += get_char_column_size(peek_c);
-				}
-				num_clrf += 1;
-			}
-			else
-			{
-				num_nix += 1;
+			if (c == '\r' && it.index + 1 < end && buffer[it.index + 1] == '\n') {
+				it.advance();
+				col_count += get_char_column_size('\n');
 			}
 
-			eol_table.push((u32)it.index - last_eol + 1);
-			last_eol = (u32)it.index + 1;
+			eols->push((u32)(it.index - last_eol + 1));
+			last_eol = it.index + 1;
 
-			line_column_table.push(col_count);
+			columns->push(col_count);
 			col_count = 0;
 		}
 	}
-	eol_table.push((u32)f_size - last_eol);
-	line_column_table.push(col_count);
 
-	if (!num_nix && num_clrf) {
-		line_ending = LE_CRLF;
+	eols->push((u32)(end - last_eol));
+	columns->push(col_count);
+}
+
+static void verify_line_tables(const Buffer& buffer) {
+	ch::Array<u32> eols;
+	ch::Array<u32> columns;
+	eols.allocator = ch::get_heap_allocator();
+	columns.allocator = ch::get_heap_allocator();
+	defer(eols.free());
+	defer(columns.free());
+
+	scan_lines_slow(buffer, &eols, &columns);
+
+	const Line_Table& line_table = buffer.line_table;
+	assert(eols.count == line_table.count());
+	assert(line_table.get_line_start(line_table.count()) == buffer.count());
+	u64 line_start = 0;
+	u64 num_lf = 0;
+	for (usize i = 0; i < eols.count; i += 1) {
+		assert(eols[i] == line_table.get_line_size(i));
+		assert(columns[i] == line_table.get_line_columns(i));
+		assert(line_start == line_table.get_line_start(i));
+		assert(line_table.get_line_from_index(line_start) == i);
+		line_start += eols[i];
+		if (eols[i] && buffer[line_start - 1] == '\n') num_lf += 1;
+	}
+
+	if (buffer.storage == BS_Piece_Tree && buffer.piece_tree.has_lf_counts) {
+		const Piece_Tree& piece_tree = buffer.piece_tree;
+		assert(piece_tree.get_num_lf() == num_lf);
+		assert(piece_tree.get_lf_before(piece_tree.count()) == num_lf);
+		assert(piece_tree.get_index_after_lf(num_lf + 1) == piece_tree.count());
+	}
+}
+#endif
+
+Buffer::Buffer(Buffer_ID _id) : id(_id), piece_tree(ch::get_heap_allocator()), line_table(ch::get_heap_allocator()), folds(ch::get_heap_allocator()), history(ch::get_heap_allocator()) {
+	gap_buffer.allocator = ch::get_heap_allocator();
+	symbol_sites.allocator = ch::get_heap_allocator();
+	use_sites.allocator = ch::get_heap_allocator();
+
+	line_table.push(0, 0);
+
+	name = ch::make_stack_string("*scratch*");
+}
+
+bool Buffer::load_file_into_buffer(const ch::Path& path) {
+	if (gap_buffer || piece_tree) return false;
+
+	ch::File f;
+	if (!f.open(path, ch::FO_Read | ch::FO_Binary)) return false;
+	defer(f.close());
+
+	const usize f_size = f.size();
+
+	// Big files are mapped instead of read so they cost next to no memory until they're edited.
+	// Lines are scanned on a worker thread so the start of the file can be shown right away.
+	File_Map map;
+	if (f_size >= piece_tree_threshold && map.open(path)) {
+		storage = BS_Piece_Tree;
+		piece_tree.set_original_map(map);
+
+		start_line_scan();
+	} else {
+		if (f_size >= piece_tree_threshold) {
+			u8* const text = ch_new u8[f_size];
+			f.read(text, f_size);
+
+			storage = BS_Piece_Tree;
+			piece_tree.set_original(text, f_size);
+		} else {
+			gap_buffer.resize(f_size + ch::default_gap_size);
+
+			f.read(gap_buffer.data, f_size);
+			gap_buffer.gap = gap_buffer.data + f_size;
+			gap_buffer.gap_size = ch::default_gap_size;
+		}
+
+		ch::Array<u32> eols;
+		ch::Array<u32> columns;
+		eols.allocator = ch::get_heap_allocator();
+		columns.allocator = ch::get_heap_allocator();
+		defer(eols.free());
+		defer(columns.free());
+
+		Line_Scanner scanner;
+		scan_all_lines(*this, &eols, &columns, &scanner);
+
+		line_table.reset();
+		line_table.replace(0, 0, eols.data, columns.data, eols.count);
+
+		line_ending = get_line_ending(scanner, line_ending);
 	}
 
 	f.get_absolute_path(&absolute_path);
@@ -84,6 +334,9 @@ bool Buffer::load_file_into_buffer(const ch::Path& path) {
 	if (name) name.free();
 	name = filename.copy(ch::get_heap_allocator());
 
+	const ch::String extension = absolute_path.get_extension();
+	language = parsing::get_language_for_extension(extension.data, extension.count);
+
 	flags |= BF_File;
 	if (f.is_read_only) {
 		flags |= BF_ReadOnly;
@@ -95,56 +348,541 @@ bool Buffer::load_file_into_buffer(const ch::Path& path) {
 
 bool Buffer::save_file_to_path() {
 	if (!absolute_path) return false;
+	if ((flags & BF_ReadOnly) == BF_ReadOnly) return false;
 
-	ch::File f;
-	if (!f.open(absolute_path, ch::FO_Write | ch::FO_Binary)) return false;
+	// Saves are written in order
+	finish_save();
+
+	Save_Job* const job = ch_new Save_Job;
+	job->spans.allocator = ch::get_heap_allocator();
+	job->edit_count = edit_count;
+	job->temp_path = absolute_path.copy(ch::get_heap_allocator());
+	job->temp_path.append(".eden_save", false);
+
+	const usize size = count();
+	if (storage == BS_Piece_Tree) {
+		// Pieces only ever point at text that's never written to again so the snapshot is just the list of pieces
+		for (usize i = 0; i < size;) {
+			usize span_count;
+			const u8* const span = get_span(i, &span_count);
+			job->spans.push({ span, span_count });
+			i += span_count;
+		}
+	} else if (size > 0) {
+		// Both sides of the gap are written where they are. The gap stays where it is and typing only writes into it.
+		for (usize i = 0; i < size;) {
+			usize span_count;
+			const u8* const span = get_span(i, &span_count);
+			job->spans.push({ span, span_count });
+			i += span_count;
+		}
+		job->gap_begin = gap_buffer.gap;
+		job->gap_end = gap_buffer.gap + gap_buffer.gap_size;
+	}
 
-	if ((flags & BF_ReadOnly) == BF_ReadOnly) return false;
+	if (!job->start()) {
+		job->free();
+		ch_delete job;
+		return false;
+	}
 
-	// Move gap to the end
-	gap_buffer.move_gap_to_index(gap_buffer.count());
+	save_job = job;
+	saving_buffers.allocator = ch::get_heap_allocator();
+	saving_buffers.push(id);
+	return true;
+}
+
+bool Buffer::update_save() {
+	if (!save_job) return true;
+	if (!atomic_load(&save_job->is_done)) return false;
+
+	finish_save();
+	return true;
+}
+
+/** Moves a finished save's temp file over the buffer's file. */
+static bool swap_in_saved_file(Buffer* buffer, Save_Job* job) {
+	const ch::Path& absolute_path = buffer->absolute_path;
+	Piece_Tree& piece_tree = buffer->piece_tree;
+
+	if (!job->finish()) {
+		ch::delete_file(job->temp_path);
+		return false;
+	}
+
+	// A mapped file can't be written over so it's moved out of the way first. The tree keeps reading from it there.
+	bool moved_original = false;
+	if (buffer->storage == BS_Piece_Tree && piece_tree.is_original_mapped && !piece_tree.moved_original_path) {
+		ch::Path moved_path = absolute_path.copy(ch::get_heap_allocator());
+		moved_path.append(".eden_old", false);
+		if (!replace_file(absolute_path, moved_path)) {
+			moved_path.free();
+			ch::delete_file(job->temp_path);
+			return false;
+		}
+
+		piece_tree.moved_original_path = moved_path;
+		moved_original = true;
+	}
+
+	if (!replace_file(job->temp_path, absolute_path)) {
+		if (moved_original) {
+			replace_file(piece_tree.moved_original_path, absolute_path);
+			piece_tree.moved_original_path.free();
+		}
+		ch::delete_file(job->temp_path);
+		return false;
+	}
 
-	f.seek_top();
-	f.write_raw(gap_buffer.data, gap_buffer.count());
-	f.set_end_of_file();
-	f.close();
+	if (buffer->edit_count != job->edit_count) return true;
+	buffer->is_dirty = false;
+	buffer->history.mark_saved();
 
-	is_dirty = false;
+	// The saved file has the same text so the tree can read from it instead and let go of the old one
+	if (buffer->storage == BS_Piece_Tree && piece_tree.is_original_mapped) {
+		buffer->finish_line_scan();
+		stop_parse_job(buffer);
+
+		File_Map map;
+		if (map.open(absolute_path)) {
+			piece_tree.set_original_map(map);
+		}
+	}
 
 	return true;
 }
 
+bool Buffer::finish_save() {
+	if (!save_job) return true;
+
+	Save_Job* const job = save_job;
+	save_job = nullptr;
+
+	const bool result = swap_in_saved_file(this, job);
+	job->free();
+	ch_delete job;
+	return result;
+}
+
+void Buffer::set_storage(Buffer_Storage new_storage) {
+	if (storage == new_storage) return;
+
+	// A save in flight may be reading from the piece tree
+	finish_save();
+
+	// The workers read from the piece tree's original text
+	finish_line_scan();
+	stop_parse_job(this);
+
+	const usize size = count();
+	if (new_storage == BS_Piece_Tree) {
+		u8* const text = ch_new u8[size];
+		gap_buffer.move_gap_to_index(size);
+		ch::mem_copy(text, gap_buffer.data, size);
+		gap_buffer.free();
+
+		piece_tree.set_original(text, size);
+	} else {
+		gap_buffer.resize(size + ch::default_gap_size);
+		for (usize i = 0; i < size;) {
+			usize span_count;
+			const u8* const span = piece_tree.get_span(i, &span_count);
+			ch::mem_copy(gap_buffer.data + i, span, span_count);
+			i += span_count;
+		}
+		gap_buffer.gap = gap_buffer.data + size;
+		gap_buffer.gap_size = gap_buffer.allocated - size;
+		piece_tree.free();
+	}
+
+	storage = new_storage;
+}
+
+const u8* Buffer::get_span(usize index, usize* out_count) const {
+	assert(index < count());
+
+	if (storage == BS_Piece_Tree) return piece_tree.get_span(index, out_count);
+
+	const usize gap_index = gap_buffer.gap - gap_buffer.data;
+	if (index < gap_index) {
+		*out_count = gap_index - index;
+		return gap_buffer.data + index;
+	}
+
+	*out_count = gap_buffer.count() - index;
+	return gap_buffer.data + index + gap_buffer.gap_size;
+}
+
+void Buffer::get_text(parsing::Text* out) const {
+	if (storage != BS_Piece_Tree) {
+		out->set(gap_buffer);
+		return;
+	}
+
+	out->clear();
+	const usize size = count();
+	for (usize i = 0; i < size;) {
+		usize span_count;
+		const u8* const span = piece_tree.get_span(i, &span_count);
+		out->push(span, span_count);
+		i += span_count;
+	}
+}
+
+void Buffer::copy_bytes(usize index, usize size, u8* out) const {
+	assert(index + size <= count());
+
+	for (usize i = 0; i < size;) {
+		usize span_count;
+		const u8* const span = get_span(index + i, &span_count);
+		if (span_count > size - i) span_count = size - i;
+
+		ch::mem_copy(out + i, span, span_count);
+		i += span_count;
+	}
+}
+
+/**
+ * Called before the gap buffer is edited. A save in flight reads the text where it is, so an edit that would move the gap,
+ * grow the buffer or write outside the gap the save started with first hands the memory to the save and carries on in a copy.
+ * That's at most one copy per save and only if something other than typing at the cursor happens while it runs.
+ */
+static void detach_saved_text(Buffer* buffer, usize index, usize removed_count, usize inserted_count) {
+	Save_Job* const job = buffer->save_job;
+	if (!job || !job->gap_begin || atomic_load(&job->is_done)) return;
+
+	ch::Gap_Buffer<u8>& gap_buffer = buffer->gap_buffer;
+	const usize gap_index = gap_buffer.gap - gap_buffer.data;
+	if (removed_count && gap_index == index + removed_count) return;
+	if (inserted_count && gap_index == index && gap_buffer.gap >= job->gap_begin && gap_buffer.gap + inserted_count <= job->gap_end) return;
+
+	const usize size = gap_buffer.count();
+	u8* const data = (u8*)gap_buffer.allocator.alloc(gap_buffer.allocated);
+	ch::mem_copy(data, gap_buffer.data, gap_index);
+	ch::mem_copy(data + gap_index + gap_buffer.gap_size, gap_buffer.gap + gap_buffer.gap_size, size - gap_index);
+
+	job->detached_text = gap_buffer.data;
+	job->detached_allocator = gap_buffer.allocator;
+	job->gap_begin = nullptr;
+	job->gap_end = nullptr;
+	gap_buffer.data = data;
+	gap_buffer.gap = data + gap_index;
+}
+
+void Buffer::insert_bytes(const u8* text, usize size, usize index) {
+	assert(index <= count());
+	edit_count += 1;
+
+	if (!history.is_applying) history.record_insert(index, text, size);
+
+	if (storage == BS_Piece_Tree) {
+		piece_tree.insert(text, size, index);
+		return;
+	}
+
+	detach_saved_text(this, index, 0, size);
+	if (gap_buffer.gap_size < size) {
+		gap_buffer.resize(gap_buffer.allocated + size + ch::default_gap_size);
+	}
+	gap_buffer.move_gap_to_index(index);
+	ch::mem_copy(gap_buffer.gap, text, size);
+	gap_buffer.gap += size;
+	gap_buffer.gap_size -= size;
+}
+
+void Buffer::remove_bytes(usize index, usize size) {
+	assert(index + size <= count());
+	edit_count += 1;
+
+	if (!history.is_applying) {
+		u8* const removed = history.record_remove(index, size);
+		if (removed) copy_bytes(index, size, removed);
+	}
+
+	if (storage == BS_Piece_Tree) {
+		piece_tree.remove(index, size);
+		return;
+	}
+
+	detach_saved_text(this, index, size, 0);
+	gap_buffer.move_gap_to_index(index + size);
+	gap_buffer.gap -= size;
+	gap_buffer.gap_size += size;
+}
+
 void Buffer::empty() {
+	stop_line_scan_job(this);
+	stop_parse_job(this);
+	if (parse_job) parse_job->has_text_copy = false;
+	history.clear();
+	if (storage == BS_Piece_Tree) {
+		piece_tree.remove(0, piece_tree.count());
+	}
     gap_buffer.gap = gap_buffer.data;
     gap_buffer.gap_size = gap_buffer.allocated;
-    eol_table.count = 0;
-    line_column_table.count = 0;
+    line_table.reset();
+    line_table.push(0, 0);
+    folds.clear();
     syntax_dirty = true;
+    syntax_edit.is_set = false;
     lexemes.count = 0;
+    get_symbol_table().remove(this);
 }
 
 void Buffer::free() {
+	finish_save();
+	stop_line_scan_job(this);
+	if (parse_job) {
+		stop_parse_job(this);
+		parse_job->free();
+		ch_delete parse_job;
+		parse_job = nullptr;
+	}
 	gap_buffer.free();
-	eol_table.free();
-	line_column_table.free();
+	piece_tree.free();
+	line_table.free();
+	folds.free();
+	get_symbol_table().remove(this);
+	symbol_sites.free();
+	use_sites.free();
 	lexemes.free();
+	history.free();
 }
 
-void Buffer::add_char(u32 c, usize index) {
-	gap_buffer.insert(c, index);
+bool Buffer::undo(usize* out_cursor, usize* out_selection) {
+	if (!history.get_undo()) return false;
+	assert(!edit_depth);
+
+	// Records of the same transaction go back together and line tables are patched once
+	history.is_applying = true;
+	edit_depth += 1;
+	for (;;) {
+		const Undo_Record* const record = history.get_undo();
+		remove_bytes(record->offset, record->inserted_size);
+		insert_bytes(record->get_removed(), record->removed_size, record->offset);
+		note_edit(record->offset, record->inserted_size, record->removed_size);
+
+		*out_cursor = record->cursor;
+		*out_selection = record->selection;
+
+		const bool joins_previous = record->joins_previous;
+		history.step_back();
+		if (!joins_previous || !history.get_undo()) break;
+	}
+	edit_depth -= 1;
+	history.is_applying = false;
 
-	refresh_line_tables();
+	apply_pending_edit();
+	is_dirty = !history.is_at_saved_state();
+	return true;
 }
 
-void Buffer::remove_char(usize index) {
-	const u32 c = gap_buffer[index];
+bool Buffer::redo(usize* out_cursor, usize* out_selection) {
+	if (!history.get_redo()) return false;
+	assert(!edit_depth);
+
+	history.is_applying = true;
+	edit_depth += 1;
+	for (;;) {
+		const Undo_Record* const record = history.get_redo();
+		remove_bytes(record->offset, record->removed_size);
+		insert_bytes(record->get_inserted(), record->inserted_size, record->offset);
+		note_edit(record->offset, record->removed_size, record->inserted_size);
+
+		*out_cursor = record->offset + record->inserted_size;
+		*out_selection = *out_cursor;
+
+		history.step_forward();
+		const Undo_Record* const next = history.get_redo();
+		if (!next || !next->joins_previous) break;
+	}
+	edit_depth -= 1;
+	history.is_applying = false;
+
+	apply_pending_edit();
+	is_dirty = !history.is_at_saved_state();
+	return true;
+}
 
-	const usize next = find_next_char(index);
-	for (u8 i = 0; i < (u8)(next - index); i += 1) {
-		gap_buffer.remove_at_index(index);	
+void Buffer::begin_edit(usize cursor, usize selection) {
+	if (!edit_depth) {
+		history.set_caret(cursor, selection);
+		history.begin_group();
 	}
+	edit_depth += 1;
+}
+
+void Buffer::end_edit() {
+	assert(edit_depth > 0);
+	edit_depth -= 1;
+	if (edit_depth) return;
+
+	history.end_group();
+	if (!pending_edit.is_set) return;
+
+	apply_pending_edit();
+	mark_file_dirty();
+}
+
+void Buffer::note_edit(usize index, usize removed_count, usize inserted_count) {
+	if (!edit_depth) {
+		update_line_tables(index, removed_count, inserted_count);
+		folds.on_edit(index, removed_count, inserted_count);
+		note_syntax_edit(index, removed_count, inserted_count);
+		return;
+	}
+
+	pending_edit.add(index, removed_count, inserted_count);
+}
+
+void Buffer::apply_pending_edit() {
+	if (!pending_edit.is_set) return;
+	pending_edit.is_set = false;
+
+	const usize begin = pending_edit.begin;
+	update_line_tables(begin, pending_edit.old_end - begin, pending_edit.new_end - begin);
+	folds.on_edit(begin, pending_edit.old_end - begin, pending_edit.new_end - begin);
+	note_syntax_edit(begin, pending_edit.old_end - begin, pending_edit.new_end - begin);
+}
+
+void Buffer::note_syntax_edit(usize index, usize removed_count, usize inserted_count) {
+	syntax_edit.add(index, removed_count, inserted_count);
+	syntax_dirty = true;
+
+	if (parse_job) parse_job->copy_edit.add(index, removed_count, inserted_count);
+
+	if (is_parsing) {
+		unparsed_edit.add(index, removed_count, inserted_count);
+
+		// Its snapshot is out of date now. A new parse starts from the lexemes the renderer has.
+		atomic_store(&parse_job->stop_requested, 1);
+	}
+}
+
+/**
+ * Copies the text of a gap buffer into the job. After the first time only what changed since the last snapshot is copied.
+ * A piece tree isn't copied, the job reads its pieces. The parse is stopped before anything that frees them.
+ */
+static void take_text_snapshot(const Buffer& buffer, Parse_Job* job) {
+	if (buffer.storage == BS_Piece_Tree) {
+		buffer.get_text(&job->text);
+		return;
+	}
+
+	ch::Gap_Buffer<u8>* const text = &job->text_copy;
+	const Edit_Range& edit = job->copy_edit;
+	if (!job->has_text_copy) {
+		const usize size = buffer.count();
+		if (text->allocated < size) {
+			text->free();
+			text->data = (u8*)text->allocator.alloc(size);
+			text->allocated = size;
+		}
+
+		buffer.copy_bytes(0, size, text->data);
+		text->gap = text->data + size;
+		text->gap_size = text->allocated - size;
+		job->has_text_copy = true;
+	} else if (edit.is_set) {
+		const usize removed_count = edit.old_end - edit.begin;
+		const usize inserted_count = edit.new_end - edit.begin;
+		text->move_gap_to_index(edit.old_end);
+		text->gap -= removed_count;
+		text->gap_size += removed_count;
+
+		if (text->gap_size < inserted_count) {
+			text->resize(text->allocated + inserted_count + ch::default_gap_size);
+		}
+		buffer.copy_bytes(edit.begin, inserted_count, text->gap);
+		text->gap += inserted_count;
+		text->gap_size -= inserted_count;
+	}
+	job->copy_edit.is_set = false;
+	job->text.set(*text);
+}
+
+void Buffer::update_syntax() {
+	if (disable_parse) return;
+
+	if (is_parsing) {
+		if (!atomic_load(&parse_job->is_done)) return;
+
+		is_parsing = false;
+		if (parse_job->finish()) {
+			const parsing::Lexemes parsed = parse_job->lexemes;
+			parse_job->lexemes = lexemes;
+			lexemes = parsed;
+			get_symbol_table().update(this, parse_job->text);
+
+			// The new lexemes are only behind by what was typed while they were being made
+			syntax_edit = unparsed_edit;
+			lex_time += parse_job->lex_time;
+			parse_time += parse_job->parse_time;
+			lex_parse_count++;
+		}
+	}
+
+	if (!syntax_dirty) return;
+
+	if (!parse_job) parse_job = ch_new Parse_Job;
+	Parse_Job* const job = parse_job;
+	take_text_snapshot(*this, job);
+	job->base = lexemes;
+	job->edit = syntax_edit;
+	job->language = language;
+	job->is_done = 0;
+	job->stop_requested = 0;
+	syntax_dirty = false;
+	unparsed_edit.is_set = false;
+
+	if (!job->start()) {
+		job->run();
+		job->is_done = 1;
+	}
+	is_parsing = true;
+}
+
+void Edit_Range::add(usize index, usize removed_count, usize inserted_count) {
+	if (!is_set) {
+		is_set = true;
+		begin = index;
+		old_end = index + removed_count;
+		new_end = index + inserted_count;
+		return;
+	}
+
+	if (index < begin) begin = index;
+	if (index + removed_count > new_end) {
+		old_end += index + removed_count - new_end;
+		new_end = index + removed_count;
+	}
+	new_end = new_end + inserted_count - removed_count;
+}
 
-	refresh_line_tables();
+void Buffer::insert_text(usize index, const u8* text, usize size) {
+	if (!size) return;
+
+	insert_bytes(text, size, index);
+	note_edit(index, 0, size);
+}
+
+void Buffer::delete_range(usize begin, usize end) {
+	assert(begin <= end);
+	if (begin == end) return;
+
+	remove_bytes(begin, end - begin);
+	note_edit(begin, end - begin, 0);
+}
+
+usize Buffer::add_char(u32 c, usize index) {
+	u8 encoded[4];
+	const usize size = encode_utf8(c, encoded);
+	insert_text(index, encoded, size);
+	return size;
+}
+
+void Buffer::remove_char(usize index) {
+	delete_range(index, find_next_char(index));
 }
 
 void Buffer::print_to(const char* fmt, ...) {
@@ -155,49 +893,171 @@ void Buffer::print_to(const char* fmt, ...) {
 	const usize size = vsprintf(write_buffer, fmt, args);
 	va_end(args);
 
-	for (usize i = 0; i < size; i += 1) {
-		gap_buffer.push(write_buffer[i]);
+	insert_text(count(), (const u8*)write_buffer, size);
+}
+
+void Buffer::refresh_line_tables() {
+	stop_line_scan_job(this);
+
+	ch::Array<u32> eols;
+	ch::Array<u32> columns;
+	eols.allocator = ch::get_heap_allocator();
+	columns.allocator = ch::get_heap_allocator();
+	defer(eols.free());
+	defer(columns.free());
+
+	scan_all_lines(*this, &eols, &columns);
+
+	line_table.reset();
+	line_table.replace(0, 0, eols.data, columns.data, eols.count);
+}
+
+void Buffer::update_line_tables(usize index, usize removed_count, usize inserted_count) {
+	const usize old_count = count() + removed_count - inserted_count;
+	assert(index + removed_count <= old_count);
+
+	// If the edit starts right at the beginning of a line the previous line is rescanned as well
+	// because its '\r' may now pair up with a '\n' or lose the one it had.
+	usize first_line = line_table.get_line_from_index(index);
+	usize begin = (usize)line_table.get_line_start(first_line);
+	if (first_line > 0 && begin == index) {
+		first_line -= 1;
+		begin -= line_table.get_line_size(first_line);
 	}
 
-	refresh_line_tables();
+	ch::Array<u32> eols;
+	ch::Array<u32> columns;
+	eols.allocator = ch::get_heap_allocator();
+	columns.allocator = ch::get_heap_allocator();
+	defer(eols.free());
+	defer(columns.free());
+
+	if (is_scanning_lines) {
+		if (index + removed_count >= line_scan_begin) {
+			// The edit reaches text that hasn't been scanned yet. Placeholders don't end with eols so scan all the way to the end.
+			stop_line_scan_job(this);
+
+			scan_lines(*this, begin, count(), true, &eols, &columns);
+			line_table.replace(first_line, line_table.count() - first_line, eols.data, columns.data, eols.count);
+			return;
+		}
+
+		line_scan_begin = line_scan_begin + inserted_count - removed_count;
+	}
+
+	// The line holding the end of the removed range still ends with the same eol after the edit, so stop right after it.
+	const usize last_line = line_table.get_line_from_index(index + removed_count);
+	const usize old_end = (usize)line_table.get_line_start(last_line + 1);
+	const usize end = old_end - removed_count + inserted_count;
+
+	const bool is_last_line = last_line == line_table.count() - 1;
+	scan_lines(*this, begin, end, is_last_line, &eols, &columns);
+
+	const usize replaced_count = last_line - first_line + 1;
+	line_table.replace(first_line, replaced_count, eols.data, columns.data, eols.count);
+
+	if (is_scanning_lines) {
+		line_scan_first_line = line_scan_first_line + eols.count - replaced_count;
+		return;
+	}
+
+#if VERIFY_LINE_TABLES
+	verify_line_tables(*this);
+#endif
 }
 
-void Buffer::refresh_line_tables() {
-	eol_table.count = 0;
-	line_column_table.count = 0;
+void Buffer::start_line_scan() {
+	assert(!is_scanning_lines);
+	assert(storage == BS_Piece_Tree && piece_tree.is_original_mapped && piece_tree.count() == piece_tree.original_size);
 
-	u32 last_eol = 0;
-	u32 col_count = 0;
-	for (ch::UTF8_Iterator<ch::Gap_Buffer<u8>> it(gap_buffer, gap_buffer.count()); it.can_advance(); it.advance()) {
-		const u32 c = it.get();
+	line_scan_job = ch_new Line_Scan_Job;
+	if (!line_scan_job->start(piece_tree.original, piece_tree.original_size, get_config().tab_width, &piece_tree.original_map)) {
+		ch_delete line_scan_job;
+		line_scan_job = nullptr;
+		refresh_line_tables();
+		return;
+	}
 
-		col_count += get_char_column_size(c);
+	is_scanning_lines = true;
+	line_scan_begin = 0;
+	line_scan_first_line = 0;
+	scanning_buffers.allocator = ch::get_heap_allocator();
+	scanning_buffers.push(id);
 
-		if (c == '\r' || c == '\n') {
-			if (c == '\r') {
-				const u32 peek_c = it.peek();
-				if (peek_c == '\n') {
-					it.advance();
-					col_count += get_char_column_size(peek_c);
-				}
-			}
+	line_table.reset();
+	update_line_scan();
+}
 
-			eol_table.push((u32)it.index - last_eol + 1);
-			last_eol = (u32)it.index + 1;
+bool Buffer::update_line_scan() {
+	if (!is_scanning_lines) return true;
 
-			line_column_table.push(col_count);
-			col_count = 0;
+	ch::Array<u32> eols;
+	ch::Array<u32> columns;
+	eols.allocator = ch::get_heap_allocator();
+	columns.allocator = ch::get_heap_allocator();
+	defer(eols.free());
+	defer(columns.free());
+
+	const bool is_done = line_scan_job->take_lines(&eols, &columns);
+
+	const usize num_scanned_lines = eols.count;
+	usize scanned_size = 0;
+	for (const u32 it : eols) {
+		scanned_size += it;
+	}
+
+	if (is_done) {
+		assert(line_scan_begin + scanned_size == count());
+		stop_line_scan_job(this);
+	} else {
+		// Cover the rest of the text, including the part of the current line that was already scanned
+		u64 remaining = count() - line_scan_begin - scanned_size;
+		while (remaining > 0) {
+			const u32 size = (u32)(remaining > max_placeholder_line_size ? max_placeholder_line_size : remaining);
+			eols.push(size);
+			columns.push(size);
+			remaining -= size;
 		}
 	}
-	eol_table.push((u32)gap_buffer.count() - last_eol);
-	line_column_table.push(col_count);
+
+	line_table.replace(line_scan_first_line, line_table.count() - line_scan_first_line, eols.data, columns.data, eols.count);
+	line_scan_first_line += num_scanned_lines;
+	line_scan_begin += scanned_size;
+
+	return !is_scanning_lines;
+}
+
+void Buffer::finish_line_scan() {
+	if (!is_scanning_lines) return;
+
+	// Take what the worker already found so only the rest has to be scanned here
+	update_line_scan();
+	if (!is_scanning_lines) return;
+	stop_line_scan_job(this);
+
+	ch::Array<u32> eols;
+	ch::Array<u32> columns;
+	eols.allocator = ch::get_heap_allocator();
+	columns.allocator = ch::get_heap_allocator();
+	defer(eols.free());
+	defer(columns.free());
+
+	Line_Scanner scanner;
+	scan_lines(*this, line_scan_begin, count(), true, &eols, &columns, &scanner);
+	line_table.replace(line_scan_first_line, line_table.count() - line_scan_first_line, eols.data, columns.data, eols.count);
+	line_ending = get_line_ending(scanner, line_ending);
+}
+
+f32 Buffer::get_line_scan_progress() const {
+	if (!is_scanning_lines || !count()) return 1.f;
+	return (f32)line_scan_begin / (f32)count();
 }
 
 usize Buffer::find_next_char(usize index) {
-	assert(index < gap_buffer.count());
+	assert(index < count());
 
 	static const u8 utf8_size_table[] = { 0, 0, 0, 0, 2, 2, 3, 4 };
-	const u8 key = (gap_buffer[index] >> 4);
+	const u8 key = ((*this)[index] >> 4);
 
 	u8 offset = 1;
 	if (key > 7) {
@@ -210,10 +1070,10 @@ usize Buffer::find_next_char(usize index) {
 }
 
 usize Buffer::find_prev_char(usize index) {
-	assert(index <= gap_buffer.count() && index > 0);
+	assert(index <= count() && index > 0);
 
 	for (u8 i = 1; i < 5 && index - i >= 0; i += 1) {
-		const u8 key = (gap_buffer[index - i] >> 4);
+		const u8 key = ((*this)[index - i] >> 4);
 		if (key < 8 || key > 11) return index - i;
 	}
 
@@ -221,13 +1081,13 @@ usize Buffer::find_prev_char(usize index) {
 }
 
 u32 Buffer::get_char(usize index) {
-	assert(index < gap_buffer.count());
+	assert(index < count());
 
 	u32 codepoint = 0;
 	u32 decoder_state = ch::utf8_accept;
 
-	for (; index < gap_buffer.count(); index += 1) {
-		const u8 c = gap_buffer[index];
+	for (; index < count(); index += 1) {
+		const u8 c = (*this)[index];
 		ch::utf8_decode(&decoder_state, &codepoint, c);
 
 		if (decoder_state == ch::utf8_reject) return '?';
@@ -241,41 +1101,23 @@ u32 Buffer::get_char(usize index) {
 }
 
 u64 Buffer::get_index_from_line(u64 line) const {
-	assert(line < eol_table.count);
+	assert(line < line_table.count());
 
-	u64 result = 0;
-	for (usize i = 0; i < line; i++) {
-		result += eol_table[i];
-	}
-	return result;
+	return line_table.get_line_start((usize)line);
 }
 
 u64 Buffer::get_line_from_index(u64 index) const {
-	assert(index <= gap_buffer.count());
-
-	u64 current_index = 0;
-	for (usize i = 0; i < eol_table.count; i++) {
-		current_index += eol_table[i];
-		if (current_index > index) return i;
-	}
+	assert(index <= count());
 
-	return eol_table.count - 1;
+	return line_table.get_line_from_index(index);
 }
 
 u64 Buffer::get_wrapped_line_from_index(u64 index, u64 max_line_width) const {
     assert(max_line_width > 0);
-	assert(index <= gap_buffer.count());
+	assert(index <= count());
 
-    u64 num_lines = 0;
-
-	u64 current_index = 0;
-	for (usize i = 0; i < eol_table.count; i++) {
-		current_index += eol_table[i];
-        num_lines += line_column_table[i] / max_line_width + 1;
-		if (current_index > index) break;
-	}
-
-	return num_lines;
+	const usize line = line_table.get_line_from_index(index);
+	return folds.get_wrapped_lines_before(line_table, line + 1, max_line_width);
 }
 
 void Buffer::mark_file_dirty() {
@@ -287,6 +1129,26 @@ void Buffer::mark_file_dirty() {
 static ch::Hash_Table<Buffer_ID, Buffer> the_buffers;
 static Buffer_ID last_buffer_id = 0;
 
+void tick_buffers() {
+	for (usize i = 0; i < scanning_buffers.count;) {
+		Buffer* const buffer = find_buffer(scanning_buffers[i]);
+		if (!buffer || buffer->update_line_scan()) {
+			scanning_buffers.remove(i);
+			continue;
+		}
+		i += 1;
+	}
+
+	for (usize i = 0; i < saving_buffers.count;) {
+		Buffer* const buffer = find_buffer(saving_buffers[i]);
+		if (!buffer || buffer->update_save()) {
+			saving_buffers.remove(i);
+			continue;
+		}
+		i += 1;
+	}
+}
+
 Buffer_ID create_buffer() {
 	last_buffer_id += 1;
 	
@@ -299,6 +1161,29 @@ Buffer* find_buffer(Buffer_ID id) {
 	return the_buffers.find(id);
 }
 
+static bool is_same_path(const ch::Path& a, const char* b) {
+	usize i = 0;
+	for (; i < a.count && b[i]; i += 1) {
+		char ca = a.data[i];
+		char cb = b[i];
+		if (ca == '\\') ca = '/';
+		if (cb == '\\') cb = '/';
+#if CH_PLATFORM_WINDOWS
+		if (ca >= 'A' && ca <= 'Z') ca += 'a' - 'A';
+		if (cb >= 'A' && cb <= 'Z') cb += 'a' - 'A';
+#endif
+		if (ca != cb) return false;
+	}
+	return i == a.count && !b[i];
+}
+
+Buffer_ID find_buffer_by_path(const char* path) {
+	for (const auto& it : the_buffers) {
+		if (it.value.absolute_path && is_same_path(it.value.absolute_path, path)) return it.key;
+	}
+	return invalid_buffer_id;
+}
+
 bool remove_buffer(Buffer_ID id) {
 	Buffer* const buffer = find_buffer(id);
 	if (buffer) {
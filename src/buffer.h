@@ -5,6 +5,14 @@
 #include <ch_stl/hash.h>
 #include "draw.h"
 #include "parsing.h"
+#include "line_table.h"
+#include "fold_table.h"
+#include "piece_tree.h"
+#include "line_scan.h"
+#include "save_job.h"
+#include "undo.h"
+
+struct Parse_Job;
 
 using Buffer_ID = usize;
 const usize invalid_buffer_id = 0;
@@ -20,6 +28,14 @@ CH_FORCEINLINE u64 hash(Buffer_ID id) {
  */
 u32 get_char_column_size(u32 c);
 
+/**
+ * Encodes a codepoint as utf-8
+ *
+ * @param out must have room for 4 bytes
+ * @returns the amount of bytes written to out
+ */
+usize encode_utf8(u32 c, u8* out);
+
 enum Line_Ending {
 	LE_NIX, // \n
 	LE_CRLF // \r\n
@@ -51,6 +67,40 @@ CH_FORCEINLINE const char* get_buffer_encoding_display(Buffer_Encoding encoding)
 	return nullptr;
 }
 
+/** How a buffer stores its text. */
+enum Buffer_Storage : u8 {
+	BS_Gap_Buffer,
+	BS_Piece_Tree,
+};
+
+/** Files at least this big are mapped into a piece tree and scanned for lines in the background. Anything smaller is read into a gap buffer. */
+const usize piece_tree_threshold = 16 * 1024 * 1024;
+
+/** [begin, old_end) of the old text was replaced by [begin, new_end) of the new text. Text past the range is the same as before, just shifted. */
+struct Edit_Range {
+	bool is_set = false;
+	usize begin = 0;
+	usize old_end = 0;
+	usize new_end = 0;
+
+	/** Grows the range to also cover removed_count bytes at index being replaced by inserted_count bytes. index is in the newest text. */
+	void add(usize index, usize removed_count, usize inserted_count);
+
+	/** @returns where index of the new text was in the old text. Text inside the range maps to begin. */
+	CH_FORCEINLINE usize to_old(usize index) const {
+		if (!is_set || index < begin) return index;
+		if (index < new_end) return begin;
+		return index - new_end + old_end;
+	}
+
+	/** @returns where index of the old text is in the new text. Text inside the range maps to begin. */
+	CH_FORCEINLINE usize to_new(usize index) const {
+		if (!is_set || index < begin) return index;
+		if (index < old_end) return begin;
+		return index - old_end + new_end;
+	}
+};
+
 enum Buffer_Flags {
 	BF_File = 1,
 	BF_Scratch = 1 << 1,
@@ -58,16 +108,27 @@ enum Buffer_Flags {
 };
 
 /**
- * Wrapper around gap buffer that keeps cached data about the contents of the gap buffer
+ * Wrapper around the text storage that keeps cached data about its contents
  *
  * @see ch:Gap_Buffer
+ * @see Piece_Tree
  */
 struct Buffer {
 	Buffer_ID id = invalid_buffer_id;
 
+	/**
+	 * Which one of gap_buffer and piece_tree holds the text. Only that one is allocated.
+	 *
+	 * @see set_storage
+	 */
+	Buffer_Storage storage = BS_Gap_Buffer;
+
 	/** Gap Buffer used to reduce moving bytes with every char press. */
 	ch::Gap_Buffer<u8> gap_buffer;
 
+	/** Used for big files where edits far apart would move a lot of bytes in a gap buffer. */
+	Piece_Tree piece_tree;
+
 	/** Absolute path to the file this buffer will save to. */
 	ch::Path absolute_path;
 
@@ -75,20 +136,31 @@ struct Buffer {
 	ch::String name;
 
 	/**
-	 * Linear table where index is line index and value is the size of the line with eol characters in bytes
-	 * Used for moving up and down lines in a fast manner
+	 * Size of every line with eol characters, both in bytes and in columns.
+	 * Used for moving up and down lines in a fast manner and for rendering
+	 *
+	 * @see Line_Table
+	 * @see update_line_tables
+	 */
+	Line_Table line_table;
+
+	/**
+	 * Folded text. Views skip the lines it hides. Edits shift folds, and drop the ones they change the text of.
 	 *
-	 * @see refresh_eol_table
+	 * @see parsing::find_fold_regions
 	 */
-	ch::Array<u32> eol_table;
+	Fold_Table folds;
 
 	/**
-	 * Linear table where index is line index and value is the size of line with eol characters in col count
-	 * Used for rendering
+	 * Set while line_table is still being built for a freshly loaded file.
+	 * Lines from line_scan_first_line on are placeholders that cover the text from line_scan_begin on, which hasn't been scanned yet.
 	 *
-	 * @see refresh_line_column_table
+	 * @see update_line_scan
 	 */
-	ch::Array<u32> line_column_table;
+	bool is_scanning_lines = false;
+	Line_Scan_Job* line_scan_job = nullptr;
+	usize line_scan_begin = 0;
+	usize line_scan_first_line = 0;
 
 	/**
 	 * Current line endings used in this buffer. 
@@ -112,15 +184,74 @@ struct Buffer {
 	u8 flags = 0;
 
 	/**
-	 * Keeps track if file is dirty
-	 * 
-	 * @temp until we have undo/redo
+	 * Keeps track if file is dirty. Undoing or redoing back to the saved text clears it.
+	 *
+	 * @see Undo_History::is_at_saved_state
 	 */
 	bool is_dirty = false;
 
+	/** Every edit made through insert_bytes and remove_bytes. */
+	Undo_History history;
+
+	/**
+	 * Nesting depth of begin_edit. While it's above 0 the text changes but line_table doesn't.
+	 * The changed range is collected in pending_edit and patched in once by end_edit.
+	 */
+	u32 edit_depth = 0;
+	Edit_Range pending_edit;
+
+	/** Bumped by every edit so a save can tell whether the text changed after its snapshot was taken. */
+	u64 edit_count = 0;
+
+	/**
+	 * Set while the text is being written out on a worker thread.
+	 *
+	 * @see save_file_to_path
+	 */
+	Save_Job* save_job = nullptr;
+
 	bool disable_parse = false;
+
+	/**
+	 * What the text is highlighted as. Set from the file's extension when it's loaded.
+	 *
+	 * @see parsing::get_language_for_extension
+	 */
+	parsing::Language language = parsing::LANG_CPP;
+
+	/** Set when the text changed after the last parse was started. */
     bool syntax_dirty = true;
-    ch::Array<parsing::Lexeme> lexemes;
+
+	/** What the renderer highlights with. Can be a few edits behind the text while a parse is running. */
+    parsing::Lexemes lexemes;
+
+	/**
+	 * The symbol table site of each of lexemes.definitions, in the same order.
+	 *
+	 * @see Symbol_Table
+	 */
+	ch::Array<u32> symbol_sites;
+
+	/**
+	 * The symbol table site of each identifier in lexemes, in the order of the lexemes.
+	 *
+	 * @see Symbol_Table
+	 */
+	ch::Array<u32> use_sites;
+
+    /** Text that changed since lexemes were made. Only this part gets relexed. Everything is lexed again if it's not set. */
+    Edit_Range syntax_edit;
+
+	/**
+	 * Lexes and parses a snapshot of the text on a worker thread. Kept around between parses so its memory gets reused.
+	 *
+	 * @see update_syntax
+	 */
+	Parse_Job* parse_job = nullptr;
+	bool is_parsing = false;
+
+	/** Text that changed since the running parse took its snapshot. Becomes syntax_edit when its lexemes are swapped in. */
+	Edit_Range unparsed_edit;
     f64 lex_time = 0;
     f64 parse_time = 0;
     u64 lex_parse_count = 0;
@@ -137,19 +268,117 @@ struct Buffer {
 	bool load_file_into_buffer(const ch::Path& path);
 
 	/**
-	 * Saves to a file at the listed path.
+	 * Starts saving a snapshot of the text to absolute_path on a worker thread.
+	 * The text is written to a temp file that replaces the real one once it's on disk. Edits can go on meanwhile.
 	 *
-	 * @returns true if save was successful
+	 * @returns true if the save was started
 	 */
 	bool save_file_to_path();
 
-	/** Empties the gap buffer and resets all cached state. */
+	/**
+	 * Swaps in the saved file if the worker is done.
+	 *
+	 * @returns true once there is no save left in flight
+	 */
+	bool update_save();
+
+	/**
+	 * Waits for the worker and swaps in the saved file.
+	 *
+	 * @returns false if the save failed. The file on disk is left as it was then.
+	 */
+	bool finish_save();
+
+	/** Moves the text into another kind of storage. Line tables stay as they are. */
+	void set_storage(Buffer_Storage new_storage);
+
+	CH_FORCEINLINE usize count() const {
+		return storage == BS_Piece_Tree ? piece_tree.count() : gap_buffer.count();
+	}
+
+	CH_FORCEINLINE u8 operator[](usize index) const {
+		return storage == BS_Piece_Tree ? piece_tree[index] : gap_buffer[index];
+	}
+
+	/**
+	 * Gets the contiguous text that starts at index.
+	 *
+	 * @param out_count is set to the amount of bytes that can be read from the result
+	 * @returns a pointer to the byte at index
+	 */
+	const u8* get_span(usize index, usize* out_count) const;
+
+	/** Copies size bytes starting at index to out. */
+	void copy_bytes(usize index, usize size, u8* out) const;
+
+	/** Points out at the text where it's stored, so it can be lexed without copying it. It's only valid until the next edit. */
+	void get_text(parsing::Text* out) const;
+
+	/** Inserts bytes into the storage and records them in history. Callers have to update_line_tables afterwards. */
+	void insert_bytes(const u8* text, usize size, usize index);
+
+	/** Removes bytes from the storage and records them in history. Callers have to update_line_tables afterwards. */
+	void remove_bytes(usize index, usize size);
+
+	/**
+	 * Reverts the last edit in history.
+	 *
+	 * @param out_cursor is set to where the cursor was before the edit
+	 * @param out_selection is set to where the selection was before the edit
+	 * @returns false if there was nothing to undo
+	 */
+	bool undo(usize* out_cursor, usize* out_selection);
+
+	/**
+	 * Applies the last undone edit again.
+	 *
+	 * @param out_cursor is set to the end of the edit
+	 * @param out_selection is set to the end of the edit
+	 * @returns false if there was nothing to redo
+	 */
+	bool redo(usize* out_cursor, usize* out_selection);
+
+	/** Empties the text storage and resets all cached state. */
     void empty();
 
 	/** Frees all dynamic memory. */
 	void free();
 
-	void add_char(u32 c, usize index);
+	/**
+	 * Starts an edit transaction. Edits until the matching end_edit are undone as one
+	 * and line tables, syntax and the dirty flag are only brought up to date once at end_edit.
+	 * Transactions can be nested. Only the outermost one counts.
+	 *
+	 * @param cursor is the caret to restore when the transaction is undone
+	 * @param selection is the selection to restore when the transaction is undone
+	 */
+	void begin_edit(usize cursor, usize selection);
+
+	/** Ends an edit transaction and brings everything derived from the text up to date. */
+	void end_edit();
+
+	/** Tells the buffer removed_count bytes at index were replaced by inserted_count bytes. Either patches line tables right away or adds to the pending edit. */
+	void note_edit(usize index, usize removed_count, usize inserted_count);
+
+	/** Patches line tables for the pending edit. */
+	void apply_pending_edit();
+
+	/**
+	 * Inserts utf-8 text at index in one go. Line tables are patched once for the whole text.
+	 *
+	 * @speed O(size) plus O(log n) to patch line_table. Only the lines the text touches are scanned.
+	 */
+	void insert_text(usize index, const u8* text, usize size);
+
+	/** Removes the bytes in [begin, end) in one go. Line tables are patched once for the whole range. */
+	void delete_range(usize begin, usize end);
+
+	/**
+	 * Inserts a codepoint at index encoded as utf-8.
+	 *
+	 * @returns the amount of bytes inserted
+	 */
+	usize add_char(u32 c, usize index);
 	void remove_char(usize index);
 
 	void print_to(const char* fmt, ...);
@@ -158,13 +387,53 @@ struct Buffer {
 	 * Clears cached data and runs through entire buffer to rebuild it. 
 	 * 
 	 * @speed this is O(n) but requires decoding
-	 * @note this will probably be deprecated. Just using now due to laziness
+	 * @note edits should use update_line_tables. This is kept around to verify the incremental path in debug builds.
 	 */
 	void refresh_line_tables();
 
+	/**
+	 * Patches line_table after an edit by only rescanning the lines the edit touched.
+	 * Must be called after the text has been modified but while the table still describes the old text.
+	 *
+	 * @speed this is O(size of touched lines) plus O(log n) to patch line_table
+	 *
+	 * @param index is where the edit happened
+	 * @param removed_count is the amount of bytes that were removed at index
+	 * @param inserted_count is the amount of bytes that were inserted at index
+	 */
+	void update_line_tables(usize index, usize removed_count, usize inserted_count);
+
+	/**
+	 * Starts building line_table on a worker thread. Until it's done line_table has placeholders for the unscanned text.
+	 * Only works on a freshly mapped piece tree.
+	 */
+	void start_line_scan();
+
+	/**
+	 * Replaces placeholders in line_table with the lines the worker has found so far.
+	 *
+	 * @returns true once line_table is complete
+	 */
+	bool update_line_scan();
+
+	/** Stops the worker and scans the rest of the text right away. */
+	void finish_line_scan();
+
+	/**
+	 * Swaps in the lexemes of a finished parse and starts a new one if the text changed since the last one started.
+	 * Edits cancel a running parse. Called every frame.
+	 */
+	void update_syntax();
+
+	/** Records a change for the next parse and cancels the running one. */
+	void note_syntax_edit(usize index, usize removed_count, usize inserted_count);
+
+	/** @returns how much of the text has been scanned for lines, from 0 to 1. */
+	f32 get_line_scan_progress() const;
+
 	/**
 	 * Finds the next codepoint based on file encoding
-	 * Returns gap_buffer.count() for end of buffer
+	 * Returns count() for end of buffer
 	 *
 	 * @param index is the location to start searching at
 	 * @return is the found "next" index
@@ -190,12 +459,17 @@ struct Buffer {
 
 	u64 get_index_from_line(u64 line) const;
 	u64 get_line_from_index(u64 index) const;
+
+	/** @returns the amount of visible wrapped lines up to and including the line index is on. Folded lines don't count. */
     u64 get_wrapped_line_from_index(u64 index, u64 max_line_width) const;
 
 	/** @temp */
 	void mark_file_dirty();
 };
 
+/** Picks up the buffers' background work like scanning lines of freshly loaded files and saving. Called once a frame. */
+void tick_buffers();
+
 /** Creates a new buffer and @returns the new buffer's id. */
 Buffer_ID create_buffer();
 
@@ -207,6 +481,14 @@ Buffer_ID create_buffer();
  */
 Buffer* find_buffer(Buffer_ID id);
 
+/**
+ * Finds the buffer that has the file at path open.
+ *
+ * @param path is an absolute path. Either slash separates directories.
+ * @returns its id or invalid_buffer_id if no buffer has it open
+ */
+Buffer_ID find_buffer_by_path(const char* path);
+
 /** 
  * Removes the buffer with the id given. 
  *
@@ -3,6 +3,7 @@
 #include "editor.h"
 #include "config.h"
 #include "gui.h"
+#include "symbol_index.h"
 
 static ch::Array<Buffer_View> views;
 static usize focused_view;
@@ -30,9 +31,9 @@ static u64 get_view_columns(f32 viewport_width, usize i) {
     Buffer* buffer = find_buffer(view->the_buffer);
 	assert(buffer);
     u64 result = (u64)(get_view_width(viewport_width, i) / the_font[' ']->advance);
-    result -= (ch::get_num_digits(buffer->eol_table.count) + 1);
-    //if (result > (ch::get_num_digits(buffer->eol_table.count) + 1)) {
-    //    result -= (ch::get_num_digits(buffer->eol_table.count) + 1);
+    result -= (ch::get_num_digits(buffer->line_table.count()) + 1);
+    //if (result > (ch::get_num_digits(buffer->line_table.count()) + 1)) {
+    //    result -= (ch::get_num_digits(buffer->line_table.count()) + 1);
     //}
     return result;
 }
@@ -108,8 +109,7 @@ static void gui_buffer_view(UI_ID id, Buffer_View* view, f32 x0, f32 y0, f32 x1,
 	const usize orig_cursor = *cursor;
 	const usize orig_selection = *selection;
 
-	const usize num_lines = buffer->eol_table.count;
-	const ch::Gap_Buffer<u8>& gap_buffer = buffer->gap_buffer;
+	const usize num_lines = buffer->line_table.count();
 
 	const f32 starting_x = x0;
 	const f32 starting_y = y0 - view->current_scroll_y;
@@ -139,34 +139,61 @@ static void gui_buffer_view(UI_ID id, Buffer_View* view, f32 x0, f32 y0, f32 x1,
 		imm_quad(ln_x0, ln_y0, ln_x1, ln_y1, config.line_number_background_color);
 	}
 
+	// Find the first visible line by looking up the wrapped line at the top of the view instead of walking every line above it.
+	// Folded lines aren't counted, so this costs the same however many of them are above it.
 	usize starting_index = 0;
-	for (usize i = 0; i < buffer->line_column_table.count; i += 1) {
-		if (y > -font_height) {
-			starting_index = buffer->get_index_from_line(i);
-			line_number = i + 1;
-			break;
+	{
+		const f32 line_height = font_height + the_font.line_gap;
+		const u64 columns_per_line = (u64)((width - line_number_quad_width) / space_glyph->advance);
+		const u64 max_line_width = columns_per_line > 2 ? columns_per_line - 2 : 1;
+
+		usize first_line = 0;
+		u64 wrapped_lines_before = 0;
+		const f32 hidden_wrapped_lines = (view->current_scroll_y - font_height) / line_height;
+		if (hidden_wrapped_lines >= 0.f) {
+			first_line = buffer->folds.get_line_from_wrapped_line(buffer->line_table, (u64)hidden_wrapped_lines, max_line_width, &wrapped_lines_before);
+			first_line = buffer->folds.get_next_visible_line(buffer->line_table, first_line);
+			if (first_line >= num_lines) first_line = num_lines - 1;
+			if (buffer->folds.is_line_hidden(buffer->line_table, first_line)) first_line = buffer->folds.find_hidden(buffer->line_table, first_line)->first - 1;
+			wrapped_lines_before = buffer->folds.get_wrapped_lines_before(buffer->line_table, first_line, max_line_width);
 		}
 
-		f32 line_size_x = buffer->line_column_table[i] * space_glyph->advance;
-
-		while (line_size_x + space_glyph->advance * 2 > width - line_number_quad_width) {
-			// width needs to be more than zero
-			line_size_x -= width;
-			y += font_height;
-		}
-
-		y += font_height;
+		starting_index = buffer->get_index_from_line(first_line);
+		line_number = first_line + 1;
+		y += wrapped_lines_before * line_height;
 	}
 
-	if (*cursor > gap_buffer.count()) {
-		*cursor = gap_buffer.count();
+	if (*cursor > buffer->count()) {
+		*cursor = buffer->count();
 		*selection = *cursor;
 	}
 
 	// Some bookkeeping variables are needed to identify the current syntax highlight.
-	const parsing::Lexeme* const lexemes_begin = buffer->lexemes.cbegin();
-	const parsing::Lexeme* const lexemes_end = buffer->lexemes.cend();
-	const parsing::Lexeme* lexeme = lexemes_begin;
+	// The lexemes can be behind the text while a parse runs. syntax_edit maps the text back to where they were made.
+	const parsing::Lexemes& lexemes = buffer->lexemes;
+	usize lexeme = lexemes.count ? parsing::find_lexeme(lexemes, buffer->syntax_edit.to_old(starting_index)) : 0;
+
+	// Every use of the name at the cursor is highlighted. The buffer's use sites are in the order of the lexemes,
+	// so they're walked along with them and only their interned names are compared.
+	const Symbol_Table& symbols = get_symbol_table();
+	const u32 cursor_name = buffer->disable_parse ? 0 : find_symbol_name_at(*buffer, *cursor);
+	usize use = cursor_name ? find_use_at(*buffer, lexeme) : 0;
+
+	// @Temporary colours for the highlights the parser gives each lexeme.
+	// More nuanced parsing and configurable colours are on the roadmap. -phillip
+	ch::Color palette[parsing::NUM_HIGHLIGHTS];
+	palette[parsing::HL_Default] = config.foreground_color;
+	palette[parsing::HL_Keyword] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	palette[parsing::HL_Function] = { 0.1f, 1.0f, 0.6f, 1.0f };
+	palette[parsing::HL_Param] = { 1.0f, 0.6f, 0.125f, 1.0f };
+	palette[parsing::HL_Type] = { 0.0f, 0.7f, 0.9f, 1.0f };
+	palette[parsing::HL_Preproc] = { 0.1f, 1.0f, 0.6f, 1.0f };
+	palette[parsing::HL_Macro] = { 0.5f, 0.5f, 1.0f, 1.0f };
+	palette[parsing::HL_String] = { 1.0f, 1.0f, 0.2f, 1.0f };
+	palette[parsing::HL_Comment] = { 0.3f, 0.3f, 0.3f, 1.0f };
+	palette[parsing::HL_Op] = { 0.7f, 0.7f, 0.7f, 1.0f };
+	palette[parsing::HL_Number] = { 0.5f, 0.5f, 1.0f, 1.0f };
+	palette[parsing::HL_Label] = palette[parsing::HL_Op];
 
 	if (show_line_numbers) imm_line_number(line_number, num_lines, &x, y, view->current_line == 0);
 	if (view->current_line == 0) {
@@ -177,117 +204,29 @@ static void gui_buffer_view(UI_ID id, Buffer_View* view, f32 x0, f32 y0, f32 x1,
 	bool found_new_cursor_pos = false;
 	const bool mouse_over = is_point_in_rect(mouse_pos, x0, y0, x1, y1);
 
-	for (ch::UTF8_Iterator<const ch::Gap_Buffer<u8>> it(gap_buffer, gap_buffer.count(), starting_index); it.can_advance(); it.advance()) {
+	for (ch::UTF8_Iterator<const Buffer> it(*buffer, buffer->count(), starting_index); it.can_advance(); it.advance()) {
 		const u32 c = it.get();
 		ch::Color color = config.foreground_color;
 
 		const f32 old_x = x;
 		const f32 old_y = y;
+		bool is_use = false;
 
-		if (!buffer->syntax_dirty && !buffer->disable_parse)
+		if (!buffer->disable_parse && lexemes.count)
 		{
-			while (lexeme + 1 < lexemes_end && ((ch::Gap_Buffer<u8>&)gap_buffer).get_index_as_cursor(it.index + 1) - 1 >= (const u8*)lexeme[1].i) {
+			const usize lexed_index = buffer->syntax_edit.to_old(it.index);
+			while (lexeme + 1 < lexemes.count && lexed_index >= lexemes.offsets[lexeme + 1]) {
 				lexeme += 1;
 			}
 
-			assert(lexeme < lexemes_end);
-			// @Temporary method to determine the colour of the current lexeme.
-			// More nuanced parsing and configurable colours are on the roadmap. -phillip
-			ch::Color stringlit = { 1.0f, 1.0f, 0.2f, 1.0f };
-			ch::Color comment = { 0.3f, 0.3f, 0.3f, 1.0f };
-			ch::Color preproc = { 0.1f, 1.0f, 0.6f, 1.0f };
-			ch::Color op = { 0.7f, 0.7f, 0.7f, 1.0f };
-			ch::Color numlit = { 0.5f, 0.5f, 1.0f, 1.0f };
-			ch::Color type = { 0.0f, 0.7f, 0.9f, 1.0f };
-			ch::Color keyword = { 1.0f, 1.0f, 1.0f, 1.0f };
-			ch::Color param = { 1.0f, 0.6f, 0.125f, 1.0f };
-			ch::Color label = op;
-			switch (lexeme->dfa) {
-			case parsing::DFA_FUNCTION:
-				if (parsing::is_keyword(lexeme)) {
-					color = keyword;
-				}
-				else {
-					color = preproc;
-				}
-				break;
-			case parsing::DFA_PARAM:
-				if (parsing::is_keyword(lexeme)) {
-					color = keyword;
-				}
-				else {
-					color = param;
-				}
-				break;
-			case parsing::DFA_KEYWORD:
-				color = keyword;
-				break;
-			case parsing::DFA_PREPROC:
-				color = preproc;
-				break;
-			case parsing::DFA_MACRO:
-				color = numlit;
-				break;
-			case parsing::DFA_STRINGLIT:
-			case parsing::DFA_STRINGLIT_BS:
-			case parsing::DFA_CHARLIT:
-			case parsing::DFA_CHARLIT_BS:
-				color = stringlit;
-				break;
-			case parsing::DFA_BLOCK_COMMENT:
-			case parsing::DFA_BLOCK_COMMENT_STAR:
-			case parsing::DFA_LINE_COMMENT:
-				color = comment;
-				break;
-			case parsing::DFA_WHITE_BS:
-			case parsing::DFA_WHITE:
-				if (lexeme > lexemes_begin && lexeme[-1].dfa == parsing::DFA_STRINGLIT) {
-					color = stringlit;
-				}
-				if (lexeme > lexemes_begin && lexeme[-1].dfa == parsing::DFA_CHARLIT) {
-					color = stringlit;
-				}
-				if (lexeme > lexemes_begin && lexeme[-1].dfa <= parsing::DFA_LINE_COMMENT) {
-					color = comment;
-				}
-				break;
-			case parsing::DFA_IDENT:
-				if (parsing::is_keyword(lexeme)) {
-					color = keyword;
-				}
-				else {
+			color = palette[lexemes.highlight[lexeme]];
 
+			if (cursor_name) {
+				while (use < buffer->use_sites.count && symbols.sites[buffer->use_sites[use]].lexeme < lexeme) use += 1;
+				if (use < buffer->use_sites.count) {
+					const Symbol_Site& site = symbols.sites[buffer->use_sites[use]];
+					is_use = site.lexeme == lexeme && site.name == cursor_name;
 				}
-				break;
-			case parsing::DFA_OP:
-			case parsing::DFA_OP2:
-				color = op;
-				break;
-			case parsing::DFA_NEWLINE:
-				break;
-			case parsing::DFA_NUMLIT:
-				color = numlit;
-				break;
-			case parsing::DFA_SLASH:
-				if (lexeme + 1 < lexemes_end && lexeme[1].dfa <= parsing::DFA_LINE_COMMENT) {
-					color = comment;
-				}
-				else {
-					color = op;
-				}
-				break;
-			case parsing::DFA_TYPE:
-				if (parsing::is_keyword(lexeme)) {
-					color = keyword;
-				}
-				else {
-					color = type;
-				}
-				break;
-			case parsing::DFA_LABEL:
-				color = label;
-				break;
-			default: ch_debug_trap;
 			}
 		}
 
@@ -327,6 +266,9 @@ static void gui_buffer_view(UI_ID id, Buffer_View* view, f32 x0, f32 y0, f32 x1,
 		const bool should_draw_selection_or_cursor = ((mouse_over && was_lmb_pressed && found_new_cursor_pos) || !was_lmb_pressed || (was_lmb_pressed && !mouse_over));
 
 		const bool is_in_selection = ((orig_cursor > orig_selection && i >= orig_selection && i < orig_cursor) || (orig_cursor < orig_selection && i < orig_selection && i >= orig_cursor)) && should_draw_selection_or_cursor;
+		if (is_use && !(is_in_selection && edit_mode)) {
+			imm_quad(old_x, old_y, x, old_y + font_height + the_font.line_gap, config.symbol_use_color);
+		}
 		if (is_in_selection && edit_mode) {
 			imm_quad(old_x, old_y, x, old_y + font_height + the_font.line_gap, config.selection_color);
 		}
@@ -368,7 +310,7 @@ static void gui_buffer_view(UI_ID id, Buffer_View* view, f32 x0, f32 y0, f32 x1,
 
 #if LINE_SIZE_DEBUG
 			char temp[100];
-			ch::sprintf(temp, "col: %lu, bytes: %lu", buffer.line_column_table[line_number - 1], buffer.eol_table[line_number - 1]);
+			ch::sprintf(temp, "col: %lu, bytes: %lu", buffer->line_table.get_line_columns(line_number - 1), buffer->line_table.get_line_size(line_number - 1));
 			imm_string(temp, the_font, x, y, ch::magenta);
 #endif;
 
@@ -376,6 +318,17 @@ static void gui_buffer_view(UI_ID id, Buffer_View* view, f32 x0, f32 y0, f32 x1,
 			y += font_height + the_font.line_gap;
 			line_number += 1;
 
+			const Hidden_Lines* const folded = buffer->folds.find_hidden(buffer->line_table, line_number - 1);
+			if (folded) {
+				imm_string("...", the_font, old_x + space_glyph->advance, old_y, config.line_number_text_color);
+
+				// Carries on from the eol of the last folded line, which is never a multibyte char
+				line_number = folded->end + 1;
+				it.index = buffer->get_index_from_line(folded->end) - 1;
+				if (lexemes.count) lexeme = parsing::find_lexeme(lexemes, buffer->syntax_edit.to_old(it.index));
+				if (cursor_name) use = find_use_at(*buffer, lexeme);
+			}
+
 			const bool on_cursor_line = view->current_line == line_number - 1;
 			if (show_line_numbers) {
 				imm_line_number(line_number, num_lines, &x, y, on_cursor_line);
@@ -417,7 +370,7 @@ static void gui_buffer_view(UI_ID id, Buffer_View* view, f32 x0, f32 y0, f32 x1,
 #endif
 #if LINE_SIZE_DEBUG
 			char temp[100];
-			ch::sprintf(temp, "col: %lu, bytes: %lu", buffer.line_column_table[line_number - 1], buffer.eol_table[line_number - 1]);
+			ch::sprintf(temp, "col: %lu, bytes: %lu", buffer->line_table.get_line_columns(line_number - 1), buffer->line_table.get_line_size(line_number - 1));
 			imm_string(temp, the_font, x, y, ch::magenta);
 #endif
 		}
@@ -425,12 +378,12 @@ static void gui_buffer_view(UI_ID id, Buffer_View* view, f32 x0, f32 y0, f32 x1,
 	}
 
 #if PARSE_SPEED_DEBUG
-	if (!buffer.syntax_dirty && !buffer.disable_parse) {
+	if (!buffer.disable_parse && buffer.lex_parse_count) {
 		char temp[1024];
 
-		u64 num_chars = buffer.gap_buffer.count();
+		u64 num_chars = buffer.count();
 		u64 num_lexemes = buffer.lexemes.count;
-		u64 num_lines = buffer.eol_table.count;
+		u64 num_lines = buffer.line_table.count();
 
 		f64 gibi = 1024 * 1024 * 1024;
 		f64 million = 1000 * 1000;
@@ -459,36 +412,82 @@ static void gui_buffer_view(UI_ID id, Buffer_View* view, f32 x0, f32 y0, f32 x1,
 	}
 #endif
 
-	if (*cursor == gap_buffer.count() && (show_cursor || !edit_mode)) imm_cursor(edit_mode, space_glyph, x, y, config.cursor_color);
+	if (*cursor == buffer->count() && (show_cursor || !edit_mode)) imm_cursor(edit_mode, space_glyph, x, y, config.cursor_color);
 
 	if (*cursor != orig_cursor || *selection != orig_cursor) {
 		view->update_column_info(true);
 	}
 }
 
+/** Lists the functions, types and macros the buffer defines in the order they're in, starting a few before the one the cursor is in. Clicking one moves the cursor to it. */
+static void gui_outline(Buffer_View* view, f32 x0, f32 y0, f32 x1, f32 y1) {
+	const Buffer* const buffer = find_buffer(view->the_buffer);
+	assert(buffer);
+
+	const Config& config = get_config();
+	imm_quad(x0, y0, x1, y1, config.line_number_background_color);
+
+	const ch::Array<u32>& sites = buffer->symbol_sites;
+	if (!sites.count) return;
+
+	const f32 row_height = the_font.size + the_font.line_gap;
+	const f32 padding = 5.f;
+	const usize num_rows = (usize)((y1 - y0) / row_height);
+
+	// The sites are in the order of their lexemes, so the one the cursor is in is found with a binary search
+	const Symbol_Table& symbols = get_symbol_table();
+	const usize cursor_lexeme = parsing::find_lexeme(buffer->lexemes, buffer->syntax_edit.to_old(view->cursor));
+	usize lo = 0;
+	usize hi = sites.count;
+	while (lo < hi) {
+		const usize mid = lo + (hi - lo) / 2;
+		if (symbols.sites[sites[mid]].lexeme <= cursor_lexeme) lo = mid + 1;
+		else hi = mid;
+	}
+	const usize current = lo ? lo - 1 : 0;
+	const usize first = current > num_rows / 2 ? current - num_rows / 2 : 0;
+
+	const ch::Vector2 mouse_pos = current_mouse_position;
+	const bool was_lmb_pressed = was_mouse_button_pressed(CH_MOUSE_LEFT);
+
+	f32 y = y0;
+	for (usize i = first; i < sites.count && y + row_height <= y1; i += 1) {
+		const Symbol_Site& site = symbols.sites[sites[i]];
+		// Parameters and labels belong to the function they're in
+		if (site.kind == parsing::SK_Param || site.kind == parsing::SK_Label) continue;
+
+		if (i == current) imm_quad(x0, y, x1, y + row_height, config.symbol_use_color);
+
+		if (was_lmb_pressed && is_point_in_rect(mouse_pos, x0, y, x1, y + row_height)) {
+			view->cursor = get_symbol_site_index(site);
+			view->selection = view->cursor;
+			view->update_column_info(true);
+			view->reset_cursor_timer();
+		}
+
+		usize count;
+		ch::String name;
+		name.data = (char*)symbols.names.get(site.name, &count);
+		name.count = count;
+		imm_string(name, the_font, x0 + padding, y, config.foreground_color);
+		y += row_height;
+	}
+}
+
 void Buffer_View::remove_selection() {
 	if (!has_selection()) return;
 
 	Buffer* buffer = find_buffer(the_buffer);
 	assert(buffer);
+	assert(buffer->edit_depth > 0);
 
-	if (cursor > selection) {
-		for (usize i = selection; i < cursor; i = buffer->find_next_char(i)) {
-			buffer->gap_buffer.remove_at_index(selection);
-		}
-		cursor = selection;
-	} else {
-		for (usize i = cursor; i <= buffer->find_prev_char(selection); i = buffer->find_next_char(i)) {
-			if (i < buffer->gap_buffer.count()) {
-				buffer->gap_buffer.remove_at_index(cursor);
-			}
-		}
-		selection = cursor;
-	}
+	const usize begin = cursor > selection ? selection : cursor;
+	usize end = cursor > selection ? cursor : selection;
+	if (end > buffer->count()) end = buffer->count();
 
-	buffer->refresh_line_tables();
-	update_column_info(true);
-	buffer->mark_file_dirty();
+	buffer->delete_range(begin, end);
+	cursor = begin;
+	selection = begin;
 }
 
 void Buffer_View::update_column_info(bool update_desired_col) {
@@ -534,18 +533,14 @@ void Buffer_View::on_char_entered(u32 c) {
 	Buffer* buffer = find_buffer(the_buffer);
 	assert(buffer);
 
-	// @NOTE(CHall): Needs to ensure we're doing the correct encoding with push
-
+	buffer->begin_edit(cursor, selection);
 	remove_selection();
-	buffer->add_char(c, cursor);
-	cursor += 1;
-	selection = cursor;
+	cursor += buffer->add_char(c, cursor);
+	buffer->end_edit();
 
+	selection = cursor;
 	update_column_info(true);
 	reset_cursor_timer();
-    buffer->syntax_dirty = true;
-
-	buffer->mark_file_dirty();
 }
 
 void tick_views(f32 dt) {
@@ -577,7 +572,7 @@ void tick_views(f32 dt) {
 			}
 		}
 
-		parsing::parse_cpp(the_buffer);
+		the_buffer->update_syntax();
 
 		const float powerline_padding = 2.f;
 		const float powerline_height = (float)the_font.size + the_font.line_gap;
@@ -595,7 +590,13 @@ void tick_views(f32 dt) {
 
 			gui_button(the_buffer, 0.f, 0.f, 100.f, 100.f);
 
-			gui_buffer_view(view, view, x0, y0, x1, y1);
+			if (view->show_outline) {
+				const f32 outline_x0 = x1 - (x1 - x0) * outline_width_ratio;
+				gui_buffer_view(view, view, x0, y0, outline_x0, y1);
+				gui_outline(view, outline_x0, y0, x1, y1);
+			} else {
+				gui_buffer_view(view, view, x0, y0, x1, y1);
+			}
 		}
 
 		// @NOTE(CHall): Draw powerline
@@ -614,32 +615,30 @@ void tick_views(f32 dt) {
 
 				const usize current_column = view->current_column + 1;
 				const usize current_line = view->current_line + 1;
-				const usize num_lines = the_buffer->eol_table.count;
-
-				u64 total_col = 0;
-				u64 cursor_col = 0;
-				for (usize i = 0; i < the_buffer->line_column_table.count; i += 1) {
-					const u64 col = the_buffer->line_column_table[i];
+				const usize num_lines = the_buffer->line_table.count();
 
-					if (i == view->current_line) {
-						cursor_col = total_col + view->current_column;
-					}
-
-					total_col += col;
-				}
+				const u64 total_col = the_buffer->line_table.get_columns_before(num_lines);
+				const u64 cursor_col = the_buffer->line_table.get_columns_before((usize)view->current_line) + view->current_column;
 				const f32 percent_through_file = total_col ? ((f32)cursor_col / (f32)total_col) * 100.f : 0.f;
 
 				const char* line_ending = get_line_ending_display(the_buffer->line_ending);
 				const char* encoding = get_buffer_encoding_display(the_buffer->encoding);
 
 				const bool is_read_only = (the_buffer->flags & BF_ReadOnly) == BF_ReadOnly;
+				const char* storage = the_buffer->storage == BS_Piece_Tree ? " | piece tree" : "";
 				char buffer[512];
-				ch::sprintf(buffer, "%s | %s | %llu:%llu | %.0f%% | %llu lines%s", line_ending, encoding, current_line, current_column, percent_through_file, num_lines, is_read_only ? " | read-only" : "");
+				if (the_buffer->is_scanning_lines) {
+					// The line count isn't known until the scan is done
+					const f32 percent_loaded = the_buffer->get_line_scan_progress() * 100.f;
+					ch::sprintf(buffer, "%s | %s | %llu:%llu | %.0f%% | loading %.0f%%%s%s", line_ending, encoding, current_line, current_column, percent_through_file, percent_loaded, storage, is_read_only ? " | read-only" : "");
+				} else {
+					ch::sprintf(buffer, "%s | %s | %llu:%llu | %.0f%% | %llu lines%s%s", line_ending, encoding, current_line, current_column, percent_through_file, num_lines, storage, is_read_only ? " | read-only" : "");
+				}
 
 				const ch::Vector2 fi_size = get_string_draw_size(buffer, the_font);
 				imm_string(buffer, the_font, x1 - fi_size.x - horz_padding, text_y, config.background_color);
 
-				ch::sprintf(buffer, "%.*s%s", the_buffer->name.count, the_buffer->name.data, the_buffer->is_dirty ? "*" : "");
+				ch::sprintf(buffer, "%.*s%s%s", the_buffer->name.count, the_buffer->name.data, the_buffer->is_dirty ? "*" : "", the_buffer->save_job ? " | saving" : "");
 				imm_string(buffer, the_font, x0 + horz_padding, text_y, config.background_color);
 			}
 		}
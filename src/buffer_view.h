@@ -3,6 +3,8 @@
 #include "buffer.h"
 
 const f32 min_width_ratio = 0.2f;
+/** How much of a view its outline takes up. */
+const f32 outline_width_ratio = 0.25f;
 
 struct Buffer_View {
 	Buffer_ID the_buffer = 0;
@@ -21,6 +23,9 @@ struct Buffer_View {
 	bool show_cursor = true;
 	f32 cursor_blink_time = 0.f;
 
+	/** Draws the functions, types and macros of the buffer on the right of it. */
+	bool show_outline = false;
+
 	CH_FORCEINLINE bool has_selection() const { return cursor != selection; }
 
 	CH_FORCEINLINE void reset_cursor_timer() {
@@ -28,6 +33,7 @@ struct Buffer_View {
 		cursor_blink_time = 0.f;
 	}
 
+	/** Removes the selected text. Has to be called inside an edit transaction. Column info isn't updated. */
 	void remove_selection();
 	
 	/**
@@ -9,6 +9,7 @@ macro(ch::Color, foreground_color, 0xD6B58DFF) \
 macro(ch::Color, cursor_color, 0x81E38EFF) \
 macro(ch::Color, selection_color, 0x000EFFFF) \
 macro(ch::Color, selected_text_color, ch::white) \
+macro(ch::Color, symbol_use_color, 0x0B3F4AFF) \
 macro(bool, show_line_numbers, true) \
 macro(ch::Color, line_number_background_color, 0x041E24FF) \
 macro(ch::Color, line_number_text_color, 0x083945FF) \
@@ -6,6 +6,7 @@
 #include "buffer_view.h"
 #include "config.h"
 #include "buffer.h"
+#include "project_index.h"
 
 #include <ch_stl/opengl.h>
 #include <ch_stl/time.h>
@@ -30,6 +31,8 @@ void tick_editor(f32 dt) {
 	frame_begin();
 	
 	tick_gui();
+	tick_buffers();
+	tick_project_index();
 	tick_views(dt);
 
 	frame_end();
@@ -124,6 +127,11 @@ int main() {
     }
 #endif
 
+	{
+		ch::Path root = ch::get_current_path();
+		start_project_index(root);
+		root.free();
+	}
 
 	// @TEMP(CHall): Load font and get size
 	{
@@ -158,5 +166,6 @@ int main() {
 		}
 	}
 
+	shutdown_project_index();
 	shutdown_config();
 }
\ No newline at end of file
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <ch_stl/types.h>
+
+/**
+ * Read only memory mapping of a whole file.
+ * Pages are only read from disk when they are touched, so mapping a huge file costs next to nothing until it is scanned or drawn.
+ */
+struct File_Map {
+	const u8* data = nullptr;
+	usize size = 0;
+
+	void* os_file = nullptr;
+	void* os_mapping = nullptr;
+
+	explicit operator bool() const { return data != nullptr; }
+
+	/** @returns true if the whole file at path was mapped. Empty files can't be mapped. */
+	bool open(const char* path);
+	void close();
+
+	/** Asks the os to start reading [offset, offset + count) from disk without waiting for it. */
+	void prefetch(usize offset, usize count) const;
+};
+
+/** A contiguous piece of text to write. */
+struct File_Span {
+	const u8* data;
+	usize size;
+};
+
+/**
+ * Writes spans in order to a new file at path and flushes it all the way to disk before returning.
+ * An existing file at path is written over.
+ *
+ * @returns false if the file couldn't be created or written. The file may be left half written then.
+ */
+bool write_file_and_flush(const char* path, const File_Span* spans, usize num_spans);
+
+/**
+ * Moves the file at from over the file at to.
+ * Used to swap in a freshly written file so a crash never leaves a half written one behind.
+ * A mapped file can't be written over but it can be moved out of the way.
+ *
+ * @returns true if to was replaced
+ */
+bool replace_file(const char* from, const char* to);
+
+/**
+ * @returns true if path is a symbolic link, a junction or any other reparse point rather than a plain file or directory.
+ * Walks of a directory tree don't go into them, as they can lead out of the tree or back up into it.
+ */
+bool is_link(const char* path);
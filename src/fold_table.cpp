@@ -0,0 +1,201 @@
+#include "fold_table.h"
+#include "line_table.h"
+
+Fold_Table::Fold_Table(const ch::Allocator& in_alloc) {
+	folds.allocator = in_alloc;
+	hidden.allocator = in_alloc;
+}
+
+void Fold_Table::free() {
+	folds.free();
+	hidden.free();
+	is_hidden_dirty = false;
+	wrap_width = 0;
+}
+
+void Fold_Table::clear() {
+	folds.count = 0;
+	hidden.count = 0;
+	is_hidden_dirty = false;
+	wrap_width = 0;
+}
+
+void Fold_Table::add(const Fold* sorted_folds, usize count) {
+	if (!count) return;
+
+	ch::Array<Fold> merged;
+	merged.allocator = folds.allocator;
+	merged.reserve(folds.count + count);
+
+	usize i = 0;
+	usize j = 0;
+	while (i < folds.count || j < count) {
+		const bool take_new = i == folds.count || (j < count && sorted_folds[j].begin < folds[i].begin);
+		const Fold fold = take_new ? sorted_folds[j] : folds[i];
+		if (take_new) j += 1;
+		else i += 1;
+
+		// A fold that's already there ends up right next to the new one
+		if (merged.count && merged[merged.count - 1].begin == fold.begin && merged[merged.count - 1].end == fold.end) continue;
+		merged.push(fold);
+	}
+
+	folds.free();
+	folds = merged;
+	is_hidden_dirty = true;
+}
+
+bool Fold_Table::remove_on_line(const Line_Table& lines, usize line) {
+	assert(line < lines.count());
+	const u64 line_begin = lines.get_line_start(line);
+	const u64 line_end = lines.get_line_start(line + 1);
+
+	usize write_index = 0;
+	for (usize i = 0; i < folds.count; i += 1) {
+		const Fold fold = folds[i];
+		if (fold.begin >= line_begin && fold.begin < line_end) continue;
+		folds[write_index] = fold;
+		write_index += 1;
+	}
+
+	if (write_index == folds.count) return false;
+	folds.count = write_index;
+	is_hidden_dirty = true;
+	return true;
+}
+
+void Fold_Table::on_edit(u64 index, u64 removed_count, u64 inserted_count) {
+	if (!folds.count) return;
+
+	// Lines move around even if no fold does
+	is_hidden_dirty = true;
+
+	usize write_index = 0;
+	for (usize i = 0; i < folds.count; i += 1) {
+		Fold fold = folds[i];
+		if (fold.end < index) {
+			// Before the edit
+		} else if (fold.begin >= index + removed_count) {
+			fold.begin = fold.begin + inserted_count - removed_count;
+			fold.end = fold.end + inserted_count - removed_count;
+		} else {
+			continue;
+		}
+		folds[write_index] = fold;
+		write_index += 1;
+	}
+	folds.count = write_index;
+}
+
+void Fold_Table::update_hidden(const Line_Table& lines) const {
+	if (!is_hidden_dirty) return;
+	is_hidden_dirty = false;
+	wrap_width = 0;
+
+	hidden.count = 0;
+	for (const Fold& fold : folds) {
+		const usize first = lines.get_line_from_index(fold.begin) + 1;
+		const usize end = lines.get_line_from_index(fold.end);
+		if (first >= end) continue;
+
+		// Folds are sorted by begin, so a range can only reach into the last one
+		if (hidden.count && first <= hidden[hidden.count - 1].end) {
+			Hidden_Lines& last = hidden[hidden.count - 1];
+			if (end > last.end) last.end = end;
+			continue;
+		}
+
+		Hidden_Lines range = {};
+		range.first = first;
+		range.end = end;
+		hidden.push(range);
+	}
+}
+
+void Fold_Table::ensure_wrap_width(const Line_Table& lines, u64 max_line_width) const {
+	update_hidden(lines);
+	if (wrap_width == max_line_width) return;
+	wrap_width = max_line_width;
+
+	u64 hidden_before = 0;
+	for (Hidden_Lines& range : hidden) {
+		range.wrapped_first = lines.get_wrapped_lines_before(range.first, max_line_width);
+		range.wrapped_count = lines.get_wrapped_lines_before(range.end, max_line_width) - range.wrapped_first;
+		range.hidden_before = hidden_before;
+		hidden_before += range.wrapped_count;
+	}
+}
+
+/** @returns the index of the last range that starts before line or hidden.count if there's none. */
+static usize find_range_before(const ch::Array<Hidden_Lines>& hidden, usize line) {
+	usize lo = 0;
+	usize hi = hidden.count;
+	while (lo < hi) {
+		const usize mid = lo + (hi - lo) / 2;
+		if (hidden[mid].first < line) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo ? lo - 1 : hidden.count;
+}
+
+const Hidden_Lines* Fold_Table::find_hidden(const Line_Table& lines, usize line) const {
+	update_hidden(lines);
+
+	const usize range_index = find_range_before(hidden, line + 1);
+	if (range_index == hidden.count) return nullptr;
+	const Hidden_Lines& range = hidden[range_index];
+	return line < range.end ? &range : nullptr;
+}
+
+usize Fold_Table::get_next_visible_line(const Line_Table& lines, usize line) const {
+	const usize next = line + 1;
+	const Hidden_Lines* const range = find_hidden(lines, next);
+	return range ? range->end : next;
+}
+
+usize Fold_Table::get_prev_visible_line(const Line_Table& lines, usize line) const {
+	assert(line > 0);
+	const usize prev = line - 1;
+	const Hidden_Lines* const range = find_hidden(lines, prev);
+	return range ? range->first - 1 : prev;
+}
+
+u64 Fold_Table::get_wrapped_lines_before(const Line_Table& lines, usize line, u64 max_line_width) const {
+	const u64 result = lines.get_wrapped_lines_before(line, max_line_width);
+	if (!folds.count) return result;
+	ensure_wrap_width(lines, max_line_width);
+
+	const usize range_index = find_range_before(hidden, line);
+	if (range_index == hidden.count) return result;
+
+	const Hidden_Lines& range = hidden[range_index];
+	const u64 hidden_in_range = line >= range.end ? range.wrapped_count : result - range.wrapped_first;
+	return result - range.hidden_before - hidden_in_range;
+}
+
+usize Fold_Table::get_line_from_wrapped_line(const Line_Table& lines, u64 wrapped_line, u64 max_line_width, u64* out_wrapped_lines_before) const {
+	if (!folds.count) return lines.get_line_from_wrapped_line(wrapped_line, max_line_width, out_wrapped_lines_before);
+	ensure_wrap_width(lines, max_line_width);
+
+	// The last range with at most wrapped_line visible wrapped lines before it. The line is past all of that range.
+	usize lo = 0;
+	usize hi = hidden.count;
+	while (lo < hi) {
+		const usize mid = lo + (hi - lo) / 2;
+		if (hidden[mid].wrapped_first - hidden[mid].hidden_before <= wrapped_line) lo = mid + 1;
+		else hi = mid;
+	}
+	const u64 hidden_before = lo ? hidden[lo - 1].hidden_before + hidden[lo - 1].wrapped_count : 0;
+
+	u64 wrapped_lines_before;
+	usize line = lines.get_line_from_wrapped_line(wrapped_line + hidden_before, max_line_width, &wrapped_lines_before);
+	if (is_line_hidden(lines, line)) {
+		// Past the end and the last lines are folded
+		line = find_hidden(lines, line)->first - 1;
+		*out_wrapped_lines_before = get_wrapped_lines_before(lines, line, max_line_width);
+		return line;
+	}
+
+	*out_wrapped_lines_before = wrapped_lines_before - hidden_before;
+	return line;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <ch_stl/array.h>
+
+struct Line_Table;
+
+/** Folded text. The lines between the one begin is on and the one end is on are hidden. */
+struct Fold {
+	u64 begin;
+	u64 end;
+};
+
+/** Lines [first, end) that are hidden by one or more folds. */
+struct Hidden_Lines {
+	usize first;
+	usize end;
+
+	/** Wrapped lines before first, hidden ones included. */
+	u64 wrapped_first;
+	/** Wrapped lines in this range. */
+	u64 wrapped_count;
+	/** Wrapped lines hidden by the ranges before this one. */
+	u64 hidden_before;
+};
+
+/**
+ * A buffer's folds and the lines they hide.
+ *
+ * Folds are kept as byte offsets so that edits only shift them. The lines they hide are worked out from the line table the first time
+ * they're asked for after a change, in O(f log n) for f folds. They're kept as sorted ranges with prefix sums of the wrapped lines they hide,
+ * so every lookup after that is a binary search over them and costs nothing for the hidden lines themselves.
+ */
+struct Fold_Table {
+	/** Sorted by begin. Folds can nest and overlap. */
+	ch::Array<Fold> folds;
+
+	/** Disjoint and never next to each other, so the line before and the line after every range are visible. */
+	mutable ch::Array<Hidden_Lines> hidden;
+	mutable bool is_hidden_dirty = false;
+	/** The wrapped line sums are only kept for the last max_line_width asked for. */
+	mutable u64 wrap_width = 0;
+
+	Fold_Table() = default;
+	Fold_Table(const ch::Allocator& in_alloc);
+
+	CH_FORCEINLINE bool is_empty() const { return !folds.count; }
+
+	void free();
+	void clear();
+
+	/** Adds count folds sorted by begin. Folds that are already there aren't added again. */
+	void add(const Fold* sorted_folds, usize count);
+
+	/**
+	 * Removes the folds that begin on line.
+	 *
+	 * @returns true if there were any
+	 */
+	bool remove_on_line(const Line_Table& lines, usize line);
+
+	/** Drops the folds the edit touches anything after the begin of and shifts the ones after it. */
+	void on_edit(u64 index, u64 removed_count, u64 inserted_count);
+
+	/** @returns the range line is hidden in or null if it's visible. */
+	const Hidden_Lines* find_hidden(const Line_Table& lines, usize line) const;
+
+	CH_FORCEINLINE bool is_line_hidden(const Line_Table& lines, usize line) const { return find_hidden(lines, line) != nullptr; }
+
+	/** @returns the first visible line after line or count() if there is none. */
+	usize get_next_visible_line(const Line_Table& lines, usize line) const;
+
+	/** @returns the last visible line before line. line has to be above 0. */
+	usize get_prev_visible_line(const Line_Table& lines, usize line) const;
+
+	/** @returns the amount of visible wrapped lines before line. line can be count(). */
+	u64 get_wrapped_lines_before(const Line_Table& lines, usize line, u64 max_line_width) const;
+
+	/**
+	 * Finds the visible line that contains a visible wrapped line.
+	 *
+	 * @param out_wrapped_lines_before is set to the amount of visible wrapped lines before the found line
+	 * @returns the found line or the last visible line if wrapped_line is past the end
+	 */
+	usize get_line_from_wrapped_line(const Line_Table& lines, u64 wrapped_line, u64 max_line_width, u64* out_wrapped_lines_before) const;
+
+	void update_hidden(const Line_Table& lines) const;
+	void ensure_wrap_width(const Line_Table& lines, u64 max_line_width) const;
+};
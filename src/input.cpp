@@ -141,6 +141,23 @@ void setup_default_bindings() {
 	bind_action(Key_Bind(KBM_Shift, CH_KEY_DOWN), []() { move_cursor_down(false); });
 
 	bind_action(Key_Bind(KBM_Ctrl, CH_KEY_S), save_buffer);
+	bind_action(Key_Bind(KBM_Ctrl | KBM_Alt, CH_KEY_P), toggle_buffer_storage);
+
+	bind_action(Key_Bind(KBM_Ctrl, CH_KEY_C), copy_selection);
+	bind_action(Key_Bind(KBM_Ctrl, CH_KEY_X), cut_selection);
+	bind_action(Key_Bind(KBM_Ctrl, CH_KEY_V), paste);
+
+	bind_action(Key_Bind(KBM_Ctrl, CH_KEY_Z), undo);
+	bind_action(Key_Bind(KBM_Ctrl, CH_KEY_Y), redo);
+	bind_action(Key_Bind(KBM_Ctrl | KBM_Shift, CH_KEY_Z), redo);
+
+	bind_action(Key_Bind(KBM_Ctrl, CH_KEY_M), toggle_fold);
+	bind_action(Key_Bind(KBM_Ctrl | KBM_Shift, CH_KEY_M), fold_all_function_bodies);
+	bind_action(Key_Bind(KBM_Ctrl | KBM_Alt, CH_KEY_M), unfold_all);
+
+	bind_action(Key_Bind(KBM_Ctrl, CH_KEY_D), go_to_definition);
+	bind_action(Key_Bind(KBM_Ctrl | KBM_Shift, CH_KEY_D), go_to_next_use);
+	bind_action(Key_Bind(KBM_Ctrl | KBM_Shift, CH_KEY_O), toggle_outline);
 
     bind_action(Key_Bind(KBM_Ctrl, CH_KEY_O), open_dialog);
 }
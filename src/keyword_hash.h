@@ -0,0 +1,14 @@
+#pragma once
+
+#include <ch_stl/types.h>
+
+// Keywords are looked up with a perfect hash of their size and first 8 bytes: every keyword gets a slot
+// of its own, so a token only has to be compared with the one keyword in its slot.
+// tools/keyword_hash.cpp searches for a multiplier that does that and writes parsing_cpp_keyword_table.h.
+CH_FORCEINLINE u32 hash_keyword(const u8* text, usize size, u64 multiplier, u32 bits) {
+    const usize n = size < 8 ? size : 8;
+    u64 x = 0;
+    for (usize i = 0; i < n; i++) x |= (u64)text[i] << (i * 8);
+    x ^= (u64)size << 59;
+    return (u32)((x * multiplier) >> (64 - bits));
+}
@@ -0,0 +1,1092 @@
+#include "parsing.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define LEX_TARGET_SSSE3
+#define LEX_TARGET_AVX2
+#else
+#define LEX_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define LEX_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#include <immintrin.h>
+
+namespace parsing {
+// The char type of a byte. Everything from 0x80 up is part of an identifier, so UTF-8 is.
+static constexpr u8 char_type_of(u8 c) {
+    if (c == '\r' || c == '\n') return NEWLINE;
+    if (c <= ' ' || c == 0x7F) return WHITE;
+    if (c == '$' || (c >= '@' && c <= 'Z') || (c >= '_' && c <= 'z') || c >= 0x80) return IDENT;
+    if (c >= '0' && c <= '9') return DIGIT;
+    switch (c) {
+    case '"':  return DOUBLEQUOTE;
+    case '\'': return SINGLEQUOTE;
+    case '/':  return SLASH;
+    case '*':  return STAR;
+    case '\\': return BS;
+    }
+    return OP;
+}
+
+// The state a char type starts when it ends the lexeme before it.
+static constexpr u8 lex_start(u8 c) {
+    switch (c) {
+    case WHITE:       return DFA_WHITE;
+    case NEWLINE:     return DFA_NEWLINE;
+    case IDENT:       return DFA_IDENT;
+    case DOUBLEQUOTE: return DFA_STRINGLIT;
+    case SINGLEQUOTE: return DFA_CHARLIT;
+    case DIGIT:       return DFA_NUMLIT;
+    case SLASH:       return DFA_SLASH;
+    case BS:          return DFA_WHITE_BS;
+    }
+    return DFA_OP;
+}
+
+// This is the deterministic finite automaton (DFA) lexer. Overtop this DFA runs a block-comment scanner.
+// The tables are made from it at compile time, so it doesn't matter what numbers the states and char types have.
+static constexpr u8 lex_next(u8 dfa, u8 c) {
+    switch (dfa) {
+    case DFA_BLOCK_COMMENT:
+        return c == STAR ? DFA_BLOCK_COMMENT_STAR : DFA_BLOCK_COMMENT;
+    case DFA_BLOCK_COMMENT_STAR:
+        if (c == SLASH) return DFA_WHITE;
+        return c == STAR ? DFA_BLOCK_COMMENT_STAR : DFA_BLOCK_COMMENT;
+    case DFA_LINE_COMMENT:
+        return c == NEWLINE ? DFA_NEWLINE : DFA_LINE_COMMENT;
+    case DFA_STRINGLIT:
+        if (c == DOUBLEQUOTE) return DFA_WHITE;
+        return c == BS ? DFA_STRINGLIT_BS : DFA_STRINGLIT;
+    case DFA_STRINGLIT_BS:
+        return DFA_STRINGLIT;
+    case DFA_CHARLIT:
+        if (c == NEWLINE) return DFA_NEWLINE;
+        if (c == SINGLEQUOTE) return DFA_WHITE;
+        return c == BS ? DFA_CHARLIT_BS : DFA_CHARLIT;
+    case DFA_CHARLIT_BS:
+        return DFA_CHARLIT;
+    case DFA_WHITE_BS:
+        // A line continuation
+        if (c == WHITE || c == NEWLINE) return DFA_WHITE;
+        break;
+    case DFA_NEWLINE:
+        if (c == WHITE || c == NEWLINE) return DFA_NEWLINE;
+        break;
+    case DFA_SLASH:
+        if (c == WHITE) return DFA_WHITE;
+        if (c == SLASH) return DFA_LINE_COMMENT;
+        if (c == STAR) return DFA_BLOCK_COMMENT;
+        break;
+    case DFA_IDENT:
+        if (c == IDENT || c == DIGIT) return DFA_IDENT;
+        break;
+    case DFA_OP:
+        if (c == STAR || c == OP) return DFA_OP2;
+        break;
+    case DFA_NUMLIT:
+        if (c == IDENT || c == DIGIT || c == SINGLEQUOTE) return DFA_NUMLIT;
+        break;
+    }
+    return lex_start(c);
+}
+
+// The vector kernels skip runs of bytes that can't change the current state, like everything
+// but '*' in a block comment, and hand the byte that ends the run to the table DFA.
+// Bytes are sorted into these classes with two 16-entry tables per class byte, one indexed by the
+// low nibble and one by the high nibble. A byte is in a class if its bit is set in both entries,
+// so every class has to be all combinations of some low nibbles with some high nibbles.
+enum Lex_Class_A : u8 {
+    LCA_STAR   = 1 << 0, // '*'
+    LCA_DQUOTE = 1 << 1, // '"'
+    LCA_BS     = 1 << 2, // '\\'
+    LCA_SQUOTE = 1 << 3, // '\''
+    LCA_EOL    = 1 << 4, // '\r' '\n'
+    LCA_CTRL   = 1 << 5, // 0x00-0x1F, which includes '\r' '\n'
+    LCA_SPACE  = 1 << 6, // ' '
+    LCA_DEL    = 1 << 7, // 0x7F
+};
+enum Lex_Class_B : u8 {
+    LCB_WORD_HI    = 1 << 0, // 0x40-0x4F 0x60-0x6F 0x80-0xFF
+    LCB_WORD_MID   = 1 << 1, // 0x50-0x5A 0x70-0x7A
+    LCB_UNDERSCORE = 1 << 2, // '_'
+    LCB_DOLLAR     = 1 << 3, // '$'
+    LCB_DIGIT      = 1 << 4, // '0'-'9'
+    LCB_RBRACKET   = 1 << 5, // ']'
+
+    LCB_WORD = LCB_WORD_HI | LCB_WORD_MID | LCB_UNDERSCORE | LCB_DOLLAR | LCB_DIGIT,
+};
+alignas(16) static constexpr u8 class_a_lo[16] = { 0x60, 0x20, 0x22, 0x20, 0x20, 0x20, 0x20, 0x28, 0x20, 0x20, 0x31, 0x20, 0x24, 0x30, 0x20, 0xA0 };
+alignas(16) static constexpr u8 class_a_hi[16] = { 0x30, 0x20, 0x4B, 0x00, 0x00, 0x04, 0x00, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+alignas(16) static constexpr u8 class_b_lo[16] = { 0x13, 0x13, 0x13, 0x13, 0x1B, 0x13, 0x13, 0x13, 0x13, 0x13, 0x03, 0x01, 0x01, 0x21, 0x01, 0x05 };
+alignas(16) static constexpr u8 class_b_hi[16] = { 0x00, 0x00, 0x08, 0x10, 0x01, 0x26, 0x01, 0x02, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01 };
+
+static constexpr u8 class_a_of(u8 c) {
+    return class_a_lo[c & 0x0F] & class_a_hi[c >> 4];
+}
+
+static constexpr u8 class_b_of(u8 c) {
+    return class_b_lo[c & 0x0F] & class_b_hi[c >> 4];
+}
+
+// Most char types a language's lexer can have.
+const usize max_char_types = 32;
+
+// A language's lexer before its tables are laid out for the kernels.
+struct Lex_Machine {
+    u8 next[max_lex_states][max_char_types];
+    u8 char_type[256];
+    u8 highlight[max_lex_states];
+    u32 continued_by[max_lex_states];
+    u8 num_states;
+    u8 num_char_types;
+    u8 start_state;
+};
+
+// The run of a state, from which bytes leave it. Stop classes are used if they hold every byte that leaves.
+// Otherwise the stay classes are the ones with a byte that stays and none that leaves without being in a stop class,
+// and the stop classes are only the ones needed for those.
+static constexpr Lex_Run make_run(const Lex_Machine& m, u8 state) {
+    u8 stays_a = 0;
+    u8 stays_b = 0;
+    u8 leaves_a = 0;
+    u8 leaves_b = 0;
+    bool can_stay = false;
+    for (usize c = 0; c < 256; c++) {
+        const u8 a = class_a_of((u8)c);
+        const u8 b = class_b_of((u8)c);
+        if (m.next[state][m.char_type[c]] == state) {
+            stays_a |= a;
+            stays_b |= b;
+            can_stay = true;
+        } else {
+            leaves_a |= a;
+            leaves_b |= b;
+        }
+    }
+
+    Lex_Run result = {};
+    // Over after a byte
+    if (!can_stay) return result;
+
+    const u8 stop_a = leaves_a & ~stays_a;
+    const u8 stop_b = leaves_b & ~stays_b;
+    u8 unstopped_a = 0;
+    u8 unstopped_b = 0;
+    bool is_stopped = true;
+    for (usize c = 0; c < 256; c++) {
+        const u8 a = class_a_of((u8)c);
+        const u8 b = class_b_of((u8)c);
+        if (m.next[state][m.char_type[c]] != state && !(a & stop_a) && !(b & stop_b)) {
+            unstopped_a |= a;
+            unstopped_b |= b;
+            is_stopped = false;
+        }
+    }
+    if (is_stopped) {
+        result.stop_a = stop_a;
+        result.stop_b = stop_b;
+        return result;
+    }
+
+    result.stay_a = stays_a & ~unstopped_a;
+    result.stay_b = stays_b & ~unstopped_b;
+    if (!result.stay_a && !result.stay_b) return result;
+    for (usize c = 0; c < 256; c++) {
+        const u8 a = class_a_of((u8)c);
+        const u8 b = class_b_of((u8)c);
+        if (m.next[state][m.char_type[c]] != state && ((a & result.stay_a) || (b & result.stay_b))) {
+            result.stop_a |= a & stop_a;
+            result.stop_b |= b & stop_b;
+        }
+    }
+    return result;
+}
+
+// Lays a machine out for the kernels. num_states is 0 if the table doesn't fit.
+static constexpr Lex_Tables make_lex_tables(const Lex_Machine& m) {
+    Lex_Tables result = {};
+    if (!m.num_states || m.num_states * m.num_char_types > sizeof(result.lex_table)) return result;
+
+    for (usize c = 0; c < 256; c++) result.char_type[c] = (u8)(m.char_type[c] * m.num_states);
+    // Column-major, so that the premultiplied char type picks the column
+    for (u8 c = 0; c < m.num_char_types; c++) {
+        for (u8 dfa = 0; dfa < m.num_states; dfa++) result.lex_table[c * m.num_states + dfa] = m.next[dfa][c];
+    }
+    for (u8 dfa = 0; dfa < m.num_states; dfa++) {
+        result.runs[dfa] = make_run(m, dfa);
+        result.highlight[dfa] = m.highlight[dfa];
+        result.continued_by[dfa] = m.continued_by[dfa];
+    }
+    result.highlight[m.num_states] = HL_Default;
+    result.num_states = m.num_states;
+    result.num_char_types = m.num_char_types;
+    result.start_state = m.start_state;
+    return result;
+}
+
+// The parser highlights C++, so all of its states are drawn alike here.
+static constexpr Lex_Machine make_cpp_machine() {
+    Lex_Machine result = {};
+    for (usize c = 0; c < 256; c++) result.char_type[c] = char_type_of((u8)c);
+    for (u8 dfa = 0; dfa < DFA_NUM_STATES; dfa++) {
+        for (u8 c = 0; c < NUM_CHAR_TYPES; c++) result.next[dfa][c] = lex_next(dfa, c);
+    }
+    result.num_states = DFA_NUM_STATES;
+    result.num_char_types = NUM_CHAR_TYPES;
+    result.start_state = DFA_NEWLINE;
+    return result;
+}
+
+// A comment or string literal, from the text that opens it to the text that closes it.
+struct Lex_Delimited {
+    const char* begin;
+    // Null if it goes to the end of the line.
+    const char* end;
+    // The byte after this one can't close it. 0 if there's none.
+    u8 escape;
+    // A newline closes it too, like in a string literal that's missing its quote.
+    bool ends_at_newline;
+    // It's only opened at the start of a line, white space before it aside.
+    bool at_line_start;
+    Highlight highlight;
+};
+
+const usize max_delimited = 8;
+
+// What the other languages' lexers are made from. They know identifiers, numbers, operators and delimited ranges,
+// which is all there is to highlight without a parser.
+struct Lex_Spec {
+    // Bytes that are part of identifiers besides letters, digits, '_' and everything from 0x80 up.
+    const char* ident_chars;
+    // Bytes that a number goes on with besides the ones identifiers are made of.
+    const char* number_chars;
+    Highlight op_highlight;
+    Highlight number_highlight;
+    // Up to the first one without a begin.
+    Lex_Delimited delimited[max_delimited];
+};
+
+static constexpr usize cstr_count(const char* s) {
+    usize result = 0;
+    while (s[result]) result++;
+    return result;
+}
+
+static constexpr bool cstr_has(const char* s, u8 c) {
+    if (!s) return false;
+    for (; *s; s++) {
+        if ((u8)*s == c) return true;
+    }
+    return false;
+}
+
+// Makes a lexer out of a spec. Every delimiter's opening text is looked up in a trie of states, one per opening text
+// that's not over yet. One trie is entered at the start of a line and has all of them, the other is entered anywhere
+// else and only has the ones that don't need a line start. A byte that isn't in the trie goes back to the longest
+// opening text seen, or lexes the text after the first byte again as code if there's none.
+// Closing text is matched like a string search, so that "**/" still closes at the "*/".
+struct Lex_Spec_Builder {
+    enum Base_Type : u8 {
+        LT_WHITE,
+        LT_NEWLINE,
+        LT_IDENT,
+        LT_DIGIT,
+        LT_OP,
+
+        NUM_BASE_TYPES,
+    };
+
+    enum Code_State : u8 {
+        LS_WHITE,
+        LS_NEWLINE,
+        LS_IDENT,
+        LS_NUMLIT,
+        LS_OP,
+
+        NUM_CODE_STATES,
+    };
+
+    enum State_Kind : u8 {
+        SK_Code,
+        SK_Prefix,
+        SK_Body,
+        SK_Close,
+        SK_Escape,
+        // Right after the closing text. It's left at the next byte like any code state.
+        SK_End,
+    };
+
+    const Lex_Spec* spec = nullptr;
+    u8 num_delimited = 0;
+    bool has_line_start_trie = false;
+    bool is_too_big = false;
+
+    // Char types after the base types are single bytes that some delimiter or number uses.
+    u8 base_of_type[max_char_types] = {};
+    u8 byte_of_type[max_char_types] = {};
+    bool has_byte[max_char_types] = {};
+
+    State_Kind kind[max_lex_states] = {};
+    // The delimiter a state belongs to, or the one whose opening text a prefix state is the start of.
+    u8 owner[max_lex_states] = {};
+    // How much of the opening or closing text has been seen.
+    u8 seen[max_lex_states] = {};
+    bool in_line_start_trie[max_lex_states] = {};
+
+    u8 body[max_delimited] = {};
+    u8 first_close[max_delimited] = {};
+    u8 escape[max_delimited] = {};
+    // One end state per highlight is enough.
+    u8 end_state[NUM_HIGHLIGHTS] = {};
+
+    Lex_Machine m = {};
+
+    constexpr u8 base_type_of(u8 c) const {
+        if (c == '\r' || c == '\n') return LT_NEWLINE;
+        if (c <= ' ' || c == 0x7F) return LT_WHITE;
+        if (c >= '0' && c <= '9') return LT_DIGIT;
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c >= 0x80 || cstr_has(spec->ident_chars, c)) return LT_IDENT;
+        return LT_OP;
+    }
+
+    constexpr bool is_byte_used(u8 c) const {
+        if (cstr_has(spec->number_chars, c)) return true;
+        for (u8 d = 0; d < num_delimited; d++) {
+            const Lex_Delimited& it = spec->delimited[d];
+            if (cstr_has(it.begin, c) || cstr_has(it.end, c) || (it.escape && it.escape == c)) return true;
+        }
+        return false;
+    }
+
+    constexpr u8 add_state(State_Kind state_kind, u8 state_owner, u8 state_seen) {
+        if (m.num_states == max_lex_states) {
+            is_too_big = true;
+            return 0;
+        }
+        const u8 result = m.num_states++;
+        kind[result] = state_kind;
+        owner[result] = state_owner;
+        seen[result] = state_seen;
+        return result;
+    }
+
+    constexpr bool is_in_trie(u8 d, bool line_start) const {
+        return line_start || !spec->delimited[d].at_line_start;
+    }
+
+    // Whether the first count bytes of d's opening text are the same as the first count of other's.
+    constexpr bool same_opening(u8 d, u8 other, usize count) const {
+        const char* const a = spec->delimited[d].begin;
+        const char* const b = spec->delimited[other].begin;
+        if (cstr_count(b) < count) return false;
+        for (usize i = 0; i < count; i++) {
+            if (a[i] != b[i]) return false;
+        }
+        return true;
+    }
+
+    // The prefix state for the first count bytes of d's opening text in a trie, or 0 if there isn't one.
+    constexpr u8 find_prefix(u8 d, usize count, bool line_start) const {
+        for (u8 s = NUM_CODE_STATES; s < m.num_states; s++) {
+            if (kind[s] != SK_Prefix || in_line_start_trie[s] != line_start || seen[s] != count) continue;
+            if (same_opening(d, owner[s], count)) return s;
+        }
+        return 0;
+    }
+
+    // A delimiter in the trie whose opening text is the first count bytes of d's, or max_delimited.
+    constexpr u8 find_opening(u8 d, usize count, bool line_start) const {
+        for (u8 other = 0; other < num_delimited; other++) {
+            if (is_in_trie(other, line_start) && cstr_count(spec->delimited[other].begin) == count && same_opening(d, other, count)) return other;
+        }
+        return max_delimited;
+    }
+
+    constexpr void add_prefixes(bool line_start) {
+        for (u8 d = 0; d < num_delimited; d++) {
+            if (!is_in_trie(d, line_start)) continue;
+            const usize count = cstr_count(spec->delimited[d].begin);
+            for (usize i = 1; i < count; i++) {
+                if (find_prefix(d, i, line_start)) continue;
+                const u8 s = add_state(SK_Prefix, d, (u8)i);
+                in_line_start_trie[s] = line_start;
+            }
+        }
+    }
+
+    // Where the trie goes from the first count bytes of d's opening text with c. 0 if the trie doesn't have it.
+    constexpr u8 trie_next(u8 d, usize count, u8 c, bool line_start) const {
+        for (u8 other = 0; other < num_delimited; other++) {
+            if (!is_in_trie(other, line_start)) continue;
+            const char* const begin = spec->delimited[other].begin;
+            if (cstr_count(begin) <= count || (u8)begin[count] != c || !same_opening(d, other, count)) continue;
+            const u8 prefix = find_prefix(other, count + 1, line_start);
+            return prefix ? prefix : body[other];
+        }
+        return 0;
+    }
+
+    constexpr u8 trie_start(u8 c, bool line_start) const {
+        for (u8 d = 0; d < num_delimited; d++) {
+            if (!is_in_trie(d, line_start) || (u8)spec->delimited[d].begin[0] != c) continue;
+            const u8 prefix = find_prefix(d, 1, line_start);
+            return prefix ? prefix : body[d];
+        }
+        return 0;
+    }
+
+    constexpr u8 code_next(u8 state, u8 type) const {
+        const u8 base = base_of_type[type];
+        if (state == LS_WHITE && base == LT_WHITE) return LS_WHITE;
+        if (state == LS_NEWLINE && (base == LT_WHITE || base == LT_NEWLINE)) return LS_NEWLINE;
+        if (state == LS_IDENT && (base == LT_IDENT || base == LT_DIGIT)) return LS_IDENT;
+        if (state == LS_NUMLIT && (base == LT_IDENT || base == LT_DIGIT || (has_byte[type] && cstr_has(spec->number_chars, byte_of_type[type])))) return LS_NUMLIT;
+        if (has_byte[type]) {
+            const u8 opened = trie_start(byte_of_type[type], state == LS_NEWLINE && has_line_start_trie);
+            if (opened) return opened;
+        }
+        switch (base) {
+        case LT_WHITE:   return LS_WHITE;
+        case LT_NEWLINE: return LS_NEWLINE;
+        case LT_IDENT:   return LS_IDENT;
+        case LT_DIGIT:   return LS_NUMLIT;
+        }
+        return LS_OP;
+    }
+
+    constexpr u8 close_state(u8 d, usize count) const {
+        const Lex_Delimited& it = spec->delimited[d];
+        if (!count) return body[d];
+        if (count == cstr_count(it.end)) return end_state[it.highlight];
+        return (u8)(first_close[d] + count - 1);
+    }
+
+    // Inside d with count bytes of its closing text seen.
+    constexpr u8 delimited_next(u8 d, usize count, u8 type) const {
+        const Lex_Delimited& it = spec->delimited[d];
+        const u8 base = base_of_type[type];
+        if (!it.end) return base == LT_NEWLINE ? LS_NEWLINE : body[d];
+        if (base == LT_NEWLINE && it.ends_at_newline) return LS_NEWLINE;
+        if (!has_byte[type]) return body[d];
+        const u8 c = byte_of_type[type];
+        if (it.escape && c == it.escape) return escape[d];
+
+        // The longest start of the closing text that what was seen ends with
+        for (usize match = count + 1; match > 0; match--) {
+            bool is_match = (u8)it.end[match - 1] == c;
+            for (usize i = 0; is_match && i + 1 < match; i++) is_match = it.end[i] == it.end[count - (match - 1) + i];
+            if (is_match) return close_state(d, match);
+        }
+        return body[d];
+    }
+
+    constexpr u8 prefix_next(u8 state, u8 type, bool* carries_on) const {
+        const u8 d = owner[state];
+        const usize count = seen[state];
+        const bool line_start = in_line_start_trie[state];
+        *carries_on = true;
+        if (has_byte[type]) {
+            const u8 next = trie_next(d, count, byte_of_type[type], line_start);
+            if (next) return next;
+        }
+
+        const char* const text = spec->delimited[d].begin;
+        for (usize opened_count = count; opened_count > 0; opened_count--) {
+            const u8 opened = find_opening(d, opened_count, line_start);
+            if (opened == max_delimited) continue;
+            u8 result = body[opened];
+            for (usize i = opened_count; i < count; i++) result = step(result, m.char_type[(u8)text[i]]);
+            return step(result, type);
+        }
+
+        *carries_on = false;
+        u8 result = LS_OP;
+        for (usize i = 1; i < count; i++) result = step(result, m.char_type[(u8)text[i]]);
+        return step(result, type);
+    }
+
+    constexpr u8 step(u8 state, u8 type) const {
+        switch (kind[state]) {
+        case SK_Code:
+        case SK_End:
+            return code_next(state, type);
+        case SK_Prefix: {
+            bool carries_on = false;
+            return prefix_next(state, type, &carries_on);
+        }
+        case SK_Body: return delimited_next(owner[state], 0, type);
+        case SK_Close: return delimited_next(owner[state], seen[state], type);
+        case SK_Escape: return body[owner[state]];
+        }
+        return LS_OP;
+    }
+
+    constexpr u8 highlight_of(u8 state) const {
+        switch (kind[state]) {
+        case SK_Code:
+            if (state == LS_NUMLIT) return spec->number_highlight;
+            if (state == LS_OP) return spec->op_highlight;
+            return HL_Default;
+        case SK_Prefix:
+            // Like the longest opening text seen so far
+            for (usize count = seen[state]; count > 0; count--) {
+                const u8 opened = find_opening(owner[state], count, in_line_start_trie[state]);
+                if (opened != max_delimited) return spec->delimited[opened].highlight;
+            }
+            return spec->op_highlight;
+        }
+        return spec->delimited[owner[state]].highlight;
+    }
+
+    constexpr Lex_Machine build(const Lex_Spec& in_spec) {
+        spec = &in_spec;
+        while (num_delimited < max_delimited && spec->delimited[num_delimited].begin) {
+            if (spec->delimited[num_delimited].at_line_start) has_line_start_trie = true;
+            num_delimited++;
+        }
+
+        m.num_char_types = NUM_BASE_TYPES;
+        for (u8 t = 0; t < NUM_BASE_TYPES; t++) base_of_type[t] = t;
+        for (usize c = 0; c < 256; c++) {
+            m.char_type[c] = base_type_of((u8)c);
+            if (!is_byte_used((u8)c)) continue;
+            if (m.num_char_types == max_char_types) return {};
+            const u8 t = m.num_char_types++;
+            base_of_type[t] = base_type_of((u8)c);
+            byte_of_type[t] = (u8)c;
+            has_byte[t] = true;
+            m.char_type[c] = t;
+        }
+
+        for (u8 s = 0; s < NUM_CODE_STATES; s++) add_state(SK_Code, 0, 0);
+        add_prefixes(false);
+        if (has_line_start_trie) add_prefixes(true);
+        for (u8 d = 0; d < num_delimited; d++) {
+            const Lex_Delimited& it = spec->delimited[d];
+            body[d] = add_state(SK_Body, d, 0);
+            if (!it.end) continue;
+            const usize end_count = cstr_count(it.end);
+            for (usize i = 1; i < end_count; i++) {
+                const u8 s = add_state(SK_Close, d, (u8)i);
+                if (i == 1) first_close[d] = s;
+            }
+            if (it.escape) escape[d] = add_state(SK_Escape, d, 0);
+            if (!end_state[it.highlight]) end_state[it.highlight] = add_state(SK_End, d, 0);
+        }
+        if (is_too_big) return {};
+
+        for (u8 s = 0; s < m.num_states; s++) {
+            for (u8 t = 0; t < m.num_char_types; t++) {
+                if (kind[s] == SK_Prefix) {
+                    bool carries_on = false;
+                    const u8 next = prefix_next(s, t, &carries_on);
+                    if (carries_on && kind[next] != SK_Code) m.continued_by[s] |= 1u << next;
+                    m.next[s][t] = next;
+                } else {
+                    m.next[s][t] = step(s, t);
+                }
+            }
+            m.highlight[s] = highlight_of(s);
+        }
+        m.start_state = LS_NEWLINE;
+        return m;
+    }
+};
+
+static constexpr Lex_Machine make_spec_machine(const Lex_Spec& spec) {
+    Lex_Spec_Builder builder;
+    return builder.build(spec);
+}
+
+static constexpr Lex_Spec lua_spec = {
+    "", ".", HL_Op, HL_Number,
+    {
+        { "--[[", "]]",    0, false, false, HL_Comment },
+        { "--",   nullptr, 0, false, false, HL_Comment },
+        { "[[",   "]]",    0, false, false, HL_String },
+        { "\"",   "\"", '\\', true,  false, HL_String },
+        { "'",    "'",  '\\', true,  false, HL_String },
+    },
+};
+
+static constexpr Lex_Spec python_spec = {
+    "", ".", HL_Op, HL_Number,
+    {
+        { "#",     nullptr, 0,    false, false, HL_Comment },
+        { "\"\"\"", "\"\"\"", '\\', false, false, HL_String },
+        { "'''",   "'''",   '\\', false, false, HL_String },
+        { "\"",    "\"",    '\\', true,  false, HL_String },
+        { "'",     "'",     '\\', true,  false, HL_String },
+    },
+};
+
+static constexpr Lex_Spec json_spec = {
+    "", ".+-", HL_Op, HL_Number,
+    {
+        { "\"", "\"", '\\', true, false, HL_String },
+    },
+};
+
+// Headings, quotes and code. Everything else is drawn as text.
+static constexpr Lex_Spec markdown_spec = {
+    "", "", HL_Default, HL_Default,
+    {
+        { "#",   nullptr, 0, false, true,  HL_Keyword },
+        { ">",   nullptr, 0, false, true,  HL_Comment },
+        { "```", "```",   0, false, true,  HL_String },
+        { "`",   "`",     0, true,  false, HL_String },
+    },
+};
+
+static constexpr Lex_Tables cpp_lex_tables = make_lex_tables(make_cpp_machine());
+static constexpr Lex_Tables lua_lex_tables = make_lex_tables(make_spec_machine(lua_spec));
+static constexpr Lex_Tables python_lex_tables = make_lex_tables(make_spec_machine(python_spec));
+static constexpr Lex_Tables json_lex_tables = make_lex_tables(make_spec_machine(json_spec));
+static constexpr Lex_Tables markdown_lex_tables = make_lex_tables(make_spec_machine(markdown_spec));
+static_assert(cpp_lex_tables.num_states && lua_lex_tables.num_states && python_lex_tables.num_states && json_lex_tables.num_states && markdown_lex_tables.num_states,
+              "a language has too many states or char types for its tables");
+
+static const Lex_Tables* const lex_tables[NUM_LANGUAGES] = {
+    &cpp_lex_tables,
+    &lua_lex_tables,
+    &python_lex_tables,
+    &json_lex_tables,
+    &markdown_lex_tables,
+};
+
+const Lex_Tables& get_lex_tables(Language language) {
+    assert(language < NUM_LANGUAGES);
+    return *lex_tables[language];
+}
+
+struct Language_Extension {
+    const char* extension;
+    Language language;
+};
+static const Language_Extension language_extensions[] = {
+    { "lua",      LANG_LUA },
+    { "py",       LANG_PYTHON },
+    { "pyw",      LANG_PYTHON },
+    { "json",     LANG_JSON },
+    { "md",       LANG_MARKDOWN },
+    { "markdown", LANG_MARKDOWN },
+};
+
+Language get_language_for_extension(const char* extension, usize count) {
+    for (const Language_Extension& it : language_extensions) {
+        if (cstr_count(it.extension) != count) continue;
+        bool is_match = true;
+        for (usize i = 0; is_match && i < count; i++) {
+            u8 c = (u8)extension[i];
+            if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+            is_match = c == (u8)it.extension[i];
+        }
+        if (is_match) return it.language;
+    }
+    return LANG_CPP;
+}
+
+void highlight_lexed(const Lex_Tables& tables, Lexemes& lexemes, usize begin, usize end) {
+    // Backwards, so that an opening is drawn like what it turned out to be
+    for (usize l = end; l > begin; l--) {
+        const u8 state = lexemes.lex_dfa[l - 1];
+        u8 hl = tables.highlight[state];
+        if (l < lexemes.count && (tables.continued_by[state] >> lexemes.lex_dfa[l] & 1)) hl = lexemes.highlight[l];
+        lexemes.highlight[l - 1] = hl;
+    }
+}
+
+// Where a kernel appends lexemes. Kernels work on a local copy so that the array pointers stay in
+// registers, and there has to be room for a lexeme per byte lexed.
+struct Lex_Out {
+    u32* offsets;
+    u8* dfa;
+    u8* lex_dfa;
+    u8* first;
+    usize count;
+    // Where the text starts, so that p - origin is p's offset.
+    const u8* origin;
+};
+
+// Takes one step of the table DFA. The kernels keep the tables in locals named lex_table and char_type.
+#define LEX_STEP()                                            \
+    do {                                                      \
+        const u8 new_dfa = lex_table[dfa + char_type[*p]];    \
+        if (new_dfa != dfa) {                                 \
+            out.offsets[out.count] = (u32)(p - out.origin);   \
+            out.dfa[out.count] = new_dfa;                     \
+            out.lex_dfa[out.count] = new_dfa;                 \
+            out.first[out.count] = *p;                        \
+            out.count++;                                      \
+            dfa = new_dfa;                                    \
+        }                                                     \
+        p++;                                                  \
+    } while (0)
+
+static u8 lex_scalar(const Lex_Tables& tables, u8 dfa, const u8* p, const u8* const end, Lex_Out& result) {
+    Lex_Out out = result;
+    const u8* const lex_table = tables.lex_table;
+    const u8* const char_type = tables.char_type;
+    while (p < end) LEX_STEP();
+    result.count = out.count;
+    return dfa;
+}
+
+// Bytes lexed one at a time in a state before trying to skip the rest of the run.
+const usize lex_short_run = 8;
+
+static CH_FORCEINLINE u32 find_first_bit(u32 mask) {
+#ifdef _MSC_VER
+    unsigned long result;
+    _BitScanForward(&result, mask);
+    return (u32)result;
+#else
+    return (u32)__builtin_ctz(mask);
+#endif
+}
+
+LEX_TARGET_SSSE3 static u8 lex_ssse3(const Lex_Tables& tables, u8 dfa, const u8* p, const u8* const end, Lex_Out& result) {
+    Lex_Out out = result;
+    const u8* const lex_table = tables.lex_table;
+    const u8* const char_type = tables.char_type;
+    const __m128i a_lo = _mm_load_si128((const __m128i*)class_a_lo);
+    const __m128i a_hi = _mm_load_si128((const __m128i*)class_a_hi);
+    const __m128i b_lo = _mm_load_si128((const __m128i*)class_b_lo);
+    const __m128i b_hi = _mm_load_si128((const __m128i*)class_b_hi);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i zero = _mm_setzero_si128();
+
+    while (p < end) {
+        const Lex_Run run = tables.runs[dfa];
+        const bool has_stay = run.stay_a || run.stay_b;
+        if ((run.stop_a || run.stop_b || has_stay) && end - p >= lex_short_run + 16) {
+            // Most identifiers and spaces are over after a few bytes. Only longer runs are worth the vector loop.
+            const u8 run_dfa = dfa;
+            const u8* const short_run_end = p + lex_short_run;
+            while (p < short_run_end && dfa == run_dfa) LEX_STEP();
+            if (dfa != run_dfa) continue;
+
+            const __m128i stop_a = _mm_set1_epi8((char)run.stop_a);
+            const __m128i stop_b = _mm_set1_epi8((char)run.stop_b);
+            const __m128i stay_a = _mm_set1_epi8((char)run.stay_a);
+            const __m128i stay_b = _mm_set1_epi8((char)run.stay_b);
+            do {
+                const __m128i v = _mm_loadu_si128((const __m128i*)p);
+                const __m128i lo = _mm_and_si128(v, nibble);
+                const __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+                const __m128i a = _mm_and_si128(_mm_shuffle_epi8(a_lo, lo), _mm_shuffle_epi8(a_hi, hi));
+                const __m128i b = _mm_and_si128(_mm_shuffle_epi8(b_lo, lo), _mm_shuffle_epi8(b_hi, hi));
+
+                const __m128i stop = _mm_or_si128(_mm_and_si128(a, stop_a), _mm_and_si128(b, stop_b));
+                u32 stops = ~(u32)_mm_movemask_epi8(_mm_cmpeq_epi8(stop, zero)) & 0xFFFF;
+                if (has_stay) {
+                    const __m128i stay = _mm_or_si128(_mm_and_si128(a, stay_a), _mm_and_si128(b, stay_b));
+                    stops |= (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(stay, zero));
+                }
+                if (stops) {
+                    p += find_first_bit(stops);
+                    break;
+                }
+                p += 16;
+            } while (end - p >= 16);
+            if (p == end) break;
+        }
+        LEX_STEP();
+    }
+    result.count = out.count;
+    return dfa;
+}
+
+LEX_TARGET_AVX2 static u8 lex_avx2(const Lex_Tables& tables, u8 dfa, const u8* p, const u8* const end, Lex_Out& result) {
+    Lex_Out out = result;
+    const u8* const lex_table = tables.lex_table;
+    const u8* const char_type = tables.char_type;
+    const __m256i a_lo = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)class_a_lo));
+    const __m256i a_hi = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)class_a_hi));
+    const __m256i b_lo = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)class_b_lo));
+    const __m256i b_hi = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)class_b_hi));
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i zero = _mm256_setzero_si256();
+
+    while (p < end) {
+        const Lex_Run run = tables.runs[dfa];
+        const bool has_stay = run.stay_a || run.stay_b;
+        if ((run.stop_a || run.stop_b || has_stay) && end - p >= lex_short_run + 32) {
+            // Most identifiers and spaces are over after a few bytes. Only longer runs are worth the vector loop.
+            const u8 run_dfa = dfa;
+            const u8* const short_run_end = p + lex_short_run;
+            while (p < short_run_end && dfa == run_dfa) LEX_STEP();
+            if (dfa != run_dfa) continue;
+
+            const __m256i stop_a = _mm256_set1_epi8((char)run.stop_a);
+            const __m256i stop_b = _mm256_set1_epi8((char)run.stop_b);
+            const __m256i stay_a = _mm256_set1_epi8((char)run.stay_a);
+            const __m256i stay_b = _mm256_set1_epi8((char)run.stay_b);
+            do {
+                const __m256i v = _mm256_loadu_si256((const __m256i*)p);
+                const __m256i lo = _mm256_and_si256(v, nibble);
+                const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+                const __m256i a = _mm256_and_si256(_mm256_shuffle_epi8(a_lo, lo), _mm256_shuffle_epi8(a_hi, hi));
+                const __m256i b = _mm256_and_si256(_mm256_shuffle_epi8(b_lo, lo), _mm256_shuffle_epi8(b_hi, hi));
+
+                const __m256i stop = _mm256_or_si256(_mm256_and_si256(a, stop_a), _mm256_and_si256(b, stop_b));
+                u32 stops = ~(u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(stop, zero));
+                if (has_stay) {
+                    const __m256i stay = _mm256_or_si256(_mm256_and_si256(a, stay_a), _mm256_and_si256(b, stay_b));
+                    stops |= (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(stay, zero));
+                }
+                if (stops) {
+                    p += find_first_bit(stops);
+                    break;
+                }
+                p += 32;
+            } while (end - p >= 32);
+            if (p == end) break;
+        }
+        LEX_STEP();
+    }
+    result.count = out.count;
+    return dfa;
+}
+
+#undef LEX_STEP
+
+static bool cpu_has_ssse3() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 9)) != 0;
+#else
+    return __builtin_cpu_supports("ssse3");
+#endif
+}
+
+static bool cpu_has_avx2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+
+    // The os has to save the ymm registers as well
+    __cpuid(info, 1);
+    const bool has_osxsave = (info[2] & (1 << 27)) != 0;
+    const bool has_avx = (info[2] & (1 << 28)) != 0;
+    if (!has_osxsave || !has_avx) return false;
+    if ((_xgetbv(0) & 6) != 6) return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+Lex_Kernel get_best_lex_kernel() {
+    static const Lex_Kernel best = cpu_has_avx2() ? LK_AVX2 : (cpu_has_ssse3() ? LK_SSSE3 : LK_Scalar);
+    return best;
+}
+
+// Text is lexed in blocks of this size, so room only has to be made for a block's worth of lexemes at a time.
+const usize lex_block_size = 64 * 1024;
+
+u8 lex(const Lex_Tables& tables, u8 dfa, const u8* p, const u8* const end, usize offset, Lexemes& lexemes, Lex_Kernel kernel) {
+    const u8* const begin = p;
+    const usize count_before = lexemes.count;
+    while (p < end) {
+        const u8* const block_end = (usize)(end - p) > lex_block_size ? p + lex_block_size : end;
+        const usize block_size = block_end - p;
+        if (lexemes.allocated - lexemes.count < block_size) {
+            // Grow by what the rest of the text needs at the density seen so far, plus some slack.
+            // Text in spans is lexed a call at a time, so it grows by at least an eighth to not reallocate for every span.
+            f32 density = lexemes.density;
+            if (p > begin) density = (f32)(lexemes.count - count_before) / (f32)(p - begin);
+            const usize expected = (usize)((f32)(end - block_end) * density * 1.125f);
+            const usize slack = expected > lexemes.allocated / 8 ? expected : lexemes.allocated / 8;
+            lexemes.reserve(lexemes.count + block_size + slack);
+        }
+
+        Lex_Out out;
+        out.offsets = lexemes.offsets;
+        out.dfa = lexemes.dfa;
+        out.lex_dfa = lexemes.lex_dfa;
+        out.first = lexemes.first;
+        out.count = lexemes.count;
+        out.origin = begin - offset;
+        switch (kernel) {
+        case LK_AVX2:
+            dfa = lex_avx2(tables, dfa, p, block_end, out);
+            break;
+        case LK_SSSE3:
+            dfa = lex_ssse3(tables, dfa, p, block_end, out);
+            break;
+        default:
+            dfa = lex_scalar(tables, dfa, p, block_end, out);
+            break;
+        }
+        lexemes.count = out.count;
+        p = block_end;
+    }
+    return dfa;
+}
+
+u8 lex(const Lex_Tables& tables, u8 dfa, const u8* p, const u8* const end, usize offset, Lexemes& lexemes) {
+    return lex(tables, dfa, p, end, offset, lexemes, get_best_lex_kernel());
+}
+
+// All five arrays live in one allocation, offsets first so that they stay aligned.
+void Lexemes::reserve(usize new_allocated) {
+    if (new_allocated <= allocated) return;
+    const usize bytes_per_lexeme = sizeof(u32) + 4;
+    u8* const block = (u8*)allocator.alloc(new_allocated * bytes_per_lexeme);
+    assert(block);
+
+    u32* const new_offsets = (u32*)block;
+    u8* const new_dfa = block + new_allocated * sizeof(u32);
+    u8* const new_lex_dfa = new_dfa + new_allocated;
+    u8* const new_first = new_lex_dfa + new_allocated;
+    u8* const new_highlight = new_first + new_allocated;
+    if (count) {
+        ch::mem_copy(new_offsets, offsets, count * sizeof(u32));
+        ch::mem_copy(new_dfa, dfa, count);
+        ch::mem_copy(new_lex_dfa, lex_dfa, count);
+        ch::mem_copy(new_first, first, count);
+        ch::mem_copy(new_highlight, highlight, count);
+    }
+    if (offsets) allocator.free(offsets);
+
+    offsets = new_offsets;
+    dfa = new_dfa;
+    lex_dfa = new_lex_dfa;
+    first = new_first;
+    highlight = new_highlight;
+    allocated = new_allocated;
+}
+
+void Lexemes::free() {
+    if (offsets) allocator.free(offsets);
+    offsets = nullptr;
+    dfa = nullptr;
+    lex_dfa = nullptr;
+    first = nullptr;
+    highlight = nullptr;
+    count = 0;
+    allocated = 0;
+    version = 0;
+    decls.free();
+    brackets.free();
+    definitions.free();
+}
+
+void Lexemes::push(u32 offset, u8 state, u8 first_byte) {
+    if (count == allocated) reserve(allocated + allocated / 2 + 16);
+    offsets[count] = offset;
+    dfa[count] = state;
+    lex_dfa[count] = state;
+    first[count] = first_byte;
+    highlight[count] = HL_Default;
+    count++;
+}
+
+void Lexemes::copy(usize to, const Lexemes& src, usize from, usize n) {
+    assert(to + n <= allocated);
+    if (!n) return;
+    ch::mem_copy(offsets + to, src.offsets + from, n * sizeof(u32));
+    ch::mem_copy(dfa + to, src.dfa + from, n);
+    ch::mem_copy(lex_dfa + to, src.lex_dfa + from, n);
+    ch::mem_copy(first + to, src.first + from, n);
+    ch::mem_copy(highlight + to, src.highlight + from, n);
+}
+
+void Lexemes::move(usize to, usize from, usize n) {
+    assert(to + n <= allocated);
+    if (!n || to == from) return;
+    ch::mem_move(offsets + to, offsets + from, n * sizeof(u32));
+    ch::mem_move(dfa + to, dfa + from, n);
+    ch::mem_move(lex_dfa + to, lex_dfa + from, n);
+    ch::mem_move(first + to, first + from, n);
+    ch::mem_move(highlight + to, highlight + from, n);
+}
+
+void Lexemes::assign(const Lexemes& src) {
+    count = 0;
+    reserve(src.allocated);
+    copy(0, src, 0, src.count);
+    count = src.count;
+    density = src.density;
+    language = src.language;
+
+    decls.allocator = allocator;
+    decls.count = 0;
+    for (const u32 decl : src.decls) decls.push(decl);
+
+    brackets.allocator = allocator;
+    brackets.count = 0;
+    if (brackets.allocated < src.brackets.count) brackets.reserve(src.brackets.count - brackets.allocated);
+    for (const Bracket& bracket : src.brackets) brackets.push(bracket);
+
+    definitions.allocator = allocator;
+    definitions.count = 0;
+    if (definitions.allocated < src.definitions.count) definitions.reserve(src.definitions.count - definitions.allocated);
+    for (const Definition& definition : src.definitions) definitions.push(definition);
+    new_definitions_begin = src.new_definitions_begin;
+    new_definitions_end = src.new_definitions_end;
+    version = src.version;
+    kept_lexemes = src.kept_lexemes;
+}
+
+// How many of decls are before lexeme.
+static usize count_before(const ch::Array<u32>& decls, usize lexeme) {
+    usize lo = 0;
+    usize hi = decls.count;
+    while (lo < hi) {
+        const usize mid = lo + (hi - lo) / 2;
+        if (decls[mid] < lexeme) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// How many of items are of lexemes before lexeme. Works for anything kept in the order of its lexemes.
+template <typename T>
+static usize count_before(const ch::Array<T>& items, usize lexeme) {
+    usize lo = 0;
+    usize hi = items.count;
+    while (lo < hi) {
+        const usize mid = lo + (hi - lo) / 2;
+        if (items[mid].lexeme < lexeme) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Makes items a copy of src, which starts with the same kept_count items.
+template <typename T>
+static void copy_after(ch::Array<T>& items, const ch::Array<T>& src, usize kept_count) {
+    items.count = kept_count;
+    if (items.allocated < src.count) items.reserve(src.count - items.allocated);
+    for (usize i = kept_count; i < src.count; i++) items.push(src[i]);
+}
+
+void Lexemes::catch_up(const Lexemes& src) {
+    const usize kept = src.kept_lexemes;
+    if (!version || version + 1 != src.version || count < kept || !kept) {
+        assign(src);
+        return;
+    }
+
+    // Only what's before kept is copied again when it grows
+    count = kept;
+    reserve(src.allocated);
+    copy(kept, src, kept, src.count - kept);
+    first[0] = src.first[0];
+    count = src.count;
+    density = src.density;
+    language = src.language;
+
+    copy_after(decls, src.decls, count_before(src.decls, kept));
+    copy_after(brackets, src.brackets, count_before(src.brackets, kept));
+    copy_after(definitions, src.definitions, count_before(src.definitions, kept));
+    new_definitions_begin = src.new_definitions_begin;
+    new_definitions_end = src.new_definitions_end;
+    version = src.version;
+}
+} // namespace parsing
@@ -0,0 +1,327 @@
+#include "line_scan.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define LINE_SCAN_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define LINE_SCAN_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#include <immintrin.h>
+
+const u32 line_scan_block_size = 32;
+
+static CH_FORCEINLINE u32 count_bits(u32 mask) {
+	mask = mask - ((mask >> 1) & 0x55555555);
+	mask = (mask & 0x33333333) + ((mask >> 2) & 0x33333333);
+	mask = (mask + (mask >> 4)) & 0x0F0F0F0F;
+	return (mask * 0x01010101) >> 24;
+}
+
+static CH_FORCEINLINE u32 find_first_bit(u32 mask) {
+	assert(mask);
+#ifdef _MSC_VER
+	unsigned long result;
+	_BitScanForward(&result, mask);
+	return (u32)result;
+#else
+	return (u32)__builtin_ctz(mask);
+#endif
+}
+
+/** Bit i of every mask is set if byte i of the block is of that kind. */
+struct Block_Masks {
+	u32 lf;
+	u32 cr;
+	u32 tab;
+	u32 cont;
+	u32 ef;
+	u32 bb;
+	u32 bf;
+};
+
+static void classify_block_scalar(const u8* block, Block_Masks* out_masks) {
+	Block_Masks masks = {};
+	for (u32 i = 0; i < line_scan_block_size; i += 1) {
+		const u8 c = block[i];
+		const u32 bit = 1u << i;
+
+		if (c == '\n') masks.lf |= bit;
+		if (c == '\r') masks.cr |= bit;
+		if (c == '\t') masks.tab |= bit;
+		if ((c & 0xC0) == 0x80) masks.cont |= bit;
+		if (c == 0xEF) masks.ef |= bit;
+		if (c == 0xBB) masks.bb |= bit;
+		if (c == 0xBF) masks.bf |= bit;
+	}
+	*out_masks = masks;
+}
+
+static CH_FORCEINLINE u32 sse2_mask(__m128i lo, __m128i hi, char c) {
+	const __m128i v = _mm_set1_epi8(c);
+	return (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(lo, v)) | ((u32)_mm_movemask_epi8(_mm_cmpeq_epi8(hi, v)) << 16);
+}
+
+static void classify_block_sse2(const u8* block, Block_Masks* out_masks) {
+	const __m128i lo = _mm_loadu_si128((const __m128i*)block);
+	const __m128i hi = _mm_loadu_si128((const __m128i*)(block + 16));
+
+	out_masks->lf  = sse2_mask(lo, hi, '\n');
+	out_masks->cr  = sse2_mask(lo, hi, '\r');
+	out_masks->tab = sse2_mask(lo, hi, '\t');
+	out_masks->ef  = sse2_mask(lo, hi, (char)0xEF);
+	out_masks->bb  = sse2_mask(lo, hi, (char)0xBB);
+	out_masks->bf  = sse2_mask(lo, hi, (char)0xBF);
+
+	// Continuation bytes 0x80-0xBF are the only ones below -64 as signed chars
+	const __m128i cont_limit = _mm_set1_epi8(-64);
+	out_masks->cont = (u32)_mm_movemask_epi8(_mm_cmplt_epi8(lo, cont_limit)) | ((u32)_mm_movemask_epi8(_mm_cmplt_epi8(hi, cont_limit)) << 16);
+}
+
+LINE_SCAN_TARGET_AVX2 static CH_FORCEINLINE u32 avx2_mask(__m256i v, char c) {
+	return (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)));
+}
+
+LINE_SCAN_TARGET_AVX2 static void classify_block_avx2(const u8* block, Block_Masks* out_masks) {
+	const __m256i v = _mm256_loadu_si256((const __m256i*)block);
+
+	out_masks->lf  = avx2_mask(v, '\n');
+	out_masks->cr  = avx2_mask(v, '\r');
+	out_masks->tab = avx2_mask(v, '\t');
+	out_masks->ef  = avx2_mask(v, (char)0xEF);
+	out_masks->bb  = avx2_mask(v, (char)0xBB);
+	out_masks->bf  = avx2_mask(v, (char)0xBF);
+	out_masks->cont = (u32)_mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_set1_epi8(-64), v));
+}
+
+static bool cpu_has_avx2() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) return false;
+
+	// The os has to save the ymm registers as well
+	__cpuid(info, 1);
+	const bool has_osxsave = (info[2] & (1 << 27)) != 0;
+	const bool has_avx = (info[2] & (1 << 28)) != 0;
+	if (!has_osxsave || !has_avx) return false;
+	if ((_xgetbv(0) & 6) != 6) return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+Line_Scan_Kernel get_best_line_scan_kernel() {
+	static const Line_Scan_Kernel best = cpu_has_avx2() ? LSK_AVX2 : LSK_SSE2;
+	return best;
+}
+
+Line_Scanner::Line_Scanner(u32 in_tab_width, ch::Array<u32>* out_sizes, ch::Array<u32>* out_columns)
+	: kernel(get_best_line_scan_kernel()), tab_width(in_tab_width), sizes(out_sizes), columns(out_columns) {}
+
+void Line_Scanner::push_line() {
+	sizes->push((u32)line_size);
+	columns->push((u32)line_columns);
+	line_size = 0;
+	line_columns = 0;
+}
+
+void Line_Scanner::scan_block(const u8* block, u32 count) {
+	assert(count > 0 && count <= line_scan_block_size);
+
+	Block_Masks m;
+	switch (kernel) {
+	case LSK_AVX2:
+		classify_block_avx2(block, &m);
+		break;
+	case LSK_SSE2:
+		classify_block_sse2(block, &m);
+		break;
+	default:
+		classify_block_scalar(block, &m);
+		break;
+	}
+
+	const u32 valid = count == line_scan_block_size ? 0xFFFFFFFF : (1u << count) - 1;
+	const u32 last_bit = 1u << (count - 1);
+
+	// A BOM (EF BB BF) takes no columns. It's counted at its last byte using the bytes carried over from the previous block.
+	const u64 ef_before = ((u64)m.ef << 2) | prev_ef_bits;
+	const u64 bb_before = ((u64)m.bb << 1) | prev_bb_bit;
+	const u32 bom = m.bf & (u32)bb_before & (u32)ef_before;
+	prev_ef_bits = (u8)((ef_before >> count) & 3);
+	prev_bb_bit = (u8)((bb_before >> count) & 1);
+
+	// Every codepoint takes a column except BOMs. Tabs take tab_width.
+	const u32 lead = valid & ~m.cont;
+	const u32 tab_extra = tab_width - 1;
+	auto get_columns = [&](u32 range) -> u64 {
+		return (u64)count_bits(lead & range) + (u64)count_bits(m.tab & range) * tab_extra - count_bits(bom & range);
+	};
+
+	if (pending_cr) {
+		pending_cr = false;
+		if (m.lf & 1) {
+			num_crlf += 1;
+			num_lf -= 1;
+		} else {
+			num_cr += 1;
+			push_line();
+		}
+	}
+
+	// A '\r' right before a '\n' doesn't end the line, the '\n' does.
+	const u32 cr_before_lf = m.cr & (m.lf >> 1);
+	u32 line_ends = m.lf | (m.cr & ~cr_before_lf);
+	num_lf += count_bits(m.lf) - count_bits(cr_before_lf);
+	num_crlf += count_bits(cr_before_lf);
+
+	// A '\r' at the end has to wait for the next byte
+	if (m.cr & last_bit) {
+		line_ends &= ~last_bit;
+		pending_cr = true;
+	}
+	num_cr += count_bits(m.cr & ~cr_before_lf & ~(pending_cr ? last_bit : 0));
+
+	u32 remaining = valid;
+	while (line_ends) {
+		const u32 end_bit = find_first_bit(line_ends);
+		const u32 through_end = end_bit == 31 ? 0xFFFFFFFF : (2u << end_bit) - 1;
+		const u32 line_range = remaining & through_end;
+
+		line_size += count_bits(line_range);
+		line_columns += get_columns(line_range);
+		push_line();
+
+		remaining &= ~through_end;
+		line_ends &= line_ends - 1;
+	}
+
+	line_size += count_bits(remaining);
+	line_columns += get_columns(remaining);
+}
+
+void Line_Scanner::scan(const u8* data, usize count) {
+	usize i = 0;
+	for (; i + line_scan_block_size <= count; i += line_scan_block_size) {
+		scan_block(data + i, line_scan_block_size);
+	}
+
+	// The tail is padded with zeros. The masks of the padding are cleared by scan_block.
+	if (i < count) {
+		u8 tail[line_scan_block_size] = {};
+		ch::mem_copy(tail, data + i, count - i);
+		scan_block(tail, (u32)(count - i));
+	}
+}
+
+void Line_Scanner::finish(bool is_last_line) {
+	if (pending_cr) {
+		pending_cr = false;
+		num_cr += 1;
+		push_line();
+	}
+
+	if (is_last_line) {
+		push_line();
+	} else {
+		// @NOTE(CHall): edits rescan whole lines so we should always stop right after an eol
+		assert(line_size == 0);
+	}
+
+	prev_ef_bits = 0;
+	prev_bb_bit = 0;
+}
+
+/** Moves every line in from_sizes and from_columns to the end of to_sizes and to_columns. */
+static void move_lines(ch::Array<u32>* from_sizes, ch::Array<u32>* from_columns, ch::Array<u32>* to_sizes, ch::Array<u32>* to_columns) {
+	const usize count = from_sizes->count;
+	assert(from_columns->count == count);
+	if (!count) return;
+
+	// reserve grows by the amount, so only the shortfall is asked for
+	if (to_sizes->count + count > to_sizes->allocated) to_sizes->reserve(to_sizes->count + count - to_sizes->allocated);
+	if (to_columns->count + count > to_columns->allocated) to_columns->reserve(to_columns->count + count - to_columns->allocated);
+	ch::mem_copy(to_sizes->data + to_sizes->count, from_sizes->data, count * sizeof(u32));
+	ch::mem_copy(to_columns->data + to_columns->count, from_columns->data, count * sizeof(u32));
+	to_sizes->count += count;
+	to_columns->count += count;
+
+	from_sizes->count = 0;
+	from_columns->count = 0;
+}
+
+static void line_scan_job_main(void* param) {
+	Line_Scan_Job* const job = (Line_Scan_Job*)param;
+
+	ch::Array<u32> sizes;
+	ch::Array<u32> columns;
+	sizes.allocator = ch::get_heap_allocator();
+	columns.allocator = ch::get_heap_allocator();
+	defer(sizes.free());
+	defer(columns.free());
+
+	job->scanner.sizes = &sizes;
+	job->scanner.columns = &columns;
+
+	const usize chunk_size = 4 * 1024 * 1024;
+	for (usize offset = 0; offset < job->size; offset += chunk_size) {
+		if (atomic_load(&job->stop_requested)) return;
+
+		const usize count = job->size - offset < chunk_size ? job->size - offset : chunk_size;
+		const usize next = offset + count;
+		if (job->map && next < job->size) {
+			const usize next_count = job->size - next < chunk_size ? job->size - next : chunk_size;
+			job->map.prefetch((usize)(job->text - job->map.data) + next, next_count);
+		}
+
+		job->scanner.scan(job->text + offset, count);
+
+		job->mutex.lock();
+		move_lines(&sizes, &columns, &job->sizes, &job->columns);
+		job->mutex.unlock();
+
+		atomic_store(&job->scanned_size, next);
+	}
+
+	job->scanner.finish(true);
+	job->scanner.sizes = nullptr;
+	job->scanner.columns = nullptr;
+
+	job->mutex.lock();
+	move_lines(&sizes, &columns, &job->sizes, &job->columns);
+	job->is_done = true;
+	job->mutex.unlock();
+}
+
+bool Line_Scan_Job::start(const u8* in_text, usize in_size, u32 tab_width, const File_Map* in_map) {
+	text = in_text;
+	size = in_size;
+	if (in_map) map = *in_map;
+	scanner = Line_Scanner(tab_width, nullptr, nullptr);
+	sizes.allocator = ch::get_heap_allocator();
+	columns.allocator = ch::get_heap_allocator();
+
+	return thread.start(line_scan_job_main, this);
+}
+
+bool Line_Scan_Job::take_lines(ch::Array<u32>* out_sizes, ch::Array<u32>* out_columns) {
+	mutex.lock();
+	move_lines(&sizes, &columns, out_sizes, out_columns);
+	const bool result = is_done;
+	mutex.unlock();
+
+	if (result) thread.join();
+	return result;
+}
+
+void Line_Scan_Job::stop() {
+	atomic_store(&stop_requested, 1);
+	thread.join();
+
+	sizes.free();
+	columns.free();
+}
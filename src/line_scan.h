@@ -0,0 +1,105 @@
+#pragma once
+
+#include <ch_stl/array.h>
+
+#include "file_map.h"
+#include "threads.h"
+
+enum Line_Scan_Kernel : u8 {
+	LSK_Scalar,
+	LSK_SSE2,
+	LSK_AVX2,
+};
+
+/** @returns the fastest kernel this cpu supports. */
+Line_Scan_Kernel get_best_line_scan_kernel();
+
+/**
+ * Splits text into lines and measures them in bytes and columns without decoding every codepoint.
+ * The text is classified 32 bytes at a time into bit masks of '\n', '\r', tabs, utf-8 continuation bytes and BOM bytes,
+ * so blocks without eol characters cost a handful of popcounts.
+ *
+ * Text can be fed in any amount of contiguous spans, for example both sides of a gap buffer or chunks of a file as they are read.
+ * The results match decoding with ch::UTF8_Iterator and get_char_column_size for valid utf-8.
+ */
+struct Line_Scanner {
+	Line_Scan_Kernel kernel = LSK_Scalar;
+	u32 tab_width = 4;
+
+	/** Every finished line gets its size in bytes and its size in columns pushed here. */
+	ch::Array<u32>* sizes = nullptr;
+	ch::Array<u32>* columns = nullptr;
+
+	/** Line ending counts used to pick a Line_Ending. */
+	u64 num_lf = 0;
+	u64 num_crlf = 0;
+	u64 num_cr = 0;
+
+	/** Size of the line that hasn't ended yet. */
+	u64 line_size = 0;
+	u64 line_columns = 0;
+
+	// State carried over from the previous block.
+	bool pending_cr = false;
+	u8 prev_ef_bits = 0;
+	u8 prev_bb_bit = 0;
+
+	Line_Scanner() = default;
+	Line_Scanner(u32 in_tab_width, ch::Array<u32>* out_sizes, ch::Array<u32>* out_columns);
+
+	/** Scans the next count bytes. data must continue right where the last span stopped. */
+	void scan(const u8* data, usize count);
+
+	/**
+	 * Finishes the current line.
+	 *
+	 * @param is_last_line pushes the trailing line without eol characters if set. Otherwise the scanned text must have ended right after an eol.
+	 */
+	void finish(bool is_last_line);
+
+	void scan_block(const u8* block, u32 count);
+	void push_line();
+};
+
+/**
+ * Scans text for lines on a worker thread. Lines are published in batches that the owner picks up with take_lines.
+ * The text must stay valid and unchanged until the job is done or stopped.
+ */
+struct Line_Scan_Job {
+	const u8* text = nullptr;
+	usize size = 0;
+
+	/**
+	 * Gets asked to read ahead of the scan so disk reads overlap with scanning. Optional.
+	 * A copy of the owner's map so the owner can move around. Never closed by the job.
+	 */
+	File_Map map;
+
+	/** Only touched by the worker until is_done is set. */
+	Line_Scanner scanner;
+
+	Thread thread;
+
+	/** Guards sizes, columns and is_done. */
+	Mutex mutex;
+	ch::Array<u32> sizes;
+	ch::Array<u32> columns;
+	bool is_done = false;
+
+	/** Amount of bytes scanned so far. Used for progress display. */
+	volatile u64 scanned_size = 0;
+	volatile u64 stop_requested = 0;
+
+	/** @returns false if the worker couldn't be started. */
+	bool start(const u8* in_text, usize in_size, u32 tab_width, const File_Map* in_map);
+
+	/**
+	 * Appends the lines published since the last call.
+	 *
+	 * @returns true once every line has been taken. The line ending counts in scanner can be read then.
+	 */
+	bool take_lines(ch::Array<u32>* out_sizes, ch::Array<u32>* out_columns);
+
+	/** Stops the worker and waits for it. Lines that weren't taken yet are dropped. */
+	void stop();
+};
@@ -0,0 +1,556 @@
+#include "line_table.h"
+
+// Fenwick trees are stored 1-indexed. tree.count is always blocks.count + 1.
+
+static CH_FORCEINLINE usize lowest_bit(usize i) {
+	return i & (~i + 1);
+}
+
+static void tree_add(ch::Array<u64>& tree, usize index, s64 delta) {
+	for (usize i = index + 1; i < tree.count; i += lowest_bit(i)) {
+		tree[i] += (u64)delta;
+	}
+}
+
+/** @returns the sum of the first count values. */
+static u64 tree_prefix(const ch::Array<u64>& tree, usize count) {
+	u64 result = 0;
+	for (usize i = count; i > 0; i -= lowest_bit(i)) {
+		result += tree[i];
+	}
+	return result;
+}
+
+/**
+ * Finds the first value where the running sum goes past target.
+ *
+ * @param out_before is set to the sum of all values before the found one
+ * @returns the index of the found value or the amount of values if target is past the total
+ */
+static usize tree_find(const ch::Array<u64>& tree, u64 target, u64* out_before) {
+	usize step = 1;
+	while (step * 2 < tree.count) step *= 2;
+
+	usize pos = 0;
+	u64 before = 0;
+	for (; step; step >>= 1) {
+		if (pos + step < tree.count && before + tree[pos + step] <= target) {
+			pos += step;
+			before += tree[pos];
+		}
+	}
+
+	*out_before = before;
+	return pos;
+}
+
+static CH_FORCEINLINE u64 get_wrapped_count(u32 columns, u64 max_line_width) {
+	return columns / max_line_width + 1;
+}
+
+static u64 get_block_wrapped_sum(const Line_Block* block, u64 max_line_width) {
+	u64 result = 0;
+	for (u32 i = 0; i < block->count; i += 1) {
+		result += get_wrapped_count(block->columns[i], max_line_width);
+	}
+	return result;
+}
+
+static void refresh_block_sums(Line_Block* block, u64 wrap_width) {
+	block->size_sum = 0;
+	block->column_sum = 0;
+	for (u32 i = 0; i < block->count; i += 1) {
+		block->size_sum += block->sizes[i];
+		block->column_sum += block->columns[i];
+	}
+	block->wrapped_sum = wrap_width ? get_block_wrapped_sum(block, wrap_width) : 0;
+}
+
+static Line_Block* make_block() {
+	Line_Block* const result = ch_new Line_Block;
+	result->count = 0;
+	result->size_sum = 0;
+	result->column_sum = 0;
+	result->wrapped_sum = 0;
+	return result;
+}
+
+Line_Table::Line_Table(const ch::Allocator& in_alloc) {
+	blocks.allocator = in_alloc;
+	line_tree.allocator = in_alloc;
+	size_tree.allocator = in_alloc;
+	column_tree.allocator = in_alloc;
+	wrapped_tree.allocator = in_alloc;
+}
+
+void Line_Table::reset() {
+	for (usize i = 1; i < blocks.count; i += 1) {
+		ch_delete blocks[i];
+	}
+	if (blocks.count) {
+		blocks.count = 1;
+	} else {
+		blocks.push(make_block());
+	}
+
+	Line_Block* const block = blocks[0];
+	block->count = 0;
+	refresh_block_sums(block, wrap_width);
+
+	num_lines = 0;
+	total_size = 0;
+	total_columns = 0;
+	rebuild_trees();
+}
+
+void Line_Table::free() {
+	for (Line_Block* block : blocks) {
+		ch_delete block;
+	}
+	blocks.free();
+	line_tree.free();
+	size_tree.free();
+	column_tree.free();
+	wrapped_tree.free();
+	num_lines = 0;
+	total_size = 0;
+	total_columns = 0;
+	wrap_width = 0;
+}
+
+void Line_Table::push(u32 size, u32 columns) {
+	replace(num_lines, 0, &size, &columns, 1);
+}
+
+void Line_Table::replace(usize first_line, usize remove_count, const u32* sizes, const u32* columns, usize count) {
+	if (!blocks.count) reset();
+	assert(first_line + remove_count <= num_lines);
+
+	// Lines that are both removed and inserted are overwritten in place. This is the common case for typing.
+	const usize overwrite_count = remove_count < count ? remove_count : count;
+	for (usize i = 0; i < overwrite_count;) {
+		usize local;
+		const usize block_index = find_block(first_line + i, &local);
+		Line_Block* const block = blocks[block_index];
+
+		s64 size_delta = 0;
+		s64 column_delta = 0;
+		s64 wrapped_delta = 0;
+		for (; local < block->count && i < overwrite_count; local += 1, i += 1) {
+			size_delta += (s64)sizes[i] - (s64)block->sizes[local];
+			column_delta += (s64)columns[i] - (s64)block->columns[local];
+			if (wrap_width) {
+				wrapped_delta += (s64)get_wrapped_count(columns[i], wrap_width) - (s64)get_wrapped_count(block->columns[local], wrap_width);
+			}
+			block->sizes[local] = sizes[i];
+			block->columns[local] = columns[i];
+		}
+
+		adjust_block(block_index, 0, size_delta, column_delta, wrapped_delta);
+	}
+
+	if (remove_count > count) {
+		remove_lines(first_line + count, remove_count - count);
+	} else if (count > remove_count) {
+		insert_lines(first_line + remove_count, sizes + remove_count, columns + remove_count, count - remove_count);
+	}
+}
+
+u32 Line_Table::get_line_size(usize line) const {
+	assert(line < num_lines);
+
+	usize local;
+	const Line_Block* const block = blocks[find_block(line, &local)];
+	return block->sizes[local];
+}
+
+u32 Line_Table::get_line_columns(usize line) const {
+	assert(line < num_lines);
+
+	usize local;
+	const Line_Block* const block = blocks[find_block(line, &local)];
+	return block->columns[local];
+}
+
+u64 Line_Table::get_line_start(usize line) const {
+	assert(line <= num_lines);
+	if (line == num_lines) return total_size;
+
+	usize local;
+	const usize block_index = find_block(line, &local);
+	const Line_Block* const block = blocks[block_index];
+
+	u64 result = tree_prefix(size_tree, block_index);
+	for (usize i = 0; i < local; i += 1) {
+		result += block->sizes[i];
+	}
+	return result;
+}
+
+u64 Line_Table::get_columns_before(usize line) const {
+	assert(line <= num_lines);
+	if (line == num_lines) return total_columns;
+
+	usize local;
+	const usize block_index = find_block(line, &local);
+	const Line_Block* const block = blocks[block_index];
+
+	u64 result = tree_prefix(column_tree, block_index);
+	for (usize i = 0; i < local; i += 1) {
+		result += block->columns[i];
+	}
+	return result;
+}
+
+usize Line_Table::get_line_from_index(u64 index) const {
+	assert(num_lines > 0);
+	if (index >= total_size) return num_lines - 1;
+
+	u64 current_index;
+	const usize block_index = tree_find(size_tree, index, &current_index);
+	assert(block_index < blocks.count);
+	const Line_Block* const block = blocks[block_index];
+
+	const usize lines_before = (usize)tree_prefix(line_tree, block_index);
+	for (usize i = 0; i < block->count; i += 1) {
+		current_index += block->sizes[i];
+		if (current_index > index) return lines_before + i;
+	}
+
+	assert(false);
+	return num_lines - 1;
+}
+
+u64 Line_Table::get_wrapped_lines_before(usize line, u64 max_line_width) const {
+	assert(max_line_width > 0);
+	assert(line <= num_lines);
+	ensure_wrap_width(max_line_width);
+
+	if (line == num_lines) return tree_prefix(wrapped_tree, blocks.count);
+
+	usize local;
+	const usize block_index = find_block(line, &local);
+	const Line_Block* const block = blocks[block_index];
+
+	u64 result = tree_prefix(wrapped_tree, block_index);
+	for (usize i = 0; i < local; i += 1) {
+		result += get_wrapped_count(block->columns[i], max_line_width);
+	}
+	return result;
+}
+
+usize Line_Table::get_line_from_wrapped_line(u64 wrapped_line, u64 max_line_width, u64* out_wrapped_lines_before) const {
+	assert(max_line_width > 0);
+	assert(num_lines > 0);
+	ensure_wrap_width(max_line_width);
+
+	u64 current_wrapped;
+	const usize block_index = tree_find(wrapped_tree, wrapped_line, &current_wrapped);
+	if (block_index < blocks.count) {
+		const Line_Block* const block = blocks[block_index];
+		const usize lines_before = (usize)tree_prefix(line_tree, block_index);
+		for (usize i = 0; i < block->count; i += 1) {
+			const u64 wrapped_count = get_wrapped_count(block->columns[i], max_line_width);
+			if (current_wrapped + wrapped_count > wrapped_line) {
+				*out_wrapped_lines_before = current_wrapped;
+				return lines_before + i;
+			}
+			current_wrapped += wrapped_count;
+		}
+	}
+
+	const usize last_line = num_lines - 1;
+	*out_wrapped_lines_before = get_wrapped_lines_before(last_line, max_line_width);
+	return last_line;
+}
+
+usize Line_Table::find_block(usize line, usize* out_local) const {
+	assert(blocks.count);
+
+	u64 lines_before;
+	usize block_index = tree_find(line_tree, line, &lines_before);
+	if (block_index >= blocks.count) {
+		// Asking for the line right after the last one. Point at the end of the last block.
+		block_index = blocks.count - 1;
+		lines_before = num_lines - blocks[block_index]->count;
+	}
+
+	*out_local = line - (usize)lines_before;
+	return block_index;
+}
+
+void Line_Table::remove_lines(usize line, usize count) {
+	assert(line + count <= num_lines);
+	if (!count) return;
+
+	usize local;
+	const usize first_block = find_block(line, &local);
+	usize block_index = first_block;
+
+	for (usize remaining = count; remaining; block_index += 1) {
+		Line_Block* const block = blocks[block_index];
+
+		const usize remove_count = (block->count - local < remaining) ? block->count - local : remaining;
+		const usize tail_count = block->count - local - remove_count;
+
+		s64 size_delta = 0;
+		s64 column_delta = 0;
+		s64 wrapped_delta = 0;
+		for (usize i = local; i < local + remove_count; i += 1) {
+			size_delta -= block->sizes[i];
+			column_delta -= block->columns[i];
+			if (wrap_width) wrapped_delta -= get_wrapped_count(block->columns[i], wrap_width);
+		}
+
+		ch::mem_move(block->sizes + local, block->sizes + local + remove_count, tail_count * sizeof(u32));
+		ch::mem_move(block->columns + local, block->columns + local + remove_count, tail_count * sizeof(u32));
+		block->count -= (u32)remove_count;
+
+		if (block_index == first_block && remove_count == count && (block->count >= line_block_capacity / 4 || blocks.count == 1)) {
+			// Everything came out of a single block that is still alive and full enough so only its sums change.
+			adjust_block(block_index, -(s64)remove_count, size_delta, column_delta, wrapped_delta);
+			return;
+		}
+
+		block->size_sum += size_delta;
+		block->column_sum += column_delta;
+		block->wrapped_sum += wrapped_delta;
+		num_lines -= remove_count;
+		total_size += size_delta;
+		total_columns += column_delta;
+
+		remaining -= remove_count;
+		local = 0;
+	}
+
+	// Drop the blocks that were emptied. At least one block always stays around.
+	usize write_index = first_block;
+	for (usize i = first_block; i < blocks.count; i += 1) {
+		Line_Block* const block = blocks[i];
+		if (i < block_index && !block->count && blocks.count - (i - write_index) > 1) {
+			ch_delete block;
+			continue;
+		}
+		blocks[write_index] = block;
+		write_index += 1;
+	}
+	blocks.count = write_index;
+
+	// Only the blocks at the ends of the removed lines can have been left with few lines
+	if (first_block + 1 < blocks.count) merge_small_block(first_block + 1);
+	merge_small_block(first_block < blocks.count ? first_block : blocks.count - 1);
+
+	rebuild_trees();
+}
+
+void Line_Table::merge_small_block(usize block_index) {
+	Line_Block* const block = blocks[block_index];
+	if (blocks.count < 2 || block->count >= line_block_capacity / 4) return;
+
+	// The block and the one after it, or the one before it if it's the last
+	const usize left_index = block_index + 1 < blocks.count ? block_index : block_index - 1;
+	Line_Block* const left = blocks[left_index];
+	Line_Block* const right = blocks[left_index + 1];
+
+	if (left->count + right->count <= line_block_capacity) {
+		ch::mem_copy(left->sizes + left->count, right->sizes, right->count * sizeof(u32));
+		ch::mem_copy(left->columns + left->count, right->columns, right->count * sizeof(u32));
+		left->count += right->count;
+		refresh_block_sums(left, wrap_width);
+
+		ch_delete right;
+		blocks.remove(left_index + 1);
+		return;
+	}
+
+	// Too many for one block, so they're evened out instead. Both end up more than half full.
+	const u32 left_count = (left->count + right->count) / 2;
+	if (left->count < left_count) {
+		const u32 moved_count = left_count - left->count;
+		ch::mem_copy(left->sizes + left->count, right->sizes, moved_count * sizeof(u32));
+		ch::mem_copy(left->columns + left->count, right->columns, moved_count * sizeof(u32));
+		ch::mem_move(right->sizes, right->sizes + moved_count, (right->count - moved_count) * sizeof(u32));
+		ch::mem_move(right->columns, right->columns + moved_count, (right->count - moved_count) * sizeof(u32));
+		left->count += moved_count;
+		right->count -= moved_count;
+	} else {
+		const u32 moved_count = left->count - left_count;
+		ch::mem_move(right->sizes + moved_count, right->sizes, right->count * sizeof(u32));
+		ch::mem_move(right->columns + moved_count, right->columns, right->count * sizeof(u32));
+		ch::mem_copy(right->sizes, left->sizes + left_count, moved_count * sizeof(u32));
+		ch::mem_copy(right->columns, left->columns + left_count, moved_count * sizeof(u32));
+		left->count -= moved_count;
+		right->count += moved_count;
+	}
+	refresh_block_sums(left, wrap_width);
+	refresh_block_sums(right, wrap_width);
+}
+
+void Line_Table::insert_lines(usize line, const u32* sizes, const u32* columns, usize count) {
+	assert(line <= num_lines);
+	if (!count) return;
+
+	usize local;
+	usize block_index = find_block(line, &local);
+	Line_Block* block = blocks[block_index];
+
+	if (block->count + count <= line_block_capacity) {
+		const usize tail_count = block->count - local;
+		ch::mem_move(block->sizes + local + count, block->sizes + local, tail_count * sizeof(u32));
+		ch::mem_move(block->columns + local + count, block->columns + local, tail_count * sizeof(u32));
+		ch::mem_copy(block->sizes + local, sizes, count * sizeof(u32));
+		ch::mem_copy(block->columns + local, columns, count * sizeof(u32));
+		block->count += (u32)count;
+
+		s64 size_delta = 0;
+		s64 column_delta = 0;
+		s64 wrapped_delta = 0;
+		for (usize i = 0; i < count; i += 1) {
+			size_delta += sizes[i];
+			column_delta += columns[i];
+			if (wrap_width) wrapped_delta += get_wrapped_count(columns[i], wrap_width);
+		}
+
+		adjust_block(block_index, (s64)count, size_delta, column_delta, wrapped_delta);
+		return;
+	}
+
+	// The block overflows. Move its tail out of the way, then refill it with the new lines followed
+	// by the tail, allocating new blocks as needed. The new blocks are spliced in all at once.
+	const usize tail_count = block->count - local;
+	u32 tail_sizes[line_block_capacity];
+	u32 tail_columns[line_block_capacity];
+	ch::mem_copy(tail_sizes, block->sizes + local, tail_count * sizeof(u32));
+	ch::mem_copy(tail_columns, block->columns + local, tail_count * sizeof(u32));
+
+	// Lines appended to the end fill every block, like when a file is loaded. Anywhere else the lines are spread evenly over blocks
+	// that are at least half full, so that more lines can go in the same place before it splits again.
+	const usize total_count = block->count + count;
+	const bool is_append = line == num_lines;
+	const usize num_filled = is_append ? (total_count + line_block_capacity - 1) / line_block_capacity : total_count / (line_block_capacity / 2);
+	auto get_fill = [&](usize filled_index) -> usize {
+		if (is_append) return filled_index + 1 < num_filled ? line_block_capacity : total_count - line_block_capacity * filled_index;
+		return total_count * (filled_index + 1) / num_filled - total_count * filled_index / num_filled;
+	};
+	block->count = (u32)local;
+
+	ch::Array<Line_Block*> new_blocks;
+	new_blocks.allocator = blocks.allocator;
+	defer(new_blocks.free());
+
+	usize filled_index = 0;
+	usize fill = get_fill(0);
+	auto append = [&](const u32* in_sizes, const u32* in_columns, usize in_count) {
+		while (in_count) {
+			if (block->count == fill) {
+				refresh_block_sums(block, wrap_width);
+				block = make_block();
+				new_blocks.push(block);
+				filled_index += 1;
+				fill = get_fill(filled_index);
+			}
+
+			const usize space = fill - block->count;
+			const usize copy_count = in_count < space ? in_count : space;
+			ch::mem_copy(block->sizes + block->count, in_sizes, copy_count * sizeof(u32));
+			ch::mem_copy(block->columns + block->count, in_columns, copy_count * sizeof(u32));
+			block->count += (u32)copy_count;
+
+			in_sizes += copy_count;
+			in_columns += copy_count;
+			in_count -= copy_count;
+		}
+	};
+	if (block->count > fill) {
+		// The lines before the new ones don't all fit in the first block
+		const usize moved_count = block->count - fill;
+		block->count = (u32)fill;
+		u32 moved_sizes[line_block_capacity];
+		u32 moved_columns[line_block_capacity];
+		ch::mem_copy(moved_sizes, block->sizes + fill, moved_count * sizeof(u32));
+		ch::mem_copy(moved_columns, block->columns + fill, moved_count * sizeof(u32));
+		append(moved_sizes, moved_columns, moved_count);
+	}
+	append(sizes, columns, count);
+	append(tail_sizes, tail_columns, tail_count);
+	refresh_block_sums(block, wrap_width);
+
+	const usize old_block_count = blocks.count;
+	const usize new_block_count = old_block_count + new_blocks.count;
+	if (new_block_count > blocks.allocated) {
+		blocks.reserve(new_block_count - blocks.allocated);
+	}
+	ch::mem_move(blocks.data + block_index + 1 + new_blocks.count, blocks.data + block_index + 1, (old_block_count - block_index - 1) * sizeof(Line_Block*));
+	ch::mem_copy(blocks.data + block_index + 1, new_blocks.data, new_blocks.count * sizeof(Line_Block*));
+	blocks.count = new_block_count;
+
+	for (usize i = 0; i < count; i += 1) {
+		total_size += sizes[i];
+		total_columns += columns[i];
+	}
+	num_lines += count;
+
+	rebuild_trees();
+}
+
+void Line_Table::adjust_block(usize block_index, s64 line_delta, s64 size_delta, s64 column_delta, s64 wrapped_delta) {
+	Line_Block* const block = blocks[block_index];
+	block->size_sum += size_delta;
+	block->column_sum += column_delta;
+	block->wrapped_sum += wrapped_delta;
+
+	num_lines += line_delta;
+	total_size += size_delta;
+	total_columns += column_delta;
+
+	tree_add(line_tree, block_index, line_delta);
+	tree_add(size_tree, block_index, size_delta);
+	tree_add(column_tree, block_index, column_delta);
+	if (wrap_width) tree_add(wrapped_tree, block_index, wrapped_delta);
+}
+
+void Line_Table::ensure_wrap_width(u64 max_line_width) const {
+	if (wrap_width == max_line_width) return;
+
+	wrap_width = max_line_width;
+	wrapped_tree.count = 0;
+	wrapped_tree.push(0);
+	for (Line_Block* block : blocks) {
+		block->wrapped_sum = get_block_wrapped_sum(block, max_line_width);
+		wrapped_tree.push(block->wrapped_sum);
+	}
+
+	for (usize i = 1; i < wrapped_tree.count; i += 1) {
+		const usize parent = i + lowest_bit(i);
+		if (parent < wrapped_tree.count) wrapped_tree[parent] += wrapped_tree[i];
+	}
+}
+
+void Line_Table::rebuild_trees() {
+	line_tree.count = 0;
+	size_tree.count = 0;
+	column_tree.count = 0;
+	wrapped_tree.count = 0;
+
+	line_tree.push(0);
+	size_tree.push(0);
+	column_tree.push(0);
+	wrapped_tree.push(0);
+	for (const Line_Block* block : blocks) {
+		line_tree.push(block->count);
+		size_tree.push(block->size_sum);
+		column_tree.push(block->column_sum);
+		wrapped_tree.push(block->wrapped_sum);
+	}
+
+	// Builds all the trees in O(n) by pushing every node's sum up into its parent.
+	for (usize i = 1; i < line_tree.count; i += 1) {
+		const usize parent = i + lowest_bit(i);
+		if (parent < line_tree.count) {
+			line_tree[parent] += line_tree[i];
+			size_tree[parent] += size_tree[i];
+			column_tree[parent] += column_tree[i];
+			wrapped_tree[parent] += wrapped_tree[i];
+		}
+	}
+}
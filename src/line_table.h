@@ -0,0 +1,103 @@
+#pragma once
+
+#include <ch_stl/array.h>
+
+/** Max amount of lines stored in a single Line_Block. */
+const usize line_block_capacity = 512;
+
+struct Line_Block {
+	u32 count;
+
+	/** Cached sums of this block's lines. These are what the Fenwick trees in Line_Table are built from. */
+	u64 size_sum;
+	u64 column_sum;
+	/** Sum of (columns / wrap_width + 1) for every line in this block. Only valid while Line_Table::wrap_width is set. */
+	u64 wrapped_sum;
+
+	u32 sizes[line_block_capacity];
+	u32 columns[line_block_capacity];
+};
+
+/**
+ * Table of every line's size in bytes (with eol characters) and in columns.
+ *
+ * Lines are stored in fixed size blocks. Fenwick trees over the blocks keep prefix sums of lines, bytes, columns and wrapped lines,
+ * so line to offset and offset to line lookups are O(log n) plus a scan inside a single block.
+ * Edits only touch the blocks they change and update the trees in O(log n). Splitting or removing a block rebuilds the trees in O(n / line_block_capacity).
+ * A block that overflows is split into blocks that are at least half full and one that drops under a quarter full is merged into a neighbour,
+ * so that happens once every so many lines edited in the same place.
+ */
+struct Line_Table {
+	ch::Array<Line_Block*> blocks;
+
+	ch::Array<u64> line_tree;
+	ch::Array<u64> size_tree;
+	ch::Array<u64> column_tree;
+
+	/** Wrapped line sums are only kept for the last max_line_width asked for. */
+	mutable ch::Array<u64> wrapped_tree;
+	mutable u64 wrap_width = 0;
+
+	usize num_lines = 0;
+	u64 total_size = 0;
+	u64 total_columns = 0;
+
+	Line_Table() = default;
+	Line_Table(const ch::Allocator& in_alloc);
+
+	CH_FORCEINLINE usize count() const { return num_lines; }
+
+	/** Removes all lines. Keeps the allocated blocks. */
+	void reset();
+	void free();
+
+	void push(u32 size, u32 columns);
+
+	/**
+	 * Replaces remove_count lines starting at first_line with count new lines.
+	 *
+	 * @param sizes are the new line sizes in bytes
+	 * @param columns are the new line sizes in columns
+	 */
+	void replace(usize first_line, usize remove_count, const u32* sizes, const u32* columns, usize count);
+
+	u32 get_line_size(usize line) const;
+	u32 get_line_columns(usize line) const;
+
+	/** @returns the byte offset of the start of line. line can be count() to get the total size. */
+	u64 get_line_start(usize line) const;
+
+	/** @returns the amount of columns in all lines before line. line can be count() to get the total amount of columns. */
+	u64 get_columns_before(usize line) const;
+
+	/** @returns the line that contains index. Indices past the end return the last line. */
+	usize get_line_from_index(u64 index) const;
+
+	/** @returns the amount of wrapped lines before line. line can be count(). */
+	u64 get_wrapped_lines_before(usize line, u64 max_line_width) const;
+
+	/**
+	 * Finds the line that contains a wrapped line.
+	 *
+	 * @param out_wrapped_lines_before is set to the amount of wrapped lines before the found line
+	 * @returns the found line or the last line if wrapped_line is past the end
+	 */
+	usize get_line_from_wrapped_line(u64 wrapped_line, u64 max_line_width, u64* out_wrapped_lines_before) const;
+
+	/** @returns the block that holds line and sets out_local to the line's index inside of it. line can be count(). */
+	usize find_block(usize line, usize* out_local) const;
+
+	void remove_lines(usize line, usize count);
+	void insert_lines(usize line, const u32* sizes, const u32* columns, usize count);
+
+	/** Merges a block that's less than a quarter full into a neighbour, or evens the two out if they don't fit in one. The trees have to be rebuilt after. */
+	void merge_small_block(usize block_index);
+
+	/** Applies the change of a single block's sums to the trees. */
+	void adjust_block(usize block_index, s64 line_delta, s64 size_delta, s64 column_delta, s64 wrapped_delta);
+
+	void ensure_wrap_width(u64 max_line_width) const;
+
+	/** Rebuilds the trees from the blocks' cached sums. Used when blocks are added or removed. */
+	void rebuild_trees();
+};
@@ -0,0 +1,41 @@
+#include "parse_job.h"
+
+void Parse_Job::run() {
+	if (edit.is_set && base.count) {
+		// Relexing starts from the old lexemes. base belongs to the buffer so they're copied rather than written to.
+		lexemes.catch_up(base);
+	} else {
+		// Whatever is left from the last parse belongs to older text
+		lexemes.count = 0;
+	}
+
+	// They're of no parse if it's stopped
+	lexemes.version = 0;
+	succeeded = parsing::parse_text(text, language, lexemes, edit, &stop_requested, &lex_time, &parse_time);
+	if (succeeded) lexemes.version = base.version + 1;
+}
+
+static void parse_job_main(void* param) {
+	Parse_Job* const job = (Parse_Job*)param;
+
+	job->run();
+	atomic_store(&job->is_done, 1);
+}
+
+bool Parse_Job::start() {
+	return thread.start(parse_job_main, this);
+}
+
+bool Parse_Job::finish() {
+	thread.join();
+	assert(atomic_load(&is_done));
+	return succeeded;
+}
+
+void Parse_Job::free() {
+	thread.join();
+
+	text_copy.free();
+	text.free();
+	lexemes.free();
+}
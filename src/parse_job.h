@@ -0,0 +1,63 @@
+#pragma once
+
+#include <ch_stl/gap_buffer.h>
+
+#include "buffer.h"
+#include "threads.h"
+
+/**
+ * Lexes and parses a snapshot of a buffer's text on a worker thread.
+ * The buffer keeps drawing with its old lexemes until the job is done and they're swapped.
+ */
+struct Parse_Job {
+	/** Copy of a gap buffer's text. The next snapshot only copies what changed since, moving its gap like the buffer's. */
+	ch::Gap_Buffer<u8> text_copy;
+	bool has_text_copy = false;
+
+	/** Text that changed since text_copy was taken. */
+	Edit_Range copy_edit;
+
+	/** What gets parsed: text_copy, or the pieces of a piece tree, which are never written to once they're in it. */
+	parsing::Text text;
+
+	/**
+	 * Lexemes the worker writes. Swapped with Buffer::lexemes when it succeeds, so then they're the ones the buffer's
+	 * were parsed from and only what that parse changed is copied from base the next time.
+	 */
+	parsing::Lexemes lexemes;
+
+	/** The buffer's lexemes when the snapshot was taken. Only read. */
+	parsing::Lexemes base;
+
+	/** Where the snapshot differs from base. Everything gets lexed again if it's not set. */
+	Edit_Range edit;
+
+	parsing::Language language = parsing::LANG_CPP;
+
+	f64 lex_time = 0;
+	f64 parse_time = 0;
+
+	Thread thread;
+	volatile u64 is_done = 0;
+
+	/** Set by the owner when the snapshot is out of date. The worker gives up at the next lexing chunk or declaration. */
+	volatile u64 stop_requested = 0;
+
+	/** Only valid once is_done is set. false if the job was stopped. */
+	bool succeeded = false;
+
+	/** @returns false if the worker couldn't be started. */
+	bool start();
+
+	/** Does the job on the calling thread. */
+	void run();
+
+	/**
+	 * Waits for the worker.
+	 *
+	 * @returns true if lexemes hold the syntax of text
+	 */
+	bool finish();
+
+	void free();
+};
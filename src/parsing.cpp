@@ -1,242 +1,121 @@
 #include "parsing.h"
 #include "buffer.h"
+#include "threads.h"
+#include "symbol_index.h"
 #include <ch_stl/time.h>
 
+#include "parsing_cpp_keyword_table.h"
+
 namespace parsing {
-// This is a column-reduction table to map 128 ASCII values to a 11-input space.
-// The values in this table are premultiplied with the number of DFA states
-// to save one multiply when indexing the state transition table.
-#define P (DFA_NUM_STATES)
-static const u8 char_type[] = {
-    WHITE*P, WHITE*P, WHITE*P, WHITE*P, WHITE*P, WHITE*P, WHITE*P, WHITE*P,
-    WHITE*P, WHITE*P, NEWLINE*P, WHITE*P, WHITE*P, NEWLINE*P, WHITE*P, WHITE*P,
-    WHITE*P, WHITE*P, WHITE*P, WHITE*P, WHITE*P, WHITE*P, WHITE*P, WHITE*P,
-    WHITE*P, WHITE*P, WHITE*P, WHITE*P, WHITE*P, WHITE*P, WHITE*P, WHITE*P,
-    WHITE*P, OP*P, DOUBLEQUOTE*P, OP*P, IDENT*P, OP*P, OP*P, SINGLEQUOTE*P,
-    OP*P, OP*P, STAR*P, OP*P, OP*P, OP*P, OP*P, SLASH*P,
-    DIGIT*P, DIGIT*P, DIGIT*P, DIGIT*P, DIGIT*P, DIGIT*P, DIGIT*P, DIGIT*P,
-    DIGIT*P, DIGIT*P, OP*P, OP*P, OP*P, OP*P, OP*P, OP*P,
-    IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P,
-    IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P,
-    IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P,
-    IDENT*P, IDENT*P, IDENT*P, OP*P, BS*P, OP*P, OP*P, IDENT*P,
-    IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P,
-    IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P,
-    IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P,
-    IDENT*P, IDENT*P, IDENT*P, OP*P, OP*P, OP*P, OP*P, WHITE*P,
-    IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P,
-    IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P,
-    IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P,
-    IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P,
-    IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P,
-    IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P,
-    IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P,
-    IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P,
-    IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P,
-    IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P,
-    IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P,
-    IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P,
-    IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P,
-    IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P,
-    IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P,
-    IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P, IDENT*P,
-};
-// This is a state transition table for the deterministic finite
-// automaton (DFA) lexer. Overtop this DFA runs a block-comment scanner.
-// This table is written in column-major format, because it allows for a
-// premultiplied column index as mentioned above.
-static const u8 lex_table[] = {
-    // WHITE
-    DFA_BLOCK_COMMENT, // DFA_BLOCK_COMMENT
-    DFA_BLOCK_COMMENT, // DFA_BLOCK_COMMENT_STAR
-    DFA_LINE_COMMENT,  // DFA_LINE_COMMENT
-    DFA_WHITE,         // DFA_WHITE
-    DFA_WHITE,         // DFA_WHITE_BS
-    DFA_NEWLINE,       // DFA_NEWLINE
-    DFA_STRINGLIT,     // DFA_STRINGLIT
-    DFA_STRINGLIT,     // DFA_STRINGLIT_BS
-    DFA_CHARLIT,       // DFA_CHARLIT
-    DFA_CHARLIT,       // DFA_CHARLIT_BS
-    DFA_WHITE,         // DFA_SLASH
-    DFA_WHITE,         // DFA_IDENT
-    DFA_WHITE,         // DFA_OP
-    DFA_WHITE,         // DFA_OP2
-    DFA_WHITE,         // DFA_NUMLIT
-    // NEWLINE
-    DFA_BLOCK_COMMENT, // DFA_BLOCK_COMMENT
-    DFA_BLOCK_COMMENT, // DFA_BLOCK_COMMENT_STAR
-    DFA_NEWLINE,       // DFA_LINE_COMMENT
-    DFA_NEWLINE,       // DFA_WHITE
-    DFA_WHITE,         // DFA_WHITE_BS
-    DFA_NEWLINE,       // DFA_NEWLINE
-    DFA_STRINGLIT,     // DFA_STRINGLIT
-    DFA_STRINGLIT,     // DFA_STRINGLIT_BS
-    DFA_NEWLINE,       // DFA_CHARLIT
-    DFA_CHARLIT,       // DFA_CHARLIT_BS
-    DFA_NEWLINE,       // DFA_SLASH
-    DFA_NEWLINE,       // DFA_IDENT
-    DFA_NEWLINE,       // DFA_OP
-    DFA_NEWLINE,       // DFA_OP2
-    DFA_NEWLINE,       // DFA_NUMLIT
-    // IDENT
-    DFA_BLOCK_COMMENT, // DFA_BLOCK_COMMENT
-    DFA_BLOCK_COMMENT, // DFA_BLOCK_COMMENT_STAR
-    DFA_LINE_COMMENT,  // DFA_LINE_COMMENT
-    DFA_IDENT,         // DFA_WHITE
-    DFA_IDENT,         // DFA_WHITE_BS
-    DFA_IDENT,         // DFA_NEWLINE
-    DFA_STRINGLIT,     // DFA_STRINGLIT
-    DFA_STRINGLIT,     // DFA_STRINGLIT_BS
-    DFA_CHARLIT,       // DFA_CHARLIT
-    DFA_CHARLIT,       // DFA_CHARLIT_BS
-    DFA_IDENT,         // DFA_SLASH
-    DFA_IDENT,         // DFA_IDENT
-    DFA_IDENT,         // DFA_OP
-    DFA_IDENT,         // DFA_OP2
-    DFA_NUMLIT,        // DFA_NUMLIT
-    // DOUBLEQUOTE
-    DFA_BLOCK_COMMENT, // DFA_BLOCK_COMMENT
-    DFA_BLOCK_COMMENT, // DFA_BLOCK_COMMENT_STAR
-    DFA_LINE_COMMENT,  // DFA_LINE_COMMENT
-    DFA_STRINGLIT,     // DFA_WHITE
-    DFA_STRINGLIT,     // DFA_WHITE_BS
-    DFA_STRINGLIT,     // DFA_NEWLINE
-    DFA_WHITE,         // DFA_STRINGLIT
-    DFA_STRINGLIT,     // DFA_STRINGLIT_BS
-    DFA_CHARLIT,       // DFA_CHARLIT
-    DFA_CHARLIT,       // DFA_CHARLIT_BS
-    DFA_STRINGLIT,     // DFA_SLASH
-    DFA_STRINGLIT,     // DFA_IDENT
-    DFA_STRINGLIT,     // DFA_OP
-    DFA_STRINGLIT,     // DFA_OP2
-    DFA_STRINGLIT,     // DFA_NUMLIT
-    // SINGLEQUOTE
-    DFA_BLOCK_COMMENT, // DFA_BLOCK_COMMENT
-    DFA_BLOCK_COMMENT, // DFA_BLOCK_COMMENT_STAR
-    DFA_LINE_COMMENT,  // DFA_LINE_COMMENT
-    DFA_CHARLIT,       // DFA_WHITE
-    DFA_CHARLIT,       // DFA_WHITE_BS
-    DFA_CHARLIT,       // DFA_NEWLINE
-    DFA_STRINGLIT,     // DFA_STRINGLIT
-    DFA_STRINGLIT,     // DFA_STRINGLIT_BS
-    DFA_WHITE,         // DFA_CHARLIT
-    DFA_CHARLIT,       // DFA_CHARLIT_BS
-    DFA_CHARLIT,       // DFA_SLASH
-    DFA_CHARLIT,       // DFA_IDENT
-    DFA_CHARLIT,       // DFA_OP
-    DFA_CHARLIT,       // DFA_OP2
-    DFA_NUMLIT,        // DFA_NUMLIT
-    // DIGIT
-    DFA_BLOCK_COMMENT, // DFA_BLOCK_COMMENT
-    DFA_BLOCK_COMMENT, // DFA_BLOCK_COMMENT_STAR
-    DFA_LINE_COMMENT,  // DFA_LINE_COMMENT
-    DFA_NUMLIT,        // DFA_WHITE
-    DFA_NUMLIT,        // DFA_WHITE_BS
-    DFA_NUMLIT,        // DFA_NEWLINE
-    DFA_STRINGLIT,     // DFA_STRINGLIT
-    DFA_STRINGLIT,     // DFA_STRINGLIT_BS
-    DFA_CHARLIT,       // DFA_CHARLIT
-    DFA_CHARLIT,       // DFA_CHARLIT_BS
-    DFA_NUMLIT,        // DFA_SLASH
-    DFA_IDENT,         // DFA_IDENT
-    DFA_NUMLIT,        // DFA_OP
-    DFA_NUMLIT,        // DFA_OP2
-    DFA_NUMLIT,        // DFA_NUMLIT
-    // SLASH
-    DFA_BLOCK_COMMENT, // DFA_BLOCK_COMMENT
-    DFA_WHITE,         // DFA_BLOCK_COMMENT_STAR
-    DFA_LINE_COMMENT,  // DFA_LINE_COMMENT
-    DFA_SLASH,         // DFA_WHITE
-    DFA_SLASH,         // DFA_WHITE_BS
-    DFA_SLASH,         // DFA_NEWLINE
-    DFA_STRINGLIT,     // DFA_STRINGLIT
-    DFA_STRINGLIT,     // DFA_STRINGLIT_BS
-    DFA_CHARLIT,       // DFA_CHARLIT
-    DFA_CHARLIT,       // DFA_CHARLIT_BS
-    DFA_LINE_COMMENT,  // DFA_SLASH
-    DFA_SLASH,         // DFA_IDENT
-    DFA_SLASH,         // DFA_OP
-    DFA_SLASH,         // DFA_OP2
-    DFA_SLASH,         // DFA_NUMLIT
-    // STAR
-    DFA_BLOCK_COMMENT_STAR, // DFA_BLOCK_COMMENT
-    DFA_BLOCK_COMMENT_STAR, // DFA_BLOCK_COMMENT_STAR
-    DFA_LINE_COMMENT,       // DFA_LINE_COMMENT
-    DFA_OP,                 // DFA_WHITE
-    DFA_OP,                 // DFA_WHITE_BS
-    DFA_OP,                 // DFA_NEWLINE
-    DFA_STRINGLIT,          // DFA_STRINGLIT
-    DFA_STRINGLIT,          // DFA_STRINGLIT_BS
-    DFA_CHARLIT,            // DFA_CHARLIT
-    DFA_CHARLIT,            // DFA_CHARLIT_BS
-    DFA_BLOCK_COMMENT,      // DFA_SLASH
-    DFA_OP,                 // DFA_IDENT
-    DFA_OP2,                // DFA_OP
-    DFA_OP,                 // DFA_OP2
-    DFA_OP,                 // DFA_NUMLIT
-    // BS
-    DFA_BLOCK_COMMENT, // DFA_BLOCK_COMMENT
-    DFA_BLOCK_COMMENT, // DFA_BLOCK_COMMENT_STAR
-    DFA_LINE_COMMENT,  // DFA_LINE_COMMENT
-    DFA_WHITE_BS,      // DFA_WHITE
-    DFA_WHITE_BS,      // DFA_WHITE_BS
-    DFA_WHITE_BS,      // DFA_NEWLINE
-    DFA_STRINGLIT_BS,  // DFA_STRINGLIT
-    DFA_STRINGLIT,     // DFA_STRINGLIT_BS
-    DFA_CHARLIT_BS,    // DFA_CHARLIT
-    DFA_CHARLIT,       // DFA_CHARLIT_BS
-    DFA_WHITE_BS,      // DFA_SLASH
-    DFA_WHITE_BS,      // DFA_IDENT
-    DFA_WHITE_BS,      // DFA_OP
-    DFA_WHITE_BS,      // DFA_OP2
-    DFA_WHITE_BS,      // DFA_NUMLIT
-    // OP
-    DFA_BLOCK_COMMENT, // DFA_BLOCK_COMMENT
-    DFA_BLOCK_COMMENT, // DFA_BLOCK_COMMENT_STAR
-    DFA_LINE_COMMENT,  // DFA_LINE_COMMENT
-    DFA_OP,            // DFA_WHITE
-    DFA_OP,            // DFA_WHITE_BS
-    DFA_OP,            // DFA_NEWLINE
-    DFA_STRINGLIT,     // DFA_STRINGLIT
-    DFA_STRINGLIT,     // DFA_STRINGLIT_BS
-    DFA_CHARLIT,       // DFA_CHARLIT
-    DFA_CHARLIT,       // DFA_CHARLIT_BS
-    DFA_OP,            // DFA_SLASH
-    DFA_OP,            // DFA_IDENT
-    DFA_OP2,           // DFA_OP
-    DFA_OP,            // DFA_OP2
-    DFA_OP,            // DFA_NUMLIT
+// No lexeme, for lexemes that haven't been found yet.
+const usize no_lexeme = (usize)-1;
+
+// Lexemes [first_changed + 1, old_end) were lexed again into [first_changed + 1, new_end).
+// first_changed was kept, but where it ends may have moved.
+struct Relexed_Range {
+    usize first_changed;
+    usize new_end;
+    usize old_end;
 };
 
-u8 lex(u8 dfa, const u8* p, const u8* const end, Lexeme*& lexemes) {
-    while (p < end) {
-        u8 new_dfa = lex_table[dfa + char_type[*p]];
-        if (new_dfa != dfa) {
-            lexemes->i = p;
-            lexemes->dfa = (Lex_Dfa)new_dfa;
-            lexemes->cached_first = *p;
-            lexemes++;
-            dfa = new_dfa;
-        }
-        p++;
+// Recursive descent over the lexemes of one buffer. Lexemes are passed around as indices.
+// Everything it looks at is in here, so buffers can be parsed on several threads at once.
+struct Parser {
+    u8* dfa;
+    const u8* first_byte;
+    const u32* offsets;
+
+    // The text is read where it is, from the span the last token was in. Lexemes are mostly read in order,
+    // so it's nearly always the one the next token is in too.
+    const Text* text;
+    mutable const u8* span_data = nullptr;
+    mutable usize span_begin = 0;
+    mutable usize span_end = 0;
+
+    // The start of a lexeme that goes across spans, put back together.
+    // Tokens are only compared if they fit in a keyword, so that's all that's needed.
+    mutable u8 stitched[max_keyword_size];
+
+    // Checked between statements. Can be null.
+    const volatile u64* stop_requested = nullptr;
+
+    // Gets every bracket pair the parser goes into, in order.
+    ch::Array<Bracket>* brackets;
+    // The opening bracket and depth of the pair it's in. Both are back to 0 after every declaration.
+    u32 bracket_parent = 0;
+    u32 bracket_depth = 0;
+
+    // Gets every name defined, in order.
+    ch::Array<Definition>* definitions;
+    // A function body can't tell a call from a declaration, so functions and parameters aren't defined in one.
+    bool is_in_function_body = false;
+
+    Parser(Lexemes& lexemes, const Text& in_text) : dfa(lexemes.dfa), first_byte(lexemes.first), offsets(lexemes.offsets), text(&in_text), brackets(&lexemes.brackets), definitions(&lexemes.definitions) {}
+
+    CH_FORCEINLINE bool is_stopped() const { return stop_requested && atomic_load(stop_requested); }
+
+    CH_FORCEINLINE u8 c(usize l) const { return first_byte[l]; }
+
+    // There's always a lexeme after the ones being parsed, so this works for all of them.
+    CH_FORCEINLINE u64 toklen(usize l) const { return offsets[l + 1] - offsets[l]; }
+
+    // The text of a lexeme, contiguous for its first max_keyword_size bytes.
+    CH_FORCEINLINE const u8* token(usize l) const {
+        const usize offset = offsets[l];
+        if (offset >= span_begin && offsets[l + 1] <= span_end) return span_data + (offset - span_begin);
+        return find_token(l);
     }
-    return dfa;
-}
+    const u8* find_token(usize l) const;
 
-const u8* temp_parser_gap;
-u64 temp_parser_gap_size;
+    bool is_keyword(usize l) const;
 
-static const u8 lexeme_sentinel_buffer[16];
-u64 toklen(const Lexeme* l) {
-    const u8* next_i = l[1].i;
-    if (next_i == lexeme_sentinel_buffer) next_i = l[2].i;
-    if (next_i == temp_parser_gap + temp_parser_gap_size) next_i = temp_parser_gap;
-    return next_i - l->i;
-}
+    usize open_bracket(usize l, Bracket_Kind kind = BK_Other);
+    void close_bracket(usize open, usize l, usize end, u8 closer);
+    void define(usize l, Symbol_Kind kind);
+
+    usize skip_comments_in_line(usize l, usize end);
+    usize parse_preproc(usize l, usize end);
+    usize next_token(usize l, usize end);
+    bool at_token(usize l, usize end);
+    usize parse_stmt_braces(usize l, usize end, Bracket_Kind kind = BK_Other);
+    usize parse_expr_braces(usize l, usize end);
+    usize parse_stmt_parens(usize l, usize end);
+    usize parse_exprs_til_semi(usize l, usize end);
+    usize parse_exprs_til_comma(usize l, usize end);
+    usize parse_expr_parens(usize l, usize end);
+    usize parse_expr_sqr(usize l, usize end);
+    usize parse_params(usize l, usize end);
+    usize parse_expr(usize l, usize end);
+    usize parse_type(usize l, usize end);
+    usize parse_param(usize l, usize end);
+    usize parse_if_switch_while_for(usize l, usize end);
+    usize parse_struct_union(usize l, usize end);
+    usize parse_using(usize l, usize end);
+    usize parse_stmt(usize l, usize end, Lex_Dfa var_name_type = DFA_IDENT);
+    usize parse_decl(usize l, usize end);
+    void parse(usize l, usize end);
+    void parse_decls(usize end, ch::Array<u32>& decls);
+    void highlight(u8* out, usize begin, usize end) const;
+};
 
 //bool nested = false; // JUST for debugging
 
-void parse(Lexeme* l, Lexeme* end);
+// Moves to the span lexeme l starts in, and stitches it together if it goes on into the next one.
+const u8* Parser::find_token(usize l) const {
+    const usize offset = offsets[l];
+    usize size = offsets[l + 1] - offset;
+    if (offset < text->count) {
+        const usize span = text->find_span(offset);
+        span_data = text->spans[span].data;
+        span_begin = text->spans[span].index;
+        span_end = text->get_span_end(span);
+        if (offset + size <= span_end) return span_data + (offset - span_begin);
+    }
+
+    if (size > sizeof(stitched)) size = sizeof(stitched);
+    for (usize i = 0; i < size; i++) stitched[i] = (*text)[offset + i];
+    return stitched;
+}
 
 #define KW_CHUNK_(s, offset, I)                                                \
     ((I) + offset < (sizeof(s) - 1)                                            \
@@ -274,8 +153,8 @@ void parse(Lexeme* l, Lexeme* end);
 // Still, it's got a speed advantage, and speed is paramount.
 #define switch_on_token(l_, fordef, for2, for3, for4, for5, for6, for7, for8)  \
     do {                                                                       \
-        const Lexeme *switch_on_token_lexeme = (l_);                           \
-        const u8* swchp = switch_on_token_lexeme->i;                           \
+        const usize switch_on_token_lexeme = (l_);                             \
+        const u8* swchp = token(switch_on_token_lexeme);                       \
         switch (u64 len = toklen(switch_on_token_lexeme)) {                    \
         default: def: { fordef; } break;                                       \
         case 2: switch (Load2(swchp)) { default: goto def; { for2; } } break;  \
@@ -288,56 +167,95 @@ void parse(Lexeme* l, Lexeme* end);
         }                                                                      \
     } while (0);
 
-#include "parsing_cpp_keywords.h"
-bool is_keyword(const Lexeme* l) {
-#define IS_KEYWORD_CASE(name) case KW_CHUNK(#name): return true;
-    switch_on_token(l, return false,
-        CPP_KEYWORDS_2(IS_KEYWORD_CASE),
-        CPP_KEYWORDS_3(IS_KEYWORD_CASE),
-        CPP_KEYWORDS_4(IS_KEYWORD_CASE),
-        CPP_KEYWORDS_5(IS_KEYWORD_CASE),
-        CPP_KEYWORDS_6(IS_KEYWORD_CASE),
-        CPP_KEYWORDS_7(IS_KEYWORD_CASE),
-        CPP_KEYWORDS_8(IS_KEYWORD_CASE));
+// Whether len bytes of text are a C++ keyword. The keyword in the slot the text hashes to is the only one it can be.
+static bool is_keyword_text(const u8* text, u64 len) {
+    if (len < 2 || len > max_keyword_size) return false;
+    const u8 slot = keyword_slots[hash_keyword(text, len, keyword_hash_multiplier, keyword_hash_bits)];
+    if (!slot) return false;
+    const Keyword& keyword = keywords[slot - 1];
+    if (keyword.size != len) return false;
+    for (usize i = 0; i < len; i++) {
+        if (text[i] != (u8)keyword.text[i]) return false;
+    }
+    return true;
+}
+
+bool Parser::is_keyword(usize l) const {
+    const u64 len = toklen(l);
+    if (len < 2 || len > max_keyword_size) return false;
+    return is_keyword_text(token(l), len);
+}
+
+// Starts a pair at the opening bracket l. Returns what close_bracket takes.
+usize Parser::open_bracket(usize l, Bracket_Kind kind) {
+    const Bracket bracket = { (u32)l, 0, bracket_parent, (u16)bracket_depth, kind };
+    bracket_parent = (u32)l;
+    bracket_depth++;
+    return brackets->push(bracket);
+}
+
+// Ends the pair started at open, where the parser left it. It's only paired if that's the bracket that closes it.
+// Every open_bracket needs one, so that the depth stays right.
+void Parser::close_bracket(usize open, usize l, usize end, u8 closer) {
+    Bracket& bracket = (*brackets)[open];
+    bracket_parent = bracket.parent;
+    bracket_depth--;
+    if (l < end && c(l) == closer) {
+        bracket.partner = (u32)l;
+        const Bracket close = { (u32)l, bracket.lexeme, bracket.parent, bracket.depth, bracket.kind };
+        brackets->push(close);
+    }
 }
 
-static Lexeme* skip_comments_in_line(Lexeme* l, Lexeme* end) {
-    while (l < end && (l->dfa < DFA_NEWLINE || l->dfa == DFA_SLASH && l[1].dfa <= DFA_LINE_COMMENT)) l++;
+// Names are mostly found in order, but a declarator's name comes before the parameters in it, like in void (*f)(int a).
+void Parser::define(usize l, Symbol_Kind kind) {
+    ch::Array<Definition>& out = *definitions;
+    usize i = out.count;
+    while (i && out[i - 1].lexeme > l) i--;
+    if (i && out[i - 1].lexeme == l) return;
+
+    const Definition definition = { (u32)l, kind };
+    out.insert(definition, i);
+}
+
+usize Parser::skip_comments_in_line(usize l, usize end) {
+    while (l < end && (dfa[l] < DFA_NEWLINE || dfa[l] == DFA_SLASH && dfa[l + 1] <= DFA_LINE_COMMENT)) l++;
     return l;
 }
-static Lexeme* parse_preproc(Lexeme* l, Lexeme* end) {
-    l->dfa = DFA_PREPROC;
+usize Parser::parse_preproc(usize l, usize end) {
+    dfa[l] = DFA_PREPROC;
     l++;
     l = skip_comments_in_line(l, end);
-    if (l->dfa == DFA_IDENT) {
-        Lexeme* directive = l;
-        l->dfa = DFA_PREPROC;
+    if (dfa[l] == DFA_IDENT) {
+        usize directive = l;
+        dfa[l] = DFA_PREPROC;
         l++;
         l = skip_comments_in_line(l, end);
         switch_on_token(directive,,,,,,
         case KW_CHUNK("define"):
-            if (l->dfa == DFA_IDENT) {
-                l->dfa = DFA_MACRO;
+            if (dfa[l] == DFA_IDENT) {
+                dfa[l] = DFA_MACRO;
+                define(l, SK_Macro);
                 l++;
-                if (l->c() == '(') {
-                    while (l < end && l->dfa != DFA_NEWLINE) {
+                if (c(l) == '(') {
+                    const usize open = open_bracket(l);
+                    while (l < end && dfa[l] != DFA_NEWLINE) {
                         l++;
-                        if (l->c() == ')') {
-                            l++;
-                            break;
-                        }
+                        if (c(l) == ')') break;
                     }
+                    close_bracket(open, l, end, ')');
+                    if (c(l) == ')') l++;
                 }
             }
             break,
         case KW_CHUNK("include"):
-            if (l->c() == '<') {
-                l->dfa = DFA_STRINGLIT;
-                while (l < end && l->dfa != DFA_NEWLINE) {
-                    l->dfa = DFA_STRINGLIT;
+            if (c(l) == '<') {
+                dfa[l] = DFA_STRINGLIT;
+                while (l < end && dfa[l] != DFA_NEWLINE) {
+                    dfa[l] = DFA_STRINGLIT;
                     l++;
-                    if (l->c() == '>') {
-                        l->dfa = DFA_STRINGLIT;
+                    if (c(l) == '>') {
+                        dfa[l] = DFA_STRINGLIT;
                         l++;
                         break;
                     }
@@ -345,19 +263,19 @@ static Lexeme* parse_preproc(Lexeme* l, Lexeme* end) {
             }
             break,);
     }
-    Lexeme* preproc_begin = l;
-    while (l < end && l->dfa != DFA_NEWLINE) l++;
+    usize preproc_begin = l;
+    while (l < end && dfa[l] != DFA_NEWLINE) l++;
     //nested = true;
     parse(preproc_begin, l);
     //nested = false;
     return l;
 }
-static Lexeme* next_token(Lexeme* l, Lexeme* end) {
+usize Parser::next_token(usize l, usize end) {
     while (true) {
         l = skip_comments_in_line(l, end);
-        if (l < end && l->dfa == DFA_NEWLINE) {
+        if (l < end && dfa[l] == DFA_NEWLINE) {
             l++;
-            if (l->c() == '#') {
+            if (c(l) == '#') {
                 //assert(!nested);
                 l = parse_preproc(l, end);
             }
@@ -368,9 +286,9 @@ static Lexeme* next_token(Lexeme* l, Lexeme* end) {
     return l;
 }
 
-static bool at_token(Lexeme* l, Lexeme* end) {
-    Lexeme* r = skip_comments_in_line(l, end);
-    return r == l && (!(r < end) || r->c() != '#');
+bool Parser::at_token(usize l, usize end) {
+    usize r = skip_comments_in_line(l, end);
+    return r == l && (!(r < end) || c(r) != '#');
 }
 
 // Brace nesting precedence: {for(;[;{;];)}}
@@ -382,184 +300,191 @@ static bool at_token(Lexeme* l, Lexeme* end) {
 //    ,  - Comma supersedes almost nothing.
 // 5. <> - Greater than/less than: least important.
 
-static Lexeme* parse_stmt(Lexeme* l, Lexeme* end, Lex_Dfa var_name = DFA_IDENT);
-static Lexeme* parse_expr(Lexeme* l, Lexeme* end);
-static Lexeme* parse_stmt_braces(Lexeme* l, Lexeme* end) {
+usize Parser::parse_stmt_braces(usize l, usize end, Bracket_Kind kind) {
     assert(l < end);
-    assert(l->c() == '{');
+    assert(c(l) == '{');
+    const usize open = open_bracket(l, kind);
     l++;
     l = next_token(l, end);
     while (l < end) {
         l = parse_stmt(l, end);
-        if (l->c() == ',' ||
-            l->c() == ']' ||
-            l->c() == ';' ||
-            l->c() == ')') {
+        if (c(l) == ',' ||
+            c(l) == ']' ||
+            c(l) == ';' ||
+            c(l) == ')') {
             l++;
         }
-        if (l->c() == '}') {
+        if (c(l) == '}') {
             break;
         }
         l = next_token(l, end);
     }
+    close_bracket(open, l, end, '}');
     return l;
 }
-static Lexeme* parse_expr_braces(Lexeme* l, Lexeme* end) {
+usize Parser::parse_expr_braces(usize l, usize end) {
     assert(l < end);
-    assert(l->c() == '{');
+    assert(c(l) == '{');
+    const usize open = open_bracket(l);
     l++;
     l = next_token(l, end);
     while (l < end) {
         l = parse_expr(l, end);
-        if (l->c() == ',' ||
-            l->c() == ']' ||
-            l->c() == ';' ||
-            l->c() == ')') {
+        if (c(l) == ',' ||
+            c(l) == ']' ||
+            c(l) == ';' ||
+            c(l) == ')') {
             l++;
         }
-        if (l->c() == '}') {
+        if (c(l) == '}') {
             break;
         }
         l = next_token(l, end);
     }
+    close_bracket(open, l, end, '}');
     return l;
 }
 
-static Lexeme* parse_stmt_parens(Lexeme* l, Lexeme* end) {
+usize Parser::parse_stmt_parens(usize l, usize end) {
     assert(l < end);
-    assert(l->c() == '(');
+    assert(c(l) == '(');
+    const usize open = open_bracket(l);
     l++;
     l = next_token(l, end);
     while (l < end) {
         l = parse_stmt(l, end);
-        if (l->c() == ',' ||
-            l->c() == ']' ||
-            l->c() == ';') {
+        if (c(l) == ',' ||
+            c(l) == ']' ||
+            c(l) == ';') {
             l++;
             l = next_token(l, end);
         }
-        if (l->c() == ')' ||
-            l->c() == '}') {
+        if (c(l) == ')' ||
+            c(l) == '}') {
             break;
         }
     }
+    close_bracket(open, l, end, ')');
     return l;
 }
 
-static Lexeme* parse_expr(Lexeme* l, Lexeme* end);
-static Lexeme* parse_exprs_til_semi(Lexeme* l, Lexeme* end) {
+usize Parser::parse_exprs_til_semi(usize l, usize end) {
     //assert(l < end);
     while (l < end) {
         l = parse_expr(l, end);
-        if (l->c() == ',' ||
-            l->c() == ']') {
+        if (c(l) == ',' ||
+            c(l) == ']') {
             l++;
         }
-        if (l->c() == ';' ||
-            l->c() == ')' ||
-            l->c() == '}') {
+        if (c(l) == ';' ||
+            c(l) == ')' ||
+            c(l) == '}') {
             break;
         }
         l = next_token(l, end);
     }
     return l;
 }
-static Lexeme* parse_exprs_til_comma(Lexeme* l, Lexeme* end) {
+usize Parser::parse_exprs_til_comma(usize l, usize end) {
     //assert(l < end);
     while (l < end) {
         l = parse_expr(l, end);
-        if (l->c() == ',' ||
-            l->c() == ']' ||
-            l->c() == ';' ||
-            l->c() == ')' ||
-            l->c() == '}') {
+        if (c(l) == ',' ||
+            c(l) == ']' ||
+            c(l) == ';' ||
+            c(l) == ')' ||
+            c(l) == '}') {
             break;
         }
         l = next_token(l, end);
     }
     return l;
 }
-static Lexeme* parse_expr_parens(Lexeme* l, Lexeme* end) {
+usize Parser::parse_expr_parens(usize l, usize end) {
     assert(l < end);
-    assert(l->c() == '(');
+    assert(c(l) == '(');
+    const usize open = open_bracket(l);
     l++;
     l = next_token(l, end);
     while (l < end) {
         l = parse_exprs_til_comma(l, end);
-        if (l->c() == ',') {
+        if (c(l) == ',') {
             l++;
             l = next_token(l, end);
         }
-        if (l->c() == ']' ||
-            l->c() == ';' ||
-            l->c() == ')' ||
-            l->c() == '}') {
+        if (c(l) == ']' ||
+            c(l) == ';' ||
+            c(l) == ')' ||
+            c(l) == '}') {
             break;
         }
     }
+    close_bracket(open, l, end, ')');
     return l;
 }
-static Lexeme* parse_expr_sqr(Lexeme* l, Lexeme* end) {
+usize Parser::parse_expr_sqr(usize l, usize end) {
     assert(l < end);
-    assert(l->c() == '[');
+    assert(c(l) == '[');
+    const usize open = open_bracket(l);
     l++;
     l = next_token(l, end);
     while (l < end) {
         l = parse_exprs_til_comma(l, end);
-        if (l->c() == ',') {
+        if (c(l) == ',') {
             l++;
             l = next_token(l, end);
         }
-        if (l->c() == ']' ||
-            l->c() == ';' ||
-            l->c() == ')' ||
-            l->c() == '}') {
+        if (c(l) == ']' ||
+            c(l) == ';' ||
+            c(l) == ')' ||
+            c(l) == '}') {
             break;
         }
     }
+    close_bracket(open, l, end, ']');
     return l;
 }
 
-static Lexeme* parse_param(Lexeme* l, Lexeme* end);
-static Lexeme* parse_params(Lexeme* l, Lexeme* end) {
+usize Parser::parse_params(usize l, usize end) {
     assert(l < end);
-    assert(l->c() == '(');
+    assert(c(l) == '(');
+    const usize open = open_bracket(l);
     l++;
     l = next_token(l, end);
     while (l < end) {
         l = parse_param(l, end);
-        if (l->c() == ',') {
+        if (c(l) == ',') {
             l++;
             l = next_token(l, end);
         }
-        if (l->c() == ']' ||
-            l->c() == ';' ||
-            l->c() == ')' ||
-            l->c() == '}') {
+        if (c(l) == ']' ||
+            c(l) == ';' ||
+            c(l) == ')' ||
+            c(l) == '}') {
             break;
         }
     }
+    close_bracket(open, l, end, ')');
     return l;
 }
 
-static Lexeme* parse_struct_union(Lexeme* l, Lexeme* end);
 
-static Lexeme* parse_expr(Lexeme* l, Lexeme* end) {
+usize Parser::parse_expr(usize l, usize end) {
     //assert(l < end);
     if (!(l < end)) return l;
-    if (l->c() == '#') {
-        if (l[1].c() == '#') {
-            l->dfa = DFA_IDENT;
+    if (c(l) == '#') {
+        if (c(l + 1) == '#') {
+            dfa[l] = DFA_IDENT;
             l++;
-            l->dfa = DFA_IDENT;
+            dfa[l] = DFA_IDENT;
             l++;
             l = next_token(l, end);
-            if (l->dfa == DFA_NUMLIT) {
-                l->dfa = DFA_IDENT;
+            if (dfa[l] == DFA_NUMLIT) {
+                dfa[l] = DFA_IDENT;
                 l++;
             }
         } else {
-            l->dfa = DFA_PREPROC;
+            dfa[l] = DFA_PREPROC;
             l++;
         }
         l = next_token(l, end);
@@ -576,72 +501,72 @@ static Lexeme* parse_expr(Lexeme* l, Lexeme* end) {
         case KW_CHUNK("struct"): {
             l = parse_struct_union(l, end);
         } break;,,);
-    if (l->c() == '~' ||
-        l->c() == '!' ||
-        l->c() == '&' ||
-        l->c() == '*' ||
-        l->c() == '-' ||
-        l->c() == '+') {
+    if (c(l) == '~' ||
+        c(l) == '!' ||
+        c(l) == '&' ||
+        c(l) == '*' ||
+        c(l) == '-' ||
+        c(l) == '+') {
         l++;
         l = next_token(l, end);
         return parse_expr(l, end);
     }
-    if (l->c() == '{') {
+    if (c(l) == '{') {
         l = parse_expr_braces(l, end);
-        if (l->c() == '}') {
+        if (c(l) == '}') {
             l++;
             l = next_token(l, end);
         }
-    } else if (l->c() == '(') {
+    } else if (c(l) == '(') {
         l = parse_expr_parens(l, end);
-        if (l->c() == ')') {
+        if (c(l) == ')') {
             l++;
             l = next_token(l, end);
         }
-    } else if (l->c() == '[') {
+    } else if (c(l) == '[') {
         l = parse_expr_sqr(l, end);
-        if (l->c() == ']') {
+        if (c(l) == ']') {
             l++;
             l = next_token(l, end);
         }
-        if (l->c() == '(') { // lambda parameter list
+        if (c(l) == '(') { // lambda parameter list
             l = parse_params(l, end);
-            if (l->c() == ')') {
+            if (c(l) == ')') {
                 l++;
                 l = next_token(l, end);
             }
         }
-        if (l->c() == '{') { // lambda body
+        if (c(l) == '{') { // lambda body
             l = parse_stmt_braces(l, end);
-            if (l->c() == '}') {
+            if (c(l) == '}') {
                 l++;
                 l = next_token(l, end);
             }
         }
-    } else if (l->dfa == DFA_IDENT) {
-        Lexeme* ident = l;
+    } else if (dfa[l] == DFA_IDENT) {
+        usize ident = l;
         l++;
         l = next_token(l, end);
-        if (l->c() == '(') {
-            ident->dfa = DFA_FUNCTION;
+        if (c(l) == '(') {
+            dfa[ident] = DFA_FUNCTION;
             l = parse_expr_parens(l, end);
-            if (l->c() == ')') {
+            if (c(l) == ')') {
                 l++;
                 l = next_token(l, end);
             }
-        } else if (l->c() == '{') {
-            ident->dfa = DFA_TYPE;
+        } else if (c(l) == '{') {
+            dfa[ident] = DFA_TYPE;
             l = parse_expr_braces(l, end);
-            if (l->c() == '}') {
+            if (c(l) == '}') {
                 l++;
                 l = next_token(l, end);
             }
         }
-    } else if (l->dfa == DFA_NUMLIT) {
+    } else if (dfa[l] == DFA_NUMLIT) {
         l++;
         l = next_token(l, end);
-    } else if (l->dfa == DFA_STRINGLIT) {
-        while (l < end && (l->dfa == DFA_STRINGLIT || l->dfa == DFA_STRINGLIT_BS)) {
+    } else if (dfa[l] == DFA_STRINGLIT) {
+        while (l < end && (dfa[l] == DFA_STRINGLIT || dfa[l] == DFA_STRINGLIT_BS)) {
             l++;
             l = next_token(l, end);
             // lets us properly parse this:
@@ -649,8 +574,8 @@ static Lexeme* parse_expr(Lexeme* l, Lexeme* end) {
             //          #pragma once
             //          "more more more";
         }
-    } else if (l->dfa == DFA_CHARLIT) {
-        while (l < end && (l->dfa == DFA_CHARLIT || l->dfa == DFA_CHARLIT_BS)) {
+    } else if (dfa[l] == DFA_CHARLIT) {
+        while (l < end && (dfa[l] == DFA_CHARLIT || dfa[l] == DFA_CHARLIT_BS)) {
             l++;
             l = next_token(l, end);
             // lets us properly parse this:
@@ -659,25 +584,25 @@ static Lexeme* parse_expr(Lexeme* l, Lexeme* end) {
             //          "more more more";
         }
     }
-    if (l->c() == '[' ||
-        l->c() == '(') {
+    if (c(l) == '[' ||
+        c(l) == '(') {
         l = parse_expr(l, end);
         l = next_token(l, end);
     }
-    if (l->c() == '%' ||
-        l->c() == '^' ||
-        l->c() == '&' ||
-        l->c() == '*' ||
-        l->c() == '-' ||
-        l->c() == '=' ||
-        l->c() == '+' ||
-        l->c() == '|' ||
-        l->c() == ':' ||
-        l->c() == '<' ||
-        l->c() == '.' ||
-        l->c() == '>' ||
-        l->c() == '/' ||
-        l->c() == '?') {
+    if (c(l) == '%' ||
+        c(l) == '^' ||
+        c(l) == '&' ||
+        c(l) == '*' ||
+        c(l) == '-' ||
+        c(l) == '=' ||
+        c(l) == '+' ||
+        c(l) == '|' ||
+        c(l) == ':' ||
+        c(l) == '<' ||
+        c(l) == '.' ||
+        c(l) == '>' ||
+        c(l) == '/' ||
+        c(l) == '?') {
         l++;
         l = next_token(l, end);
         l = parse_expr(l, end);
@@ -685,52 +610,54 @@ static Lexeme* parse_expr(Lexeme* l, Lexeme* end) {
     return l;
 }
 
-static Lexeme* parse_type(Lexeme* l, Lexeme* end) {
-    if (l->dfa == DFA_IDENT) {
-        l->dfa = DFA_TYPE;
+usize Parser::parse_type(usize l, usize end) {
+    if (dfa[l] == DFA_IDENT) {
+        dfa[l] = DFA_TYPE;
         l++;
         l = next_token(l, end);
-        if (l->c() == '<') {
+        if (c(l) == '<') {
             do {
                 l++;
                 l = next_token(l, end);
                 l = parse_type(l, end);
-            } while (l->c() == ',');
-            if (l->c() == '>') {
+            } while (c(l) == ',');
+            if (c(l) == '>') {
                 l++;
                 l = next_token(l, end);
             }
         }
         while (l < end) {
-            if (l->c() == '*' ||
-                l->c() == '&') {
-                l->dfa = DFA_TYPE;
+            if (c(l) == '*' ||
+                c(l) == '&') {
+                dfa[l] = DFA_TYPE;
                 l++;
                 l = next_token(l, end);
-            } else if (l->c() == '[') {
+            } else if (c(l) == '[') {
                 l = parse_expr_sqr(l, end);
-                if (l->c() == ']') {
+                if (c(l) == ']') {
                     l++;
                     l = next_token(l, end);
                 }
-            } else if (l->c() == '(') {
+            } else if (c(l) == '(') {
+                const usize open = open_bracket(l);
                 do {
                     l++;
                     l = next_token(l, end);
                     l = parse_type(l, end);
-                } while (l->c() == ',');
-                if (l->c() == ')') {
+                } while (c(l) == ',');
+                close_bracket(open, l, end, ')');
+                if (c(l) == ')') {
                     l++;
                     l = next_token(l, end);
                 }
             } else {
                 break;
             }
-            if (l->c() == ';' ||
-                l->c() == '}' ||
-                l->c() == ')' ||
-                l->c() == ']' ||
-                l->c() == '>') {
+            if (c(l) == ';' ||
+                c(l) == '}' ||
+                c(l) == ')' ||
+                c(l) == ']' ||
+                c(l) == '>') {
                 break;
             }
         }
@@ -738,46 +665,52 @@ static Lexeme* parse_type(Lexeme* l, Lexeme* end) {
     return l;
 }
 
-static Lexeme* parse_param(Lexeme* l, Lexeme* end) { return parse_stmt(l, end, DFA_PARAM); }
+usize Parser::parse_param(usize l, usize end) { return parse_stmt(l, end, DFA_PARAM); }
 
-static Lexeme* parse_if_switch_while_for(Lexeme* l, Lexeme* end) {
+usize Parser::parse_if_switch_while_for(usize l, usize end) {
     l++;
     l = next_token(l, end);
-    if (l->c() == '(') {
+    if (c(l) == '(') {
         l = parse_stmt_parens(l, end);
-        if (l->c() == ')') {
+        if (c(l) == ')') {
             l++;
             l = next_token(l, end);
         }
     }
     return parse_stmt(l, end);
 }                            
-static Lexeme* parse_struct_union(Lexeme* l, Lexeme* end) {
+usize Parser::parse_struct_union(usize l, usize end) {
     l++;
     l = next_token(l, end);
-    if (l->dfa == DFA_IDENT) {
-        l->dfa = DFA_TYPE;
+    usize name = no_lexeme;
+    if (dfa[l] == DFA_IDENT) {
+        dfa[l] = DFA_TYPE;
+        name = l;
         l++;
         l = next_token(l, end);
     }
-    if (l->c() == '{') {
-        l = parse_stmt_braces(l, end);
-        if (l->c() == '}') {
+    if (c(l) == '{') {
+        if (name != no_lexeme) define(name, SK_Type);
+        l = parse_stmt_braces(l, end, BK_Struct_Body);
+        if (c(l) == '}') {
             l++;
             l = next_token(l, end);
         }
     }
     return l;
 }
-static Lexeme* parse_using(Lexeme* l, Lexeme* end) {
+usize Parser::parse_using(usize l, usize end) {
     l++;
     l = next_token(l, end);
-    if (l->dfa == DFA_IDENT) {
-        l->dfa = DFA_TYPE;
+    usize name = no_lexeme;
+    if (dfa[l] == DFA_IDENT) {
+        dfa[l] = DFA_TYPE;
+        name = l;
         l++;
         l = next_token(l, end);
     }
-    if (l->c() == '=') {
+    if (c(l) == '=') {
+        if (name != no_lexeme) define(name, SK_Type);
         l++;
         l = next_token(l, end);
         l = parse_type(l, end);
@@ -785,22 +718,22 @@ static Lexeme* parse_using(Lexeme* l, Lexeme* end) {
     return l;
 }
 
-static Lexeme* parse_stmt(Lexeme* l, Lexeme* end, Lex_Dfa var_name_type) {
-    //if (l->c() == '{') {
+usize Parser::parse_stmt(usize l, usize end, Lex_Dfa var_name_type) {
+    //if (c(l) == '{') {
     //    return parse_stmt_braces(l, end);
     //}
-    if (l->dfa != DFA_IDENT) {
+    if (dfa[l] != DFA_IDENT) {
         return parse_exprs_til_semi(l, end);
     }
-    Lexeme* first = l;
+    usize first = l;
     switch_on_token(l,
         {
-            l->dfa = DFA_TYPE;
+            dfa[l] = DFA_TYPE;
             l++;
             l = next_token(l, end);
             if (var_name_type == DFA_IDENT) {
                 // Ad-hoc heuristic: Quickly scan ahead and check if this is definitely an expression.
-                switch (l->c()) {
+                switch (c(l)) {
                     case '~':
                     case '!':
                     case '#':
@@ -820,10 +753,13 @@ static Lexeme* parse_stmt(Lexeme* l, Lexeme* end, Lex_Dfa var_name_type) {
                     case '.':
                     case '>':
                     case '/':
-                        first->dfa = DFA_IDENT;
+                        dfa[first] = DFA_IDENT;
                         return parse_exprs_til_semi(l, end);
                     case ':':
-                        first->dfa = DFA_LABEL; 
+                        // A::f is a qualified name
+                        if (c(l + 1) == ':') break;
+                        dfa[first] = DFA_LABEL; 
+                        define(first, SK_Label);
                         l++;
                         l = next_token(l, end);
                         return parse_stmt(l, end);
@@ -876,23 +812,25 @@ static Lexeme* parse_stmt(Lexeme* l, Lexeme* end, Lex_Dfa var_name_type) {
 more_decls:
     bool seen_closing_paren = false;
     int paren_nesting = 0;
-    Lexeme* last = nullptr;
-    Lexeme* func = nullptr;
+    usize last = no_lexeme;
+    usize func = no_lexeme;
     while (l < end &&
-           (l->dfa == DFA_IDENT ||
-            l->c() == '*' ||
-            l->c() == '&' ||
-            l->c() == '(' ||
-            l->c() == ')' ||
+           (dfa[l] == DFA_IDENT ||
+            c(l) == '*' ||
+            c(l) == '&' ||
+            c(l) == '(' ||
+            c(l) == ')' ||
+            (c(l) == ':' && c(l + 1) == ':') ||
             paren_nesting)) {
-        if (l->c() == '(') {
-            if (seen_closing_paren || func) {
-                if (func) {
-                    func->dfa = DFA_FUNCTION;
+        if (c(l) == '(') {
+            if (seen_closing_paren || func != no_lexeme) {
+                if (func != no_lexeme) {
+                    dfa[func] = DFA_FUNCTION;
+                    if (!is_in_function_body) define(func, SK_Function);
                 }
                 is_likely_function = true;
                 l = parse_params(l, end);
-                if (l->c() == ')') {
+                if (c(l) == ')') {
                     l++;
                     l = next_token(l, end);
                 }
@@ -900,35 +838,40 @@ more_decls:
             } else {
                 paren_nesting++;
             }
-            func = nullptr;
-        } else if (l->c() == ')') {
+            func = no_lexeme;
+        } else if (c(l) == ')') {
             paren_nesting--;
             if (paren_nesting < 0) break;
             seen_closing_paren = true;
-            func = nullptr;
-        } else if (l->c() == '[') {
+            func = no_lexeme;
+        } else if (c(l) == '[') {
             l = parse_expr_sqr(l, end);
-            if (l->c() == ']') {
+            if (c(l) == ']') {
                 l++;
                 l = next_token(l, end);
             }
             continue;
-        } else if (l->c() == '*' ||
-                   l->c() == '&') {
-            l->dfa = DFA_TYPE;
-        } else if (l->dfa == DFA_IDENT) {
+        } else if (c(l) == '*' ||
+                   c(l) == '&') {
+            dfa[l] = DFA_TYPE;
+        } else if (dfa[l] == DFA_IDENT) {
             last = l;
             func = l;
-            l->dfa = DFA_TYPE;
-        } else if (l->c() == ':' && l[1].c() == ':') {
-            // do nothing
+            dfa[l] = DFA_TYPE;
+        } else if (c(l) == ':' && c(l + 1) == ':') {
+            // The name after it is the one declared
+            l++;
         } else {
-            while (l < end && paren_nesting && l->c() != ';') {
+            while (l < end && paren_nesting && c(l) != ';') {
+                const usize before = l;
                 l = parse_exprs_til_semi(l, end);
-                if (l->c() == ')') {
+                if (c(l) == ')') {
                     paren_nesting--;
                     l++;
                     l = next_token(l, end);
+                } else if (l == before) {
+                    // A } or ] that doesn't belong to these parentheses, like in f(}
+                    break;
                 }
             }
             return l;
@@ -936,21 +879,28 @@ more_decls:
         l++;
         l = next_token(l, end);
     }
-    if (last && last->dfa != DFA_FUNCTION) last->dfa = var_name_type;
+    if (last != no_lexeme && dfa[last] != DFA_FUNCTION) {
+        dfa[last] = var_name_type;
+        if (var_name_type == DFA_TYPE) define(last, SK_Type);
+        else if (var_name_type == DFA_PARAM && !is_in_function_body) define(last, SK_Param);
+    }
     if (l < end) {
         if (var_name_type != DFA_PARAM) {
             //assert(at_token(l, end));
             l = next_token(l, end);
-            if (is_likely_function && l->c() == '{') {
-                l = parse_stmt_braces(l, end);
-                if (l->c() == '}') {
+            if (is_likely_function && c(l) == '{') {
+                const bool was_in_function_body = is_in_function_body;
+                is_in_function_body = true;
+                l = parse_stmt_braces(l, end, BK_Function_Body);
+                is_in_function_body = was_in_function_body;
+                if (c(l) == '}') {
                     l++;
                     l = next_token(l, end);
                 }
                 return l;
             } else {
                 l = parse_exprs_til_comma(l, end);
-                if (l->c() == ',') {
+                if (c(l) == ',') {
                     l++;
                     l = next_token(l, end);
                     goto more_decls;
@@ -964,95 +914,845 @@ more_decls:
     return l;
 }
 
-static void parse(Lexeme* l, Lexeme* end) {
-    while (l < end) {
-        //if (l->dfa == DFA_IDENT) {
-        //    Lexeme* m = l;
-        //    do {
-        //        l++;
-        //        l = skip_comments_in_line(l, end);
-        //    } while (l->dfa == DFA_NEWLINE);
-        //    if (l->c() == '(') m->dfa = DFA_FUNCTION;
-        //} else l++;
+// One statement of the top level. Only writes lexemes before the one it returns and reads one past it,
+// so it parses the same wherever it's started from as long as those didn't change.
+usize Parser::parse_decl(usize l, usize end) {
+    //if (dfa[l] == DFA_IDENT) {
+    //    usize m = l;
+    //    do {
+    //        l++;
+    //        l = skip_comments_in_line(l, end);
+    //    } while (dfa[l] == DFA_NEWLINE);
+    //    if (c(l) == '(') dfa[m] = DFA_FUNCTION;
+    //} else l++;
 
-        l = next_token(l, end);
-        l = parse_stmt(l, end);
-        assert(l->c() != ',');
-        if (l->c() == ']' ||
-            l->c() == ';' ||
-            l->c() == ')' ||
-            l->c() == '}') {
-            l++;
+    l = next_token(l, end);
+    l = parse_stmt(l, end);
+    assert(c(l) != ',');
+    if (c(l) == ']' ||
+        c(l) == ';' ||
+        c(l) == ')' ||
+        c(l) == '}') {
+        l++;
+    }
+    return l;
+}
+
+void Parser::parse(usize l, usize end) {
+    while (l < end && !is_stopped()) {
+        l = parse_decl(l, end);
+    }
+}
+
+// Parses everything from the front lexeme and pushes where every declaration starts.
+void Parser::parse_decls(usize end, ch::Array<u32>& decls) {
+    usize l = 0;
+    while (l < end && !is_stopped()) {
+        decls.push((u32)l);
+        l = parse_decl(l, end);
+    }
+}
+
+void Parser::highlight(u8* out, usize begin, usize end) const {
+    for (usize l = begin; l < end; l++) {
+        u8 hl = HL_Default;
+        switch (dfa[l]) {
+        case DFA_FUNCTION: hl = is_keyword(l) ? HL_Keyword : HL_Function; break;
+        case DFA_PARAM:    hl = is_keyword(l) ? HL_Keyword : HL_Param; break;
+        case DFA_TYPE:     hl = is_keyword(l) ? HL_Keyword : HL_Type; break;
+        case DFA_IDENT:    hl = is_keyword(l) ? HL_Keyword : HL_Default; break;
+        case DFA_KEYWORD:  hl = HL_Keyword; break;
+        case DFA_PREPROC:  hl = HL_Preproc; break;
+        case DFA_MACRO:    hl = HL_Macro; break;
+        case DFA_STRINGLIT:
+        case DFA_STRINGLIT_BS:
+        case DFA_CHARLIT:
+        case DFA_CHARLIT_BS:
+            hl = HL_String;
+            break;
+        case DFA_BLOCK_COMMENT:
+        case DFA_BLOCK_COMMENT_STAR:
+        case DFA_LINE_COMMENT:
+            hl = HL_Comment;
+            break;
+        case DFA_WHITE_BS:
+        case DFA_WHITE:
+            // The white that ends a literal or a comment is drawn with it
+            if (l > 0 && (dfa[l - 1] == DFA_STRINGLIT || dfa[l - 1] == DFA_CHARLIT)) hl = HL_String;
+            if (l > 0 && dfa[l - 1] <= DFA_LINE_COMMENT) hl = HL_Comment;
+            break;
+        case DFA_OP:
+        case DFA_OP2:
+            hl = HL_Op;
+            break;
+        case DFA_NUMLIT:   hl = HL_Number; break;
+        case DFA_SLASH:    hl = dfa[l + 1] <= DFA_LINE_COMMENT ? HL_Comment : HL_Op; break;
+        case DFA_LABEL:    hl = HL_Label; break;
+        case DFA_NEWLINE:
+        case DFA_NUM_STATES:
+            break;
+        default: ch_debug_trap;
         }
+        out[l] = hl;
     }
 }
 
-void parse_cpp(Buffer* buf) {
-    if (!buf->syntax_dirty || buf->disable_parse) return;
-    buf->syntax_dirty = false;
-    ch::Gap_Buffer<u8>& b = buf->gap_buffer;
-    usize buffer_count = b.count();
+// Offsets are 32 bits. Text this big isn't highlighted.
+const usize max_lexed_size = 0xFFFFFFFF;
+
+// Grows by at least an eighth, so that edits that keep adding a few lexemes don't reallocate every time.
+static void make_room(Lexemes& lexemes, usize count) {
+    if (count > lexemes.allocated) lexemes.reserve(count + lexemes.allocated / 8);
+}
+
+void Text::set(const ch::Gap_Buffer<u8>& b) {
+    clear();
+    const usize gap_index = b.gap - b.data;
+    push(b.data, gap_index);
+    push(b.gap + b.gap_size, b.count() - gap_index);
+}
+
+void Text::push(const u8* data, usize size) {
+    if (!size) return;
+    const Text_Span span = { data, count };
+    spans.push(span);
+    count += size;
+}
+
+void Text::clear() {
+    spans.count = 0;
+    count = 0;
+}
+
+void Text::free() {
+    spans.free();
+    count = 0;
+}
+
+usize Text::find_span(usize index) const {
+    assert(index < count);
+    usize lo = 0;
+    usize hi = spans.count - 1;
+    while (lo < hi) {
+        const usize mid = lo + (hi - lo + 1) / 2;
+        if (spans[mid].index <= index) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+u8 Text::operator[](usize index) const {
+    const Text_Span& span = spans[find_span(index)];
+    return span.data[index - span.index];
+}
+
+// Lexes [begin, end) of the text, a span at a time.
+static u8 lex_range(const Lex_Tables& tables, u8 dfa, const Text& text, usize begin, usize end, Lexemes& lexemes) {
+    if (begin >= end) return dfa;
+    for (usize span = text.find_span(begin); begin < end; span++) {
+        const Text_Span& it = text.spans[span];
+        const usize span_end = text.get_span_end(span) < end ? text.get_span_end(span) : end;
+        dfa = lex(tables, dfa, it.data + (begin - it.index), it.data + (span_end - it.index), begin, lexemes);
+        begin = span_end;
+    }
+    return dfa;
+}
+
+// count lexemes starting at begin that text was lexed into before.
+struct Lexed_Text {
+    const Lexemes* lexemes;
+    usize begin;
+    usize count;
+    // The state right before the first one.
+    u8 dfa_before;
+};
+
+struct Sync_Result {
+    bool is_synced;
+    // How many of the old lexemes were lexed again. The ones after them are still right.
+    usize old_lexemes_replaced;
+    u8 dfa;
+};
+
+// Lexes [index, end) from state dfa into out until the lexer is in the same state the old lexemes were in right before the same text.
+// Text from new_sync_index on is the same as the old text from old_sync_index on, so only positions from there are compared.
+// It's only compared where a lexeme starts. Once the states match they keep matching, so that's at most one lexeme late.
+static Sync_Result lex_until_synced(const Lex_Tables& tables, const Text& text, u8 dfa, usize index, usize end, usize new_sync_index, usize old_sync_index, const Lexed_Text& old, Lexemes* out) {
+    Sync_Result result = {};
+    const u32* const old_offsets = old.lexemes->offsets + old.begin;
+    const u8* const old_lex_dfa = old.lexemes->lex_dfa + old.begin;
+    usize old_next = 0;
+    for (usize span = index < end ? text.find_span(index) : 0; index < end; span++) {
+        const Text_Span& it = text.spans[span];
+        const usize span_end = text.get_span_end(span) < end ? text.get_span_end(span) : end;
+        const u8* p = it.data + (index - it.index);
+        const u8* const p_end = it.data + (span_end - it.index);
+
+        for (; p < p_end; p++, index++) {
+            const u8 new_dfa = tables.lex_table[dfa + tables.char_type[*p]];
+            if (index >= new_sync_index && (new_dfa != dfa || index == new_sync_index)) {
+                const usize old_index = index - new_sync_index + old_sync_index;
+                while (old_next < old.count && old_offsets[old_next] < old_index) old_next++;
+                const u8 old_dfa = old_next ? old_lex_dfa[old_next - 1] : old.dfa_before;
+                if (old_dfa == dfa) {
+                    result.is_synced = true;
+                    result.old_lexemes_replaced = old_next;
+                    result.dfa = dfa;
+                    return result;
+                }
+            }
+            if (new_dfa != dfa) {
+                out->push((u32)index, new_dfa, *p);
+                dfa = new_dfa;
+            }
+        }
+    }
+
+    result.old_lexemes_replaced = old.count;
+    result.dfa = dfa;
+    return result;
+}
+
+// Every thread gets at least this much text when a buffer is lexed on multiple threads.
+const usize parallel_lex_chunk_size = 1024 * 1024;
+
+// Chunks are moved forward to the next line start, at most this far.
+const usize parallel_lex_max_line_search = 64 * 1024;
+
+// A part of the text lexed on its own thread. The state the text before it ends in is only known once
+// the chunks before it are done, so it's lexed as if it started on a new line. That's right unless
+// it starts in a block comment or string literal, in which case the start is lexed again while stitching.
+struct Lex_Chunk {
+    const Lex_Tables* tables = nullptr;
+    const Text* text = nullptr;
+    usize begin = 0;
+    usize end = 0;
+    const volatile u64* stop_requested = nullptr;
+
+    Lexemes lexemes;
+    u8 end_dfa = 0;
+    bool is_stopped = false;
+
+    // Set while stitching. fixed_lexemes followed by lexemes from kept_lexemes on are copied to out at out_index.
+    Lexemes fixed_lexemes;
+    usize kept_lexemes = 0;
+    Lexemes* out = nullptr;
+    usize out_index = 0;
+
+    Thread thread;
+};
+
+static void lex_chunk_main(void* param) {
+    Lex_Chunk* const chunk = (Lex_Chunk*)param;
+    // A sub-chunk at a time so that a stop doesn't have to wait for all of it
+    u8 dfa = chunk->tables->start_state;
+    for (usize begin = chunk->begin; begin < chunk->end; begin += parallel_lex_chunk_size) {
+        if (chunk->stop_requested && atomic_load(chunk->stop_requested)) {
+            chunk->is_stopped = true;
+            return;
+        }
+        const usize end = chunk->end - begin > parallel_lex_chunk_size ? begin + parallel_lex_chunk_size : chunk->end;
+        dfa = lex_range(*chunk->tables, dfa, *chunk->text, begin, end, chunk->lexemes);
+    }
+    chunk->end_dfa = dfa;
+}
+
+static void copy_chunk_main(void* param) {
+    Lex_Chunk* const chunk = (Lex_Chunk*)param;
+    const usize fixed_count = chunk->fixed_lexemes.count;
+    chunk->out->copy(chunk->out_index, chunk->fixed_lexemes, 0, fixed_count);
+    chunk->out->copy(chunk->out_index + fixed_count, chunk->lexemes, chunk->kept_lexemes, chunk->lexemes.count - chunk->kept_lexemes);
+}
+
+// Runs proc for every chunk. The first one runs on this thread, like any whose thread can't be started.
+static void run_on_chunks(ch::Array<Lex_Chunk>& chunks, Thread_Proc proc) {
+    for (usize i = 1; i < chunks.count; i++) {
+        if (!chunks[i].thread.start(proc, &chunks[i])) proc(&chunks[i]);
+    }
+    proc(&chunks[0]);
+    for (usize i = 1; i < chunks.count; i++) chunks[i].thread.join();
+}
+
+static void free_chunks(ch::Array<Lex_Chunk>& chunks) {
+    for (Lex_Chunk& chunk : chunks) {
+        chunk.lexemes.free();
+        chunk.fixed_lexemes.free();
+    }
+    chunks.free();
+}
+
+// Lexes the text on num_chunks threads and appends the lexemes to lexemes.
+// @returns false if it was stopped.
+static bool lex_parallel(const Lex_Tables& tables, const Text& b, u32 num_chunks, Lexemes& lexemes, const volatile u64* stop_requested) {
+    const usize buffer_count = b.count;
+
+    ch::Array<Lex_Chunk> chunks;
+    chunks.allocator = ch::get_heap_allocator();
+    chunks.reserve(num_chunks);
+    defer(free_chunks(chunks));
+
+    // Chunks start on a new line so that the guessed state is most likely right
+    usize begin = 0;
+    for (u32 i = 0; i < num_chunks && begin < buffer_count; i++) {
+        usize end = buffer_count;
+        if (i + 1 < num_chunks) {
+            const usize split = begin + (buffer_count - begin) / (num_chunks - i);
+            end = split;
+            while (end < buffer_count && end - split < parallel_lex_max_line_search && b[end - 1] != '\n') end++;
+            if (end - split == parallel_lex_max_line_search) end = split;
+            if (end <= begin) continue;
+        }
+
+        Lex_Chunk chunk;
+        chunk.tables = &tables;
+        chunk.text = &b;
+        chunk.begin = begin;
+        chunk.end = end;
+        chunk.stop_requested = stop_requested;
+        chunk.lexemes.allocator = lexemes.allocator;
+        chunk.lexemes.density = lexemes.density;
+        chunk.fixed_lexemes.allocator = lexemes.allocator;
+        chunks.push(chunk);
+        begin = end;
+    }
+
+    run_on_chunks(chunks, lex_chunk_main);
+    for (const Lex_Chunk& chunk : chunks) {
+        if (chunk.is_stopped) return false;
+    }
+
+    // Chain the chunks' states. The first chunk starts on a new line for real.
+    usize out_index = lexemes.count;
+    u8 dfa = tables.start_state;
+    for (Lex_Chunk& chunk : chunks) {
+        chunk.out = &lexemes;
+        chunk.out_index = out_index;
+        if (dfa == tables.start_state) {
+            dfa = chunk.end_dfa;
+        } else {
+            const Lexed_Text guessed = { &chunk.lexemes, 0, chunk.lexemes.count, tables.start_state };
+            const Sync_Result sync = lex_until_synced(tables, b, dfa, chunk.begin, chunk.end, chunk.begin, chunk.begin, guessed, &chunk.fixed_lexemes);
+            chunk.kept_lexemes = sync.old_lexemes_replaced;
+            dfa = sync.is_synced ? chunk.end_dfa : sync.dfa;
+        }
+        out_index += chunk.fixed_lexemes.count + chunk.lexemes.count - chunk.kept_lexemes;
+    }
+
+    // Room for the end lexeme and the one after it too
+    make_room(lexemes, out_index + 2);
+    if (stop_requested && atomic_load(stop_requested)) return false;
+    run_on_chunks(chunks, copy_chunk_main);
+    lexemes.count = out_index;
+    return true;
+}
+
+// Lexes the whole text into [front lexeme, lexemes..., end lexeme].
+// @returns false if it was stopped.
+static bool lex_all(const Lex_Tables& tables, const Text& b, Lexemes& lexemes, const volatile u64* stop_requested) {
+    usize buffer_count = b.count;
 
-    // Three extra lexemes:
     // One extra lexeme at the front.
-    // One at the back to indicate buffer end to the parser, pointing to safe
-    // scratch data.
-    // One after that pointing to the the real position of the (unreadable) buffer
-    // end, so that identifier lengths can be correctly computed.
-    buf->lexemes.reserve((1 + buffer_count + 1 + 1) - buf->lexemes.allocated);
-    buf->lexemes.count = 1;
-    if (buffer_count) {
-        u8 lexer = DFA_NEWLINE;
-        Lexeme* lex_seeker = buf->lexemes.begin();
-        {
-            lex_seeker->i = b.data;
-            lex_seeker->dfa = (Lex_Dfa)lexer;
-            lex_seeker->cached_first = b.data[0];
-            lex_seeker++;
+    // One at the back at the end of the text, so that identifier lengths can be correctly computed.
+    // lex() makes room for the rest by the density of the last time.
+    lexemes.count = 0;
+    u8 lexer = tables.start_state;
+    lexemes.push(0, lexer, b[0]);
+
+    usize num_chunks = get_num_cpu_threads();
+    if (num_chunks > buffer_count / parallel_lex_chunk_size) num_chunks = buffer_count / parallel_lex_chunk_size;
+    if (num_chunks > 1) {
+        if (!lex_parallel(tables, b, (u32)num_chunks, lexemes, stop_requested)) return false;
+    } else {
+        // A chunk at a time so that a stop doesn't have to wait for all of it
+        for (usize begin = 0; begin < buffer_count; begin += parallel_lex_chunk_size) {
+            if (stop_requested && atomic_load(stop_requested)) return false;
+            const usize end = buffer_count - begin > parallel_lex_chunk_size ? begin + parallel_lex_chunk_size : buffer_count;
+            lexer = lex_range(tables, lexer, b, begin, end, lexemes);
+        }
+    }
+
+    // parse_text adds one more after it for the parser
+    make_room(lexemes, lexemes.count + 2);
+    lexemes.push((u32)buffer_count, tables.num_states, 0);
+    lexemes.density = (f32)lexemes.count / (f32)buffer_count;
+    return true;
+}
+
+// Lexes only the text in edit and splices it into the old lexemes.
+// The state doesn't change inside a lexeme, so every lexeme boundary works as a checkpoint:
+// lexing restarts right at the edit with the state of the lexeme it's in, and stops as soon as
+// it's in the same state as the old lexemes were at the same text after the edit.
+// Everything past that point would lex the same, so the old lexemes are kept and shifted.
+static Relexed_Range relex(const Lex_Tables& tables, const Text& b, Lexemes& lexemes, const Edit_Range& edit) {
+    const usize old_count = lexemes.count;
+    const usize old_end_lexeme = old_count - 1;
+    assert(lexemes.lex_dfa[old_end_lexeme] == tables.num_states);
+
+    // Last lexeme starting before the edit. The front lexeme stands in for the start state.
+    usize lo = 1;
+    usize hi = old_end_lexeme;
+    while (lo < hi) {
+        const usize mid = lo + (hi - lo) / 2;
+        if (lexemes.offsets[mid] < edit.begin) lo = mid + 1;
+        else hi = mid;
+    }
+    const usize kept_head = lo;
+
+    Lexemes relexed;
+    relexed.allocator = lexemes.allocator;
+    defer(relexed.free());
+
+    const Lexed_Text old = { &lexemes, kept_head, old_end_lexeme - kept_head, lexemes.lex_dfa[kept_head - 1] };
+    const Sync_Result sync = lex_until_synced(tables, b, old.dfa_before, edit.begin, b.count, edit.new_end, edit.old_end, old, &relexed);
+    const usize old_tail = kept_head + sync.old_lexemes_replaced;
+
+    // Old lexemes past the edit move over and get shifted by how much the text grew or shrank.
+    // Offsets don't depend on where the gap is, so the ones before the edit stay as they are.
+    const usize new_count = kept_head + relexed.count + (old_count - old_tail);
+    make_room(lexemes, new_count + 1);
+    lexemes.move(kept_head + relexed.count, old_tail, old_count - old_tail);
+    lexemes.copy(kept_head, relexed, 0, relexed.count);
+    lexemes.count = new_count;
+
+    // Wraps around when the text shrank, which still gives the right offsets
+    const u32 shift = (u32)(edit.new_end - edit.old_end);
+    if (shift) {
+        for (usize i = kept_head + relexed.count; i < new_count; i++) lexemes.offsets[i] += shift;
+    }
+    lexemes.first[0] = b[0];
+
+    Relexed_Range result;
+    result.first_changed = kept_head - 1;
+    result.new_end = kept_head + relexed.count;
+    result.old_end = old_tail;
+    return result;
+}
+
+// Makes lexeme index look like the end of the text to the parser, and puts it back.
+struct Fake_End {
+    Lexemes* lexemes = nullptr;
+    usize index = no_lexeme;
+    u8 dfa;
+    u8 first;
+
+    void set(Lexemes& in_lexemes, usize in_index) {
+        lexemes = &in_lexemes;
+        index = in_index;
+        dfa = lexemes->dfa[index];
+        first = lexemes->first[index];
+        lexemes->dfa[index] = DFA_NUM_STATES;
+        lexemes->first[index] = 0;
+    }
+    void clear() {
+        if (index == no_lexeme) return;
+        lexemes->dfa[index] = dfa;
+        lexemes->first[index] = first;
+        index = no_lexeme;
+    }
+};
+
+// The first of items at or after lexeme. Works for anything kept in the order of its lexemes.
+template <typename T>
+static usize find_first_at(const ch::Array<T>& items, usize lexeme) {
+    usize lo = 0;
+    usize hi = items.count;
+    while (lo < hi) {
+        const usize mid = lo + (hi - lo) / 2;
+        if (items[mid].lexeme < lexeme) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Replaces items [kept, old_tail) with the new ones. Returns where the ones from old_tail on moved to.
+template <typename T>
+static T* splice(ch::Array<T>& items, usize kept, usize old_tail, const ch::Array<T>& new_items) {
+    const usize tail_count = items.count - old_tail;
+    const usize new_count = kept + new_items.count + tail_count;
+    if (new_count > items.allocated) items.reserve(new_count - items.allocated + items.allocated / 8);
+    T* const tail = items.data + kept + new_items.count;
+    if (tail_count) ch::mem_move(tail, items.data + old_tail, tail_count * sizeof(T));
+    if (new_items.count) ch::mem_copy(items.data + kept, new_items.data, new_items.count * sizeof(T));
+    items.count = new_count;
+    return tail;
+}
+
+// Parses again after relexing, with dfa still holding the old parse. A declaration only writes the lexemes from where
+// it starts up to where it ends and reads one more. So parsing starts at the last declaration before the edit and is
+// done as soon as one ends where an old one started in the unchanged lexemes. The parser doesn't get to see the old
+// parse: the lexemes up to the next old declaration are put back in their lexed state, and the text looks like it ends
+// two lexemes after it. A declaration that gets close to that end, like when a brace got unbalanced, is parsed again
+// up to the old declaration after it.
+// decls has the old declarations and gets the new ones. The brackets and definitions of the declarations that aren't
+// parsed again are kept.
+// Returns false if it was stopped.
+// The lexemes from changed_begin to changed_end have to be highlighted again.
+static bool reparse(Parser& parser, Lexemes& lexemes, const Relexed_Range& relexed, usize* changed_begin, usize* changed_end) {
+    const usize end = lexemes.count - 1;
+    ch::Array<u32>& decls = lexemes.decls;
+    // Old lexemes from old_end on are shift further now. Wraps around when there are fewer.
+    const usize shift = relexed.new_end - relexed.old_end;
+
+    // The declaration before this one looked at its first lexeme, so that has to be before first_changed
+    usize decl = 0;
+    while (decl + 1 < decls.count && decls[decl + 1] < relexed.first_changed) decl++;
+
+    ch::Array<u32> new_decls;
+    new_decls.allocator = decls.allocator;
+    new_decls.reserve(decls.count + 16);
+    for (usize i = 0; i < decl; i++) new_decls.push(decls[i]);
+
+    usize l = decls[decl];
+
+    // The brackets of the declarations that are parsed again are replaced by the ones in new_brackets
+    ch::Array<Bracket>& brackets = lexemes.brackets;
+    const usize kept_brackets = find_first_at(brackets, l);
+    usize old_brackets_tail = brackets.count;
+    ch::Array<Bracket> new_brackets;
+    new_brackets.allocator = brackets.allocator;
+    parser.brackets = &new_brackets;
+
+    ch::Array<Definition>& definitions = lexemes.definitions;
+    const usize kept_definitions = find_first_at(definitions, l);
+    usize old_definitions_tail = definitions.count;
+    ch::Array<Definition> new_definitions;
+    new_definitions.allocator = definitions.allocator;
+    parser.definitions = &new_definitions;
+    // White after a changed lexeme is drawn like it
+    *changed_begin = l ? l - 1 : 0;
+    *changed_end = lexemes.count;
+    usize min_sync = relexed.new_end;
+    usize sync_decl = decl;
+    bool is_synced = false;
+    while (!is_synced && l < end) {
+        // The first old declaration from min_sync on. The old parse of it and the lexeme after it is kept aside.
+        while (sync_decl < decls.count && (decls[sync_decl] < relexed.old_end || decls[sync_decl] + shift < min_sync)) sync_decl++;
+        usize sync = no_lexeme;
+        usize parse_end = end;
+        u8 sync_dfa[2];
+        if (sync_decl < decls.count) {
+            sync = decls[sync_decl] + shift;
+            sync_dfa[0] = lexemes.dfa[sync];
+            sync_dfa[1] = lexemes.dfa[sync + 1];
+            if (sync + 2 < end) parse_end = sync + 2;
         }
-        
-        f64 lex_time = -ch::get_time_in_seconds();
-        lexer = lex(lexer, b.data, b.gap, lex_seeker);
-        Lexeme* lexeme_at_gap = lex_seeker - 1;
-        lexer = lex(lexer, b.gap + b.gap_size, b.data + b.allocated, lex_seeker);
-        lex_time += ch::get_time_in_seconds();
-
-        if (lexeme_at_gap > buf->lexemes.begin() && lexeme_at_gap < lex_seeker) {
-            assert(lexeme_at_gap->i < b.gap);
-            if (lexeme_at_gap + 1 < lex_seeker) {
-                assert(lexeme_at_gap[1].i >= b.gap + b.gap_size);
+        ch::mem_copy(lexemes.dfa + l, lexemes.lex_dfa + l, parse_end - l);
+        Fake_End fake_end;
+        if (parse_end < end) fake_end.set(lexemes, parse_end);
+
+        while (l < parse_end) {
+            if (parser.is_stopped()) {
+                fake_end.clear();
+                new_decls.free();
+                new_brackets.free();
+                new_definitions.free();
+                parser.brackets = &brackets;
+                parser.definitions = &definitions;
+                return false;
+            }
+
+            const usize brackets_before = new_brackets.count;
+            const usize definitions_before = new_definitions.count;
+            const usize next = parser.parse_decl(l, parse_end);
+            if (sync != no_lexeme && next > sync) {
+                new_brackets.count = brackets_before;
+                new_definitions.count = definitions_before;
+                // It saw the end that isn't there. Everything it wrote is before the one after that end.
+                // It's parsed again with at least twice as much room, so a brace that swallows the rest of the file
+                // doesn't get parsed again for every declaration after it.
+                min_sync = parse_end + (parse_end - l);
+                if (min_sync < next) min_sync = next;
+                break;
+            }
+
+            new_decls.push((u32)l);
+            l = next;
+            if (l == sync) {
+                lexemes.dfa[sync] = sync_dfa[0];
+                lexemes.dfa[sync + 1] = sync_dfa[1];
+                for (usize i = sync_decl; i < decls.count; i++) new_decls.push((u32)(decls[i] + shift));
+                old_brackets_tail = find_first_at(brackets, decls[sync_decl]);
+                old_definitions_tail = find_first_at(definitions, decls[sync_decl]);
+                // The slash before sync looks at it and the white after it looks back
+                if (sync + 2 < *changed_end) *changed_end = sync + 2;
+                is_synced = true;
+                break;
             }
-            b.move_gap_to_index(lexeme_at_gap->i - b.data);
-            assert(lexeme_at_gap->i == b.gap);
-            lexeme_at_gap->i += b.gap_size;
-            // lexeme_at_gap->cached_first should definitely not have changed.
         }
+        fake_end.clear();
+    }
 
-        {
-            assert(lex_seeker < buf->lexemes.begin() + buf->lexemes.allocated);
-            lex_seeker->dfa = DFA_NUM_STATES;
-            lex_seeker->i = lexeme_sentinel_buffer; // So the parser can safely read from here.
-            lex_seeker->cached_first = lex_seeker->i[0];
-            lex_seeker++;
-            assert(lex_seeker < buf->lexemes.begin() + buf->lexemes.allocated);
-            lex_seeker->dfa = DFA_NUM_STATES;
-            lex_seeker->i = b.data + b.allocated; // So the parser knows the real end position.
-            lex_seeker->cached_first = 0;
-            lex_seeker++;
+    decls.free();
+    decls = new_decls;
+
+    // The old brackets and definitions from the declaration it synced at onwards move over and get shifted like the declarations
+    const usize brackets_tail_count = brackets.count - old_brackets_tail;
+    Bracket* const brackets_tail = splice(brackets, kept_brackets, old_brackets_tail, new_brackets);
+    const usize definitions_tail_count = definitions.count - old_definitions_tail;
+    Definition* const definitions_tail = splice(definitions, kept_definitions, old_definitions_tail, new_definitions);
+    if (shift) {
+        for (usize i = 0; i < brackets_tail_count; i++) {
+            brackets_tail[i].lexeme += (u32)shift;
+            if (brackets_tail[i].partner) brackets_tail[i].partner += (u32)shift;
+            if (brackets_tail[i].parent) brackets_tail[i].parent += (u32)shift;
+        }
+        for (usize i = 0; i < definitions_tail_count; i++) definitions_tail[i].lexeme += (u32)shift;
+    }
+    lexemes.new_definitions_begin = kept_definitions;
+    lexemes.new_definitions_end = kept_definitions + new_definitions.count;
+    new_brackets.free();
+    new_definitions.free();
+    parser.brackets = &brackets;
+    parser.definitions = &definitions;
+    return true;
+}
+
+// The lexemes from changed_begin to changed_end are the ones a parse made. The ones after them are the old ones shifted
+// by as many lexemes as the relex added or removed.
+static void set_changed_lexemes(Lexemes& lexemes, const Relexed_Range& relexed, bool is_relexed, usize changed_begin, usize changed_end) {
+    lexemes.kept_lexemes = changed_begin;
+    lexemes.new_lexemes_end = changed_end;
+    lexemes.old_lexemes_end = no_lexeme;
+    if (is_relexed) {
+        assert(changed_end >= relexed.new_end);
+        lexemes.old_lexemes_end = changed_end - (relexed.new_end - relexed.old_end);
+    }
+}
+
+bool parse_text(const Text& b, Language language, Lexemes& lexemes, const Edit_Range& edit, const volatile u64* stop_requested, f64* out_lex_time, f64* out_parse_time) {
+    usize buffer_count = b.count;
+    *out_lex_time = 0;
+    *out_parse_time = 0;
+
+    if (!buffer_count || buffer_count >= max_lexed_size) {
+        // Nothing of the old parse is left, so nothing is kept and a catch up copies all of it
+        lexemes.count = 0;
+        lexemes.language = language;
+        lexemes.decls.count = 0;
+        lexemes.brackets.count = 0;
+        lexemes.definitions.count = 0;
+        lexemes.new_definitions_begin = 0;
+        lexemes.new_definitions_end = 0;
+        lexemes.kept_lexemes = 0;
+        lexemes.new_lexemes_end = 0;
+        lexemes.old_lexemes_end = no_lexeme;
+        lexemes.version = 0;
+        return true;
+    }
+
+    const Lex_Tables& tables = get_lex_tables(language);
+    f64 lex_time = -ch::get_time_in_seconds();
+    // C++ can only be reparsed from the old declarations
+    const bool is_relexed = edit.is_set && lexemes.count >= 2 && lexemes.language == language && (language != LANG_CPP || lexemes.decls.count);
+    Relexed_Range relexed = {};
+    if (is_relexed) {
+        relexed = relex(tables, b, lexemes, edit);
+    } else {
+        if (!lex_all(tables, b, lexemes, stop_requested)) return false;
+        lexemes.language = language;
+        lexemes.decls.count = 0;
+        lexemes.brackets.count = 0;
+        lexemes.definitions.count = 0;
+        lexemes.new_definitions_begin = 0;
+        lexemes.new_definitions_end = 0;
+    }
+    lex_time += ch::get_time_in_seconds();
+
+    if (language != LANG_CPP) {
+        // Nothing parses it, so it's drawn by its lexed states. The lexer already wrote them to dfa as well.
+        f64 highlight_time = -ch::get_time_in_seconds();
+        usize changed_begin = 0;
+        usize changed_end = lexemes.count;
+        if (is_relexed) {
+            // An opening text right before the edit can turn out to be something else now
+            changed_begin = relexed.first_changed;
+            while (changed_begin && tables.continued_by[lexemes.lex_dfa[changed_begin - 1]]) changed_begin--;
+            changed_end = relexed.new_end;
+        }
+        highlight_lexed(tables, lexemes, changed_begin, changed_end);
+        set_changed_lexemes(lexemes, relexed, is_relexed, changed_begin, changed_end);
+        highlight_time += ch::get_time_in_seconds();
+
+        *out_lex_time = lex_time;
+        *out_parse_time = highlight_time;
+        return true;
+    }
+
+    // The end lexeme tells the parser where the buffer ends. It can look one lexeme past it.
+    const usize end_lexeme = lexemes.count - 1;
+    make_room(lexemes, lexemes.count + 1);
+    lexemes.offsets[end_lexeme + 1] = lexemes.offsets[end_lexeme];
+    lexemes.dfa[end_lexeme + 1] = DFA_NUM_STATES;
+    lexemes.first[end_lexeme + 1] = 0;
+
+    Parser parser(lexemes, b);
+    parser.stop_requested = stop_requested;
+    f64 parse_time = -ch::get_time_in_seconds();
+    usize changed_begin = 0;
+    usize changed_end = lexemes.count;
+    if (is_relexed) {
+        if (!reparse(parser, lexemes, relexed, &changed_begin, &changed_end)) return false;
+    } else {
+        // The parser overwrites the states of the previous parse
+        ch::mem_copy(lexemes.dfa, lexemes.lex_dfa, lexemes.count);
+        lexemes.decls.allocator = lexemes.allocator;
+        lexemes.decls.count = 0;
+        lexemes.brackets.allocator = lexemes.allocator;
+        lexemes.brackets.count = 0;
+        lexemes.definitions.allocator = lexemes.allocator;
+        lexemes.definitions.count = 0;
+        parser.parse_decls(end_lexeme, lexemes.decls);
+        lexemes.new_definitions_begin = 0;
+        lexemes.new_definitions_end = lexemes.definitions.count;
+    }
+    lexemes.dfa[end_lexeme] = DFA_NUM_STATES;
+    if (parser.is_stopped()) return false;
+    parser.highlight(lexemes.highlight, changed_begin, changed_end);
+    set_changed_lexemes(lexemes, relexed, is_relexed, changed_begin, changed_end);
+    parse_time += ch::get_time_in_seconds();
+
+    *out_lex_time = lex_time;
+    *out_parse_time = parse_time;
+    return true;
+}
+
+usize find_lexeme(const Lexemes& lexemes, usize offset) {
+    assert(lexemes.count);
+    usize lo = 0;
+    usize hi = lexemes.count - 1;
+    while (lo < hi) {
+        const usize mid = lo + (hi - lo + 1) / 2;
+        if (lexemes.offsets[mid] <= offset) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+// The last bracket at or before lexeme, or null if there's none.
+static const Bracket* find_bracket_before(const Lexemes& lexemes, usize lexeme) {
+    const usize after = find_first_at(lexemes.brackets, lexeme + 1);
+    return after ? &lexemes.brackets[after - 1] : nullptr;
+}
+
+const Bracket* find_bracket(const Lexemes& lexemes, usize lexeme) {
+    const Bracket* const bracket = find_bracket_before(lexemes, lexeme);
+    return bracket && bracket->lexeme == lexeme ? bracket : nullptr;
+}
+
+const Bracket* find_enclosing_bracket(const Lexemes& lexemes, usize lexeme) {
+    const Bracket* bracket = find_bracket_before(lexemes, lexeme);
+    if (!bracket) return nullptr;
+    if (!bracket->is_open()) {
+        // Past a pair that closed, so it's in the pair that one is in
+        const u32 open = bracket->lexeme == lexeme ? bracket->partner : bracket->parent;
+        if (!open) return nullptr;
+        bracket = find_bracket(lexemes, open);
+    }
+    if (bracket->partner) return bracket;
+
+    // Where the parser gave up on it isn't known. It goes on to the end of its declaration at most, as pairs don't span them.
+    const ch::Array<u32>& decls = lexemes.decls;
+    usize lo = 0;
+    usize hi = decls.count;
+    while (lo < hi) {
+        const usize mid = lo + (hi - lo) / 2;
+        if (decls[mid] <= bracket->lexeme) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < decls.count && lexeme >= decls[lo] ? nullptr : bracket;
+}
+
+// Whether lexeme l is the text s.
+static bool is_token(const Lexemes& lexemes, const Buffer& buffer, usize l, const char* s) {
+    const usize offset = lexemes.offsets[l];
+    const usize size = lexemes.offsets[l + 1] - offset;
+    for (usize i = 0; i < size; i++) {
+        if (!s[i] || buffer[offset + i] != (u8)s[i]) return false;
+    }
+    return !s[size];
+}
+
+static Fold_Kind get_fold_kind(Bracket_Kind kind) {
+    switch (kind) {
+    case BK_Function_Body: return FOLD_Function_Body;
+    case BK_Struct_Body:   return FOLD_Struct_Body;
+    default:               return FOLD_Block;
+    }
+}
+
+void find_fold_regions(const Lexemes& lexemes, const Buffer& buffer, ch::Array<Fold_Region>& out) {
+    if (lexemes.count < 2) return;
+    const usize end_lexeme = lexemes.count - 1;
+    const ch::Array<Bracket>& brackets = lexemes.brackets;
+    usize bracket = 0;
+
+    // An #if block is pushed at the #if and gets its end at the #endif. The ones that never get one are taken out again.
+    const usize first_region = out.count;
+    ch::Array<usize> open_ifs;
+    open_ifs.allocator = lexemes.allocator;
+    defer(open_ifs.free());
+
+    for (usize l = 1; l < end_lexeme; l++) {
+        if (bracket < brackets.count && brackets[bracket].lexeme == l) {
+            const Bracket& it = brackets[bracket];
+            bracket++;
+            if (it.partner > it.lexeme && lexemes.first[l] == '{') {
+                const Fold_Region region = { lexemes.offsets[l], lexemes.offsets[it.partner], get_fold_kind(it.kind) };
+                out.push(region);
+            }
+            continue;
         }
-        buf->lexemes.count = lex_seeker - buf->lexemes.begin();
-
-        temp_parser_gap = b.gap;
-        temp_parser_gap_size = b.gap_size;
-
-        f64 parse_time = -ch::get_time_in_seconds();
-        parse(buf->lexemes.begin(), buf->lexemes.end() - 2);
-        parse_time += ch::get_time_in_seconds();
-        buf->lexemes.end()[-2] = buf->lexemes.end()[-1];
-        buf->lexemes.count -= 1;
-        buf->lex_time += lex_time;
-        buf->parse_time += parse_time;
-        buf->lex_parse_count++;
+
+        if (lexemes.highlight[l] == HL_Comment) {
+            const usize begin = l;
+            while (l + 1 < end_lexeme && lexemes.highlight[l + 1] == HL_Comment) l++;
+            const Fold_Region region = { lexemes.offsets[begin], lexemes.offsets[l + 1] - 1, FOLD_Comment };
+            out.push(region);
+            continue;
+        }
+
+        // Only the parser marks directives
+        if (lexemes.language != LANG_CPP || lexemes.dfa[l] != DFA_PREPROC || lexemes.first[l] != '#') continue;
+        usize directive = l + 1;
+        while (directive < end_lexeme && lexemes.dfa[directive] != DFA_PREPROC && lexemes.dfa[directive] != DFA_NEWLINE) directive++;
+        if (directive == end_lexeme || lexemes.dfa[directive] != DFA_PREPROC) continue;
+
+        if (is_token(lexemes, buffer, directive, "if") || is_token(lexemes, buffer, directive, "ifdef") || is_token(lexemes, buffer, directive, "ifndef")) {
+            const Fold_Region region = { lexemes.offsets[l], 0, FOLD_Preproc };
+            open_ifs.push(out.push(region));
+        } else if (is_token(lexemes, buffer, directive, "endif") && open_ifs.count) {
+            out[open_ifs[open_ifs.count - 1]].end = lexemes.offsets[l];
+            open_ifs.count--;
+        }
+        l = directive;
+    }
+
+    if (!open_ifs.count) return;
+    usize write_index = first_region;
+    for (usize i = first_region; i < out.count; i++) {
+        if (out[i].kind == FOLD_Preproc && !out[i].end) continue;
+        out[write_index] = out[i];
+        write_index++;
     }
+    out.count = write_index;
+}
+
+void parse_cpp(Buffer* buf) {
+    if (!buf->syntax_dirty || buf->disable_parse) return;
+    assert(!buf->is_parsing);
+    buf->syntax_dirty = false;
+
+    f64 lex_time;
+    f64 parse_time;
+    Text text;
+    defer(text.free());
+    buf->get_text(&text);
+    parse_text(text, buf->language, buf->lexemes, buf->syntax_edit, nullptr, &lex_time, &parse_time);
+    buf->lexemes.version++;
+    get_symbol_table().update(buf, text);
+    buf->syntax_edit.is_set = false;
+    buf->lex_time += lex_time;
+    buf->parse_time += parse_time;
+    buf->lex_parse_count++;
 }
 } // namespace parsing
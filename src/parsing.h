@@ -1,7 +1,11 @@
 #pragma once
 #include <ch_stl/types.h>
+#include <ch_stl/allocator.h>
+#include <ch_stl/array.h>
+#include <ch_stl/gap_buffer.h>
 
 struct Buffer;
+struct Edit_Range;
 
 // C++ lexing/parsing tools.
 namespace parsing {
@@ -13,64 +17,275 @@ namespace parsing {
 // It doesn't even recognize keywords, it just treats all identifiers alike.
 // The tradeoff is that this puts an increased burden of code processing
 // onto the parser. There is no nesting of any kind.
-// I don't yet know the optimal ordering here for cache-efficiency, if there is
-// one; I will have to write some sort of randomizer/permutation-checker.
-enum Lex_Dfa : u8 {
-    DFA_BLOCK_COMMENT,
-    DFA_BLOCK_COMMENT_STAR,
-    DFA_LINE_COMMENT,
-    DFA_WHITE,
-    DFA_WHITE_BS,
-    DFA_NEWLINE,
-    DFA_STRINGLIT,
-    DFA_STRINGLIT_BS,
-    DFA_CHARLIT,
-    DFA_CHARLIT_BS,
-    DFA_SLASH,
-    DFA_IDENT,
-    DFA_OP,
-    DFA_OP2,
-    DFA_NUMLIT,
-    
-    DFA_NUM_STATES,
-
-    DFA_PREPROC,
-    DFA_MACRO,
-    DFA_TYPE,
-    DFA_KEYWORD,
-    DFA_FUNCTION,
-    DFA_PARAM,
-    DFA_LABEL,
-};
-
+// Which numbers the states get only matters for cache-efficiency. tools/lex_tune.cpp tries orderings
+// on real code and writes the fastest one to parsing_lex_order.h, together with the Char_Type ordering.
+// The parser skips the states before DFA_NEWLINE and takes the ones up to DFA_LINE_COMMENT for comments,
+// so those stay put.
+//
 // This is an enum for categorizing C++ source code characters.
 // Since the lexer uses a table-based DFA, all of its relevant
 // char types need to be numerically adjacent, so that they can
 // index a contiguous cache-friendly table.
 // Strictly speaking, a real lexer would also process digraphs,
 // but digraphs are rarely used. Trigraphs are never used.
-enum Char_Type : u8 {
-    WHITE      ,
-    NEWLINE    , // '\r' '\n'
-    IDENT      , // '$' '@'-'Z' '_'-'z'
-    DOUBLEQUOTE, // '"'
-    SINGLEQUOTE, // '\''
-    DIGIT      , // '0'-'9'
-    SLASH      , // '/'
-    STAR       , // '*'
-    BS         , // '\\'
-    OP         ,
-    NUM_CHAR_TYPES,
+#include "parsing_lex_order.h"
+
+// What a lexeme is drawn as. The parser works it out, so drawing is a palette lookup per lexeme.
+enum Highlight : u8 {
+    HL_Default,
+    HL_Keyword,
+    HL_Function,
+    HL_Param,
+    HL_Type,
+    HL_Preproc,
+    HL_Macro,
+    HL_String,
+    HL_Comment,
+    HL_Op,
+    HL_Number,
+    HL_Label,
+
+    NUM_HIGHLIGHTS,
+};
+
+// What a buffer's text is lexed as. C++ gets parsed too, the others are highlighted straight from the lexer's states.
+enum Language : u8 {
+    LANG_CPP,
+    LANG_LUA,
+    LANG_PYTHON,
+    LANG_JSON,
+    LANG_MARKDOWN,
+
+    NUM_LANGUAGES,
+};
+
+// Lexemes per byte of text assumed until some text has been lexed.
+const f32 default_lexeme_density = 0.3f;
+
+// What the parser took a pair of brackets for.
+enum Bracket_Kind : u8 {
+    BK_Other,
+    BK_Function_Body,
+    BK_Struct_Body,
+};
+
+// A bracket of a pair the parser went into. Lexeme 0 is the front lexeme, which is never a bracket, so 0 stands for none.
+struct Bracket {
+    u32 lexeme;
+    // The bracket this one pairs with. An opening bracket that never closes has none.
+    u32 partner;
+    // The opening bracket of the innermost pair this one is in.
+    u32 parent;
+    // How many pairs this one is in. The parser runs out of stack long before this runs out of bits.
+    u16 depth;
+    Bracket_Kind kind;
+
+    bool is_open() const { return !partner || partner > lexeme; }
+};
+
+// What a defined name is.
+enum Symbol_Kind : u8 {
+    SK_Function,
+    SK_Type,
+    SK_Macro,
+    SK_Param,
+    SK_Label,
+
+    NUM_SYMBOL_KINDS,
+};
+
+// A name the parser saw being defined: a function that has a body or is declared outside of one, the parameters of
+// such a function, a struct or union with a body, a typedef or using, a #define or a label.
+struct Definition {
+    u32 lexeme;
+    Symbol_Kind kind;
 };
 
-struct Lexeme {
-    const u8* i;
-    u8 dfa;
-    u8 cached_first;
-    CH_FORCEINLINE u8 c() const { return cached_first; }
+// A buffer's lexemes as parallel arrays, so that the parser and renderer only touch the parts they read.
+// A lexeme starts at an offset into the text rather than at a pointer, so it stays valid when the gap moves.
+// Lexeme 0 is a front lexeme in the start state and the last one is an end lexeme at the end of the text in the
+// state after the last one, DFA_NUM_STATES for C++.
+struct Lexemes {
+    u32* offsets = nullptr;
+    // The state after parsing.
+    u8* dfa = nullptr;
+    // The state the lexer left this lexeme in. The parser overwrites dfa,
+    // this is kept so that relexing can pick up from any lexeme.
+    u8* lex_dfa = nullptr;
+    // The first byte of the lexeme, so that the parser rarely has to look at the text.
+    u8* first = nullptr;
+    // Highlight of every lexeme, set by the parser or from the lexed states if the language isn't parsed.
+    u8* highlight = nullptr;
+    usize count = 0;
+    usize allocated = 0;
+    // Lexemes per byte of text the last time all of it was lexed. Room for new lexemes is made by this
+    // instead of a lexeme per byte of text.
+    f32 density = default_lexeme_density;
+    ch::Allocator allocator = ch::get_heap_allocator();
+    // The lexeme every top-level declaration starts at, in order, the first one at 0. Parsing a declaration
+    // only looks at the lexemes up to where the next one starts, so a reparse can start at any of them.
+    ch::Array<u32> decls;
+    // Every {}, () and [] the parser went into, in the order of their lexemes. Both halves of a pair are in it,
+    // so either one is found with a binary search. Closing brackets the parser didn't pair up aren't, and neither are
+    // parentheses it only counts, like the ones around *f in int (*f)(int).
+    // A pair never spans two declarations, so a reparse only replaces the brackets of the ones it parses.
+    // Empty if the language isn't parsed.
+    ch::Array<Bracket> brackets;
+    // Every name defined in the text, in the order of their lexemes. Like brackets, a reparse only replaces the ones of
+    // the declarations it parses. Empty if the language isn't parsed.
+    ch::Array<Definition> definitions;
+    // The definitions the last parse made are the ones from new_definitions_begin to new_definitions_end. The ones before
+    // them were kept and the ones after them were kept and shifted, so that whatever indexes them can update just as much.
+    usize new_definitions_begin = 0;
+    usize new_definitions_end = 0;
+    // What the states are states of.
+    Language language = LANG_CPP;
+    // Goes up by one with every parse of a buffer, so that a parse job can tell whether it still has the lexemes the
+    // buffer's ones were parsed from. 0 if they're of no parse.
+    u64 version = 0;
+    // The lexemes before this one are the same as in the lexemes the last parse started from, and so are the
+    // declarations, brackets and definitions of them. Only first[0] can differ, as that's the first byte of the text.
+    usize kept_lexemes = 0;
+    // The lexemes from new_lexemes_end on are the old ones from old_lexemes_end on, moved over with the same states.
+    // old_lexemes_end is -1 if none were kept after the parse, so that whatever indexes lexemes can update just as much.
+    usize new_lexemes_end = 0;
+    usize old_lexemes_end = (usize)-1;
+
+    // Grows to room for at least new_allocated lexemes.
+    void reserve(usize new_allocated);
+    void free();
+    void push(u32 offset, u8 state, u8 first_byte);
+    // Copies n lexemes starting at from in src to this starting at to. There has to be room for them.
+    void copy(usize to, const Lexemes& src, usize from, usize n);
+    // Moves n lexemes starting at from to to. There has to be room for them.
+    void move(usize to, usize from, usize n);
+    // Makes this a copy of src, decls, brackets, definitions and language too.
+    void assign(const Lexemes& src);
+    // Makes this a copy of src like assign. If this is what src was parsed from, only what that parse changed is copied.
+    void catch_up(const Lexemes& src);
+};
+
+// The language of a file with this extension, without the dot. C++ if it's not one of the others.
+Language get_language_for_extension(const char* extension, usize count);
+
+// Most states a language's lexer can have. The end lexeme's state comes on top.
+const usize max_lex_states = 31;
+
+// A run of bytes in some state ends at a byte in any of the stop classes or, if there are any, in none of the stay classes.
+// The classes are bits of the vector kernels' byte classes in lexer.cpp.
+struct Lex_Run {
+    u8 stop_a;
+    u8 stop_b;
+    u8 stay_a;
+    u8 stay_b;
 };
 
-bool is_keyword(const Lexeme* l);
+// A language's lexer. Every table a kernel reads is in here, so that they take up as few cache lines as they can.
+struct alignas(64) Lex_Tables {
+    // Maps a byte to its char type premultiplied with num_states.
+    u8 char_type[256];
+    // Next state is lex_table[state + char_type[c]].
+    u8 lex_table[256];
+    Lex_Run runs[max_lex_states];
+    // What a lexeme in a state is drawn as when the language isn't parsed.
+    u8 highlight[max_lex_states + 1];
+    // For a state that is part of a delimiter's opening text, the states after it that carry on the same opening.
+    // A lexeme in it is drawn like the lexeme after it then, as it only turns out what it is later.
+    u32 continued_by[max_lex_states + 1];
+    // Also the state of the end lexeme.
+    u8 num_states;
+    u8 num_char_types;
+    // The state the text and every line start in.
+    u8 start_state;
+};
+
+// Made at compile time, C++'s from its state machine and the others' from the specs in lexer.cpp.
+const Lex_Tables& get_lex_tables(Language language);
+
+enum Lex_Kernel : u8 {
+    LK_Scalar,
+    LK_SSSE3,
+    LK_AVX2,
+};
+
+// The fastest kernel this cpu supports.
+Lex_Kernel get_best_lex_kernel();
+
+// Lexes [p, end) with tables starting in state dfa and appends a lexeme to lexemes wherever the state changes.
+// offset is where p is in the text. Room is made as it goes. Returns the state at end.
+// Every kernel gives the same lexemes.
+u8 lex(const Lex_Tables& tables, u8 dfa, const u8* p, const u8* end, usize offset, Lexemes& lexemes, Lex_Kernel kernel);
+u8 lex(const Lex_Tables& tables, u8 dfa, const u8* p, const u8* end, usize offset, Lexemes& lexemes);
+
+// Sets the highlights of lexemes [begin, end) from their lexed states. The ones from end on have to be highlighted already.
+void highlight_lexed(const Lex_Tables& tables, Lexemes& lexemes, usize begin, usize end);
+
+// A part of the text that's contiguous in memory.
+struct Text_Span {
+    const u8* data;
+    // Where data starts in the text. It goes on to where the next span starts.
+    usize index;
+};
+
+// The text that's lexed and parsed, read where it's stored. A gap buffer is the text before and after its gap, a piece
+// tree is its pieces. The lexer goes through the spans in order and the parser reads lexemes from the one it's in,
+// so it costs next to nothing over contiguous text however many there are.
+struct Text {
+    // In order of their text, none of them empty.
+    ch::Array<Text_Span> spans;
+    usize count = 0;
+
+    Text() { spans.allocator = ch::get_heap_allocator(); }
+
+    // Makes this the text of b.
+    void set(const ch::Gap_Buffer<u8>& b);
+    // Appends size bytes at data to the end of the text.
+    void push(const u8* data, usize size);
+    void clear();
+    void free();
+
+    // The span that index is in. There has to be text.
+    usize find_span(usize index) const;
+    CH_FORCEINLINE usize get_span_end(usize span) const { return span + 1 < spans.count ? spans[span + 1].index : count; }
+    u8 operator[](usize index) const;
+};
+
+// Lexes text as language into lexemes and parses it if it's C++. edit is what changed since lexemes were made and only
+// that gets relexed. Everything is lexed again if it's not set, there are no lexemes yet or they're of another language.
+// Gives up and returns false as soon as stop_requested is set, which can be null. The lexemes are garbage then.
+bool parse_text(const Text& text, Language language, Lexemes& lexemes, const Edit_Range& edit, const volatile u64* stop_requested, f64* out_lex_time, f64* out_parse_time);
+
+// The lexeme the text at offset is in. There have to be lexemes.
+usize find_lexeme(const Lexemes& lexemes, usize offset);
+
+// The bracket at lexeme, or null if the parser didn't pair it up.
+const Bracket* find_bracket(const Lexemes& lexemes, usize lexeme);
+
+// The opening bracket of the innermost pair lexeme is in, counting the brackets of a pair as in it. Null if it isn't in any.
+// An opening bracket that never closes has the lexemes after it in it up to the next bracket that isn't, or the end of its declaration.
+const Bracket* find_enclosing_bracket(const Lexemes& lexemes, usize lexeme);
+
+enum Fold_Kind : u8 {
+    FOLD_Block,
+    FOLD_Function_Body,
+    FOLD_Struct_Body,
+    FOLD_Comment,
+    FOLD_Preproc,
+};
+
+// Text that can be folded, from the offset of its first byte to the offset of its last one.
+struct Fold_Region {
+    u32 begin;
+    u32 end;
+    Fold_Kind kind;
+};
+
+// Appends everything in lexemes that can be folded, sorted by begin: {} pairs, comments and #if blocks up to their #endif.
+// Folding only hides whole lines, so regions that don't span lines can be left out by the caller.
+// The buffer's text has to be the text the lexemes were made from.
+void find_fold_regions(const Lexemes& lexemes, const Buffer& buffer, ch::Array<Fold_Region>& out);
+
+// Parses a buffer on this thread. It can't have a parse job running.
 void parse_cpp(Buffer* b);
 
 } // namespace parsing
@@ -0,0 +1,148 @@
+#pragma once
+
+// Generated by tools/keyword_hash.cpp from parsing_cpp_keywords.h. Don't edit, run it again instead.
+
+#include "keyword_hash.h"
+
+const u64 keyword_hash_multiplier = 0xACDB21AF19B8930Bull;
+const u32 keyword_hash_bits = 9;
+const usize max_keyword_size = 16;
+
+struct Keyword {
+    u8 size;
+    char text[max_keyword_size + 1];
+};
+
+static const Keyword keywords[95] = {
+    { 2, "do" },
+    { 2, "if" },
+    { 2, "or" },
+    { 3, "and" },
+    { 3, "asm" },
+    { 3, "for" },
+    { 3, "int" },
+    { 3, "new" },
+    { 3, "not" },
+    { 3, "try" },
+    { 3, "xor" },
+    { 4, "auto" },
+    { 4, "bool" },
+    { 4, "case" },
+    { 4, "char" },
+    { 4, "else" },
+    { 4, "enum" },
+    { 4, "goto" },
+    { 4, "long" },
+    { 4, "this" },
+    { 4, "true" },
+    { 4, "void" },
+    { 5, "bitor" },
+    { 5, "break" },
+    { 5, "catch" },
+    { 5, "class" },
+    { 5, "compl" },
+    { 5, "const" },
+    { 5, "false" },
+    { 5, "float" },
+    { 5, "or_eq" },
+    { 5, "short" },
+    { 5, "throw" },
+    { 5, "union" },
+    { 5, "using" },
+    { 5, "while" },
+    { 6, "and_eq" },
+    { 6, "bitand" },
+    { 6, "delete" },
+    { 6, "double" },
+    { 6, "export" },
+    { 6, "extern" },
+    { 6, "friend" },
+    { 6, "inline" },
+    { 6, "not_eq" },
+    { 6, "public" },
+    { 6, "return" },
+    { 6, "signed" },
+    { 6, "sizeof" },
+    { 6, "static" },
+    { 6, "struct" },
+    { 6, "switch" },
+    { 6, "typeid" },
+    { 6, "xor_eq" },
+    { 7, "alignas" },
+    { 7, "alignof" },
+    { 7, "char8_t" },
+    { 7, "concept" },
+    { 7, "default" },
+    { 7, "mutable" },
+    { 7, "nullptr" },
+    { 7, "private" },
+    { 7, "typedef" },
+    { 7, "virtual" },
+    { 7, "wchar_t" },
+    { 8, "char16_t" },
+    { 8, "char32_t" },
+    { 8, "continue" },
+    { 8, "co_await" },
+    { 8, "co_yield" },
+    { 8, "decltype" },
+    { 8, "explicit" },
+    { 8, "noexcept" },
+    { 8, "operator" },
+    { 8, "reflexpr" },
+    { 8, "register" },
+    { 8, "requires" },
+    { 8, "template" },
+    { 8, "typename" },
+    { 8, "unsigned" },
+    { 8, "volatile" },
+    { 9, "consteval" },
+    { 9, "constexpr" },
+    { 9, "constinit" },
+    { 9, "co_return" },
+    { 9, "namespace" },
+    { 9, "protected" },
+    { 10, "const_cast" },
+    { 11, "static_cast" },
+    { 12, "dynamic_cast" },
+    { 12, "synchronized" },
+    { 12, "thread_local" },
+    { 13, "static_assert" },
+    { 15, "atomic_noexcept" },
+    { 16, "reinterpret_cast" },
+};
+
+// 1 + the index of the keyword that hashes to each slot. 0 if none does.
+static const u8 keyword_slots[1 << keyword_hash_bits] = {
+    0, 0, 0, 82, 0, 0, 0, 0, 0, 0, 44, 25, 0, 0, 64, 0,
+    0, 0, 13, 0, 50, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 11, 70, 0, 0, 89, 0, 0, 0, 42, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 65, 0, 88, 0, 0, 0, 0, 18, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 90, 69, 0, 0, 76, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 31,
+    0, 0, 0, 0, 20, 0, 0, 0, 0, 12, 0, 0, 45, 0, 0, 0,
+    3, 0, 1, 0, 0, 81, 16, 0, 0, 19, 0, 0, 87, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 66, 0, 0, 77, 0, 0, 0, 22, 61,
+    0, 56, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 5, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 80, 68, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 7, 0, 0, 0, 92, 0, 0, 0, 28, 0, 74, 0, 0,
+    0, 0, 27, 0, 0, 0, 0, 94, 0, 0, 0, 0, 0, 59, 0, 0,
+    23, 0, 0, 91, 0, 8, 49, 0, 0, 0, 0, 0, 53, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 14, 0,
+    0, 0, 37, 0, 0, 0, 0, 0, 0, 0, 0, 60, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 46,
+    62, 0, 0, 0, 0, 0, 47, 0, 0, 0, 0, 0, 0, 0, 35, 0,
+    0, 0, 43, 0, 0, 0, 0, 0, 63, 67, 9, 0, 0, 0, 0, 0,
+    0, 0, 86, 0, 0, 0, 0, 0, 0, 0, 51, 0, 0, 0, 0, 0,
+    32, 0, 48, 0, 0, 0, 29, 0, 0, 30, 0, 0, 0, 0, 0, 0,
+    55, 0, 0, 52, 0, 34, 0, 0, 0, 0, 0, 17, 0, 0, 0, 0,
+    71, 0, 0, 40, 0, 0, 0, 54, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 41, 0, 0, 0, 78, 0, 0, 0, 0, 0, 0, 0, 0,
+    95, 0, 0, 0, 21, 0, 57, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 83, 0, 0, 0, 39, 0, 0,
+    85, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 4,
+    0, 0, 0, 0, 0, 0, 0, 24, 10, 0, 0, 0, 75, 0, 0, 38,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 0, 0, 0, 79,
+    0, 0, 0, 0, 0, 6, 0, 0, 0, 0, 36, 0, 93, 0, 0, 0,
+    0, 0, 0, 33, 0, 0, 0, 84, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 15, 58, 0, 26, 73, 0, 0, 72, 0, 0,
+};
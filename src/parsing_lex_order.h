@@ -0,0 +1,47 @@
+#pragma once
+
+// Generated by tools/lex_tune.cpp. Don't edit, run it again instead.
+// The fastest of 200 orderings on 1965186 bytes of code: 183.5 MB/s, against 183.5 MB/s for the one before it.
+// parsing.h includes this inside namespace parsing.
+
+enum Lex_Dfa : u8 {
+    DFA_BLOCK_COMMENT,
+    DFA_BLOCK_COMMENT_STAR,
+    DFA_LINE_COMMENT,
+    DFA_WHITE,
+    DFA_WHITE_BS,
+    DFA_NEWLINE,
+    DFA_STRINGLIT,
+    DFA_STRINGLIT_BS,
+    DFA_CHARLIT,
+    DFA_CHARLIT_BS,
+    DFA_SLASH,
+    DFA_IDENT,
+    DFA_OP,
+    DFA_OP2,
+    DFA_NUMLIT,
+
+    DFA_NUM_STATES,
+
+    DFA_PREPROC,
+    DFA_MACRO,
+    DFA_TYPE,
+    DFA_KEYWORD,
+    DFA_FUNCTION,
+    DFA_PARAM,
+    DFA_LABEL,
+};
+
+enum Char_Type : u8 {
+    WHITE      ,
+    NEWLINE    , // '\r' '\n'
+    IDENT      , // '$' '@'-'Z' '_'-'z'
+    DOUBLEQUOTE, // '"'
+    SINGLEQUOTE, // '\''
+    DIGIT      , // '0'-'9'
+    SLASH      , // '/'
+    STAR       , // '*'
+    BS         , // '\\'
+    OP         ,
+    NUM_CHAR_TYPES,
+};
@@ -0,0 +1,412 @@
+#include "piece_tree.h"
+
+static u32 count_lf(const u8* text, usize size) {
+	u32 result = 0;
+	for (usize i = 0; i < size; i += 1) {
+		result += text[i] == '\n';
+	}
+	return result;
+}
+
+Piece_Tree::Piece_Tree(const ch::Allocator& in_alloc) : allocator(in_alloc) {
+	nodes.allocator = in_alloc;
+	free_nodes.allocator = in_alloc;
+	add_blocks.allocator = in_alloc;
+}
+
+void Piece_Tree::set_original(u8* text, usize size) {
+	free();
+
+	original = text;
+	original_size = size;
+	is_original_mapped = false;
+	has_lf_counts = true;
+	build_original();
+}
+
+void Piece_Tree::set_original_map(const File_Map& map) {
+	free();
+
+	original_map = map;
+	original = map.data;
+	original_size = map.size;
+	is_original_mapped = true;
+	has_lf_counts = false;
+	build_original();
+}
+
+void Piece_Tree::build_original() {
+	ch::Array<u32> pieces;
+	pieces.allocator = allocator;
+	defer(pieces.free());
+	pieces.reserve(original_size / max_piece_size + 1);
+
+	for (usize i = 0; i < original_size; i += max_piece_size) {
+		const usize piece_size = original_size - i < max_piece_size ? original_size - i : max_piece_size;
+		pieces.push(make_node(original + i, piece_size));
+	}
+
+	root = build(pieces.data, pieces.count);
+}
+
+void Piece_Tree::free() {
+	if (is_original_mapped) {
+		original_map.close();
+
+		if (moved_original_path) {
+			ch::delete_file(moved_original_path);
+			moved_original_path.free();
+		}
+	} else if (original) {
+		ch_delete[] (u8*)original;
+	}
+	original = nullptr;
+	is_original_mapped = false;
+	original_size = 0;
+
+	for (u8* block : add_blocks) {
+		ch_delete[] block;
+	}
+	add_blocks.free();
+	add_block_used = 0;
+
+	nodes.free();
+	free_nodes.free();
+	root = invalid_piece_node;
+
+	cached_data = nullptr;
+	cached_start = 0;
+	cached_end = 0;
+}
+
+u8 Piece_Tree::operator[](usize index) const {
+	if (index >= cached_start && index < cached_end) {
+		return cached_data[index - cached_start];
+	}
+
+	usize span_count;
+	return *get_span(index, &span_count);
+}
+
+const u8* Piece_Tree::get_span(usize index, usize* out_count) const {
+	assert(index < count());
+
+	u32 node = root;
+	u64 offset = index;
+	while (node) {
+		const Piece_Node& n = nodes[node];
+		const u64 left_size = n.left ? nodes[n.left].subtree_size : 0;
+
+		if (offset < left_size) {
+			node = n.left;
+		} else if (offset < left_size + n.size) {
+			const u64 piece_offset = offset - left_size;
+
+			cached_data = n.data;
+			cached_start = index - piece_offset;
+			cached_end = cached_start + n.size;
+
+			*out_count = (usize)(n.size - piece_offset);
+			return n.data + piece_offset;
+		} else {
+			offset -= left_size + n.size;
+			node = n.right;
+		}
+	}
+
+	assert(false);
+	*out_count = 0;
+	return nullptr;
+}
+
+void Piece_Tree::insert(const u8* text, usize size, usize index) {
+	assert(index <= count());
+	if (!size) return;
+
+	cached_data = nullptr;
+	cached_start = 0;
+	cached_end = 0;
+
+	u32 left;
+	u32 right;
+	split(root, index, &left, &right);
+
+	// Typing keeps appending right after the last insert so that piece can just grow instead of adding a node per char.
+	bool extended = false;
+	if (left && add_blocks.count > 0 && add_block_used + size <= piece_add_block_size) {
+		u32 spine[64];
+		usize spine_count = 0;
+		for (u32 node = left; node && spine_count < 64; node = nodes[node].right) {
+			spine[spine_count] = node;
+			spine_count += 1;
+		}
+
+		Piece_Node& last = nodes[spine[spine_count - 1]];
+		const u8* add_end = add_blocks[add_blocks.count - 1] + add_block_used;
+		if (!last.right && last.data + last.size == add_end && last.size + size <= max_piece_size) {
+			append(text, size);
+			last.size += (u32)size;
+			if (has_lf_counts) last.num_lf += count_lf(text, size);
+
+			for (usize i = spine_count; i > 0; i -= 1) {
+				update(spine[i - 1]);
+			}
+			extended = true;
+		}
+	}
+
+	if (!extended) {
+		ch::Array<u32> pieces;
+		pieces.allocator = allocator;
+		defer(pieces.free());
+
+		for (usize i = 0; i < size; i += max_piece_size) {
+			const usize piece_size = size - i < max_piece_size ? size - i : max_piece_size;
+			const u8* const data = append(text + i, piece_size);
+			pieces.push(make_node(data, piece_size));
+		}
+
+		left = merge(left, build(pieces.data, pieces.count));
+	}
+
+	root = merge(left, right);
+}
+
+void Piece_Tree::remove(usize index, usize size) {
+	assert(index + size <= count());
+	if (!size) return;
+
+	cached_data = nullptr;
+	cached_start = 0;
+	cached_end = 0;
+
+	u32 left;
+	u32 rest;
+	split(root, index, &left, &rest);
+
+	u32 middle;
+	u32 right;
+	split(rest, size, &middle, &right);
+
+	free_subtree(middle);
+	root = merge(left, right);
+}
+
+u64 Piece_Tree::get_lf_before(usize index) const {
+	assert(has_lf_counts);
+	assert(index <= count());
+
+	u64 result = 0;
+	u32 node = root;
+	u64 offset = index;
+	while (node) {
+		const Piece_Node& n = nodes[node];
+		const u64 left_size = n.left ? nodes[n.left].subtree_size : 0;
+
+		if (offset < left_size) {
+			node = n.left;
+		} else if (offset < left_size + n.size) {
+			if (n.left) result += nodes[n.left].subtree_lf;
+			return result + count_lf(n.data, (usize)(offset - left_size));
+		} else {
+			result += n.subtree_lf - (n.right ? nodes[n.right].subtree_lf : 0);
+			offset -= left_size + n.size;
+			node = n.right;
+		}
+	}
+
+	return result;
+}
+
+usize Piece_Tree::get_index_after_lf(u64 n) const {
+	assert(has_lf_counts);
+	if (n == 0) return 0;
+	if (n > get_num_lf()) return count();
+
+	u64 base = 0;
+	u32 node = root;
+	while (node) {
+		const Piece_Node& it = nodes[node];
+		const u64 left_lf = it.left ? nodes[it.left].subtree_lf : 0;
+		const u64 left_size = it.left ? nodes[it.left].subtree_size : 0;
+
+		if (n <= left_lf) {
+			node = it.left;
+		} else if (n <= left_lf + it.num_lf) {
+			u64 remaining = n - left_lf;
+			for (u32 i = 0; i < it.size; i += 1) {
+				if (it.data[i] == '\n') {
+					remaining -= 1;
+					if (!remaining) return (usize)(base + left_size + i + 1);
+				}
+			}
+			break;
+		} else {
+			n -= left_lf + it.num_lf;
+			base += left_size + it.size;
+			node = it.right;
+		}
+	}
+
+	assert(false);
+	return count();
+}
+
+u32 Piece_Tree::make_node(const u8* data, usize size) {
+	assert(size <= max_piece_size);
+
+	if (nodes.count == 0) {
+		// Reserve node 0 as invalid_piece_node
+		nodes.push({});
+	}
+
+	// xorshift32
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+
+	Piece_Node node = {};
+	node.data = data;
+	node.size = (u32)size;
+	node.num_lf = has_lf_counts ? count_lf(data, size) : 0;
+	node.priority = random_state;
+	node.subtree_size = size;
+	node.subtree_lf = node.num_lf;
+
+	if (free_nodes.count > 0) {
+		const u32 result = free_nodes[free_nodes.count - 1];
+		free_nodes.count -= 1;
+		nodes[result] = node;
+		return result;
+	}
+
+	return (u32)nodes.push(node);
+}
+
+void Piece_Tree::free_subtree(u32 node) {
+	if (!node) return;
+
+	free_subtree(nodes[node].left);
+	free_subtree(nodes[node].right);
+	free_nodes.push(node);
+}
+
+void Piece_Tree::update(u32 node) {
+	Piece_Node& n = nodes[node];
+	n.subtree_size = n.size;
+	n.subtree_lf = n.num_lf;
+	if (n.left) {
+		n.subtree_size += nodes[n.left].subtree_size;
+		n.subtree_lf += nodes[n.left].subtree_lf;
+	}
+	if (n.right) {
+		n.subtree_size += nodes[n.right].subtree_size;
+		n.subtree_lf += nodes[n.right].subtree_lf;
+	}
+}
+
+void Piece_Tree::split(u32 node, u64 index, u32* out_left, u32* out_right) {
+	if (!node) {
+		*out_left = invalid_piece_node;
+		*out_right = invalid_piece_node;
+		return;
+	}
+
+	// @NOTE: make_node can grow nodes so never hold on to a reference across the recursion
+	const u64 left_size = nodes[node].left ? nodes[nodes[node].left].subtree_size : 0;
+	const u64 piece_size = nodes[node].size;
+
+	if (index <= left_size) {
+		u32 right_of_split;
+		split(nodes[node].left, index, out_left, &right_of_split);
+		nodes[node].left = right_of_split;
+		update(node);
+		*out_right = node;
+	} else if (index >= left_size + piece_size) {
+		u32 left_of_split;
+		split(nodes[node].right, index - left_size - piece_size, &left_of_split, out_right);
+		nodes[node].right = left_of_split;
+		update(node);
+		*out_left = node;
+	} else {
+		// index is inside this node's piece. The tail becomes a new node that takes over the right subtree.
+		// It gets the same priority so the heap order still holds.
+		const usize offset = (usize)(index - left_size);
+		const u32 tail = make_node(nodes[node].data + offset, (usize)piece_size - offset);
+
+		Piece_Node& head = nodes[node];
+		nodes[tail].priority = head.priority;
+		nodes[tail].right = head.right;
+		head.right = invalid_piece_node;
+		head.size = (u32)offset;
+		head.num_lf -= nodes[tail].num_lf;
+
+		update(tail);
+		update(node);
+		*out_left = node;
+		*out_right = tail;
+	}
+}
+
+u32 Piece_Tree::merge(u32 left, u32 right) {
+	if (!left) return right;
+	if (!right) return left;
+
+	if (nodes[left].priority > nodes[right].priority) {
+		const u32 merged = merge(nodes[left].right, right);
+		nodes[left].right = merged;
+		update(left);
+		return left;
+	}
+
+	const u32 merged = merge(left, nodes[right].left);
+	nodes[right].left = merged;
+	update(right);
+	return right;
+}
+
+u32 Piece_Tree::build(const u32* sorted_nodes, usize count) {
+	// Builds the treap in O(n) by keeping the right spine on a stack
+	ch::Array<u32> spine;
+	spine.allocator = allocator;
+	defer(spine.free());
+
+	for (usize i = 0; i < count; i += 1) {
+		const u32 node = sorted_nodes[i];
+
+		u32 last = invalid_piece_node;
+		while (spine.count > 0 && nodes[spine[spine.count - 1]].priority < nodes[node].priority) {
+			last = spine[spine.count - 1];
+			update(last);
+			spine.count -= 1;
+		}
+
+		nodes[node].left = last;
+		nodes[node].right = invalid_piece_node;
+		if (spine.count > 0) {
+			nodes[spine[spine.count - 1]].right = node;
+		}
+		spine.push(node);
+	}
+
+	if (spine.count == 0) return invalid_piece_node;
+
+	for (usize i = spine.count; i > 0; i -= 1) {
+		update(spine[i - 1]);
+	}
+	return spine[0];
+}
+
+const u8* Piece_Tree::append(const u8* text, usize size) {
+	assert(size <= piece_add_block_size);
+
+	if (add_blocks.count == 0 || add_block_used + size > piece_add_block_size) {
+		add_blocks.push(ch_new u8[piece_add_block_size]);
+		add_block_used = 0;
+	}
+
+	u8* const result = add_blocks[add_blocks.count - 1] + add_block_used;
+	ch::mem_copy(result, text, size);
+	add_block_used += size;
+	return result;
+}
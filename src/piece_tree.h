@@ -0,0 +1,130 @@
+#pragma once
+
+#include <ch_stl/array.h>
+#include <ch_stl/filesystem.h>
+
+#include "file_map.h"
+
+/** Pieces never get bigger than this so splitting one and recounting its line feeds stays cheap. */
+const usize max_piece_size = 64 * 1024;
+
+/** Inserted text is appended to blocks of this size. Blocks are never reallocated so pieces can point into them. */
+const usize piece_add_block_size = 64 * 1024;
+
+const u32 invalid_piece_node = 0;
+
+struct Piece_Node {
+	/** Points into either the original text or one of the add blocks. */
+	const u8* data;
+	u32 size;
+	u32 num_lf;
+
+	u32 priority;
+	u32 left;
+	u32 right;
+
+	/** Sums of this node and all of its children. */
+	u64 subtree_size;
+	u64 subtree_lf;
+};
+
+/**
+ * Text stored as a balanced tree of pieces over an immutable original buffer and append-only add blocks.
+ * Edits split and join pieces instead of moving text so they cost O(log n) no matter how far apart they are.
+ *
+ * The tree is a treap ordered by text position. Every node caches the byte and line feed count of its subtree
+ * so byte to line feed lookups are O(log n) as well.
+ *
+ * @see ch::Gap_Buffer which is the default for small buffers
+ */
+struct Piece_Tree {
+	ch::Allocator allocator;
+
+	/** Node 0 is never used so invalid_piece_node can be 0. */
+	ch::Array<Piece_Node> nodes;
+	ch::Array<u32> free_nodes;
+	u32 root = invalid_piece_node;
+
+	/** The text the tree was created with. Owned by the tree. Points into original_map if the file is mapped. */
+	const u8* original = nullptr;
+	usize original_size = 0;
+	File_Map original_map;
+	bool is_original_mapped = false;
+
+	/** Set once a save moved the mapped file out of the way. The file there is deleted when the tree stops reading from it. */
+	ch::Path moved_original_path;
+
+	/**
+	 * Mapped originals don't count line feeds up front so opening a file doesn't read all of it.
+	 * Every num_lf is 0 and the line feed queries can't be used while this is false.
+	 */
+	bool has_lf_counts = true;
+
+	ch::Array<u8*> add_blocks;
+	usize add_block_used = 0;
+
+	u32 random_state = 0x9E3779B9;
+
+	/** The last piece looked up by operator[] so walking the text byte by byte doesn't search the tree every time. */
+	mutable const u8* cached_data = nullptr;
+	mutable u64 cached_start = 0;
+	mutable u64 cached_end = 0;
+
+	Piece_Tree() = default;
+	Piece_Tree(const ch::Allocator& in_alloc);
+
+	explicit operator bool() const { return nodes.allocated > 0; }
+
+	CH_FORCEINLINE usize count() const { return root ? (usize)nodes[root].subtree_size : 0; }
+	CH_FORCEINLINE u64 get_num_lf() const { return root ? nodes[root].subtree_lf : 0; }
+
+	/**
+	 * Makes text the tree's original buffer and replaces the contents with it.
+	 *
+	 * @param text must be allocated with ch_new. The tree takes ownership of it.
+	 */
+	void set_original(u8* text, usize size);
+
+	/** Makes a mapped file the tree's original buffer and replaces the contents with it. The tree takes ownership of map. */
+	void set_original_map(const File_Map& map);
+
+	void free();
+
+	u8 operator[](usize index) const;
+
+	/**
+	 * Gets the contiguous text that starts at index.
+	 *
+	 * @param out_count is set to the amount of bytes that can be read from the result. Stays within a single piece.
+	 * @returns a pointer to the byte at index
+	 */
+	const u8* get_span(usize index, usize* out_count) const;
+
+	void insert(const u8* text, usize size, usize index);
+	CH_FORCEINLINE void insert(u8 c, usize index) { insert(&c, 1, index); }
+	CH_FORCEINLINE void push(u8 c) { insert(&c, 1, count()); }
+
+	void remove(usize index, usize size);
+	CH_FORCEINLINE void remove_at_index(usize index) { remove(index, 1); }
+
+	/** @returns the amount of '\n' before index. */
+	u64 get_lf_before(usize index) const;
+
+	/** @returns the index right after the nth '\n' or count() if there aren't that many. */
+	usize get_index_after_lf(u64 n) const;
+
+	u32 make_node(const u8* data, usize size);
+	void free_subtree(u32 node);
+	void build_original();
+	void update(u32 node);
+
+	/** Splits node into the first index bytes and the rest. Pieces that straddle index are split in two. */
+	void split(u32 node, u64 index, u32* out_left, u32* out_right);
+	u32 merge(u32 left, u32 right);
+
+	/** Builds a balanced tree out of pieces that are already in order. */
+	u32 build(const u32* sorted_nodes, usize count);
+
+	/** Copies text into the add blocks and @returns where it ended up. size must fit into a single block. */
+	const u8* append(const u8* text, usize size);
+};
@@ -0,0 +1,544 @@
+#include "project_index.h"
+
+#include <ch_stl/hash.h>
+
+/** @returns true if count items of item_size at offset are all in the map and aligned. */
+static bool is_section_valid(const File_Map& map, u64 offset, u64 count, u64 item_size) {
+	if (offset % 8 != 0 || offset > map.size) return false;
+	return count <= (map.size - offset) / item_size;
+}
+
+bool Project_Index::open(const char* path) {
+	assert(!header);
+	if (!map.open(path)) return false;
+
+	const Index_Header* const it = (const Index_Header*)map.data;
+	bool is_valid = map.size >= sizeof(Index_Header) && it->magic == index_magic && it->version == index_version;
+	is_valid = is_valid && is_section_valid(map, it->files_offset, it->num_files, sizeof(Index_File));
+	is_valid = is_valid && is_section_valid(map, it->names_offset, it->num_names, sizeof(Symbol_Name));
+	is_valid = is_valid && is_section_valid(map, it->slots_offset, it->num_slots, sizeof(u32));
+	is_valid = is_valid && is_section_valid(map, it->symbols_offset, it->num_symbols, sizeof(Index_Symbol));
+	is_valid = is_valid && is_section_valid(map, it->name_first_offset, (u64)it->num_names + 1, sizeof(u32));
+	is_valid = is_valid && is_section_valid(map, it->text_offset, it->text_size, 1);
+	// Probing stops at an empty slot, so there has to be one
+	is_valid = is_valid && (it->num_slots & (it->num_slots - 1)) == 0 && (u64)it->num_names * 2 <= it->num_slots;
+	is_valid = is_valid && ((const u32*)(map.data + it->name_first_offset))[it->num_names] == it->num_symbols;
+	if (!is_valid) {
+		map.close();
+		return false;
+	}
+
+	header = it;
+	files = (const Index_File*)(map.data + it->files_offset);
+	names = (const Symbol_Name*)(map.data + it->names_offset);
+	slots = (const u32*)(map.data + it->slots_offset);
+	symbols = (const Index_Symbol*)(map.data + it->symbols_offset);
+	name_first = (const u32*)(map.data + it->name_first_offset);
+	text = map.data + it->text_offset;
+	return true;
+}
+
+void Project_Index::close() {
+	map.close();
+	*this = Project_Index();
+}
+
+u32 Project_Index::find_name(const u8* in_text, usize count) const {
+	if (!header || !header->num_slots) return 0;
+	return slots[find_symbol_name_slot(text, names, slots, header->num_slots, in_text, count, ch::fnv1_hash(in_text, count))];
+}
+
+const u8* Project_Index::get_name(u32 name, usize* out_count) const {
+	assert(name && name <= header->num_names);
+	const Symbol_Name& it = names[name - 1];
+	*out_count = it.count;
+	return text + it.offset;
+}
+
+const Index_Symbol* Project_Index::get_symbols(u32 name, usize* out_count) const {
+	assert(name && name <= header->num_names);
+	*out_count = name_first[name] - name_first[name - 1];
+	return symbols + name_first[name - 1];
+}
+
+const u32 no_file = 0xFFFFFFFF;
+
+/** A file found under the root. */
+struct Job_File {
+	/** Offset of its null terminated path in Index_State::paths. */
+	u32 path;
+	u32 path_count;
+	u64 size;
+	u64 write_time;
+	u64 content_hash;
+	/** The same file in the old index, or no_file. */
+	u32 old_file;
+	/** Set if its symbols are the ones in the old index. */
+	bool is_reused;
+	bool is_parsed;
+};
+
+/** A name a worker found. Its text is in the worker's text so nothing is shared until the workers are done. */
+struct Found_Symbol {
+	u32 file;
+	u32 offset;
+	u32 text;
+	u32 count;
+	parsing::Symbol_Kind kind;
+};
+
+struct Index_State {
+	Index_Job* job;
+	ch::Array<char> paths;
+	ch::Array<Job_File> files;
+	volatile u64 next_file;
+};
+
+struct Index_Worker {
+	Index_State* state;
+	parsing::Lexemes lexemes;
+	ch::Array<Found_Symbol> found;
+	ch::Array<u8> text;
+	/** The file being parsed, read straight from its map. */
+	parsing::Text file_text;
+	Thread thread;
+};
+
+static bool is_source_extension(const char* name, usize count) {
+	static const char* const extensions[] = { "c", "cc", "cpp", "cxx", "h", "hh", "hpp", "hxx", "inl" };
+
+	usize dot = count;
+	while (dot && name[dot - 1] != '.') dot -= 1;
+	if (!dot) return false;
+
+	const char* const extension = name + dot;
+	const usize extension_count = count - dot;
+	for (const char* it : extensions) {
+		bool is_match = true;
+		usize i = 0;
+		for (; is_match && i < extension_count; i += 1) {
+			char c = extension[i];
+			if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+			is_match = c == it[i];
+		}
+		if (is_match && !it[i]) return true;
+	}
+	return false;
+}
+
+/** Pushes the null terminated path of name in the directory at dir. @returns its offset. */
+static u32 push_path(ch::Array<char>& paths, const ch::Array<char>& dir, const char* name) {
+	const u32 offset = (u32)paths.count;
+	for (usize i = 0; i + 1 < dir.count; i += 1) paths.push(dir[i]);
+	paths.push('/');
+	for (const char* c = name; *c; c += 1) paths.push(*c);
+	paths.push(0);
+	return offset;
+}
+
+/** Finds every source file under the root. Directories that start with a '.' are skipped, like .git, and so are links to directories, so that a link back up the tree can't make it walk forever. */
+static void find_files(Index_State& state) {
+	ch::Array<u32> dirs;
+	ch::Array<char> dir;
+	dirs.allocator = ch::get_heap_allocator();
+	dir.allocator = ch::get_heap_allocator();
+	defer(dirs.free());
+	defer(dir.free());
+
+	const ch::Path& root = state.job->root;
+	usize root_count = root.count;
+	while (root_count > 1 && (root.data[root_count - 1] == '/' || root.data[root_count - 1] == '\\')) root_count -= 1;
+	dirs.push((u32)state.paths.count);
+	for (usize i = 0; i < root_count; i += 1) state.paths.push(root.data[i]);
+	state.paths.push(0);
+
+	while (dirs.count && !atomic_load(&state.job->stop_requested)) {
+		const u32 dir_path = dirs[dirs.count - 1];
+		dirs.count -= 1;
+
+		// Pushing paths moves them, so the iterator gets a copy
+		dir.count = 0;
+		for (const char* c = state.paths.data + dir_path; *c; c += 1) dir.push(*c);
+		dir.push(0);
+
+		for (ch::Directory_Iterator it(dir.data); it.can_advance(); it.advance()) {
+			const ch::Directory_Result result = it.get();
+			if (result.file_name[0] == '.') continue;
+
+			if (result.type == ch::DRT_Directory) {
+				const u32 path = push_path(state.paths, dir, result.file_name);
+				if (is_link(state.paths.data + path)) state.paths.count = path;
+				else dirs.push(path);
+			} else if (result.type == ch::DRT_File && is_source_extension(result.file_name, ch::strlen(result.file_name))) {
+				Job_File file = {};
+				file.path = push_path(state.paths, dir, result.file_name);
+				file.path_count = (u32)(state.paths.count - file.path - 1);
+				file.size = result.file_size;
+				file.write_time = result.last_write_time;
+				file.old_file = no_file;
+				state.files.push(file);
+			}
+		}
+	}
+}
+
+/** Checks and parses files until there are none left. */
+static void index_worker_main(void* param) {
+	Index_Worker* const worker = (Index_Worker*)param;
+	Index_State& state = *worker->state;
+	const Project_Index* const old_index = state.job->old_index;
+
+	for (;;) {
+		if (atomic_load(&state.job->stop_requested)) return;
+		const usize file_index = (usize)atomic_add(&state.next_file, 1);
+		if (file_index >= state.files.count) return;
+
+		Job_File& file = state.files[file_index];
+		const Index_File* const old_file = file.old_file != no_file ? &old_index->files[file.old_file] : nullptr;
+		if (old_file && old_file->size == file.size && old_file->write_time == file.write_time) {
+			file.content_hash = old_file->content_hash;
+			file.is_reused = true;
+			continue;
+		}
+
+		File_Map map;
+		if (!map.open(state.paths.data + file.path)) {
+			// Empty files can't be mapped. Any other file is tried again next time.
+			if (file.size) file.write_time = 0;
+			file.content_hash = 0;
+			continue;
+		}
+		defer(map.close());
+
+		file.size = map.size;
+		file.content_hash = ch::fnv1_hash(map.data, map.size);
+		if (old_file && old_file->size == map.size && old_file->content_hash == file.content_hash) {
+			file.is_reused = true;
+			continue;
+		}
+
+		parsing::Text& text = worker->file_text;
+		text.clear();
+		text.push(map.data, map.size);
+
+		const Edit_Range full_parse;
+		f64 lex_time;
+		f64 parse_time;
+		if (!parsing::parse_text(text, parsing::LANG_CPP, worker->lexemes, full_parse, &state.job->stop_requested, &lex_time, &parse_time)) return;
+		file.is_parsed = true;
+
+		const parsing::Lexemes& lexemes = worker->lexemes;
+		for (const parsing::Definition& it : lexemes.definitions) {
+			Found_Symbol found;
+			found.file = (u32)file_index;
+			found.offset = lexemes.offsets[it.lexeme];
+			found.text = (u32)worker->text.count;
+			found.count = lexemes.offsets[it.lexeme + 1] - found.offset;
+			found.kind = it.kind;
+			for (u32 i = 0; i < found.count; i += 1) worker->text.push(map.data[found.offset + i]);
+			worker->found.push(found);
+		}
+	}
+}
+
+struct Merged_Symbol {
+	u32 name;
+	u32 file;
+	u32 offset;
+	parsing::Symbol_Kind kind;
+};
+
+static const u8 zero_padding[8] = {};
+
+/** Adds count bytes at data to the spans of the file, padded to a multiple of 8. @returns where they start. */
+static u64 add_section(ch::Array<File_Span>& spans, u64* size, const void* data, usize count) {
+	const u64 offset = *size;
+	if (count) spans.push({ (const u8*)data, count });
+	*size += count;
+	if (*size % 8) {
+		const usize padding = 8 - *size % 8;
+		spans.push({ zero_padding, padding });
+		*size += padding;
+	}
+	return offset;
+}
+
+static bool write_index(Index_State& state, ch::Array<Index_Worker>& workers) {
+	const Index_Job& job = *state.job;
+	const Project_Index* const old_index = job.old_index;
+
+	Symbol_Names names;
+	names.text.allocator = ch::get_heap_allocator();
+	names.names.allocator = ch::get_heap_allocator();
+	names.slots.allocator = ch::get_heap_allocator();
+	ch::Array<Index_File> files;
+	ch::Array<Merged_Symbol> merged;
+	files.allocator = ch::get_heap_allocator();
+	merged.allocator = ch::get_heap_allocator();
+	defer(names.free());
+	defer(files.free());
+	defer(merged.free());
+
+	files.reserve(state.files.count);
+	for (const Job_File& it : state.files) {
+		Index_File file = {};
+		file.size = it.size;
+		file.write_time = it.write_time;
+		file.content_hash = it.content_hash;
+		file.path = names.intern((const u8*)state.paths.data + it.path, it.path_count);
+		files.push(file);
+	}
+
+	if (old_index) {
+		// Old symbols are kept by name, so every name is looked at once
+		ch::Array<u32> new_files;
+		new_files.allocator = ch::get_heap_allocator();
+		defer(new_files.free());
+		new_files.reserve(old_index->header->num_files);
+		for (u32 i = 0; i < old_index->header->num_files; i += 1) new_files.push(no_file);
+		for (usize i = 0; i < state.files.count; i += 1) {
+			if (state.files[i].is_reused) new_files[state.files[i].old_file] = (u32)i;
+		}
+
+		for (u32 old_name = 1; old_name <= old_index->header->num_names; old_name += 1) {
+			usize num_symbols;
+			const Index_Symbol* const symbols = old_index->get_symbols(old_name, &num_symbols);
+			u32 name = 0;
+			for (usize i = 0; i < num_symbols; i += 1) {
+				const u32 file = new_files[symbols[i].file];
+				if (file == no_file) continue;
+				if (!name) {
+					usize count;
+					const u8* const text = old_index->get_name(old_name, &count);
+					name = names.intern(text, count);
+				}
+				merged.push({ name, file, symbols[i].offset, symbols[i].kind });
+			}
+		}
+	}
+
+	for (const Index_Worker& worker : workers) {
+		for (const Found_Symbol& it : worker.found) {
+			const u32 name = names.intern(worker.text.data + it.text, it.count);
+			merged.push({ name, it.file, it.offset, it.kind });
+		}
+	}
+
+	// The symbols of a name go together so that a lookup is a single range
+	const usize num_names = names.names.count;
+	ch::Array<u32> name_first;
+	ch::Array<Index_Symbol> symbols;
+	name_first.allocator = ch::get_heap_allocator();
+	symbols.allocator = ch::get_heap_allocator();
+	defer(name_first.free());
+	defer(symbols.free());
+	name_first.reserve(num_names + 2);
+	for (usize i = 0; i < num_names + 2; i += 1) name_first.push(0);
+	for (const Merged_Symbol& it : merged) {
+		name_first[it.name + 1] += 1;
+		files[it.file].num_symbols += 1;
+	}
+	for (usize i = 1; i < num_names + 2; i += 1) name_first[i] += name_first[i - 1];
+
+	symbols.reserve(merged.count);
+	symbols.count = merged.count;
+	for (const Merged_Symbol& it : merged) {
+		Index_Symbol symbol = {};
+		symbol.file = it.file;
+		symbol.offset = it.offset;
+		symbol.kind = it.kind;
+		symbols[name_first[it.name]] = symbol;
+		name_first[it.name] += 1;
+	}
+	// Every start moved to the next one's, so name n starts at name_first[n - 1] again
+
+	Index_Header header = {};
+	header.magic = index_magic;
+	header.version = index_version;
+	header.num_files = (u32)files.count;
+	header.num_names = (u32)num_names;
+	header.num_slots = (u32)names.slots.count;
+	header.num_symbols = (u32)symbols.count;
+	header.text_size = names.text.count;
+
+	ch::Array<File_Span> spans;
+	spans.allocator = ch::get_heap_allocator();
+	defer(spans.free());
+	u64 size = 0;
+	add_section(spans, &size, &header, sizeof(header));
+	header.files_offset = add_section(spans, &size, files.data, files.count * sizeof(Index_File));
+	header.names_offset = add_section(spans, &size, names.names.data, num_names * sizeof(Symbol_Name));
+	header.slots_offset = add_section(spans, &size, names.slots.data, names.slots.count * sizeof(u32));
+	header.symbols_offset = add_section(spans, &size, symbols.data, symbols.count * sizeof(Index_Symbol));
+	header.name_first_offset = add_section(spans, &size, name_first.data, (num_names + 1) * sizeof(u32));
+	header.text_offset = add_section(spans, &size, names.text.data, names.text.count);
+
+	if (!write_file_and_flush(job.temp_path, spans.data, spans.count)) {
+		ch::delete_file(job.temp_path);
+		return false;
+	}
+	return true;
+}
+
+static void free_workers(ch::Array<Index_Worker>& workers) {
+	for (Index_Worker& it : workers) {
+		it.lexemes.free();
+		it.found.free();
+		it.text.free();
+		it.file_text.free();
+	}
+	workers.free();
+}
+
+static void index_job_main(void* param) {
+	Index_Job* const job = (Index_Job*)param;
+
+	Index_State state = {};
+	state.job = job;
+	state.paths.allocator = ch::get_heap_allocator();
+	state.files.allocator = ch::get_heap_allocator();
+	defer(state.paths.free());
+	defer(state.files.free());
+
+	find_files(state);
+
+	const Project_Index* const old_index = job->old_index;
+	if (old_index && old_index->header->num_names) {
+		ch::Array<u32> old_files;
+		old_files.allocator = ch::get_heap_allocator();
+		defer(old_files.free());
+		old_files.reserve(old_index->header->num_names + 1);
+		for (u32 i = 0; i <= old_index->header->num_names; i += 1) old_files.push(no_file);
+		for (u32 i = 0; i < old_index->header->num_files; i += 1) {
+			const u32 path = old_index->files[i].path;
+			if (path <= old_index->header->num_names) old_files[path] = i;
+		}
+
+		for (Job_File& file : state.files) {
+			const u32 path = old_index->find_name((const u8*)state.paths.data + file.path, file.path_count);
+			if (path) file.old_file = old_files[path];
+		}
+	}
+
+	ch::Array<Index_Worker> workers;
+	workers.allocator = ch::get_heap_allocator();
+	const u32 num_workers = get_num_cpu_threads();
+	workers.reserve(num_workers);
+	for (u32 i = 0; i < num_workers; i += 1) {
+		Index_Worker worker;
+		worker.state = &state;
+		worker.found.allocator = ch::get_heap_allocator();
+		worker.text.allocator = ch::get_heap_allocator();
+		workers.push(worker);
+	}
+	defer(free_workers(workers));
+
+	// The first worker runs on this thread, like any whose thread can't be started
+	for (usize i = 1; i < workers.count; i += 1) {
+		if (!workers[i].thread.start(index_worker_main, &workers[i])) index_worker_main(&workers[i]);
+	}
+	index_worker_main(&workers[0]);
+	for (usize i = 1; i < workers.count; i += 1) workers[i].thread.join();
+
+	job->num_files = (u32)state.files.count;
+	for (const Job_File& it : state.files) {
+		if (it.is_parsed) job->num_parsed += 1;
+	}
+
+	job->succeeded = !atomic_load(&job->stop_requested) && write_index(state, workers);
+	atomic_store(&job->is_done, 1);
+}
+
+bool Index_Job::start() {
+	return thread.start(index_job_main, this);
+}
+
+bool Index_Job::finish() {
+	thread.join();
+	assert(atomic_load(&is_done));
+	return succeeded;
+}
+
+void Index_Job::free() {
+	thread.join();
+
+	root.free();
+	index_path.free();
+	temp_path.free();
+}
+
+static Project_Index the_project_index;
+static Index_Job* the_index_job = nullptr;
+
+static bool is_same_name(const char* a, const char* b) {
+	for (; *a && *a == *b; a += 1, b += 1) {}
+	return *a == *b;
+}
+
+/** Only a directory with a .git or an .eden_index in it is indexed, so the index never lands in whatever directory the editor was started from. */
+static bool is_project_root(const ch::Path& root) {
+	for (ch::Directory_Iterator it(root); it.can_advance(); it.advance()) {
+		const ch::Directory_Result result = it.get();
+		if (is_same_name(result.file_name, ".git") || is_same_name(result.file_name, ".eden_index")) return true;
+	}
+	return false;
+}
+
+void start_project_index(const ch::Path& root) {
+	assert(!the_index_job);
+	if (!is_project_root(root)) return;
+
+	Index_Job* const job = ch_new Index_Job;
+	job->root = root.copy(ch::get_heap_allocator());
+	job->index_path = root.copy(ch::get_heap_allocator());
+	job->index_path.append(".eden_index");
+	job->temp_path = job->index_path.copy(ch::get_heap_allocator());
+	job->temp_path.append(".tmp", false);
+
+	if (!the_project_index) the_project_index.open(job->index_path);
+	if (the_project_index) job->old_index = &the_project_index;
+
+	if (!job->start()) {
+		job->free();
+		ch_delete job;
+		return;
+	}
+	the_index_job = job;
+}
+
+/** Moves a finished job's index over the one in use. A mapped file can't be written over, so the old one is unmapped first. */
+static void swap_in_index(Index_Job* job) {
+	if (!job->finish()) {
+		ch::delete_file(job->temp_path);
+		return;
+	}
+
+	the_project_index.close();
+	if (!replace_file(job->temp_path, job->index_path)) ch::delete_file(job->temp_path);
+	the_project_index.open(job->index_path);
+}
+
+void tick_project_index() {
+	Index_Job* const job = the_index_job;
+	if (!job || !atomic_load(&job->is_done)) return;
+
+	swap_in_index(job);
+	job->free();
+	ch_delete job;
+	the_index_job = nullptr;
+}
+
+void shutdown_project_index() {
+	if (the_index_job) {
+		atomic_store(&the_index_job->stop_requested, 1);
+		swap_in_index(the_index_job);
+		the_index_job->free();
+		ch_delete the_index_job;
+		the_index_job = nullptr;
+	}
+	the_project_index.close();
+}
+
+const Project_Index& get_project_index() {
+	return the_project_index;
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <ch_stl/array.h>
+#include <ch_stl/filesystem.h>
+
+#include "file_map.h"
+#include "parsing.h"
+#include "symbol_index.h"
+#include "threads.h"
+
+/**
+ * The project index is a single file that's mapped as is and searched in place, so opening it costs nothing until a name is looked up.
+ * Everything in it is in the byte order of the machine that wrote it, and every section starts at a multiple of 8.
+ *
+ * Names are stored like Symbol_Names, so the same hashing finds them. File paths are names too.
+ */
+const u32 index_magic = 'e' | 'd' << 8 | 'i' << 16 | 'x' << 24;
+/** Bumped whenever the layout or what the parser defines changes, so an old index is made again instead of read wrong. */
+const u32 index_version = 1;
+
+struct Index_Header {
+	u32 magic;
+	u32 version;
+
+	u32 num_files;
+	u32 num_names;
+	/** A power of two, or 0 if there are no names. */
+	u32 num_slots;
+	u32 num_symbols;
+	u64 text_size;
+
+	/** Byte offsets of the sections from the start of the file. */
+	u64 files_offset;
+	u64 names_offset;
+	u64 slots_offset;
+	u64 symbols_offset;
+	u64 name_first_offset;
+	u64 text_offset;
+};
+
+/** A file that was indexed. */
+struct Index_File {
+	u64 size;
+	u64 write_time;
+	/** ch::fnv1_hash of the whole file. */
+	u64 content_hash;
+	u32 path;
+	u32 num_symbols;
+};
+
+/** A name defined in a file. The symbols of a name are next to each other. */
+struct Index_Symbol {
+	u32 file;
+	/** Byte offset of the name in the file. */
+	u32 offset;
+	parsing::Symbol_Kind kind;
+	u8 pad[3];
+};
+
+/** An index file mapped into memory. */
+struct Project_Index {
+	File_Map map;
+
+	const Index_Header* header = nullptr;
+	const Index_File* files = nullptr;
+	/** Name id - 1. */
+	const Symbol_Name* names = nullptr;
+	const u32* slots = nullptr;
+	const Index_Symbol* symbols = nullptr;
+	/** The first symbol of every name id, and one more for the end of the last one. */
+	const u32* name_first = nullptr;
+	const u8* text = nullptr;
+
+	explicit operator bool() const { return header != nullptr; }
+
+	/** @returns false if there's no index at path or it isn't one this version can read. */
+	bool open(const char* path);
+	void close();
+
+	/** @returns the id of text or 0 if the index doesn't have it. */
+	u32 find_name(const u8* in_text, usize count) const;
+
+	/** @returns the text of name. */
+	const u8* get_name(u32 name, usize* out_count) const;
+
+	/** @returns the symbols of name. */
+	const Index_Symbol* get_symbols(u32 name, usize* out_count) const;
+};
+
+/**
+ * Indexes the C and C++ files under a directory on a worker thread and writes the index to a temp file next to them.
+ *
+ * Files go to a pool of threads that lex and parse them with parsing::parse_text, the same as a buffer but without one.
+ * A file that the last index has with the same size and write time isn't read at all, and one with the same content hash isn't parsed,
+ * so starting again after a few files changed only costs the enumeration and those files.
+ */
+struct Index_Job {
+	ch::Path root;
+	ch::Path index_path;
+	/** Where the job writes the new index. The owner moves it over index_path once nothing maps the old one. */
+	ch::Path temp_path;
+
+	/** The index the last run wrote, or null. Must stay mapped until the job is done. */
+	const Project_Index* old_index = nullptr;
+
+	Thread thread;
+	volatile u64 is_done = 0;
+	volatile u64 stop_requested = 0;
+
+	/** Only valid once is_done is set. */
+	bool succeeded = false;
+	u32 num_files = 0;
+	u32 num_parsed = 0;
+
+	/** @returns false if the worker couldn't be started. */
+	bool start();
+
+	/**
+	 * Waits for the worker.
+	 *
+	 * @returns true if temp_path was written and flushed to disk
+	 */
+	bool finish();
+
+	void free();
+};
+
+/**
+ * Maps the index of root if there is one and starts bringing it up to date.
+ * Does nothing unless root is marked as a project by a .git or an .eden_index in it. An empty .eden_index marks one that isn't a repository.
+ */
+void start_project_index(const ch::Path& root);
+
+/** Swaps in the new index once the job is done. */
+void tick_project_index();
+
+/** Stops the job without waiting for the rest of the files and unmaps the index. */
+void shutdown_project_index();
+
+/** The index of the project. It can be empty and it's replaced when a job finishes, so nothing from it should be kept across frames. */
+const Project_Index& get_project_index();
@@ -0,0 +1,29 @@
+#include "save_job.h"
+
+static void save_job_main(void* param) {
+	Save_Job* const job = (Save_Job*)param;
+
+	job->succeeded = write_file_and_flush(job->temp_path, job->spans.data, job->spans.count);
+	atomic_store(&job->is_done, 1);
+}
+
+bool Save_Job::start() {
+	return thread.start(save_job_main, this);
+}
+
+bool Save_Job::finish() {
+	thread.join();
+	assert(atomic_load(&is_done));
+	return succeeded;
+}
+
+void Save_Job::free() {
+	thread.join();
+
+	spans.free();
+	if (detached_text) {
+		detached_allocator.free(detached_text);
+		detached_text = nullptr;
+	}
+	temp_path.free();
+}
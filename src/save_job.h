@@ -0,0 +1,50 @@
+#pragma once
+
+#include <ch_stl/array.h>
+#include <ch_stl/filesystem.h>
+
+#include "file_map.h"
+#include "threads.h"
+
+/**
+ * Writes a snapshot of a buffer's text to a temp file on a worker thread.
+ * The owner moves the temp file over the real one once it's done, so a crash never leaves a half written file behind.
+ */
+struct Save_Job {
+	/** The text to write, in order. Must not change until the job is done. */
+	ch::Array<File_Span> spans;
+
+	/**
+	 * Set while the spans are both sides of a gap buffer, read where they are. Typing into the gap the save started with
+	 * doesn't touch them, anything else has the buffer hand its memory over first. Piece tree text never changes.
+	 */
+	const u8* gap_begin = nullptr;
+	const u8* gap_end = nullptr;
+
+	/** A gap buffer's memory that was handed over so the buffer could be edited. Freed with the job. */
+	u8* detached_text = nullptr;
+	ch::Allocator detached_allocator;
+
+	ch::Path temp_path;
+
+	/** Buffer::edit_count when the snapshot was taken. */
+	u64 edit_count = 0;
+
+	Thread thread;
+	volatile u64 is_done = 0;
+
+	/** Only valid once is_done is set. */
+	bool succeeded = false;
+
+	/** @returns false if the worker couldn't be started. */
+	bool start();
+
+	/**
+	 * Waits for the worker.
+	 *
+	 * @returns true if temp_path was written and flushed to disk
+	 */
+	bool finish();
+
+	void free();
+};
@@ -0,0 +1,321 @@
+#include "symbol_index.h"
+
+#include <ch_stl/hash.h>
+
+static Symbol_Table the_symbol_table;
+
+Symbol_Table& get_symbol_table() {
+	return the_symbol_table;
+}
+
+static bool is_same_text(const u8* a, const u8* b, usize count) {
+	for (usize i = 0; i < count; i += 1) {
+		if (a[i] != b[i]) return false;
+	}
+	return true;
+}
+
+usize find_symbol_name_slot(const u8* all_text, const Symbol_Name* names, const u32* slots, usize num_slots, const u8* text, usize count, u64 hash) {
+	const usize mask = num_slots - 1;
+	for (usize i = (usize)hash & mask;; i = (i + 1) & mask) {
+		const u32 id = slots[i];
+		if (!id) return i;
+
+		const Symbol_Name& name = names[id - 1];
+		if (name.hash == hash && name.count == count && is_same_text(all_text + name.offset, text, count)) return i;
+	}
+}
+
+static usize find_slot(const Symbol_Names& names, const u8* text, usize count, u64 hash) {
+	return find_symbol_name_slot(names.text.data, names.names.data, names.slots.data, names.slots.count, text, count, hash);
+}
+
+u32 Symbol_Names::intern(const u8* in_text, usize count) {
+	// Twice as many slots as names keeps the probes short
+	if ((names.count + 1) * 2 > slots.count) {
+		usize new_count = slots.count ? slots.count * 2 : 1024;
+		while ((names.count + 1) * 2 > new_count) new_count *= 2;
+
+		slots.count = 0;
+		if (slots.allocated < new_count) slots.reserve(new_count - slots.allocated);
+		slots.count = new_count;
+		ch::mem_zero(slots.data, new_count * sizeof(u32));
+		for (usize i = 0; i < names.count; i += 1) {
+			const Symbol_Name& name = names[i];
+			slots[find_slot(*this, text.data + name.offset, name.count, name.hash)] = (u32)(i + 1);
+		}
+	}
+
+	const u64 hash = ch::fnv1_hash(in_text, count);
+	const usize slot = find_slot(*this, in_text, count, hash);
+	if (slots[slot]) return slots[slot];
+
+	Symbol_Name name;
+	name.offset = (u32)text.count;
+	name.count = (u32)count;
+	name.hash = hash;
+	if (text.count + count > text.allocated) text.reserve(count + text.allocated / 2);
+	for (usize i = 0; i < count; i += 1) text.push(in_text[i]);
+
+	const u32 id = (u32)(names.push(name) + 1);
+	slots[slot] = id;
+	return id;
+}
+
+u32 Symbol_Names::find(const u8* in_text, usize count) const {
+	if (!slots.count) return 0;
+	return slots[find_slot(*this, in_text, count, ch::fnv1_hash(in_text, count))];
+}
+
+const u8* Symbol_Names::get(u32 name, usize* out_count) const {
+	assert(name && name <= names.count);
+	const Symbol_Name& it = names[name - 1];
+	*out_count = it.count;
+	return text.data + it.offset;
+}
+
+void Symbol_Names::free() {
+	text.free();
+	names.free();
+	slots.free();
+}
+
+/** Text that goes across spans is copied into scratch, the rest is read where it is. */
+static const u8* get_text(const parsing::Text& text, usize index, usize count, ch::Array<u8>& scratch) {
+	const usize span = text.find_span(index);
+	if (index + count <= text.get_span_end(span)) return text.spans[span].data + (index - text.spans[span].index);
+
+	scratch.count = 0;
+	for (usize i = 0; i < count; i += 1) scratch.push(text[index + i]);
+	return scratch.data;
+}
+
+static const u8* get_text(const Buffer& buffer, usize index, usize count, ch::Array<u8>& scratch) {
+	usize span_count;
+	const u8* const span = buffer.get_span(index, &span_count);
+	if (count <= span_count) return span;
+
+	scratch.count = 0;
+	for (usize i = 0; i < count; i += 1) scratch.push(buffer[index + i]);
+	return scratch.data;
+}
+
+static ch::Array<u8> scratch_text;
+
+u32 Symbol_Table::add_site(ch::Array<u32>& firsts, Buffer_ID buffer, u32 lexeme, u32 name, parsing::Symbol_Kind kind) {
+	// Site 0 is the end of the lists
+	if (!sites.count) sites.push({});
+	while (firsts.count <= name) firsts.push(0);
+
+	u32 site = first_free_site;
+	if (site) {
+		first_free_site = sites[site].next;
+	} else {
+		site = (u32)sites.push({});
+	}
+
+	Symbol_Site& it = sites[site];
+	it.buffer = buffer;
+	it.lexeme = lexeme;
+	it.name = name;
+	it.kind = kind;
+	it.prev = 0;
+	it.next = firsts[name];
+	if (it.next) sites[it.next].prev = site;
+	firsts[name] = site;
+	return site;
+}
+
+void Symbol_Table::remove_site(ch::Array<u32>& firsts, u32 site) {
+	Symbol_Site& it = sites[site];
+	if (it.prev) sites[it.prev].next = it.next;
+	else firsts[it.name] = it.next;
+	if (it.next) sites[it.next].prev = it.prev;
+
+	it.buffer = invalid_buffer_id;
+	it.next = first_free_site;
+	first_free_site = site;
+}
+
+static bool is_name(u8 dfa) {
+	switch (dfa) {
+	case parsing::DFA_IDENT:
+	case parsing::DFA_TYPE:
+	case parsing::DFA_FUNCTION:
+	case parsing::DFA_PARAM:
+	case parsing::DFA_LABEL:
+	case parsing::DFA_MACRO:
+		return true;
+	}
+	return false;
+}
+
+void Symbol_Table::update(Buffer* buffer, const parsing::Text& text) {
+	const parsing::Lexemes& lexemes = buffer->lexemes;
+	const ch::Array<parsing::Definition>& definitions = lexemes.definitions;
+	ch::Array<u32>& buffer_sites = buffer->symbol_sites;
+
+	usize new_begin = lexemes.new_definitions_begin;
+	usize new_end = lexemes.new_definitions_end;
+	usize tail_count = definitions.count - new_end;
+	bool is_whole = false;
+	if (new_begin + tail_count > buffer_sites.count) {
+		// The sites aren't of the lexemes the parse started from, like when the buffer was emptied while it ran
+		remove(buffer);
+		new_begin = 0;
+		new_end = definitions.count;
+		tail_count = 0;
+		is_whole = true;
+	}
+
+	// The sites of the declarations that were parsed again go and the ones after them move over
+	const usize old_tail = buffer_sites.count - tail_count;
+	for (usize i = new_begin; i < old_tail; i += 1) remove_site(first_sites, buffer_sites[i]);
+	if (definitions.count > buffer_sites.allocated) buffer_sites.reserve(definitions.count - buffer_sites.allocated);
+	if (tail_count) ch::mem_move(buffer_sites.data + new_end, buffer_sites.data + old_tail, tail_count * sizeof(u32));
+	buffer_sites.count = definitions.count;
+
+	for (usize i = new_begin; i < new_end; i += 1) {
+		const parsing::Definition& it = definitions[i];
+		const usize offset = lexemes.offsets[it.lexeme];
+		const usize count = lexemes.offsets[it.lexeme + 1] - offset;
+		const u32 name = names.intern(get_text(text, offset, count, scratch_text), count);
+		buffer_sites[i] = add_site(first_sites, buffer->id, it.lexeme, name, it.kind);
+	}
+
+	// Their lexemes were shifted by the reparse
+	if (tail_count && sites[buffer_sites[new_end]].lexeme != definitions[new_end].lexeme) {
+		for (usize i = new_end; i < definitions.count; i += 1) sites[buffer_sites[i]].lexeme = definitions[i].lexeme;
+	}
+
+	update_uses(buffer, text, is_whole);
+}
+
+/** @returns the first of uses at or after lexeme. */
+static usize find_first_use_at(const Symbol_Table& table, const ch::Array<u32>& uses, usize lexeme) {
+	usize lo = 0;
+	usize hi = uses.count;
+	while (lo < hi) {
+		const usize mid = lo + (hi - lo) / 2;
+		if (table.sites[uses[mid]].lexeme < lexeme) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+static ch::Array<u32> new_uses;
+
+void Symbol_Table::update_uses(Buffer* buffer, const parsing::Text& text, bool is_whole) {
+	const parsing::Lexemes& lexemes = buffer->lexemes;
+	ch::Array<u32>& buffer_uses = buffer->use_sites;
+
+	// Only C++ is parsed into names
+	if (lexemes.language != parsing::LANG_CPP) {
+		for (const u32 site : buffer_uses) remove_site(first_uses, site);
+		buffer_uses.count = 0;
+		return;
+	}
+
+	usize begin = lexemes.kept_lexemes;
+	usize end = lexemes.new_lexemes_end;
+	usize old_end = lexemes.old_lexemes_end;
+	if (is_whole) {
+		begin = 0;
+		end = lexemes.count;
+		old_end = (usize)-1;
+	}
+
+	// The uses of the lexemes the parse made go and the ones after them move over
+	const usize kept_count = find_first_use_at(*this, buffer_uses, begin);
+	const usize old_tail = find_first_use_at(*this, buffer_uses, old_end);
+	const usize tail_count = buffer_uses.count - old_tail;
+	for (usize i = kept_count; i < old_tail; i += 1) remove_site(first_uses, buffer_uses[i]);
+
+	new_uses.count = 0;
+	for (usize l = begin; l < end && l + 1 < lexemes.count; l += 1) {
+		if (!is_name(lexemes.dfa[l])) continue;
+
+		const usize offset = lexemes.offsets[l];
+		const usize count = lexemes.offsets[l + 1] - offset;
+		const u32 name = names.intern(get_text(text, offset, count, scratch_text), count);
+		new_uses.push(add_site(first_uses, buffer->id, (u32)l, name, parsing::NUM_SYMBOL_KINDS));
+	}
+
+	const usize new_count = kept_count + new_uses.count + tail_count;
+	if (new_count > buffer_uses.allocated) buffer_uses.reserve(new_count - buffer_uses.allocated);
+	if (tail_count) ch::mem_move(buffer_uses.data + kept_count + new_uses.count, buffer_uses.data + old_tail, tail_count * sizeof(u32));
+	if (new_uses.count) ch::mem_copy(buffer_uses.data + kept_count, new_uses.data, new_uses.count * sizeof(u32));
+	buffer_uses.count = new_count;
+
+	// Wraps around when there are fewer lexemes now, which still gives the right ones
+	const u32 shift = (u32)(end - old_end);
+	if (tail_count && shift) {
+		for (usize i = new_count - tail_count; i < new_count; i += 1) sites[buffer_uses[i]].lexeme += shift;
+	}
+}
+
+void Symbol_Table::remove(Buffer* buffer) {
+	for (const u32 site : buffer->symbol_sites) remove_site(first_sites, site);
+	buffer->symbol_sites.count = 0;
+	for (const u32 site : buffer->use_sites) remove_site(first_uses, site);
+	buffer->use_sites.count = 0;
+}
+
+const Symbol_Site* Symbol_Table::find_first(u32 name) const {
+	if (!name || name >= first_sites.count || !first_sites[name]) return nullptr;
+	return &sites[first_sites[name]];
+}
+
+const Symbol_Site* Symbol_Table::find_first_use(u32 name) const {
+	if (!name || name >= first_uses.count || !first_uses[name]) return nullptr;
+	return &sites[first_uses[name]];
+}
+
+const Symbol_Site* Symbol_Table::find_next(const Symbol_Site& site) const {
+	return site.next ? &sites[site.next] : nullptr;
+}
+
+void Symbol_Table::free() {
+	names.free();
+	sites.free();
+	first_sites.free();
+	first_uses.free();
+	first_free_site = 0;
+}
+
+const u8* find_identifier_at(const Buffer& buffer, usize index, usize* out_count) {
+	const parsing::Lexemes& lexemes = buffer.lexemes;
+	if (lexemes.language != parsing::LANG_CPP || lexemes.count < 2) return nullptr;
+
+	// The lexemes can be behind the text
+	const Edit_Range& edit = buffer.syntax_edit;
+	const usize old_index = edit.to_old(index);
+	usize l = parsing::find_lexeme(lexemes, old_index);
+	// A cursor right after a name is on it too
+	if (!is_name(lexemes.dfa[l]) && l > 1 && lexemes.offsets[l] == old_index) l -= 1;
+	if (l + 1 >= lexemes.count || !is_name(lexemes.dfa[l])) return nullptr;
+
+	const usize offset = lexemes.offsets[l];
+	const usize count = lexemes.offsets[l + 1] - offset;
+	if (edit.is_set && offset < edit.old_end && offset + count > edit.begin) return nullptr;
+
+	*out_count = count;
+	return get_text(buffer, edit.to_new(offset), count, scratch_text);
+}
+
+u32 find_symbol_name_at(const Buffer& buffer, usize index) {
+	usize count;
+	const u8* const text = find_identifier_at(buffer, index, &count);
+	if (!text) return 0;
+	return the_symbol_table.names.find(text, count);
+}
+
+usize find_use_at(const Buffer& buffer, usize lexeme) {
+	return find_first_use_at(the_symbol_table, buffer.use_sites, lexeme);
+}
+
+usize get_symbol_site_index(const Symbol_Site& site) {
+	const Buffer* const buffer = find_buffer(site.buffer);
+	assert(buffer);
+	return buffer->syntax_edit.to_new(buffer->lexemes.offsets[site.lexeme]);
+}
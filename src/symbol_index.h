@@ -0,0 +1,130 @@
+#pragma once
+
+#include <ch_stl/array.h>
+
+#include "buffer.h"
+
+/** An interned identifier. */
+struct Symbol_Name {
+	u32 offset;
+	u32 count;
+	u64 hash;
+};
+
+/**
+ * Looks text up in an open addressing table of names. Takes the arrays instead of Symbol_Names so that a table mapped from disk can be searched too.
+ *
+ * @returns the slot of text or the empty slot it would go in. There has to be an empty one.
+ */
+usize find_symbol_name_slot(const u8* all_text, const Symbol_Name* names, const u32* slots, usize num_slots, const u8* text, usize count, u64 hash);
+
+/**
+ * Every identifier that was ever in a buffer, stored once. Names are never removed, so an id stays the same name for as long as the editor runs.
+ * Ids start at 1, 0 is no name.
+ */
+struct Symbol_Names {
+	/** The text of every name back to back. */
+	ch::Array<u8> text;
+	/** Name id - 1. */
+	ch::Array<Symbol_Name> names;
+	/** Open addressing table of ids by the hash of their text. The amount of slots is a power of two and at most half of them are taken. */
+	ch::Array<u32> slots;
+
+	/** @returns the id of text, giving it one if it doesn't have one yet. */
+	u32 intern(const u8* in_text, usize count);
+
+	/** @returns the id of text or 0 if it was never interned. */
+	u32 find(const u8* in_text, usize count) const;
+
+	/** @returns the text of name. It moves when more names are interned. */
+	const u8* get(u32 name, usize* out_count) const;
+
+	void free();
+};
+
+/** A name defined or used in a buffer. */
+struct Symbol_Site {
+	Buffer_ID buffer;
+	/** The lexeme of the name in the buffer's lexemes. */
+	u32 lexeme;
+	u32 name;
+	/** NUM_SYMBOL_KINDS for a use. */
+	parsing::Symbol_Kind kind;
+
+	/** The sites of the same name are linked both ways, so that one comes out in O(1). 0 is the end. */
+	u32 next;
+	u32 prev;
+};
+
+/**
+ * The definitions and uses of every buffer, looked up by name.
+ *
+ * A buffer's parser keeps the names defined in it in parsing::Lexemes::definitions. Every one of those has a site here, which Buffer::symbol_sites holds
+ * in the same order. After a reparse only the sites of the declarations that were parsed again are replaced and the ones after them are moved along,
+ * so this costs as much as the reparse did and a whole buffer is never looked at again.
+ *
+ * Every identifier lexeme of a C++ buffer has a use site too, which Buffer::use_sites holds in the order of the lexemes. Those are replaced for the
+ * lexemes the parse made, as told by parsing::Lexemes::kept_lexemes and new_lexemes_end.
+ */
+struct Symbol_Table {
+	Symbol_Names names;
+
+	/** Site 0 is the end of every list and isn't used. Removed sites are linked through next to be reused. */
+	ch::Array<Symbol_Site> sites;
+	u32 first_free_site = 0;
+
+	/** The first definition of every name, by id. 0 if none of them defines it. */
+	ch::Array<u32> first_sites;
+	/** The first use of every name, by id. 0 if none of them uses it. */
+	ch::Array<u32> first_uses;
+
+	/**
+	 * Makes the sites of buffer match its lexemes after they were parsed.
+	 *
+	 * @param text is the text the lexemes were made from, which can be a snapshot that's behind the buffer
+	 */
+	void update(Buffer* buffer, const parsing::Text& text);
+
+	/** Removes every site of buffer. */
+	void remove(Buffer* buffer);
+
+	/** @returns the first definition of name in any buffer or null if there's none. */
+	const Symbol_Site* find_first(u32 name) const;
+
+	/** @returns the first use of name in any buffer or null if there's none. They're in no particular order. */
+	const Symbol_Site* find_first_use(u32 name) const;
+
+	/** @returns the definition or use of the same name after site or null if it's the last. */
+	const Symbol_Site* find_next(const Symbol_Site& site) const;
+
+	void free();
+
+	/** Adds a site to the list of name in firsts, which is first_sites or first_uses. */
+	u32 add_site(ch::Array<u32>& firsts, Buffer_ID buffer, u32 lexeme, u32 name, parsing::Symbol_Kind kind);
+	void remove_site(ch::Array<u32>& firsts, u32 site);
+
+	void update_uses(Buffer* buffer, const parsing::Text& text, bool is_whole);
+};
+
+/** The symbol table every buffer is indexed in. Only used on the main thread. */
+Symbol_Table& get_symbol_table();
+
+/**
+ * Finds the text of the identifier at index in buffer.
+ *
+ * @returns the text, which is only valid until the next call, or null if there's no identifier at index
+ */
+const u8* find_identifier_at(const Buffer& buffer, usize index, usize* out_count);
+
+/**
+ * Finds the name of the identifier at index in buffer.
+ *
+ * @returns its id or 0 if there's no identifier at index or it was never indexed
+ */
+u32 find_symbol_name_at(const Buffer& buffer, usize index);
+
+/** @returns the first of buffer's use sites at or after lexeme. */
+usize find_use_at(const Buffer& buffer, usize lexeme);
+
+/** @returns where site is in the text of its buffer now. The lexemes can be behind the text, so a name that was edited since maps to where the edit starts. */
+usize get_symbol_site_index(const Symbol_Site& site);
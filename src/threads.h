@@ -0,0 +1,61 @@
+#pragma once
+
+#include <ch_stl/types.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using Thread_Proc = void(*)(void* param);
+
+/** An os thread that runs a single proc. */
+struct Thread {
+	void* os_handle = nullptr;
+
+	explicit operator bool() const { return os_handle != nullptr; }
+
+	/** @returns true if the thread was started. */
+	bool start(Thread_Proc proc, void* param);
+
+	/** Waits for the thread to finish and releases it. */
+	void join();
+};
+
+/** @returns the amount of threads the cpus can run at once. At least 1. */
+u32 get_num_cpu_threads();
+
+/** Non recursive lock. Zero initialized is unlocked. */
+struct Mutex {
+	void* os_lock = nullptr;
+
+	void lock();
+	void unlock();
+};
+
+CH_FORCEINLINE u64 atomic_load(const volatile u64* value) {
+#ifdef _MSC_VER
+	const u64 result = *value;
+	_ReadWriteBarrier();
+	return result;
+#else
+	return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+#endif
+}
+
+CH_FORCEINLINE void atomic_store(volatile u64* value, u64 new_value) {
+#ifdef _MSC_VER
+	_ReadWriteBarrier();
+	*value = new_value;
+#else
+	__atomic_store_n(value, new_value, __ATOMIC_RELEASE);
+#endif
+}
+
+/** @returns the value before amount was added. */
+CH_FORCEINLINE u64 atomic_add(volatile u64* value, u64 amount) {
+#ifdef _MSC_VER
+	return (u64)_InterlockedExchangeAdd64((volatile long long*)value, (long long)amount);
+#else
+	return __atomic_fetch_add(value, amount, __ATOMIC_ACQ_REL);
+#endif
+}
@@ -0,0 +1,240 @@
+#include "undo.h"
+
+Undo_History::Undo_History(const ch::Allocator& in_alloc) {
+	chunks.allocator = in_alloc;
+	records.allocator = in_alloc;
+}
+
+void Undo_History::set_caret(usize cursor, usize selection) {
+	caret_cursor = cursor;
+	caret_selection = selection;
+	is_new_action = true;
+}
+
+void Undo_History::begin_group() {
+	is_grouping = true;
+	group_has_record = false;
+}
+
+void Undo_History::end_group() {
+	is_grouping = false;
+}
+
+void Undo_History::record_insert(usize offset, const u8* text, usize size) {
+	if (!size) return;
+
+	drop_redo();
+
+	Undo_Record* const last = get_mergeable_record(size);
+	if (last && offset == last->offset + last->inserted_size) {
+		const u8* const data = allocate(size);
+		assert(data == last->data + last->get_size());
+		ch::mem_copy((u8*)data, text, size);
+		last->inserted_size += size;
+	} else {
+		Undo_Record* const record = push_record(offset, size);
+		record->inserted_size = size;
+		ch::mem_copy(record->data, text, size);
+	}
+
+	is_new_action = false;
+	trim();
+}
+
+u8* Undo_History::record_remove(usize offset, usize size) {
+	if (!size) return nullptr;
+
+	drop_redo();
+
+	u8* result = nullptr;
+	Undo_Record* const last = get_mergeable_record(size);
+	if (last && last->inserted_size >= size && offset + size == last->offset + last->inserted_size) {
+		// Removing what was just typed only has to forget it
+		last->inserted_size -= size;
+		chunks[chunks.count - 1].used -= size;
+
+		if (!last->get_size()) {
+			if (!last->joins_previous) group_has_record = false;
+			records.count -= 1;
+			current -= 1;
+		}
+	} else if (last && !last->inserted_size && offset + size == last->offset) {
+		// Backspacing keeps removing in front of the last removal so the removed bytes go in front
+		allocate(size);
+		ch::mem_move(last->data + size, last->data, last->removed_size);
+		last->offset = offset;
+		last->removed_size += size;
+		result = last->data;
+	} else {
+		Undo_Record* const record = push_record(offset, size);
+		record->removed_size = size;
+		result = record->data;
+	}
+
+	is_new_action = false;
+	trim();
+	return result;
+}
+
+const Undo_Record* Undo_History::get_undo() const {
+	if (!current) return nullptr;
+	return &records[current - 1];
+}
+
+const Undo_Record* Undo_History::get_redo() const {
+	if (current == records.count) return nullptr;
+	return &records[current];
+}
+
+void Undo_History::step_back() {
+	assert(current > 0);
+	current -= 1;
+	is_new_action = true;
+}
+
+void Undo_History::step_forward() {
+	assert(current < records.count);
+	current += 1;
+	is_new_action = true;
+}
+
+void Undo_History::clear() {
+	for (Undo_Chunk& it : chunks) {
+		ch_delete[] it.data;
+	}
+	chunks.count = 0;
+	records.count = 0;
+	memory_used = 0;
+
+	current = 0;
+	first_record_number = 0;
+	saved_record_number = 0;
+	is_new_action = true;
+}
+
+void Undo_History::free() {
+	clear();
+	chunks.free();
+	records.free();
+}
+
+Undo_Record* Undo_History::get_mergeable_record(usize extra) {
+	if (!records.count || current != records.count) return nullptr;
+
+	// The saved state has to stay exactly as it was so undoing back to it is clean again
+	if (is_at_saved_state()) return nullptr;
+
+	Undo_Record* const last = &records[records.count - 1];
+	const usize size = last->get_size();
+	if (last->data + size != chunks[chunks.count - 1].data + chunks[chunks.count - 1].used) return nullptr;
+
+	if (is_new_action) {
+		// Only typing or backspacing right where the last action stopped continues it
+		const usize end = last->offset + last->inserted_size;
+		if (caret_cursor != caret_selection) return nullptr;
+		if (caret_cursor != end) return nullptr;
+		if (size + extra > max_coalesced_edit_size) return nullptr;
+		if (last->inserted_size && last->get_inserted()[last->inserted_size - 1] == '\n') return nullptr;
+	}
+
+	if (chunks[chunks.count - 1].used + extra > chunks[chunks.count - 1].allocated) {
+		// Records have to stay contiguous so the last one moves to a chunk it can grow in
+		chunks[chunks.count - 1].used -= size;
+		const u8* const old_data = last->data;
+
+		Undo_Chunk chunk = {};
+		chunk.allocated = size + extra > undo_chunk_size ? size + extra : undo_chunk_size;
+		chunk.data = ch_new u8[chunk.allocated];
+		chunk.used = size;
+		ch::mem_copy(chunk.data, old_data, size);
+		last->data = chunk.data;
+
+		if (!chunks[chunks.count - 1].used) {
+			memory_used -= chunks[chunks.count - 1].allocated;
+			ch_delete[] chunks[chunks.count - 1].data;
+			chunks.count -= 1;
+		}
+		chunks.push(chunk);
+		memory_used += chunk.allocated;
+	}
+
+	return last;
+}
+
+Undo_Record* Undo_History::push_record(usize offset, usize size) {
+	Undo_Record record = {};
+	record.data = allocate(size);
+	record.offset = offset;
+	record.cursor = caret_cursor;
+	record.selection = caret_selection;
+	record.joins_previous = is_grouping && group_has_record;
+	group_has_record = is_grouping;
+
+	records.push(record);
+	current = records.count;
+	return &records[records.count - 1];
+}
+
+u8* Undo_History::allocate(usize size) {
+	if (!chunks.count || chunks[chunks.count - 1].used + size > chunks[chunks.count - 1].allocated) {
+		Undo_Chunk chunk = {};
+		chunk.allocated = size > undo_chunk_size ? size : undo_chunk_size;
+		chunk.data = ch_new u8[chunk.allocated];
+		chunks.push(chunk);
+		memory_used += chunk.allocated;
+	}
+
+	Undo_Chunk& chunk = chunks[chunks.count - 1];
+	u8* const result = chunk.data + chunk.used;
+	chunk.used += size;
+	return result;
+}
+
+void Undo_History::drop_redo() {
+	if (current == records.count) return;
+
+	// The saved state can't be reached anymore
+	if (saved_record_number > first_record_number + current) saved_record_number = (u64)-1;
+	records.count = current;
+
+	// Records are stored in order so everything after the last one kept is free again
+	const u8* const end = current ? records[current - 1].data + records[current - 1].get_size() : nullptr;
+	while (chunks.count > 0) {
+		Undo_Chunk& chunk = chunks[chunks.count - 1];
+		if (end && end > chunk.data && end <= chunk.data + chunk.allocated) {
+			chunk.used = end - chunk.data;
+			break;
+		}
+
+		memory_used -= chunk.allocated;
+		ch_delete[] chunk.data;
+		chunks.count -= 1;
+	}
+}
+
+void Undo_History::trim() {
+	while (memory_used > max_undo_memory && chunks.count > 1) {
+		const Undo_Chunk oldest = chunks[0];
+
+		usize num_dropped = 0;
+		while (num_dropped < records.count && records[num_dropped].data >= oldest.data && records[num_dropped].data < oldest.data + oldest.allocated) {
+			num_dropped += 1;
+		}
+		assert(num_dropped <= current);
+
+		for (usize i = num_dropped; i < records.count; i += 1) {
+			records[i - num_dropped] = records[i];
+		}
+		records.count -= num_dropped;
+		current -= num_dropped;
+		first_record_number += num_dropped;
+
+		for (usize i = 1; i < chunks.count; i += 1) {
+			chunks[i - 1] = chunks[i];
+		}
+		chunks.count -= 1;
+
+		memory_used -= oldest.allocated;
+		ch_delete[] oldest.data;
+	}
+}
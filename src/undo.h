@@ -0,0 +1,122 @@
+#pragma once
+
+#include <ch_stl/array.h>
+
+/** The history is stored in chunks of this size. Edits that don't fit get a chunk of their own. */
+const usize undo_chunk_size = 64 * 1024;
+
+/** The oldest chunks are dropped once the history takes up more than this. The newest edit is always kept. */
+const usize max_undo_memory = 256 * 1024 * 1024;
+
+/** Typing stops being merged into the same edit once it gets this big. */
+const usize max_coalesced_edit_size = 4 * 1024;
+
+struct Undo_Chunk {
+	u8* data;
+	usize allocated;
+	usize used;
+};
+
+/** removed_size bytes at offset were replaced by inserted_size bytes. */
+struct Undo_Record {
+	/** The removed bytes followed by the inserted bytes. Points into a chunk. */
+	u8* data;
+
+	usize offset;
+	usize removed_size;
+	usize inserted_size;
+
+	/** Caret right before the edit. Restored by undo. */
+	usize cursor;
+	usize selection;
+
+	/** Set if this record was made by the same edit transaction as the one before it. They are undone and redone together. */
+	bool joins_previous;
+
+	CH_FORCEINLINE const u8* get_removed() const { return data; }
+	CH_FORCEINLINE const u8* get_inserted() const { return data + removed_size; }
+	CH_FORCEINLINE usize get_size() const { return removed_size + inserted_size; }
+};
+
+/**
+ * Log of edits that can be undone and redone.
+ * Consecutive edits of the same action and runs of typing or backspacing are merged into a single record,
+ * so undoing a replace of the whole text is still one remove and one insert.
+ */
+struct Undo_History {
+	ch::Array<Undo_Chunk> chunks;
+	ch::Array<Undo_Record> records;
+
+	/** Sum of the chunks' sizes. */
+	usize memory_used = 0;
+
+	/** Records before this one are applied. The rest can be redone. */
+	usize current = 0;
+
+	/** Counts every record ever pushed up to records[0] so positions stay the same when old records are dropped. */
+	u64 first_record_number = 0;
+	u64 saved_record_number = 0;
+
+	/** Caret to store with the next record. */
+	usize caret_cursor = 0;
+	usize caret_selection = 0;
+
+	/** Set by set_caret. The edits of a new action only merge into the last record if they continue it. */
+	bool is_new_action = true;
+
+	/** Set while a record is applied so its edits aren't recorded again. */
+	bool is_applying = false;
+
+	/** Set between begin_group and end_group. */
+	bool is_grouping = false;
+	bool group_has_record = false;
+
+	Undo_History() = default;
+	Undo_History(const ch::Allocator& in_alloc);
+
+	/** Starts a new action. Views call this with their caret before they edit so undo can put it back. */
+	void set_caret(usize cursor, usize selection);
+
+	/** Every record made until end_group is undone and redone as one. */
+	void begin_group();
+	void end_group();
+
+	/** Records that size bytes of text were inserted at offset. */
+	void record_insert(usize offset, const u8* text, usize size);
+
+	/**
+	 * Records that size bytes at offset are about to be removed.
+	 *
+	 * @returns where the caller has to copy the removed bytes to or nullptr if they don't have to be kept
+	 */
+	u8* record_remove(usize offset, usize size);
+
+	/** @returns the record to undo next or nullptr if there is none. Call step_back once it's applied. */
+	const Undo_Record* get_undo() const;
+
+	/** @returns the record to redo next or nullptr if there is none. Call step_forward once it's applied. */
+	const Undo_Record* get_redo() const;
+
+	void step_back();
+	void step_forward();
+
+	/** Remembers the current position as the text that is on disk. */
+	CH_FORCEINLINE void mark_saved() { saved_record_number = first_record_number + current; }
+	CH_FORCEINLINE bool is_at_saved_state() const { return saved_record_number == first_record_number + current; }
+
+	/** Forgets every record. The text as it is now counts as saved. */
+	void clear();
+	void free();
+
+	/** @returns the last record if the next edit may be merged into it and it can grow by extra bytes. */
+	Undo_Record* get_mergeable_record(usize extra);
+
+	Undo_Record* push_record(usize offset, usize size);
+	u8* allocate(usize size);
+
+	/** Drops everything that could be redone. */
+	void drop_redo();
+
+	/** Drops the oldest chunks until the history fits in max_undo_memory. */
+	void trim();
+};
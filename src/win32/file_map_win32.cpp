@@ -0,0 +1,132 @@
+#include "../file_map.h"
+
+#include <ch_stl/os.h>
+
+#define FILE_MAP_READ 0x0004
+#define PAGE_READONLY 0x02
+#define MOVEFILE_REPLACE_EXISTING 0x1
+#define MOVEFILE_WRITE_THROUGH 0x8
+#define INVALID_FILE_ATTRIBUTES 0xFFFFFFFF
+#define FILE_ATTRIBUTE_REPARSE_POINT 0x400
+
+extern "C" {
+	DLL_IMPORT HANDLE WINAPI CreateFileA(LPCSTR, DWORD, DWORD, void*, DWORD, DWORD, HANDLE);
+	DLL_IMPORT BOOL WINAPI GetFileSizeEx(HANDLE, s64*);
+	DLL_IMPORT HANDLE WINAPI CreateFileMappingA(HANDLE, void*, DWORD, DWORD, DWORD, LPCSTR);
+	DLL_IMPORT void* WINAPI MapViewOfFile(HANDLE, DWORD, DWORD, DWORD, usize);
+	DLL_IMPORT BOOL WINAPI UnmapViewOfFile(const void*);
+	DLL_IMPORT BOOL WINAPI CloseHandle(HANDLE);
+	DLL_IMPORT BOOL WINAPI MoveFileExA(LPCSTR, LPCSTR, DWORD);
+	DLL_IMPORT BOOL WINAPI WriteFile(HANDLE, const void*, DWORD, DWORD*, void*);
+	DLL_IMPORT BOOL WINAPI FlushFileBuffers(HANDLE);
+	DLL_IMPORT DWORD WINAPI GetFileAttributesA(LPCSTR);
+
+	struct WIN32_MEMORY_RANGE_ENTRY {
+		void* VirtualAddress;
+		usize NumberOfBytes;
+	};
+	DLL_IMPORT HANDLE WINAPI GetCurrentProcess();
+	DLL_IMPORT BOOL WINAPI PrefetchVirtualMemory(HANDLE, usize, WIN32_MEMORY_RANGE_ENTRY*, unsigned long);
+}
+
+bool File_Map::open(const char* path) {
+	assert(!data);
+
+	const DWORD generic_read = 0x80000000;
+	const DWORD share_read = 0x1;
+	const DWORD share_delete = 0x4;
+	const DWORD open_existing = 3;
+	const DWORD sequential_scan = 0x08000000;
+
+	// Share delete so the file can still be replaced when saving
+	HANDLE file = CreateFileA(path, generic_read, share_read | share_delete, nullptr, open_existing, sequential_scan, nullptr);
+	if (file == (HANDLE)-1) return false;
+
+	s64 file_size = 0;
+	if (!GetFileSizeEx(file, &file_size) || file_size <= 0) {
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping) {
+		CloseHandle(file);
+		return false;
+	}
+
+	void* const view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!view) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	data = (const u8*)view;
+	size = (usize)file_size;
+	os_file = file;
+	os_mapping = mapping;
+	return true;
+}
+
+void File_Map::close() {
+	if (!data) return;
+
+	UnmapViewOfFile(data);
+	CloseHandle((HANDLE)os_mapping);
+	CloseHandle((HANDLE)os_file);
+
+	data = nullptr;
+	size = 0;
+	os_file = nullptr;
+	os_mapping = nullptr;
+}
+
+void File_Map::prefetch(usize offset, usize count) const {
+	assert(offset + count <= size);
+
+	WIN32_MEMORY_RANGE_ENTRY range;
+	range.VirtualAddress = (void*)(data + offset);
+	range.NumberOfBytes = count;
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+
+bool write_file_and_flush(const char* path, const File_Span* spans, usize num_spans) {
+	const DWORD generic_write = 0x40000000;
+	const DWORD create_always = 2;
+	const DWORD sequential_scan = 0x08000000;
+
+	HANDLE file = CreateFileA(path, generic_write, 0, nullptr, create_always, sequential_scan, nullptr);
+	if (file == (HANDLE)-1) return false;
+
+	// WriteFile takes a DWORD so huge spans go in pieces
+	const usize max_write_size = 1024 * 1024 * 1024;
+
+	bool result = true;
+	for (usize i = 0; i < num_spans && result; i += 1) {
+		const u8* data = spans[i].data;
+		usize remaining = spans[i].size;
+		while (remaining > 0) {
+			const DWORD size = (DWORD)(remaining < max_write_size ? remaining : max_write_size);
+			DWORD written = 0;
+			if (!WriteFile(file, data, size, &written, nullptr) || written != size) {
+				result = false;
+				break;
+			}
+			data += size;
+			remaining -= size;
+		}
+	}
+
+	if (result) result = FlushFileBuffers(file) != 0;
+	CloseHandle(file);
+	return result;
+}
+
+bool replace_file(const char* from, const char* to) {
+	return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+}
+
+bool is_link(const char* path) {
+	const DWORD attributes = GetFileAttributesA(path);
+	return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0;
+}
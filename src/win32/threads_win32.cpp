@@ -0,0 +1,69 @@
+#include "../threads.h"
+
+#include <ch_stl/os.h>
+
+extern "C" {
+	using LPTHREAD_START_ROUTINE = DWORD(WINAPI*)(void*);
+	DLL_IMPORT HANDLE WINAPI CreateThread(void*, usize, LPTHREAD_START_ROUTINE, void*, DWORD, DWORD*);
+	DLL_IMPORT DWORD WINAPI WaitForSingleObject(HANDLE, DWORD);
+	DLL_IMPORT BOOL WINAPI CloseHandle(HANDLE);
+	DLL_IMPORT DWORD WINAPI GetActiveProcessorCount(u16);
+
+	DLL_IMPORT void WINAPI AcquireSRWLockExclusive(void**);
+	DLL_IMPORT void WINAPI ReleaseSRWLockExclusive(void**);
+}
+
+struct Thread_Start {
+	Thread_Proc proc;
+	void* param;
+};
+
+static DWORD WINAPI thread_main(void* param) {
+	Thread_Start* const start = (Thread_Start*)param;
+	const Thread_Proc proc = start->proc;
+	void* const proc_param = start->param;
+	ch_delete start;
+
+	proc(proc_param);
+	return 0;
+}
+
+bool Thread::start(Thread_Proc proc, void* param) {
+	assert(!os_handle);
+
+	Thread_Start* const start = ch_new Thread_Start;
+	start->proc = proc;
+	start->param = param;
+
+	os_handle = CreateThread(nullptr, 0, thread_main, start, 0, nullptr);
+	if (!os_handle) {
+		ch_delete start;
+		return false;
+	}
+
+	return true;
+}
+
+void Thread::join() {
+	if (!os_handle) return;
+
+	const DWORD infinite = 0xFFFFFFFF;
+	WaitForSingleObject((HANDLE)os_handle, infinite);
+	CloseHandle((HANDLE)os_handle);
+	os_handle = nullptr;
+}
+
+u32 get_num_cpu_threads() {
+	const u16 all_processor_groups = 0xFFFF;
+	const DWORD count = GetActiveProcessorCount(all_processor_groups);
+	return count ? (u32)count : 1;
+}
+
+// An SRWLOCK is a single pointer that starts out as null
+void Mutex::lock() {
+	AcquireSRWLockExclusive(&os_lock);
+}
+
+void Mutex::unlock() {
+	ReleaseSRWLockExclusive(&os_lock);
+}
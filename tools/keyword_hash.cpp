@@ -0,0 +1,115 @@
+#include "../src/keyword_hash.h"
+#include "../src/parsing_cpp_keywords.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Writes parsing_cpp_keyword_table.h: a perfect hash table of the keywords in parsing_cpp_keywords.h.
+// Usage: keyword_hash [output path]. Without a path the table goes to stdout.
+// Run it again whenever the keyword list changes.
+
+#define KEYWORD_STRING(name) #name,
+static const char* keywords[] = {
+    CPP_KEYWORDS_2(KEYWORD_STRING)
+    CPP_KEYWORDS_3(KEYWORD_STRING)
+    CPP_KEYWORDS_4(KEYWORD_STRING)
+    CPP_KEYWORDS_5(KEYWORD_STRING)
+    CPP_KEYWORDS_6(KEYWORD_STRING)
+    CPP_KEYWORDS_7(KEYWORD_STRING)
+    CPP_KEYWORDS_8(KEYWORD_STRING)
+    CPP_KEYWORDS_9(KEYWORD_STRING)
+    CPP_KEYWORDS_10(KEYWORD_STRING)
+    CPP_KEYWORDS_11(KEYWORD_STRING)
+    CPP_KEYWORDS_12(KEYWORD_STRING)
+    CPP_KEYWORDS_13(KEYWORD_STRING)
+    CPP_KEYWORDS_15(KEYWORD_STRING)
+    CPP_KEYWORDS_17(KEYWORD_STRING)
+};
+#undef KEYWORD_STRING
+const usize num_keywords = sizeof(keywords) / sizeof(keywords[0]);
+
+// Multipliers tried for every table size before trying the next bigger one.
+const u32 tries_per_size = 1000000;
+const u32 max_bits = 12;
+
+static u32 hash(const char* keyword, u64 multiplier, u32 bits) {
+    return hash_keyword((const u8*)keyword, strlen(keyword), multiplier, bits);
+}
+
+// Whether every keyword gets a slot of its own.
+static bool is_perfect(u64 multiplier, u32 bits, u8* used) {
+    memset(used, 0, (usize)1 << bits);
+    for (usize i = 0; i < num_keywords; i++) {
+        const u32 slot = hash(keywords[i], multiplier, bits);
+        if (used[slot]) return false;
+        used[slot] = 1;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    static u8 used[1 << max_bits];
+
+    usize max_size = 0;
+    for (usize i = 0; i < num_keywords; i++) {
+        const usize size = strlen(keywords[i]);
+        if (size > max_size) max_size = size;
+    }
+
+    // The smallest table first, so that it stays in as few cache lines as possible
+    u32 bits = 1;
+    while (((usize)1 << bits) < num_keywords) bits++;
+    u64 multiplier = 0;
+    u64 seed = 0x9E3779B97F4A7C15ull;
+    for (; bits <= max_bits && !multiplier; bits++) {
+        for (u32 i = 0; i < tries_per_size; i++) {
+            seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+            const u64 candidate = seed | 1;
+            if (is_perfect(candidate, bits, used)) {
+                multiplier = candidate;
+                break;
+            }
+        }
+    }
+    if (!multiplier) {
+        printf("no perfect hash found for %llu keywords\n", (unsigned long long)num_keywords);
+        return 1;
+    }
+    bits--;
+
+    // Slots hold 1 + the keyword's index, so that 0 is empty
+    static u8 slots[1 << max_bits];
+    for (usize i = 0; i < num_keywords; i++) slots[hash(keywords[i], multiplier, bits)] = (u8)(i + 1);
+
+    FILE* out = stdout;
+    if (argc > 1) {
+        out = fopen(argv[1], "wb");
+        if (!out) {
+            printf("failed to open %s\n", argv[1]);
+            return 1;
+        }
+    }
+
+    fprintf(out, "#pragma once\n\n");
+    fprintf(out, "// Generated by tools/keyword_hash.cpp from parsing_cpp_keywords.h. Don't edit, run it again instead.\n\n");
+    fprintf(out, "#include \"keyword_hash.h\"\n\n");
+    fprintf(out, "const u64 keyword_hash_multiplier = 0x%016llXull;\n", (unsigned long long)multiplier);
+    fprintf(out, "const u32 keyword_hash_bits = %u;\n", bits);
+    fprintf(out, "const usize max_keyword_size = %llu;\n\n", (unsigned long long)max_size);
+    fprintf(out, "struct Keyword {\n    u8 size;\n    char text[max_keyword_size + 1];\n};\n\n");
+    fprintf(out, "static const Keyword keywords[%llu] = {\n", (unsigned long long)num_keywords);
+    for (usize i = 0; i < num_keywords; i++) {
+        fprintf(out, "    { %llu, \"%s\" },\n", (unsigned long long)strlen(keywords[i]), keywords[i]);
+    }
+    fprintf(out, "};\n\n");
+    fprintf(out, "// 1 + the index of the keyword that hashes to each slot. 0 if none does.\n");
+    fprintf(out, "static const u8 keyword_slots[1 << keyword_hash_bits] = {");
+    for (usize i = 0; i < ((usize)1 << bits); i++) {
+        if (i % 16 == 0) fprintf(out, "\n   ");
+        fprintf(out, " %u,", slots[i]);
+    }
+    fprintf(out, "\n};\n");
+
+    if (out != stdout) fclose(out);
+    return 0;
+}
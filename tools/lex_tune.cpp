@@ -0,0 +1,414 @@
+#include "../src/parsing.h"
+
+#include <ch_stl/time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Tries orderings of the lexer's states and char types on real code and writes the fastest one to parsing_lex_order.h.
+// Usage: lex_tune [-n candidates] [-o output path] files...
+// Without an output path the header goes to stdout. The first candidate is the ordering the lexer was built with,
+// and it's only replaced by one that's clearly faster.
+// The lexer's tables are made from the state machine at compile time, so the new ordering takes effect on the next build.
+
+using namespace parsing;
+
+const u32 default_num_candidates = 200;
+// Every candidate lexes the code this many times and keeps its best time.
+const u32 runs_per_candidate = 5;
+// The fastest candidates and the current ordering are timed again, taking turns, so that a candidate
+// that got lucky once doesn't win.
+const u32 num_finalists = 8;
+const u32 final_rounds = 10;
+// A new ordering has to be at least this much faster to replace the current one.
+const f64 min_speedup = 1.02;
+
+struct Name {
+    u8 value;
+    const char* name;
+    const char* comment;
+};
+
+static const Name state_names[] = {
+    { DFA_BLOCK_COMMENT,      "DFA_BLOCK_COMMENT",      nullptr },
+    { DFA_BLOCK_COMMENT_STAR, "DFA_BLOCK_COMMENT_STAR", nullptr },
+    { DFA_LINE_COMMENT,       "DFA_LINE_COMMENT",       nullptr },
+    { DFA_WHITE,              "DFA_WHITE",              nullptr },
+    { DFA_WHITE_BS,           "DFA_WHITE_BS",           nullptr },
+    { DFA_NEWLINE,            "DFA_NEWLINE",            nullptr },
+    { DFA_STRINGLIT,          "DFA_STRINGLIT",          nullptr },
+    { DFA_STRINGLIT_BS,       "DFA_STRINGLIT_BS",       nullptr },
+    { DFA_CHARLIT,            "DFA_CHARLIT",            nullptr },
+    { DFA_CHARLIT_BS,         "DFA_CHARLIT_BS",         nullptr },
+    { DFA_SLASH,              "DFA_SLASH",              nullptr },
+    { DFA_IDENT,              "DFA_IDENT",              nullptr },
+    { DFA_OP,                 "DFA_OP",                 nullptr },
+    { DFA_OP2,                "DFA_OP2",                nullptr },
+    { DFA_NUMLIT,             "DFA_NUMLIT",             nullptr },
+};
+
+// The parser's states come after the lexer's, in this order.
+static const char* parser_state_names[] = {
+    "DFA_PREPROC",
+    "DFA_MACRO",
+    "DFA_TYPE",
+    "DFA_KEYWORD",
+    "DFA_FUNCTION",
+    "DFA_PARAM",
+    "DFA_LABEL",
+};
+
+static const Name char_type_names[] = {
+    { WHITE,       "WHITE",       nullptr },
+    { NEWLINE,     "NEWLINE",     "'\\r' '\\n'" },
+    { IDENT,       "IDENT",       "'$' '@'-'Z' '_'-'z'" },
+    { DOUBLEQUOTE, "DOUBLEQUOTE", "'\"'" },
+    { SINGLEQUOTE, "SINGLEQUOTE", "'\\''" },
+    { DIGIT,       "DIGIT",       "'0'-'9'" },
+    { SLASH,       "SLASH",       "'/'" },
+    { STAR,        "STAR",        "'*'" },
+    { BS,          "BS",          "'\\\\'" },
+    { OP,          "OP",          nullptr },
+};
+
+static_assert(sizeof(state_names) / sizeof(state_names[0]) == DFA_NUM_STATES, "every state needs a name");
+static_assert(sizeof(char_type_names) / sizeof(char_type_names[0]) == NUM_CHAR_TYPES, "every char type needs a name");
+
+// States only trade places with the others in their group, and the groups stay in this order.
+// The parser skips what's before DFA_NEWLINE and takes what's up to DFA_LINE_COMMENT for comments.
+struct State_Group {
+    u8 count;
+    u8 states[DFA_NUM_STATES];
+};
+static const State_Group state_groups[] = {
+    { 2, { DFA_BLOCK_COMMENT, DFA_BLOCK_COMMENT_STAR } },
+    { 1, { DFA_LINE_COMMENT } },
+    { 2, { DFA_WHITE, DFA_WHITE_BS } },
+    { 1, { DFA_NEWLINE } },
+    { 9, { DFA_STRINGLIT, DFA_STRINGLIT_BS, DFA_CHARLIT, DFA_CHARLIT_BS, DFA_SLASH, DFA_IDENT, DFA_OP, DFA_OP2, DFA_NUMLIT } },
+};
+const usize num_state_groups = sizeof(state_groups) / sizeof(state_groups[0]);
+
+// The number every state and char type gets, indexed by the number it has now.
+struct Candidate {
+    u8 state[DFA_NUM_STATES];
+    u8 char_type[NUM_CHAR_TYPES];
+};
+
+// Laid out like the lexer's own tables.
+struct alignas(64) Tables {
+    u8 char_type[256];
+    u8 lex_table[DFA_NUM_STATES * NUM_CHAR_TYPES];
+};
+
+static u64 seed = 0x9E3779B97F4A7C15ull;
+
+static u32 next_random(u32 n) {
+    seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+    return (u32)((seed >> 33) % n);
+}
+
+static void shuffle(u8* values, usize count) {
+    for (usize i = count; i > 1; i--) {
+        const u32 j = next_random((u32)i);
+        const u8 t = values[i - 1];
+        values[i - 1] = values[j];
+        values[j] = t;
+    }
+}
+
+static Candidate current_ordering() {
+    Candidate result;
+    for (u8 i = 0; i < DFA_NUM_STATES; i++) result.state[i] = i;
+    for (u8 i = 0; i < NUM_CHAR_TYPES; i++) result.char_type[i] = i;
+    return result;
+}
+
+static Candidate random_ordering() {
+    Candidate result;
+    u8 next = 0;
+    for (usize g = 0; g < num_state_groups; g++) {
+        const State_Group& group = state_groups[g];
+        u8 values[DFA_NUM_STATES];
+        for (u8 i = 0; i < group.count; i++) values[i] = next + i;
+        shuffle(values, group.count);
+        for (u8 i = 0; i < group.count; i++) result.state[group.states[i]] = values[i];
+        next += group.count;
+    }
+
+    u8 values[NUM_CHAR_TYPES];
+    for (u8 i = 0; i < NUM_CHAR_TYPES; i++) values[i] = i;
+    shuffle(values, NUM_CHAR_TYPES);
+    for (u8 i = 0; i < NUM_CHAR_TYPES; i++) result.char_type[i] = values[i];
+    return result;
+}
+
+// The lexer's tables with everything renumbered.
+static void make_tables(const Candidate& c, Tables* out) {
+    const Lex_Tables& cpp = get_lex_tables(LANG_CPP);
+    for (usize i = 0; i < 256; i++) {
+        out->char_type[i] = c.char_type[cpp.char_type[i] / DFA_NUM_STATES] * DFA_NUM_STATES;
+    }
+    for (u8 t = 0; t < NUM_CHAR_TYPES; t++) {
+        for (u8 s = 0; s < DFA_NUM_STATES; s++) {
+            out->lex_table[c.char_type[t] * DFA_NUM_STATES + c.state[s]] = c.state[cpp.lex_table[t * DFA_NUM_STATES + s]];
+        }
+    }
+}
+
+struct Lexed {
+    u32* offsets;
+    u8* dfa;
+    u8* lex_dfa;
+    u8* first;
+    usize count;
+};
+
+#ifdef _MSC_VER
+#define LEX_TUNE_NOINLINE __declspec(noinline)
+#else
+#define LEX_TUNE_NOINLINE __attribute__((noinline))
+#endif
+
+// The lexer's table DFA step by step, so that only the tables differ between candidates.
+LEX_TUNE_NOINLINE static void lex_text(const Tables& tables, u8 dfa, const u8* text, usize size, Lexed& out) {
+    usize count = 0;
+    for (usize i = 0; i < size; i++) {
+        const u8 new_dfa = tables.lex_table[dfa + tables.char_type[text[i]]];
+        if (new_dfa != dfa) {
+            out.offsets[count] = (u32)i;
+            out.dfa[count] = new_dfa;
+            out.lex_dfa[count] = new_dfa;
+            out.first[count] = text[i];
+            count++;
+            dfa = new_dfa;
+        }
+    }
+    out.count = count;
+}
+
+// Best time of runs lexes of the text with c's tables.
+static f64 time_candidate(const Candidate& c, Tables* tables, const u8* text, usize size, Lexed& lexed, u32 runs) {
+    make_tables(c, tables);
+    f64 best_time = 0;
+    for (u32 run = 0; run < runs; run++) {
+        const f64 start = ch::get_time_in_seconds();
+        lex_text(*tables, c.state[DFA_NEWLINE], text, size, lexed);
+        const f64 time = ch::get_time_in_seconds() - start;
+        if (!run || time < best_time) best_time = time;
+    }
+    return best_time;
+}
+
+static bool alloc_lexed(Lexed& l, usize size) {
+    l.offsets = (u32*)malloc(size * sizeof(u32));
+    l.dfa = (u8*)malloc(size);
+    l.lex_dfa = (u8*)malloc(size);
+    l.first = (u8*)malloc(size);
+    l.count = 0;
+    if (!l.offsets || !l.dfa || !l.lex_dfa || !l.first) return false;
+    // Page faults shouldn't count against the first candidate
+    memset(l.offsets, 0, size * sizeof(u32));
+    memset(l.dfa, 0, size);
+    memset(l.lex_dfa, 0, size);
+    memset(l.first, 0, size);
+    return true;
+}
+
+static void free_lexed(Lexed& l) {
+    free(l.offsets);
+    free(l.dfa);
+    free(l.lex_dfa);
+    free(l.first);
+}
+
+// Whether a candidate found the same lexemes as the lexer, in its own numbering.
+static bool is_same(const Lexed& expected, const Lexed& lexed, const Candidate& c) {
+    if (expected.count != lexed.count) return false;
+    for (usize i = 0; i < lexed.count; i++) {
+        if (expected.offsets[i] != lexed.offsets[i] || c.state[expected.dfa[i]] != lexed.dfa[i]) return false;
+    }
+    return true;
+}
+
+static void write_header(FILE* out, const Candidate& c, u32 num_candidates, usize size, f64 best_mb_per_second, f64 current_mb_per_second) {
+    fprintf(out, "#pragma once\n\n");
+    fprintf(out, "// Generated by tools/lex_tune.cpp. Don't edit, run it again instead.\n");
+    fprintf(out, "// The fastest of %u orderings on %llu bytes of code: %.1f MB/s, against %.1f MB/s for the one before it.\n",
+        num_candidates, (unsigned long long)size, best_mb_per_second, current_mb_per_second);
+    fprintf(out, "// parsing.h includes this inside namespace parsing.\n\n");
+
+    fprintf(out, "enum Lex_Dfa : u8 {\n");
+    for (u8 value = 0; value < DFA_NUM_STATES; value++) {
+        for (const Name& it : state_names) {
+            if (c.state[it.value] == value) fprintf(out, "    %s,\n", it.name);
+        }
+    }
+    fprintf(out, "\n    DFA_NUM_STATES,\n\n");
+    for (const char* it : parser_state_names) fprintf(out, "    %s,\n", it);
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "enum Char_Type : u8 {\n");
+    for (u8 value = 0; value < NUM_CHAR_TYPES; value++) {
+        for (const Name& it : char_type_names) {
+            if (c.char_type[it.value] != value) continue;
+            if (it.comment) fprintf(out, "    %-11s, // %s\n", it.name, it.comment);
+            else fprintf(out, "    %-11s,\n", it.name);
+        }
+    }
+    fprintf(out, "    NUM_CHAR_TYPES,\n");
+    fprintf(out, "};\n");
+}
+
+static u8* read_files(char** paths, int num_paths, usize* out_size) {
+    usize size = 0;
+    u8* result = nullptr;
+    for (int i = 0; i < num_paths; i++) {
+        FILE* f = fopen(paths[i], "rb");
+        if (!f) {
+            printf("failed to open %s\n", paths[i]);
+            free(result);
+            return nullptr;
+        }
+        fseek(f, 0, SEEK_END);
+        const usize file_size = (usize)ftell(f);
+        fseek(f, 0, SEEK_SET);
+
+        u8* const grown = (u8*)realloc(result, size + file_size);
+        if (!grown) {
+            fclose(f);
+            free(result);
+            return nullptr;
+        }
+        result = grown;
+        size += fread(result + size, 1, file_size, f);
+        fclose(f);
+    }
+    *out_size = size;
+    return result;
+}
+
+int main(int argc, char** argv) {
+    u32 num_candidates = default_num_candidates;
+    const char* output_path = nullptr;
+    int first_file = 1;
+    while (first_file + 1 < argc && argv[first_file][0] == '-') {
+        if (strcmp(argv[first_file], "-n") == 0) {
+            num_candidates = (u32)atoi(argv[first_file + 1]);
+        } else if (strcmp(argv[first_file], "-o") == 0) {
+            output_path = argv[first_file + 1];
+        } else {
+            break;
+        }
+        first_file += 2;
+    }
+    if (first_file >= argc || num_candidates < 1) {
+        printf("usage: lex_tune [-n candidates] [-o output path] files...\n");
+        return 1;
+    }
+
+    usize size = 0;
+    u8* const text = read_files(argv + first_file, argc - first_file, &size);
+    if (!text || !size || size > 0xFFFFFFFF) {
+        printf("no code to lex\n");
+        return 1;
+    }
+
+    Lexed expected;
+    Lexed lexed;
+    if (!alloc_lexed(expected, size) || !alloc_lexed(lexed, size)) {
+        printf("out of memory\n");
+        return 1;
+    }
+
+    Tables* const tables = (Tables*)malloc(sizeof(Tables) + alignof(Tables));
+    Tables* const aligned = (Tables*)(((usize)tables + alignof(Tables) - 1) & ~(usize)(alignof(Tables) - 1));
+
+    const Candidate current = current_ordering();
+    make_tables(current, aligned);
+    lex_text(*aligned, current.state[DFA_NEWLINE], text, size, expected);
+
+    Candidate* const candidates = (Candidate*)malloc(num_candidates * sizeof(Candidate));
+    f64* const times = (f64*)malloc(num_candidates * sizeof(f64));
+    if (!candidates || !times) {
+        printf("out of memory\n");
+        return 1;
+    }
+    const f64 mb = (f64)size / (1024.0 * 1024.0);
+    for (u32 i = 0; i < num_candidates; i++) {
+        candidates[i] = i ? random_ordering() : current;
+        times[i] = time_candidate(candidates[i], aligned, text, size, lexed, runs_per_candidate);
+        if (!is_same(expected, lexed, candidates[i])) {
+            printf("candidate %u doesn't lex like the lexer\n", i);
+            return 1;
+        }
+        printf("  candidate %4u %10.1f MB/s%s\n", i, mb / times[i], i ? "" : " (current)");
+    }
+
+    // The current ordering is always a finalist, as finalist 0
+    u32 finalists[num_finalists + 1];
+    u32 num_final = 1;
+    finalists[0] = 0;
+    for (u32 f = 0; f < num_finalists && f + 1 < num_candidates; f++) {
+        u32 fastest = 0;
+        for (u32 i = 1; i < num_candidates; i++) {
+            bool is_taken = false;
+            for (u32 k = 1; k < num_final; k++) is_taken |= finalists[k] == i;
+            if (!is_taken && (!fastest || times[i] < times[fastest])) fastest = i;
+        }
+        finalists[num_final++] = fastest;
+    }
+    f64 final_times[num_finalists + 1];
+    for (u32 round = 0; round < final_rounds; round++) {
+        for (u32 f = 0; f < num_final; f++) {
+            const f64 time = time_candidate(candidates[finalists[f]], aligned, text, size, lexed, 1);
+            if (!round || time < final_times[f]) final_times[f] = time;
+        }
+    }
+
+    printf("finalists:\n");
+    u32 fastest = 0;
+    for (u32 f = 0; f < num_final; f++) {
+        printf("  candidate %4u %10.1f MB/s%s\n", finalists[f], mb / final_times[f], f ? "" : " (current)");
+        if (final_times[f] < final_times[fastest]) fastest = f;
+    }
+    if (final_times[0] < final_times[fastest] * min_speedup) fastest = 0;
+    const Candidate best = candidates[finalists[fastest]];
+    const f64 best_mb_per_second = mb / final_times[fastest];
+    const f64 current_mb_per_second = mb / final_times[0];
+
+    printf("fastest: %.1f MB/s, current: %.1f MB/s\n", best_mb_per_second, current_mb_per_second);
+    printf("  states:");
+    for (u8 value = 0; value < DFA_NUM_STATES; value++) {
+        for (const Name& it : state_names) {
+            if (best.state[it.value] == value) printf(" %s", it.name);
+        }
+    }
+    printf("\n  char types:");
+    for (u8 value = 0; value < NUM_CHAR_TYPES; value++) {
+        for (const Name& it : char_type_names) {
+            if (best.char_type[it.value] == value) printf(" %s", it.name);
+        }
+    }
+    printf("\n");
+
+    FILE* out = stdout;
+    if (output_path) {
+        out = fopen(output_path, "wb");
+        if (!out) {
+            printf("failed to open %s\n", output_path);
+            return 1;
+        }
+    }
+    write_header(out, best, num_candidates, size, best_mb_per_second, current_mb_per_second);
+    if (out != stdout) fclose(out);
+
+    free(candidates);
+    free(times);
+    free(tables);
+    free_lexed(expected);
+    free_lexed(lexed);
+    free(text);
+    return 0;
+}